@@ -206,6 +206,7 @@ void STKConfig::init_defaults()
     m_title_music                = NULL;
     m_solver_split_impulse       = false;
     m_smooth_normals             = false;
+    m_quantized_bvh              = true;
     m_same_powerup_mode          = POWERUP_MODE_ONLY_IF_SAME;
     m_ai_acceleration            = 1.0f;
     m_disable_steer_while_unskid = false;
@@ -285,6 +286,7 @@ void STKConfig::getAllData(const XMLNode * root)
     {
         physics_node->get("smooth-normals",         &m_smooth_normals        );
         physics_node->get("smooth-angle-limit",     &m_smooth_angle_limit    );
+        physics_node->get("quantized-bvh",          &m_quantized_bvh         );
         physics_node->get("default-track-friction", &m_default_track_friction);
         physics_node->get("default-moveable-friction",
                                                  &m_default_moveable_friction);
@@ -85,6 +85,8 @@ public:
     int   m_max_karts;                 /**<Maximum number of karts.            */
     bool  m_smooth_normals;            /**< If normals for raycasts for wheels
                                            should be interpolated.             */
+    bool  m_quantized_bvh;             /**< If the BVHs of triangle meshes use
+                                           quantized bounding boxes.           */
 
     /** How many state updates per second the server will send. */
     int m_network_state_frequeny;
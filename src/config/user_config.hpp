@@ -667,6 +667,9 @@ namespace UserConfigParams
     /** If gamepad debugging is enabled. */
     PARAM_PREFIX bool m_unit_testing PARAM_DEFAULT(false);
 
+    /** If benchmarks are run. */
+    PARAM_PREFIX bool m_benchmark PARAM_DEFAULT(false);
+
     /** If gamepad debugging is enabled. */
     PARAM_PREFIX bool m_gamepad_debug PARAM_DEFAULT( false );
 
@@ -772,6 +775,19 @@ namespace UserConfigParams
      PARAM_PREFIX IntUserConfigParam m_timer_sync_difference_tolerance
         PARAM_DEFAULT(IntUserConfigParam(5, "timer-sync-difference-tolerance",
         &m_network_group, "Max time difference tolerance (in ms) to synchronize timer with server."));
+    PARAM_PREFIX BoolUserConfigParam m_partial_rewind
+        PARAM_DEFAULT(BoolUserConfigParam(false, "partial-rewind",
+        &m_network_group, "Only update the karts affected by a different "
+        "server state when rewinding on a client, instead of all karts."));
+    PARAM_PREFIX FloatUserConfigParam m_rewind_budget
+        PARAM_DEFAULT(FloatUserConfigParam(0.0f, "rewind-budget",
+        &m_network_group, "Maximum time (in ms per second) a client spends "
+        "on rewinds. If exceeded, a rewind for a received state is deferred "
+        "and merged with the next one. 0 disables the budget."));
+    PARAM_PREFIX StringUserConfigParam m_rewind_statistics_file
+        PARAM_DEFAULT(StringUserConfigParam("", "rewind-statistics-file",
+        &m_network_group, "If not empty, the rewind statistics are written "
+        "to this file at the end of each networked race."));
 
     // ---- Gamemode setup
     PARAM_PREFIX UIntToUIntUserConfigParam m_num_karts_per_gamemode
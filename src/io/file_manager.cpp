@@ -36,6 +36,8 @@
 #include <irrlicht.h>
 
 #include <stdio.h>
+#include <cstdio>
+#include <fstream>
 #include <stdexcept>
 #include <sstream>
 #include <sys/stat.h>
@@ -247,6 +249,7 @@ FileManager::FileManager()
     checkAndCreateScreenshotDir();
     checkAndCreateReplayDir();
     checkAndCreateCachedTexturesDir();
+    checkAndCreateCachedDataDir();
     checkAndCreateGPDir();
 
     redirectOutput();
@@ -716,6 +719,14 @@ std::string FileManager::getCachedTexturesDir() const
     return m_cached_textures_dir;
 }   // getCachedTexturesDir
 
+//-----------------------------------------------------------------------------
+/** Returns the directory in which data computed from tracks is cached.
+*/
+std::string FileManager::getCachedDataDir() const
+{
+    return m_cached_data_dir;
+}   // getCachedDataDir
+
 //-----------------------------------------------------------------------------
 /** Returns the directory in which user-defined grand prix should be stored.
  */
@@ -1056,6 +1067,31 @@ void FileManager::checkAndCreateCachedTexturesDir()
 
 }   // checkAndCreateCachedTexturesDir
 
+// ----------------------------------------------------------------------------
+/** Creates the directory for data computed from tracks (which is stored next
+ *  to the cached textures). This will set m_cached_data_dir.
+ */
+void FileManager::checkAndCreateCachedDataDir()
+{
+#if defined(WIN32) || defined(__CYGWIN__)
+    m_cached_data_dir = m_user_config_dir + "cached-data/";
+#elif defined(__APPLE__)
+    m_cached_data_dir = getenv("HOME");
+    m_cached_data_dir += "/Library/Application Support/SuperTuxKart/CachedData/";
+#else
+    m_cached_data_dir = checkAndCreateLinuxDir("XDG_CACHE_HOME", "supertuxkart", ".cache/", ".");
+    m_cached_data_dir += "cached-data/";
+#endif
+
+    if (!checkAndCreateDirectory(m_cached_data_dir))
+    {
+        Log::error("FileManager", "Can not create cached data directory '%s', "
+            "falling back to '.'.", m_cached_data_dir.c_str());
+        m_cached_data_dir = "./";
+    }
+
+}   // checkAndCreateCachedDataDir
+
 // ----------------------------------------------------------------------------
 /** Creates the directories for user-defined grand prix. This will set m_gp_dir
  *  with the appropriate path.
@@ -1474,6 +1510,63 @@ bool FileManager::copyFile(const std::string &source, const std::string &dest)
     fclose(f_dest);
     return true;
 }   // copyFile
+
+// ----------------------------------------------------------------------------
+/** Returns a temporary name for a file, which includes the id of this
+ *  process. So several processes (e.g. forked server instances) can write
+ *  the same file at the same time without overwriting each other's
+ *  temporary file.
+ *  \param file_name Name of the file.
+ */
+std::string FileManager::getTempFileName(const std::string &file_name) const
+{
+#if defined(WIN32)
+    const unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+    const unsigned long pid = (unsigned long)getpid();
+#endif
+    return file_name + "." + StringUtils::toString(pid) + ".tmp";
+}   // getTempFileName
+
+// ----------------------------------------------------------------------------
+/** Writes a file under a temporary name and then renames it, so a reader
+ *  never sees a partially written file.
+ *  \param file_name Name of the file.
+ *  \param write Writes the content to the given stream, which is opened in
+ *         binary mode.
+ *  \return True if the file was written.
+ */
+bool FileManager::writeFileAtomic(const std::string &file_name,
+                    const std::function<void(std::ostream&)> &write) const
+{
+    const std::string tmp_name = getTempFileName(file_name);
+    {
+        std::ofstream out(tmp_name.c_str(), std::ios::binary);
+        if (out.good())
+            write(out);
+        if (!out.good())
+        {
+            Log::error("FileManager", "Cannot write '%s'.", tmp_name.c_str());
+            out.close();
+            std::remove(tmp_name.c_str());
+            return false;
+        }
+    }
+    // Windows does not replace an existing file when renaming
+    if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0)
+    {
+        std::remove(file_name.c_str());
+        if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0)
+        {
+            Log::error("FileManager", "Cannot rename '%s' to '%s'.",
+                       tmp_name.c_str(), file_name.c_str());
+            std::remove(tmp_name.c_str());
+            return false;
+        }
+    }
+    return true;
+}   // writeFileAtomic
+
 // ----------------------------------------------------------------------------
 /** Returns true if the first file is newer than the second. The comparison is
 *   based on the modification time of the two files.
@@ -25,6 +25,8 @@
  * Contains generic utility classes for file I/O (especially XML handling).
  */
 
+#include <functional>
+#include <iosfwd>
 #include <string>
 #include <vector>
 #include <set>
@@ -97,6 +99,10 @@ private:
     /** Directory where resized textures are cached. */
     std::string       m_cached_textures_dir;
 
+    /** Directory where data computed from tracks (e.g. navigation data)
+     *  is cached. */
+    std::string       m_cached_data_dir;
+
     /** Directory where user-defined grand prix are stored. */
     std::string       m_gp_dir;
 
@@ -124,6 +130,7 @@ private:
     void              checkAndCreateScreenshotDir();
     void              checkAndCreateReplayDir();
     void              checkAndCreateCachedTexturesDir();
+    void              checkAndCreateCachedDataDir();
     void              checkAndCreateGPDir();
     void              discoverPaths();
 #if !defined(WIN32) && !defined(__CYGWIN__) && !defined(__APPLE__)
@@ -147,6 +154,7 @@ public:
     std::string       getScreenshotDir() const;
     std::string       getReplayDir() const;
     std::string       getCachedTexturesDir() const;
+    std::string       getCachedDataDir() const;
     std::string       getGPDir() const;
     bool              checkAndCreateDirectoryP(const std::string &path);
     const std::string &getAddonsDir() const;
@@ -156,6 +164,9 @@ public:
     bool removeFile(const std::string &name) const;
     bool removeDirectory(const std::string &name) const;
     bool copyFile(const std::string &source, const std::string &dest);
+    std::string getTempFileName(const std::string &file_name) const;
+    bool writeFileAtomic(const std::string &file_name,
+                   const std::function<void(std::ostream&)> &write) const;
     std::vector<std::string>getMusicDirs() const;
     std::string getAssetChecked(AssetType type, const std::string& name,
                                 bool abort_on_error=false) const;
@@ -359,6 +359,10 @@ public:
         lc.setY(lc.getY() / 2.0f);
         return lc.length2() < m_distance_2;
     }   // hitKart
+    // ------------------------------------------------------------------------
+    /** Returns a distance from the item beyond which hitKart is always
+     *  false (the height difference is halved in hitKart). */
+    float getMaxHitDistance() const { return 2.0f * sqrtf(m_distance_2); }
 
 protected:
     // ------------------------------------------------------------------------
@@ -38,7 +38,9 @@
 #include <IMesh.h>
 #include <IAnimatedMesh.h>
 
+#include <algorithm>
 #include <assert.h>
+#include <cmath>
 #include <stdexcept>
 #include <sstream>
 #include <string>
@@ -51,6 +53,12 @@ bool                         ItemManager::m_disable_item_collection = false;
 std::shared_ptr<ItemManager> ItemManager::m_item_manager;
 std::mt19937                 ItemManager::m_random_engine;
 
+/** Size of the cells used by checkItemHit, in m. */
+static const float ITEM_CELL_SIZE = 8.0f;
+
+/** Items with a larger maximum hit distance are tested for all karts. */
+static const float ITEM_MAX_CELL_DISTANCE = 4 * ITEM_CELL_SIZE;
+
 //-----------------------------------------------------------------------------
 /** Creates one instance of the item manager. */
 void ItemManager::create()
@@ -234,6 +242,7 @@ unsigned int ItemManager::insertItem(Item *item)
     else
         m_all_items.push_back(item);
     item->setItemId(index);
+    addItemToCells(index);
 
     // Now insert into the appropriate quad list, if there is a quad list
     // (i.e. race mode has a quad graph).
@@ -378,30 +387,39 @@ void ItemManager::collectedItem(Item *item, AbstractKart *kart)
  */
 void  ItemManager::checkItemHit(AbstractKart* kart)
 {
-    // We could use m_items_in_quads to to check for item hits: take the quad
-    // of the graph node of the kart, and only check items in that quad. But
-    // then we also need to check for any adjacent quads (since an item just
-    // on the order of one quad might get hit from an adjacent quad). Then
-    // it is possible that a quad is that short that we need to test adjacent
-    // of adjacent quads. And check for items outside of the track.
-    // Since at this stace item detection is by far not a bottle neck,
-    // the original, simple and stable algorithm is left in place.
-
     /** Disable item collection detection for debug purposes. */
     if(m_disable_item_collection) return;
 
-    for(AllItemTypes::iterator i =m_all_items.begin();
-                               i!=m_all_items.end();  i++)
+    // Only test the items in the cell of the kart (and the few items with a
+    // large hit distance). They are tested in the same order as in the list
+    // of all items, since collecting an item can change the kart (e.g.
+    // a shield), which affects the items collected afterwards.
+    const Vec3& xyz = kart->getXYZ();
+    m_hit_candidates = m_large_items;
+    auto cell = m_items_in_cells.find(
+        getCellKey((int)floorf(xyz.getX() / ITEM_CELL_SIZE),
+                   (int)floorf(xyz.getZ() / ITEM_CELL_SIZE)));
+    if (cell != m_items_in_cells.end())
+    {
+        m_hit_candidates.insert(m_hit_candidates.end(), cell->second.begin(),
+                                cell->second.end());
+    }
+    if (m_hit_candidates.empty())
+        return;
+    std::sort(m_hit_candidates.begin(), m_hit_candidates.end());
+
+    for (unsigned int index : m_hit_candidates)
     {
-        if((!*i) || !(*i)->isAvailable()) continue;
+        Item* item = m_all_items[index];
+        if (!item || !item->isAvailable()) continue;
 
         // To allow inlining and avoid including kart.hpp in item.hpp,
         // we pass the kart and the position separately.
-        if((*i)->hitKart(kart->getXYZ(), kart))
+        if (item->hitKart(kart->getXYZ(), kart))
         {
-            collectedItem(*i, kart);
+            collectedItem(item, kart);
         }   // if hit
-    }   // for m_all_items
+    }   // for m_hit_candidates
 }   // checkItemHit
 
 //-----------------------------------------------------------------------------
@@ -518,10 +536,87 @@ void ItemManager::deleteItem(Item *item)
     }   // if m_items_in_quads
 
     int index = item->getItemId();
+    removeItemFromCells(index);
     m_all_items[index] = NULL;
     delete item;
 }   // delete item
 
+//-----------------------------------------------------------------------------
+/** Adds the item at the given index of m_all_items to all cells in which
+ *  a kart can hit it.
+ */
+void ItemManager::addItemToCells(unsigned int index)
+{
+    const Item* item = m_all_items[index];
+    // Allow for rounding errors in hitKart
+    const float distance = item->getMaxHitDistance() * 1.01f + 0.01f;
+    if (distance > ITEM_MAX_CELL_DISTANCE)
+    {
+        m_large_items.push_back(index);
+        return;
+    }
+    const Vec3& xyz = item->getXYZ();
+    const int x0 = (int)floorf((xyz.getX() - distance) / ITEM_CELL_SIZE);
+    const int x1 = (int)floorf((xyz.getX() + distance) / ITEM_CELL_SIZE);
+    const int z0 = (int)floorf((xyz.getZ() - distance) / ITEM_CELL_SIZE);
+    const int z1 = (int)floorf((xyz.getZ() + distance) / ITEM_CELL_SIZE);
+    for (int x = x0; x <= x1; x++)
+    {
+        for (int z = z0; z <= z1; z++)
+            m_items_in_cells[getCellKey(x, z)].push_back(index);
+    }
+}   // addItemToCells
+
+//-----------------------------------------------------------------------------
+/** Removes the item at the given index of m_all_items from the cells. */
+void ItemManager::removeItemFromCells(unsigned int index)
+{
+    const Item* item = m_all_items[index];
+    const float distance = item->getMaxHitDistance() * 1.01f + 0.01f;
+    if (distance > ITEM_MAX_CELL_DISTANCE)
+    {
+        auto it = std::find(m_large_items.begin(), m_large_items.end(), index);
+        if (it != m_large_items.end())
+            m_large_items.erase(it);
+        return;
+    }
+    const Vec3& xyz = item->getXYZ();
+    const int x0 = (int)floorf((xyz.getX() - distance) / ITEM_CELL_SIZE);
+    const int x1 = (int)floorf((xyz.getX() + distance) / ITEM_CELL_SIZE);
+    const int z0 = (int)floorf((xyz.getZ() - distance) / ITEM_CELL_SIZE);
+    const int z1 = (int)floorf((xyz.getZ() + distance) / ITEM_CELL_SIZE);
+    for (int x = x0; x <= x1; x++)
+    {
+        for (int z = z0; z <= z1; z++)
+        {
+            auto cell = m_items_in_cells.find(getCellKey(x, z));
+            if (cell == m_items_in_cells.end())
+                continue;
+            std::vector<unsigned int>& items = cell->second;
+            auto it = std::find(items.begin(), items.end(), index);
+            if (it != items.end())
+                items.erase(it);
+        }
+    }
+}   // removeItemFromCells
+
+//-----------------------------------------------------------------------------
+/** Recomputes the cells of all items. This must be called after the
+ *  positions of items were changed (e.g. when restoring a state).
+ */
+void ItemManager::updateItemCells()
+{
+    // Keep the (empty) vectors to avoid memory allocations
+    for (auto& cell : m_items_in_cells)
+        cell.second.clear();
+    m_large_items.clear();
+    for (unsigned int i = 0; i < m_all_items.size(); i++)
+    {
+        if (m_all_items[i])
+            addItemToCells(i);
+    }
+}   // updateItemCells
+
 //-----------------------------------------------------------------------------
 /** Switches all items: boxes become bananas and vice versa for a certain
  *  amount of time (as defined in stk_config.xml.
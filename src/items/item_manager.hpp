@@ -33,6 +33,7 @@
 #include <memory>
 #include <random>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class Kart;
@@ -108,6 +109,18 @@ private:
      *  field is undefined if no Graph exist, e.g. arena without navmesh. */
     std::vector< AllItemTypes > *m_items_in_quads;
 
+    /** A hash grid over the x/z plane used by checkItemHit: each cell
+     *  stores the indices (in m_all_items) of the items that can be hit
+     *  by a kart in this cell. */
+    std::unordered_map<uint64_t, std::vector<unsigned int> > m_items_in_cells;
+
+    /** Indices of items with a very large hit distance (e.g. triggers),
+     *  which are tested for all karts instead of being stored in cells. */
+    std::vector<unsigned int> m_large_items;
+
+    /** Used in checkItemHit to avoid memory allocations. */
+    std::vector<unsigned int> m_hit_candidates;
+
     /** What item this item is switched to. */
     std::vector<ItemState::ItemType> m_switch_to;
 
@@ -115,8 +128,19 @@ private:
      *  value is <0, it indicates that the items are not switched atm. */
     int m_switch_ticks;
 
+    // ------------------------------------------------------------------------
+    static uint64_t getCellKey(int x, int z)
+    {
+        return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+    }   // getCellKey
+    // ------------------------------------------------------------------------
+    void addItemToCells(unsigned int index);
+    // ------------------------------------------------------------------------
+    void removeItemFromCells(unsigned int index);
+
 protected:
     void deleteItem(Item *item);
+    void updateItemCells();
     virtual unsigned int insertItem(Item *item);
     void setSwitchItems(const std::vector<int> &switch_items);
              ItemManager();
@@ -18,6 +18,7 @@
 
 #include "items/network_item_manager.hpp"
 
+#include "config/stk_config.hpp"
 #include "karts/abstract_kart.hpp"
 #include "modes/world.hpp"
 #include "network/network_config.hpp"
@@ -155,8 +156,15 @@ void NetworkItemManager::setItemConfirmationTime(std::weak_ptr<STKPeer> peer,
                                                  int ticks)
 {
     assert(NetworkConfig::get()->isServer());
-    if (ticks > m_last_confirmed_item_ticks.at(peer))
-        m_last_confirmed_item_ticks.at(peer) = ticks;
+    m_item_events.lock();
+    auto confirmed = m_last_confirmed_item_ticks.find(peer);
+    if (confirmed == m_last_confirmed_item_ticks.end())
+    {
+        m_item_events.unlock();
+        return;
+    }
+    if (ticks > confirmed->second)
+        confirmed->second = ticks;
 
     // Now discard unneeded events and expired (disconnected) peer, i.e. all
     // events that have been confirmed by all clients:
@@ -178,7 +186,6 @@ void NetworkItemManager::setItemConfirmationTime(std::weak_ptr<STKPeer> peer,
     // Find the last entry before the minimal confirmed time.
     // Since the event list is sorted, all events up to this
     // entry can be deleted.
-    m_item_events.lock();
     auto p = m_item_events.getData().begin();
     while (p != m_item_events.getData().end() && p->getTicks() < min_time)
         p++;
@@ -187,39 +194,84 @@ void NetworkItemManager::setItemConfirmationTime(std::weak_ptr<STKPeer> peer,
 
 }   // setItemConfirmationTime
 
+//-----------------------------------------------------------------------------
+/** Returns the time of the first event the given client has not confirmed
+ *  yet, which is the start of the events sent to this client. Clients
+ *  with the same window start receive the same events, so the server can
+ *  send them the same state message.
+ *  \param peer The client.
+ *  \return Time of the first event to send, or the maximum integer value if
+ *          the client has confirmed all events.
+ */
+int NetworkItemManager::getEventWindowStart(std::weak_ptr<STKPeer> peer)
+{
+    int start = std::numeric_limits<int>::max();
+    m_item_events.lock();
+    auto confirmed = m_last_confirmed_item_ticks.find(peer);
+    const int confirmed_ticks = confirmed == m_last_confirmed_item_ticks.end()
+                              ? 0 : confirmed->second;
+    for (auto& p : m_item_events.getData())
+    {
+        if (p.getTicks() >= confirmed_ticks)
+        {
+            start = p.getTicks();
+            break;
+        }
+    }
+    m_item_events.unlock();
+    return start;
+}   // getEventWindowStart
+
+//-----------------------------------------------------------------------------
+/** Writes the item state for clients with the given event window start (see
+ *  getEventWindowStart), which is used instead of the shared state written
+ *  by saveState in the state message sent to these clients.
+ *  \param buffer The buffer to write the events to.
+ *  \param start_ticks Time of the first event to write.
+ */
+void NetworkItemManager::saveEventWindow(BareNetworkString* buffer,
+                                         int start_ticks)
+{
+    m_item_events.lock();
+    for (auto& p : m_item_events.getData())
+    {
+        if (p.getTicks() >= start_ticks)
+            p.saveState(buffer);
+    }
+    m_item_events.unlock();
+}   // saveEventWindow
+
 //-----------------------------------------------------------------------------
 /** Saves the state of all items. This is done by using a state that has
- *  been confirmed by all clients as a base, and then only adding any
- *  changes applied to that state later. As clients keep on confirming events
+ *  been confirmed by a client as a base, and then only adding any changes
+ *  applied to that state later. As clients keep on confirming events
  *  the confirmed event will be moved forward in time, and older events can
  *  be deleted (and not sent to the clients anymore).
- *  This function is also called on the client in the first frame of a race
- *  to save the initial state, which is the first confirmed state by all
- *  clients.
+ *  The events depend on the client, so the server only writes an empty
+ *  state here, which GameProtocol replaces with the event window of each
+ *  client (see saveEventWindow). The server also removes events which are
+ *  too old, in case a client does not confirm events anymore.
  */
-BareNetworkString* NetworkItemManager::saveState(std::vector<std::string>* ru)
+bool NetworkItemManager::saveState(BareNetworkString* buffer)
 {
-    ru->push_back(getUniqueIdentity());
     // On the server:
     // ==============
+    const int oldest_ticks = World::getWorld()->getTicksSinceStart() -
+        stk_config->time2Ticks((float)MAX_EVENT_AGE_SECONDS);
     m_item_events.lock();
-    uint16_t n = (uint16_t)m_item_events.getData().size();
-    if(n==0)
-    {
-        BareNetworkString *s = new BareNetworkString();
-        m_item_events.unlock();
-        return s;
-    }
-
-    BareNetworkString *s =
-        new BareNetworkString(n * (  sizeof(int) + sizeof(uint16_t)
-                                   + sizeof(uint8_t)              ) );
-    for (auto p : m_item_events.getData())
+    std::vector<ItemEventInfo>& events = m_item_events.getData();
+    auto p = events.begin();
+    while (p != events.end() && p->getTicks() < oldest_ticks)
+        p++;
+    if (p != events.begin())
     {
-        p.saveState(s);
+        Log::warn("NetworkItemManager",
+                  "Removing %d item events not confirmed by all clients.",
+                  (int)(p - events.begin()));
+        events.erase(events.begin(), p);
     }
     m_item_events.unlock();
-    return s;
+    return true;
 }   // saveState
 
 //-----------------------------------------------------------------------------
@@ -366,6 +418,8 @@ void NetworkItemManager::restoreState(BareNetworkString *buffer, int count)
             deleteItem(m_all_items[i]);
         }
     }
+    // The positions of items can be changed by the restored states
+    updateItemCells();
 
     // Now we save the current local
     m_confirmed_state_time = World::getWorld()->getTicksSinceStart();
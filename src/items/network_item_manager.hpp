@@ -36,9 +36,11 @@ class STKPeer;
  *  maintains one 'confirmed' state on the clients, based on the latest
  *  server update. The server sends updates that only contains the delta
  *  between the last confirmed and the current server state. Eash client
- *  confirms to the server which deltas it has received. Once all clients
- *  have received a delta, the server will remove it from the list of 
- *  deltas.
+ *  confirms to the server which deltas it has received. Each client only
+ *  receives the events it has not confirmed yet (its event window), so a
+ *  client with a high ping does not increase the state size of the other
+ *  clients. Once all clients have received a delta, the server will remove
+ *  it from the list of deltas.
   */
 class NetworkItemManager : public Rewinder, public ItemManager
 {
@@ -55,9 +57,16 @@ private:
     std::map<std::weak_ptr<STKPeer>, int32_t,
         std::owner_less<std::weak_ptr<STKPeer> > > m_last_confirmed_item_ticks;
 
-    /** List of all items events. */
+    /** List of all items events, sorted by time. On the server it also
+     *  protects m_last_confirmed_item_ticks, which is updated when an
+     *  asynchronous confirmation is received. */
     Synchronised< std::vector<ItemEventInfo> > m_item_events;
 
+    /** Events older than this are removed on the server even if a client
+     *  has not confirmed them yet, which limits the memory used for a client
+     *  that stopped responding. */
+    static const int MAX_EVENT_AGE_SECONDS = 10;
+
     void forwardTime(int ticks);
 
     NetworkItemManager();
@@ -69,6 +78,8 @@ public:
     void setSwitchItems(const std::vector<int> &switch_items);
     void sendItemUpdate();
     void initClientConfirmState();
+    int getEventWindowStart(std::weak_ptr<STKPeer> peer);
+    void saveEventWindow(BareNetworkString* buffer, int start_ticks);
 
     virtual void reset() OVERRIDE;
     virtual void setItemConfirmationTime(std::weak_ptr<STKPeer> peer,
@@ -76,7 +87,7 @@ public:
     virtual void collectedItem(Item *item, AbstractKart *kart) OVERRIDE;
     virtual Item* dropNewItem(ItemState::ItemType type, const AbstractKart *kart,
                               const Vec3 *xyz=NULL) OVERRIDE;
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru)
+    virtual bool saveState(BareNetworkString* buffer)
         OVERRIDE;
     virtual void restoreState(BareNetworkString *buffer, int count) OVERRIDE;
     // ------------------------------------------------------------------------
@@ -251,15 +251,15 @@ void Plunger::hideNodeWhenUndoDestruction()
 }   // hideNodeWhenUndoDestruction
 
 // ----------------------------------------------------------------------------
-BareNetworkString* Plunger::saveState(std::vector<std::string>* ru)
+bool Plunger::saveState(BareNetworkString* buffer)
 {
-    BareNetworkString* buffer = Flyable::saveState(ru);
+    Flyable::saveState(buffer);
     buffer->addUInt16(m_keep_alive).addUInt8(m_moved_to_infinity ? 1 : 0);
     if (m_rubber_band)
         buffer->addUInt8(m_rubber_band->getRubberBandTo());
     else
         buffer->addUInt8(255);
-    return buffer;
+    return true;
 }   // saveState
 
 // ----------------------------------------------------------------------------
@@ -790,9 +790,9 @@ bool RubberBall::hit(AbstractKart* kart, PhysicalObject* object)
 }   // hit
 
 // ----------------------------------------------------------------------------
-BareNetworkString* RubberBall::saveState(std::vector<std::string>* ru)
+bool RubberBall::saveState(BareNetworkString* buffer)
 {
-    BareNetworkString* buffer = Flyable::saveState(ru);
+    Flyable::saveState(buffer);
     buffer->addUInt32(m_last_aimed_graph_node);
     buffer->add(m_control_points[0]);
     buffer->add(m_control_points[1]);
@@ -810,7 +810,7 @@ BareNetworkString* RubberBall::saveState(std::vector<std::string>* ru)
     buffer->addFloat(m_current_max_height);
     buffer->addUInt8(m_tunnel_count | (m_aiming_at_target ? (1 << 7) : 0));
     TrackSector::saveState(buffer);
-    return buffer;
+    return true;
 }   // saveState
 
 // ----------------------------------------------------------------------------
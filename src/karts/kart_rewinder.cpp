@@ -27,8 +27,11 @@
 #include "karts/max_speed.hpp"
 #include "karts/skidding.hpp"
 #include "modes/world.hpp"
+#include "network/bit_packer.hpp"
+#include "network/network_config.hpp"
 #include "network/rewind_manager.hpp"
 #include "network/network_string.hpp"
+#include "network/state_quantizer.hpp"
 #include "physics/btKart.hpp"
 #include "utils/vec3.hpp"
 
@@ -101,21 +104,14 @@ void KartRewinder::computeError()
 }   // computeError
 
 // ----------------------------------------------------------------------------
-/** Saves all state information for a kart in a memory buffer. The memory
- *  is allocated here and the address returned. It will then be managed
- *  by the RewindManager.
- *  \param[out] ru The unique identity of rewinder writing to.
- *  \return The address of the memory buffer with the state.
+/** Saves all state information for a kart in the given buffer.
+ *  \param buffer The buffer to append the state to.
+ *  \return False if the kart is eliminated and no state is saved.
  */
-BareNetworkString* KartRewinder::saveState(std::vector<std::string>* ru)
+bool KartRewinder::saveState(BareNetworkString* buffer)
 {
     if (m_eliminated)
-        return nullptr;
-
-    ru->push_back(getUniqueIdentity());
-    const int MEMSIZE = 17*sizeof(float) + 9+3;
-
-    BareNetworkString *buffer = new BareNetworkString(MEMSIZE);
+        return false;
 
     // 1) Firing and related handling
     // -----------
@@ -140,25 +136,52 @@ BareNetworkString* KartRewinder::saveState(std::vector<std::string>* ru)
         buffer->add(quat);
         buffer->addUInt32(ka->getEndTicks());
     }
-    else
+
+    // The physics values are quantized (see StateQuantizer), which replaces
+    // them with the values the clients will restore
+    btTransform t = body->getWorldTransform();
+    Vec3 lv = body->getLinearVelocity();
+    Vec3 av = body->getAngularVelocity();
     {
-        const btTransform &t = body->getWorldTransform();
-        buffer->add(t.getOrigin());
-        btQuaternion q = t.getRotation();
-        buffer->add(q);
+        BitWriter writer(buffer);
+        if (!has_animation)
+        {
+            Vec3 origin = t.getOrigin();
+            btQuaternion q = t.getRotation();
+            StateQuantizer::writePosition(&writer, &origin);
+            StateQuantizer::writeRotation(&writer, &q);
+            t.setOrigin(origin);
+            t.setRotation(q);
+        }
+        StateQuantizer::writeHalfVec3(&writer, &lv);
+        StateQuantizer::writeHalfVec3(&writer, &av);
+    }
+    // The server continues with the quantized values, so that it simulates
+    // exactly what the clients will simulate after restoring this state
+    if (!getKartAnimation() && NetworkConfig::get()->isServer())
+    {
+        body->setLinearVelocity(lv);
+        body->setAngularVelocity(av);
+        body->proceedToTransform(t);
+        setTrans(t);
+        m_vehicle->updateAllWheelTransformsWS();
     }
 
-    buffer->add(body->getLinearVelocity());
-    buffer->add(body->getAngularVelocity());
     buffer->addFloat(m_vehicle->getMinSpeed());
-    buffer->addFloat(m_vehicle->getTimedRotationTime());
-    buffer->add(m_vehicle->getTimedRotation());
+    // The timed rotation and impulse are only used while their time is
+    // positive
+    const float time_rot = m_vehicle->getTimedRotationTime();
+    buffer->addFloat(time_rot);
+    if (time_rot > 0.0f)
+        buffer->add(m_vehicle->getTimedRotation());
     buffer->addUInt8(m_vehicle->getCushioningDisableTime());
 
     // For collision rewind
     buffer->addUInt16(m_bounce_back_ticks);
-    buffer->addFloat(m_vehicle->getCentralImpulseTime());
-    buffer->add(m_vehicle->getAdditionalImpulse());
+    const float central_impulse_time = m_vehicle->getCentralImpulseTime();
+    buffer->addFloat(central_impulse_time);
+    if (central_impulse_time > 0.0f)
+        buffer->add(m_vehicle->getAdditionalImpulse());
 
     // 3) Steering and other player controls
     // -------------------------------------
@@ -179,7 +202,7 @@ BareNetworkString* KartRewinder::saveState(std::vector<std::string>* ru)
     // -----------
     m_skidding->saveState(buffer);
 
-    return buffer;
+    return true;
 }   // saveState
 
 // ----------------------------------------------------------------------------
@@ -202,19 +225,29 @@ void KartRewinder::restoreState(BareNetworkString *buffer, int count)
 
     // 2) Kart animation status or transform and velocities
     // -----------
-    m_transfrom_from_network.setOrigin(buffer->getVec3());
-    m_transfrom_from_network.setRotation(buffer->getQuat());
-
     if (has_animation)
     {
+        m_transfrom_from_network.setOrigin(buffer->getVec3());
+        m_transfrom_from_network.setRotation(buffer->getQuat());
         int end_ticks = buffer->getUInt32();
         AbstractKartAnimation* ka = getKartAnimation();
         if (ka)
             ka->setEndTransformTicks(m_transfrom_from_network, end_ticks);
     }
 
-    Vec3 lv = buffer->getVec3();
-    Vec3 av = buffer->getVec3();
+    Vec3 lv, av;
+    {
+        BitReader reader(buffer);
+        if (!has_animation)
+        {
+            m_transfrom_from_network.setOrigin(
+                StateQuantizer::readPosition(&reader));
+            m_transfrom_from_network.setRotation(
+                StateQuantizer::readRotation(&reader));
+        }
+        lv = StateQuantizer::readHalfVec3(&reader);
+        av = StateQuantizer::readHalfVec3(&reader);
+    }
     // Don't restore to phyics position if showing kart animation
     if (!getKartAnimation())
     {
@@ -234,13 +267,18 @@ void KartRewinder::restoreState(BareNetworkString *buffer, int count)
     m_vehicle->setMinSpeed(buffer->getFloat());
     float time_rot = buffer->getFloat();
     // Set timed rotation divides by time_rot
-    m_vehicle->setTimedRotation(time_rot, time_rot*buffer->getVec3());
+    if (time_rot > 0.0f)
+        m_vehicle->setTimedRotation(time_rot, time_rot*buffer->getVec3());
+    else
+        m_vehicle->setTimedRotation(0.0f, Vec3(0.0f, 0.0f, 0.0f));
     m_vehicle->setCushioningDisableTime(buffer->getUInt8());
 
     // Collision rewind
     m_bounce_back_ticks = buffer->getUInt16();
     float central_impulse_time = buffer->getFloat();
-    Vec3 additional_impulse = buffer->getVec3();
+    Vec3 additional_impulse(0.0f, 0.0f, 0.0f);
+    if (central_impulse_time > 0.0f)
+        additional_impulse = buffer->getVec3();
     m_vehicle->setTimedCentralImpulse(central_impulse_time,
         additional_impulse, true/*rewind*/);
 
@@ -213,6 +213,7 @@
 #include "modes/cutscene_world.hpp"
 #include "modes/demo_world.hpp"
 #include "modes/profile_world.hpp"
+#include "network/encryption_pool.hpp"
 #include "network/protocols/connect_to_server.hpp"
 #include "network/protocols/client_lobby.hpp"
 #include "network/protocols/server_lobby.hpp"
@@ -223,10 +224,13 @@
 #include "network/server.hpp"
 #include "network/server_config.hpp"
 #include "network/servers_manager.hpp"
+#include "network/state_snapshot.hpp"
+#include "network/state_quantizer.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
 #include "online/profile_manager.hpp"
 #include "online/request_manager.hpp"
+#include "physics/triangle_mesh.hpp"
 #include "race/grand_prix_manager.hpp"
 #include "race/highscore_manager.hpp"
 #include "race/history.hpp"
@@ -251,10 +255,12 @@
 #include "utils/mini_glm.hpp"
 #include "utils/profiler.hpp"
 #include "utils/translation.hpp"
+#include "utils/worker_pool.hpp"
 
 static void cleanSuperTuxKart();
 static void cleanUserConfig();
 void runUnitTests();
+void runBenchmarks();
 
 // ============================================================================
 //                        gamepad visualisation screen
@@ -605,6 +611,8 @@ void cmdLineHelp()
     "       --wan-server=name  Start a Wan server (not a playing client).\n"
     "       --public-server    Allow direct connection to the server (without stk server)\n"
     "       --lan-server=name  Start a LAN server (not a playing client).\n"
+    "       --server-instances=n Start n servers, which share the loaded karts\n"
+    "                          and tracks. Server i uses port + i - 1 (not on Windows).\n"
     "       --server-password= Sets a password for a server (both client&server).\n"
     "       --connect-now=ip   Connect to a server with IP known now\n"
     "                          (in format x.x.x.x:xxx(port)), the port should be its\n"
@@ -612,6 +620,14 @@ void cmdLineHelp()
     "       --server-id=n      Server id in stk addons for --connect-now.\n"
     "       --network-ai=n     Numbers of AI for connecting to linear race server, used\n"
     "                          together with --connect-now.\n"
+    "       --network-latency=n Delay all sent messages by n ms (for load tests).\n"
+    "       --network-jitter=n Delay all sent messages by up to n additional ms.\n"
+    "       --network-loss=n   Drop n percent of unreliable sent messages.\n"
+    "       --load-statistics=file Write tick time, bandwidth and rewind\n"
+    "                          statistics to file at the end of each network race.\n"
+    "       --capture-packets=file Write all received network messages to file.\n"
+    "       --replay-packets=file Replay the network messages of a capture file in a\n"
+    "                          LAN server instead of using the network.\n"
     "       --login=s          Automatically log in (set the login).\n"
     "       --password=s       Automatically log in (set the password).\n"
     "       --init-user        Save the above login and password (if set) in config.\n"
@@ -944,6 +960,8 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
 
     if (CommandLine::has("--unit-testing"))
         UserConfigParams::m_unit_testing = true;
+    if (CommandLine::has("--benchmark"))
+        UserConfigParams::m_benchmark = true;
     if (CommandLine::has("--gamepad-debug"))
         UserConfigParams::m_gamepad_debug=true;
     if (CommandLine::has("--keyboard-debug"))
@@ -1189,6 +1207,20 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
     if (CommandLine::has("--disable-item-collection"))
         ItemManager::disableItemCollection();
 
+    int latency = 0, jitter = 0;
+    float loss = 0.0f;
+    CommandLine::has("--network-latency", &latency);
+    CommandLine::has("--network-jitter", &jitter);
+    CommandLine::has("--network-loss", &loss);
+    NetworkConfig::get()->setSimulatedNetwork(std::max(latency, 0),
+        std::max(jitter, 0), std::min(std::max(loss, 0.0f), 100.0f) * 0.01f);
+    if (CommandLine::has("--load-statistics", &s))
+        NetworkConfig::get()->setLoadStatisticsFile(s);
+    if (CommandLine::has("--capture-packets", &s))
+        NetworkConfig::get()->setPacketCaptureFile(s);
+    if (CommandLine::has("--replay-packets", &s))
+        NetworkConfig::get()->setPacketReplayFile(s);
+
     std::string server_password;
     if (CommandLine::has("--server-password", &s))
     {
@@ -1274,6 +1306,31 @@ int handleCmdLine(bool has_server_config, bool has_parent_process)
         NetworkConfig::get()->setClientPort(n);
         ServerConfig::m_server_port = n;
     }
+    const unsigned instance = NetworkConfig::get()->getServerInstance();
+    if (instance > 0)
+    {
+        // Each additional server of --server-instances uses the next port
+        // (a port of 0 is changed to a random port if it is already used),
+        // its own name and its own statistics, capture and metrics file
+        if (ServerConfig::m_server_port != 0)
+            ServerConfig::m_server_port = ServerConfig::m_server_port + instance;
+        const std::string number = StringUtils::toString(instance + 1);
+        ServerConfig::m_server_name =
+            (std::string)ServerConfig::m_server_name + " " + number;
+        auto instance_file = [number](const std::string& file)
+        {
+            if (file.empty())
+                return file;
+            const std::string ext = StringUtils::getExtension(file);
+            return ext == file ? file + "-" + number :
+                StringUtils::removeExtension(file) + "-" + number + "." + ext;
+        };
+        NetworkConfig* nc = NetworkConfig::get();
+        nc->setLoadStatisticsFile(instance_file(nc->getLoadStatisticsFile()));
+        nc->setPacketCaptureFile(instance_file(nc->getPacketCaptureFile()));
+        ServerConfig::m_metrics_file =
+            instance_file((std::string)ServerConfig::m_metrics_file);
+    }
     if (CommandLine::has("--public-server"))
     {
         NetworkConfig::get()->setIsPublicServer();
@@ -1662,6 +1719,75 @@ void initUserConfig()
                                                     // command line parameters
 }   // initUserConfig
 
+//=============================================================================
+/** Returns the number of servers to start with --server-instances, or 1 if
+ *  this is not a server or forking is not supported. Forking is only done
+ *  for a server without graphics and sound, since otherwise threads (e.g.
+ *  of the SFXManager) are already running, which are not copied into the
+ *  child processes.
+ */
+int getServerInstances()
+{
+#ifdef WIN32
+    return 1;
+#else
+    static int instances = -1;
+    if (instances != -1)
+        return instances;
+    instances = 1;
+    if (!NetworkConfig::get()->isServer() ||
+        !CommandLine::has("--server-instances", &instances))
+    {
+        instances = 1;
+        return instances;
+    }
+    if (!ProfileWorld::isNoGraphics() || UserConfigParams::m_enable_sound)
+    {
+        Log::error("main", "--server-instances can only be used for a "
+                   "server without graphics, starting only one server.");
+        instances = 1;
+    }
+    instances = std::max(instances, 1);
+    return instances;
+#endif
+}   // getServerInstances
+
+//=============================================================================
+#ifndef WIN32
+/** Starts the additional servers of --server-instances as child processes.
+ *  This is done after all karts, tracks and materials are loaded, so the
+ *  memory used by them is shared (copy-on-write) by all servers and only
+ *  loaded once. Each server then has its own lobby, world and network
+ *  threads. The child processes exit when the first server exits.
+ *  \param instances Total number of servers.
+ */
+void forkServerInstances(int instances)
+{
+    const pid_t parent = getpid();
+    // Finished child processes are removed without waiting for them
+    signal(SIGCHLD, SIG_IGN);
+    Log::setPrefix("Server 1");
+    for (int i = 1; i < instances; i++)
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            NetworkConfig::get()->setServerInstance(i);
+            main_loop->setParentPid((unsigned)parent);
+            Log::setPrefix("Server " + StringUtils::toString(i + 1));
+            return;
+        }
+        if (pid < 0)
+        {
+            Log::error("main", "Cannot start server %d.", i + 1);
+            return;
+        }
+        Log::info("main", "Started server %d with process id %d.", i + 1,
+                  (int)pid);
+    }
+}   // forkServerInstances
+#endif
+
 //=============================================================================
 void initRest()
 {
@@ -1707,7 +1833,10 @@ void initRest()
     // The rest will be read later (since the rest needs the unlock- and
     // achievement managers to be created, which can only be created later).
     PlayerManager::create();
-    Online::RequestManager::get()->startNetworkThread();
+    // With several server instances the thread is started after the
+    // servers are forked, since only the forking thread is copied
+    if (getServerInstances() == 1)
+        Online::RequestManager::get()->startNetworkThread();
 #ifndef SERVER_ONLY
     if (!ProfileWorld::isNoGraphics())
         NewsManager::get();   // this will create the news manager
@@ -2019,6 +2148,14 @@ int main(int argc, char *argv[] )
         GUIEngine::addLoadingIcon( irr_driver->getTexture(FileManager::GUI_ICON,
                                                           "banana.png")    );
 
+#ifndef WIN32
+        if (getServerInstances() > 1)
+        {
+            forkServerInstances(getServerInstances());
+            Online::RequestManager::get()->startNetworkThread();
+        }
+#endif
+
         //handleCmdLine() needs InitTuxkart() so it can't be called first
         if (!handleCmdLine(!server_config.empty(), has_parent_process))
             exit(0);
@@ -2056,6 +2193,12 @@ int main(int argc, char *argv[] )
             exit(0);
         }
 
+        if(UserConfigParams::m_benchmark)
+        {
+            runBenchmarks();
+            exit(0);
+        }
+
 #ifndef SERVER_ONLY
         if (!ProfileWorld::isNoGraphics())
         {
@@ -2462,12 +2605,24 @@ void runUnitTests()
     Log::info("UnitTest", "Arena Graph");
     ArenaGraph::unitTesting();
 
+    Log::info("UnitTest", "Graph spatial index");
+    Graph::unitTesting();
+
     Log::info("UnitTest", "Fonts for translation");
     font_manager->unitTesting();
 
     Log::info("UnitTest", "RewindQueue");
     RewindQueue::unitTesting();
 
+    Log::info("UnitTest", "StateSnapshot");
+    StateSnapshot::unitTesting();
+
+    Log::info("UnitTest", "StateQuantizer");
+    StateQuantizer::unitTesting();
+
+    Log::info("UnitTest", "WorkerPool");
+    WorkerPool::unitTesting();
+
     Log::info("UnitTest", "IP ban");
     NetworkConfig::get()->unsetNetworking();
     ServerLobby sl;
@@ -2537,3 +2692,18 @@ void runUnitTests()
     Log::info("UnitTest", "Testing successful   ");
     Log::info("UnitTest", "=====================");
 }   // runUnitTests
+
+//=============================================================================
+void runBenchmarks()
+{
+    Log::info("Benchmark", "Starting benchmarks");
+    Log::info("Benchmark", "===================");
+    Log::info("Benchmark", "RewindManager save state");
+    RewindManager::benchmark();
+    Log::info("Benchmark", "EncryptionPool broadcast");
+    EncryptionPool::benchmark();
+    Log::info("Benchmark", "NetworkString receive");
+    NetworkString::benchmark();
+    Log::info("Benchmark", "TriangleMesh raycasts");
+    TriangleMesh::benchmark();
+}   // runBenchmarks
@@ -31,11 +31,14 @@
 #include "input/input_manager.hpp"
 #include "modes/profile_world.hpp"
 #include "modes/world.hpp"
+#include "network/load_statistics.hpp"
 #include "network/network_config.hpp"
 #include "network/protocols/game_protocol.hpp"
 #include "network/protocol_manager.hpp"
 #include "network/race_event_manager.hpp"
 #include "network/rewind_manager.hpp"
+#include "network/server_config.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_host.hpp"
 #include "online/request_manager.hpp"
 #include "race/history.hpp"
@@ -44,6 +47,9 @@
 #include "utils/profiler.hpp"
 #include "utils/time.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 #ifndef WIN32
 #include <unistd.h>
 #endif
@@ -72,6 +78,8 @@ MainLoop::MainLoop(unsigned parent_pid)
     m_prev_time       = 0;
     m_throttle_fps    = true;
     m_frame_before_loading_world = false;
+    m_fixed_rate      = false;
+    m_scheduled_ticks = 0;
 #ifdef WIN32
     if (parent_pid != 0)
     {
@@ -192,6 +200,65 @@ float MainLoop::getLimitedDt()
     return dt;
 }   // getLimitedDt
 
+//-----------------------------------------------------------------------------
+/** Used by a server without graphics instead of getLimitedDt if
+ *  fixed-rate-ticks is set in the server config. Sleeps until the time of
+ *  the next tick, which is computed from the time scheduling started (so
+ *  rounding errors do not accumulate), and returns the number of ticks
+ *  which are due. At most max-catch-up-ticks are returned at once, and if
+ *  the server is more than one second late the missed ticks are skipped.
+ */
+int MainLoop::getFixedRateTicks()
+{
+    typedef std::chrono::steady_clock Clock;
+    const uint64_t fps = stk_config->getPhysicsFPS();
+    Clock::time_point now = Clock::now();
+    if (!m_fixed_rate)
+    {
+        m_fixed_rate = true;
+        m_fixed_rate_start = now;
+        m_previous_tick_time = now;
+        m_scheduled_ticks = 0;
+    }
+
+    Clock::time_point next = m_fixed_rate_start +
+        std::chrono::nanoseconds((m_scheduled_ticks + 1) * 1000000000 / fps);
+    if (now < next)
+    {
+        StkTime::sleepUntil(next);
+        now = Clock::now();
+    }
+    const uint64_t elapsed = std::chrono::duration_cast
+        <std::chrono::nanoseconds>(now - m_fixed_rate_start).count();
+    uint64_t due = elapsed * fps / 1000000000 - m_scheduled_ticks;
+    if (due > fps)
+    {
+        Log::warn("MainLoop", "Server is late, skipping %d ticks.",
+                  (int)(due - 1));
+        if (World::getWorld())
+            LoadStatistics::addSkippedTicks((unsigned)(due - 1));
+        m_scheduled_ticks += due - 1;
+        due = 1;
+        next = m_fixed_rate_start +
+            std::chrono::nanoseconds((m_scheduled_ticks + 1) * 1000000000 /
+                                     fps);
+    }
+
+    if (World::getWorld())
+    {
+        typedef std::chrono::duration<float, std::milli> Ms;
+        const float tick_ms = 1000.0f / fps;
+        LoadStatistics::addTickSchedule(Ms(now - next).count(),
+            fabsf(Ms(now - m_previous_tick_time).count() - tick_ms));
+    }
+    m_previous_tick_time = now;
+    const int num_steps = (int)std::min<uint64_t>(due,
+        std::max(1, (int)ServerConfig::m_max_catch_up_ticks));
+    m_scheduled_ticks += num_steps;
+    m_curr_time = StkTime::getRealTimeMs();
+    return num_steps;
+}   // getFixedRateTicks
+
 //-----------------------------------------------------------------------------
 /** Updates all race related objects.
  *  \param ticks Number of ticks (physics steps) to simulate - should be 1.
@@ -321,10 +388,20 @@ void MainLoop::run()
 #endif
         PROFILER_PUSH_CPU_MARKER("Main loop", 0xFF, 0x00, 0xF7);
 
-        left_over_time += getLimitedDt();
-        int num_steps   = stk_config->time2Ticks(left_over_time);
+        int num_steps = 0;
         float dt = stk_config->ticks2Time(1);
-        left_over_time -= num_steps * dt ;
+        if (ProfileWorld::isNoGraphics() && ServerConfig::m_fixed_rate_ticks &&
+            NetworkConfig::get()->isServer())
+        {
+            num_steps = getFixedRateTicks();
+        }
+        else
+        {
+            m_fixed_rate = false;
+            left_over_time += getLimitedDt();
+            num_steps = stk_config->time2Ticks(left_over_time);
+            left_over_time -= num_steps * dt;
+        }
 
         // Shutdown next frame if shutdown request is sent while loading the
         // world
@@ -445,7 +522,19 @@ void MainLoop::run()
             PROFILER_POP_CPU_MARKER();
 
             PROFILER_PUSH_CPU_MARKER("Update race", 0, 255, 255);
-            if (World::getWorld()) updateRace(1);
+            if (World::getWorld())
+            {
+                const double start = StkTime::getRealTime();
+                updateRace(1);
+                if (NetworkConfig::get()->isNetworking())
+                {
+                    const float ms =
+                        float((StkTime::getRealTime() - start) * 1000.0);
+                    LoadStatistics::addTickTime(ms);
+                    if (NetworkConfig::get()->isServer())
+                        ServerMetrics::addTickTime(ms);
+                }
+            }
             PROFILER_POP_CPU_MARKER();
 
             // We need to check again because update_race may have requested
@@ -482,6 +571,9 @@ void MainLoop::run()
             }
             if (auto gp = GameProtocol::lock())
                 gp->sendActions();
+            if (NetworkConfig::get()->isNetworking() &&
+                NetworkConfig::get()->isServer())
+                ServerMetrics::update();
         }
         PROFILER_POP_CPU_MARKER();   // MainLoop pop
         PROFILER_SYNC_FRAME();
@@ -23,6 +23,7 @@
 #include "utils/synchronised.hpp"
 #include "utils/types.hpp"
 #include <atomic>
+#include <chrono>
 
 /** Management class for the whole gameflow, this is where the
     main-loop is */
@@ -44,7 +45,22 @@ private:
     uint64_t m_curr_time;
     uint64_t m_prev_time;
     unsigned m_parent_pid;
+
+    /** True if ticks are scheduled at a fixed rate (see getFixedRateTicks),
+     *  the following values are only used then. */
+    bool m_fixed_rate;
+
+    /** Time at which fixed rate scheduling started. */
+    std::chrono::steady_clock::time_point m_fixed_rate_start;
+
+    /** Time at which the previous ticks were started. */
+    std::chrono::steady_clock::time_point m_previous_tick_time;
+
+    /** Number of ticks scheduled since m_fixed_rate_start. */
+    uint64_t m_scheduled_ticks;
+
     float    getLimitedDt();
+    int      getFixedRateTicks();
     void     updateRace(int ticks);
 public:
          MainLoop(unsigned parent_pid);
@@ -54,11 +70,21 @@ public:
     void abort() { m_abort = true; }
     void requestAbort() { m_request_abort = true; }
     void setThrottleFPS(bool throttle) { m_throttle_fps = throttle; }
+    /** Sets the process id of the parent, if the parent is terminated the
+     *  main loop is left. */
+    void setParentPid(unsigned pid)            { m_parent_pid = pid; }
     // ------------------------------------------------------------------------
     /** Returns true if STK is to be stoppe. */
     bool isAborted() const { return m_abort; }
     // ------------------------------------------------------------------------
-    void setFrameBeforeLoadingWorld()  { m_frame_before_loading_world = true; }
+    /** Called when a world is created. The world is loaded in the current
+     *  frame, so the loading time is not simulated and fixed rate
+     *  scheduling is restarted with the next frame. */
+    void setFrameBeforeLoadingWorld()
+    {
+        m_frame_before_loading_world = true;
+        m_fixed_rate = false;
+    }   // setFrameBeforeLoadingWorld
     // ------------------------------------------------------------------------
     void setTicksAdjustment(int ticks)
     {
@@ -232,15 +232,16 @@ void LinearWorld::update(int ticks)
 //-----------------------------------------------------------------------------
 void LinearWorld::updateTrackSectors()
 {
-    const unsigned int kart_amount = getNumKarts();
-    for(unsigned int n=0; n<kart_amount; n++)
+    // Each kart only changes its own track sector and kart info, so this
+    // can be done in parallel
+    forEachKartInParallel([this](unsigned int n)
     {
         KartInfo& kart_info = m_kart_info[n];
         AbstractKart* kart = m_karts[n].get();
 
         // Nothing to do for karts that are currently being
         // rescued or eliminated
-        if(kart->getKartAnimation()) continue;
+        if(kart->getKartAnimation()) return;
         // If the kart is off road, and 'flying' over a reset plane
         // don't adjust the distance of the kart, to avoid a jump
         // in the position of the kart (e.g. while falling the kart
@@ -250,12 +251,12 @@ void LinearWorld::updateTrackSectors()
             (!kart->getMaterial() ||
               kart->getMaterial()->isDriveReset()))  &&
              !kart->isGhostKart())
-            continue;
+            return;
         getTrackSector(n)->update(kart->getFrontXYZ());
         kart_info.m_overall_distance = kart_info.m_finished_laps
                                      * Track::getCurrentTrack()->getTrackLength()
                         + getDistanceDownTrackForKart(kart->getWorldKartId(), true);
-    }   // for n
+    });
 }   // updateTrackSectors
 
 //-----------------------------------------------------------------------------
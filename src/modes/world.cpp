@@ -54,6 +54,7 @@
 #include "modes/profile_world.hpp"
 #include "network/network_config.hpp"
 #include "network/rewind_manager.hpp"
+#include "network/server_config.hpp"
 #include "physics/btKart.hpp"
 #include "physics/physics.hpp"
 #include "physics/triangle_mesh.hpp"
@@ -78,12 +79,14 @@
 #include "utils/profiler.hpp"
 #include "utils/translation.hpp"
 #include "utils/string_utils.hpp"
+#include "utils/worker_pool.hpp"
 
 #include <algorithm>
 #include <assert.h>
 #include <ctime>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 
 
 World* World::m_world = NULL;
@@ -259,6 +262,22 @@ void World::init()
         }   // if server with graphics of is watching replay
     } // if getNumCameras()==0
     initTeamArrows();
+
+    // Only worth the thread synchronisation on servers with many karts
+    if (NetworkConfig::get()->isServer() && m_karts.size() >= 8)
+    {
+        int threads = ServerConfig::m_kart_update_threads;
+        if (threads < 0)
+        {
+            const int cores = (int)std::thread::hardware_concurrency();
+            threads = std::min(cores - 1, 3);
+        }
+        if (threads > 0)
+        {
+            m_kart_worker_pool.reset(new WorkerPool(threads,
+                                                    "KartWorkerPool"));
+        }
+    }
 }   // init
 
 //-----------------------------------------------------------------------------
@@ -1079,6 +1098,9 @@ void World::update(int ticks)
     const int kart_amount = (int)m_karts.size();
     for (int i = 0 ; i < kart_amount; ++i)
     {
+        // Karts not affected by a partial rewind are not updated
+        if (RewindManager::get()->isKartSkipped(i))
+            continue;
         SpareTireAI* sta =
             dynamic_cast<SpareTireAI*>(m_karts[i]->getController());
         // Update all karts that are not eliminated
@@ -1127,6 +1149,26 @@ void World::updateTrack(int ticks)
     Track::getCurrentTrack()->update(ticks);
 }   // update Track
 
+// ----------------------------------------------------------------------------
+/** Calls update(i) for each kart index i, using the worker threads if
+ *  available. This must only be used for work that reads the track and the
+ *  kart, and only modifies data of this kart (like its track sector), so
+ *  the result is the same as updating the karts one after another.
+ *  Everything that depends on other karts or changes the physics, items or
+ *  attachments must be done in the (serial) World::update.
+ */
+void World::forEachKartInParallel(const std::function<void(unsigned)>& update)
+{
+    const unsigned int kart_amount = getNumKarts();
+    if (m_kart_worker_pool)
+    {
+        m_kart_worker_pool->run(kart_amount, update);
+        return;
+    }
+    for (unsigned int i = 0; i < kart_amount; i++)
+        update(i);
+}   // forEachKartInParallel
+
 // ----------------------------------------------------------------------------
 Highscores* World::getHighscores() const
 {
@@ -25,6 +25,7 @@
   * battle, etc.)
   */
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <vector>
@@ -44,6 +45,7 @@ class btRigidBody;
 class Controller;
 class Item;
 class PhysicalObject;
+class WorkerPool;
 
 namespace Scripting
 {
@@ -176,6 +178,10 @@ protected:
 
     /** Set when the world is online and counts network players. */
     bool m_is_network_world;
+
+    /** Worker threads for the per kart work which only depends on the kart
+     *  itself, NULL if it is done in the main thread only. */
+    std::unique_ptr<WorkerPool> m_kart_worker_pool;
     
     virtual void  onGo() OVERRIDE;
     /** Returns true if the race is over. Must be defined by all modes. */
@@ -183,6 +189,8 @@ protected:
     virtual void  update(int ticks) OVERRIDE;
     virtual void  createRaceGUI();
             void  updateTrack(int ticks);
+            void  forEachKartInParallel(
+                             const std::function<void(unsigned)>& update);
     // ------------------------------------------------------------------------
     /** Used for AI karts that are still racing when all player kart finished.
      *  Generally it should estimate the arrival time for those karts, but as
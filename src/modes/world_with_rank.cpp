@@ -250,13 +250,12 @@ void WorldWithRank::updateSectorForKarts()
 {
     if (isRaceOver()) return;
 
-    const unsigned int n = getNumKarts();
-    assert(n == m_kart_track_sector.size());
-    for (unsigned int i = 0; i < n; i++)
+    assert(getNumKarts() == m_kart_track_sector.size());
+    forEachKartInParallel([this](unsigned int i)
     {
         SpareTireAI* sta =
             dynamic_cast<SpareTireAI*>(m_karts[i]->getController());
         if (!m_karts[i]->isEliminated() || (sta && sta->isMoving()))
             getTrackSector(i)->update(m_karts[i]->getXYZ());
-    }
+    });
 }   // updateSectorForKarts
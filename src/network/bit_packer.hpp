@@ -0,0 +1,128 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_BIT_PACKER_HPP
+#define HEADER_BIT_PACKER_HPP
+
+#include "network/network_string.hpp"
+#include "utils/no_copy.hpp"
+
+#include <assert.h>
+
+/** \ingroup network
+ *  Writes values with an arbitrary number of bits to a network string. The
+ *  bits are written most significant bit first, and the last byte is padded
+ *  with zero bits when flush() is called (or the writer is deleted), so
+ *  byte aligned values can be added to the string afterwards.
+ */
+class BitWriter : public NoCopy
+{
+private:
+    BareNetworkString* m_buffer;
+
+    /** Bits not yet written to the buffer, the lowest m_num_bits are used. */
+    uint64_t m_bits;
+
+    unsigned m_num_bits;
+
+public:
+    BitWriter(BareNetworkString* buffer)
+    {
+        m_buffer = buffer;
+        m_bits = 0;
+        m_num_bits = 0;
+    }   // BitWriter
+    // ------------------------------------------------------------------------
+    ~BitWriter() { flush(); }
+    // ------------------------------------------------------------------------
+    /** Writes the lowest bits of value.
+     *  \param value The value, must be smaller than 2^bits.
+     *  \param bits Number of bits to write, at most 32.
+     */
+    void write(uint32_t value, unsigned bits)
+    {
+        assert(bits <= 32);
+        assert(bits == 32 || value < (uint32_t(1) << bits));
+        m_bits = (m_bits << bits) | value;
+        m_num_bits += bits;
+        while (m_num_bits >= 8)
+        {
+            m_num_bits -= 8;
+            m_buffer->addUInt8((uint8_t)(m_bits >> m_num_bits));
+        }
+        m_bits &= (uint64_t(1) << m_num_bits) - 1;
+    }   // write
+    // ------------------------------------------------------------------------
+    void writeBool(bool b) { write(b ? 1 : 0, 1); }
+    // ------------------------------------------------------------------------
+    /** Writes the remaining bits, padded to a full byte. */
+    void flush()
+    {
+        if (m_num_bits == 0)
+            return;
+        m_buffer->addUInt8((uint8_t)(m_bits << (8 - m_num_bits)));
+        m_bits = 0;
+        m_num_bits = 0;
+    }   // flush
+};   // BitWriter
+
+// ============================================================================
+/** \ingroup network
+ *  Reads values written by a BitWriter. Bytes are only read from the string
+ *  when they are needed, so after reading all values the string is
+ *  positioned after the padded last byte, as it was written.
+ */
+class BitReader : public NoCopy
+{
+private:
+    const BareNetworkString* m_buffer;
+
+    /** Bits read from the buffer but not used yet, the lowest m_num_bits
+     *  are valid. */
+    uint64_t m_bits;
+
+    unsigned m_num_bits;
+
+public:
+    BitReader(const BareNetworkString* buffer)
+    {
+        m_buffer = buffer;
+        m_bits = 0;
+        m_num_bits = 0;
+    }   // BitReader
+    // ------------------------------------------------------------------------
+    /** Reads a value of the given number of bits (at most 32). */
+    uint32_t read(unsigned bits)
+    {
+        assert(bits <= 32);
+        while (m_num_bits < bits)
+        {
+            m_bits = (m_bits << 8) | m_buffer->getUInt8();
+            m_num_bits += 8;
+        }
+        m_num_bits -= bits;
+        const uint32_t value =
+            (uint32_t)((m_bits >> m_num_bits) & ((uint64_t(1) << bits) - 1));
+        m_bits &= (uint64_t(1) << m_num_bits) - 1;
+        return value;
+    }   // read
+    // ------------------------------------------------------------------------
+    bool readBool() { return read(1) == 1; }
+};   // BitReader
+
+#endif
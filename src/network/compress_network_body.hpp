@@ -19,7 +19,9 @@
 #ifndef HEADER_COMPRESS_NETWORK_BODY_HPP
 #define HEADER_COMPRESS_NETWORK_BODY_HPP
 
+#include "network/bit_packer.hpp"
 #include "network/network_string.hpp"
+#include "network/state_quantizer.hpp"
 #include "utils/mini_glm.hpp"
 
 #include "LinearMath/btMotionState.h"
@@ -33,22 +35,22 @@ namespace CompressNetworkBody
                          BareNetworkString* bns, btRigidBody* body,
                          btMotionState* ms)
     {
-        bns->add(t.getOrigin());
+        // The write functions replace the values with the uncompressed ones
+        Vec3 origin = t.getOrigin();
         uint32_t compressed_q = compressQuaternion(t.getRotation());
-        bns->addUInt32(compressed_q);
-        std::array<short, 3> lvs =
-            {{ toFloat16(lv.x()), toFloat16(lv.y()), toFloat16(lv.z()) }};
-        bns->addUInt16(lvs[0]).addUInt16(lvs[1]).addUInt16(lvs[2]);
-        std::array<short, 3> avs =
-            {{ toFloat16(av.x()), toFloat16(av.y()), toFloat16(av.z()) }};
-        bns->addUInt16(avs[0]).addUInt16(avs[1]).addUInt16(avs[2]);
+        Vec3 uncompressed_lv = lv;
+        Vec3 uncompressed_av = av;
+        {
+            BitWriter writer(bns);
+            StateQuantizer::writePosition(&writer, &origin);
+            writer.write(compressed_q, 32);
+            StateQuantizer::writeHalfVec3(&writer, &uncompressed_lv);
+            StateQuantizer::writeHalfVec3(&writer, &uncompressed_av);
+        }
 
         btQuaternion uncompressed_q = decompressbtQuaternion(compressed_q);
+        t.setOrigin(origin);
         t.setRotation(uncompressed_q);
-        Vec3 uncompressed_lv(toFloat32(lvs[0]), toFloat32(lvs[1]),
-            toFloat32(lvs[2]));
-        Vec3 uncompressed_av(toFloat32(avs[0]), toFloat32(avs[1]),
-            toFloat32(avs[2]));
         body->setWorldTransform(t);
         ms->setWorldTransform(t);
         body->setInterpolationWorldTransform(t);
@@ -61,17 +63,11 @@ namespace CompressNetworkBody
     inline void decompress(const BareNetworkString* bns, btTransform* t,
                            Vec3* lv, Vec3* av)
     {
-        t->setOrigin(bns->getVec3());
-        t->setRotation(decompressbtQuaternion(bns->getUInt32()));
-        short vec[3];
-        vec[0] = bns->getUInt16();
-        vec[1] = bns->getUInt16();
-        vec[2] = bns->getUInt16();
-        *lv = Vec3(toFloat32(vec[0]), toFloat32(vec[1]), toFloat32(vec[2]));
-        vec[0] = bns->getUInt16();
-        vec[1] = bns->getUInt16();
-        vec[2] = bns->getUInt16();
-        *av = Vec3(toFloat32(vec[0]), toFloat32(vec[1]), toFloat32(vec[2]));
+        BitReader reader(bns);
+        t->setOrigin(StateQuantizer::readPosition(&reader));
+        t->setRotation(decompressbtQuaternion(reader.read(32)));
+        *lv = StateQuantizer::readHalfVec3(&reader);
+        *av = StateQuantizer::readHalfVec3(&reader);
     }   // decompress
 };
 
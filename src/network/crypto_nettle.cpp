@@ -73,6 +73,7 @@ std::string Crypto::m_client_iv;
 // ============================================================================
 bool Crypto::encryptConnectionRequest(BareNetworkString& ns)
 {
+    ns.ownData();
     std::vector<uint8_t> cipher(ns.m_buffer.size() + 4, 0);
     gcm_aes128_encrypt(&m_aes_encrypt_context, ns.m_buffer.size(),
         cipher.data() + 4, ns.m_buffer.data());
@@ -84,6 +85,7 @@ bool Crypto::encryptConnectionRequest(BareNetworkString& ns)
 // ----------------------------------------------------------------------------
 bool Crypto::decryptConnectionRequest(BareNetworkString& ns)
 {
+    ns.ownData();
     std::vector<uint8_t> pt(ns.m_buffer.size() - 4, 0);
     uint8_t* tag = ns.m_buffer.data();
     std::array<uint8_t, 4> tag_after = {};
@@ -101,7 +103,7 @@ bool Crypto::decryptConnectionRequest(BareNetworkString& ns)
 ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
 {
     // 4 bytes counter and 4 bytes tag
-    ENetPacket* p = enet_packet_create(NULL, ns.m_buffer.size() + 8,
+    ENetPacket* p = enet_packet_create(NULL, ns.getTotalSize() + 8,
         (reliable ? ENET_PACKET_FLAG_RELIABLE :
         (ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT))
         );
@@ -120,8 +122,8 @@ ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
     uint8_t* packet_start = p->data + 8;
 
     gcm_aes128_set_iv(&m_aes_encrypt_context, 12, iv.data());
-    gcm_aes128_encrypt(&m_aes_encrypt_context, ns.m_buffer.size(),
-        packet_start, ns.m_buffer.data());
+    gcm_aes128_encrypt(&m_aes_encrypt_context, ns.getTotalSize(),
+        packet_start, ns.getRawData());
     gcm_aes128_digest(&m_aes_encrypt_context, 4, p->data + 4);
     ul.unlock();
 
@@ -132,8 +134,9 @@ ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
 // ----------------------------------------------------------------------------
 NetworkString* Crypto::decryptRecieve(ENetPacket* p)
 {
-    int clen = (int)(p->dataLength - 8);
-    auto ns = std::unique_ptr<NetworkString>(new NetworkString(p->data, clen));
+    if (p->dataLength < 8)
+        throw std::runtime_error("Encrypted packet too short.");
+    size_t clen = p->dataLength - 8;
 
     std::array<uint8_t, 12> iv = {};
     if (NetworkConfig::get()->isClient())
@@ -145,15 +148,15 @@ NetworkString* Crypto::decryptRecieve(ENetPacket* p)
     uint8_t* tag = p->data + 4;
     std::array<uint8_t, 4> tag_after = {};
 
+    // Decrypt in place, the returned string then uses the packet data
+    // directly
     gcm_aes128_set_iv(&m_aes_decrypt_context, 12, iv.data());
-    gcm_aes128_decrypt(&m_aes_decrypt_context, clen, ns->m_buffer.data(),
+    gcm_aes128_decrypt(&m_aes_decrypt_context, clen, packet_start,
         packet_start);
     gcm_aes128_digest(&m_aes_decrypt_context, 4, tag_after.data());
     handleAuthentication(tag, tag_after);
 
-    NetworkString* result = ns.get();
-    ns.release();
-    return result;
+    return new NetworkString(p, 8);
 }   // decryptRecieve
 
 #endif
@@ -83,6 +83,7 @@ std::string Crypto::m_client_iv;
 // ============================================================================
 bool Crypto::encryptConnectionRequest(BareNetworkString& ns)
 {
+    ns.ownData();
     std::vector<uint8_t> cipher(ns.m_buffer.size() + 4, 0);
 
     int elen;
@@ -104,6 +105,7 @@ bool Crypto::encryptConnectionRequest(BareNetworkString& ns)
 // ----------------------------------------------------------------------------
 bool Crypto::decryptConnectionRequest(BareNetworkString& ns)
 {
+    ns.ownData();
     std::vector<uint8_t> pt(ns.m_buffer.size() - 4, 0);
 
     if (EVP_DecryptInit_ex(m_decrypt, NULL, NULL, NULL, NULL) != 1)
@@ -132,7 +134,7 @@ bool Crypto::decryptConnectionRequest(BareNetworkString& ns)
 ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
 {
     // 4 bytes counter and 4 bytes tag
-    ENetPacket* p = enet_packet_create(NULL, ns.m_buffer.size() + 8,
+    ENetPacket* p = enet_packet_create(NULL, ns.getTotalSize() + 8,
         (reliable ? ENET_PACKET_FLAG_RELIABLE :
         (ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT))
         );
@@ -157,8 +159,8 @@ ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
     }
 
     int elen;
-    if (EVP_EncryptUpdate(m_encrypt, packet_start, &elen, ns.m_buffer.data(),
-        (int)ns.m_buffer.size()) != 1)
+    if (EVP_EncryptUpdate(m_encrypt, packet_start, &elen, ns.getRawData(),
+        (int)ns.getTotalSize()) != 1)
     {
         enet_packet_destroy(p);
         return NULL;
@@ -183,8 +185,9 @@ ENetPacket* Crypto::encryptSend(BareNetworkString& ns, bool reliable)
 // ----------------------------------------------------------------------------
 NetworkString* Crypto::decryptRecieve(ENetPacket* p)
 {
+    if (p->dataLength < 8)
+        throw std::runtime_error("Encrypted packet too short.");
     int clen = (int)(p->dataLength - 8);
-    auto ns = std::unique_ptr<NetworkString>(new NetworkString(p->data, clen));
 
     std::array<uint8_t, 12> iv = {};
     if (NetworkConfig::get()->isClient())
@@ -203,8 +206,10 @@ NetworkString* Crypto::decryptRecieve(ENetPacket* p)
         throw std::runtime_error("Failed to set tag.");
     }
 
+    // Decrypt in place, the returned string then uses the packet data
+    // directly
     int dlen;
-    if (EVP_DecryptUpdate(m_decrypt, ns->m_buffer.data(), &dlen,
+    if (EVP_DecryptUpdate(m_decrypt, packet_start, &dlen,
         packet_start, clen) != 1)
     {
         throw std::runtime_error("Failed to decrypt.");
@@ -212,9 +217,7 @@ NetworkString* Crypto::decryptRecieve(ENetPacket* p)
     if (EVP_DecryptFinal_ex(m_decrypt, unused_16_blocks.data(), &dlen) > 0)
     {
         assert(dlen == 0);
-        NetworkString* result = ns.get();
-        ns.release();
-        return result;
+        return new NetworkString(p, 8);
     }
     throw std::runtime_error("Failed to finalize decryption.");
 }   // decryptRecieve
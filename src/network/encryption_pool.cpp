@@ -0,0 +1,159 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include "network/encryption_pool.hpp"
+
+#include "network/crypto.hpp"
+#include "network/network_string.hpp"
+#include "utils/log.hpp"
+#include "utils/time.hpp"
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <thread>
+
+// ----------------------------------------------------------------------------
+/** Creates the pool and starts the worker threads.
+ *  \param num_threads Number of worker threads, 0 to always encrypt in the
+ *         calling thread.
+ *  \param parallel_min_bytes Minimum number of bytes of a batch for which
+ *         the worker threads are used.
+ */
+EncryptionPool::EncryptionPool(unsigned num_threads,
+                               unsigned parallel_min_bytes)
+              : m_workers(num_threads, "EncryptionPool")
+{
+    m_parallel_min_bytes = parallel_min_bytes;
+}   // EncryptionPool
+
+// ----------------------------------------------------------------------------
+/** Returns the number of worker threads to use on this machine: one core is
+ *  left for the main thread and one for the ENet listening thread.
+ */
+unsigned EncryptionPool::getDefaultNumThreads()
+{
+    const unsigned cores = std::thread::hardware_concurrency();
+    return cores > 2 ? std::min(cores - 2, 3u) : 0;
+}   // getDefaultNumThreads
+
+// ----------------------------------------------------------------------------
+/** Encrypts a message for several peers.
+ *  \param crypto The crypto object of each peer.
+ *  \param data The message to encrypt.
+ *  \param reliable If the packets should be sent reliable.
+ *  \param packets On return the encrypted packet for each crypto object
+ *         (NULL if a packet could not be created).
+ */
+void EncryptionPool::encrypt(const std::vector<Crypto*>& crypto,
+                             BareNetworkString* data, bool reliable,
+                             std::vector<ENetPacket*>* packets)
+{
+    packets->resize(crypto.size());
+    auto encrypt_one = [&crypto, data, reliable, packets](unsigned i)
+    {
+        (*packets)[i] = crypto[i]->encryptSend(*data, reliable);
+    };
+    if (data->getTotalSize() * crypto.size() < m_parallel_min_bytes)
+    {
+        for (unsigned i = 0; i < crypto.size(); i++)
+            encrypt_one(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> batch_lock(m_batch_mutex);
+    m_workers.run((unsigned)crypto.size(), encrypt_one);
+}   // encrypt
+
+// ----------------------------------------------------------------------------
+/** Benchmark for sending a state message of 1000 bytes to 8, 16 and 32
+ *  peers. It compares encrypting and queueing the packet for each peer
+ *  separately (each queued with its own lock and list node, as
+ *  STKPeer::sendPacket does), encrypting all packets in the calling thread
+ *  and queueing them at once, and encrypting them with the worker threads.
+ */
+void EncryptionPool::benchmark()
+{
+    const int num_messages = 2000;
+    BareNetworkString data(1000);
+    for (unsigned i = 0; i < 1000; i++)
+        data.addUInt8((uint8_t)(i * 7));
+
+    std::vector<uint8_t> key(16), iv(12);
+    std::mutex queue_mutex;
+    std::list<ENetPacket*> queue;
+    EncryptionPool serial(0);
+    EncryptionPool parallel(std::max(getDefaultNumThreads(), 1u),
+                            /*parallel_min_bytes*/0);
+
+    for (unsigned num_peers : { 8, 16, 32 })
+    {
+        std::vector<std::unique_ptr<Crypto> > all_crypto;
+        std::vector<Crypto*> crypto;
+        for (unsigned i = 0; i < num_peers; i++)
+        {
+            for (unsigned j = 0; j < key.size(); j++)
+                key[j] = (uint8_t)(i + j);
+            all_crypto.emplace_back(new Crypto(key, iv));
+            crypto.push_back(all_crypto.back().get());
+        }
+
+        auto clear_queue = [&queue]()
+        {
+            for (ENetPacket* p : queue)
+                enet_packet_destroy(p);
+            queue.clear();
+        };
+
+        double start = StkTime::getRealTime();
+        for (int m = 0; m < num_messages; m++)
+        {
+            for (Crypto* c : crypto)
+            {
+                ENetPacket* p = c->encryptSend(data, /*reliable*/false);
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                queue.push_back(p);
+            }
+            clear_queue();
+        }
+        const double per_peer = StkTime::getRealTime() - start;
+
+        std::vector<ENetPacket*> packets;
+        double times[2];
+        EncryptionPool* pools[2] = { &serial, &parallel };
+        for (unsigned i = 0; i < 2; i++)
+        {
+            start = StkTime::getRealTime();
+            for (int m = 0; m < num_messages; m++)
+            {
+                pools[i]->encrypt(crypto, &data, /*reliable*/false,
+                                  &packets);
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue.insert(queue.end(), packets.begin(), packets.end());
+                lock.unlock();
+                clear_queue();
+            }
+            times[i] = StkTime::getRealTime() - start;
+        }
+
+        Log::info("EncryptionPool", "%d peers: per peer %f us, batched %f us, "
+            "%d worker threads %f us per message.", num_peers,
+            per_peer * 1e6 / num_messages, times[0] * 1e6 / num_messages,
+            parallel.getNumThreads(), times[1] * 1e6 / num_messages);
+    }
+}   // benchmark
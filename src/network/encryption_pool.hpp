@@ -0,0 +1,72 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_ENCRYPTION_POOL_HPP
+#define HEADER_ENCRYPTION_POOL_HPP
+
+#include "utils/no_copy.hpp"
+#include "utils/worker_pool.hpp"
+
+#include <enet/enet.h>
+
+#include <mutex>
+#include <vector>
+
+class BareNetworkString;
+class Crypto;
+
+/** \ingroup network
+ *  Encrypts the same message for several peers. Each peer uses its own key,
+ *  so the message still has to be encrypted once for each peer, but for a
+ *  large enough batch the encryption is split between the calling thread
+ *  and the threads of a WorkerPool.
+ */
+class EncryptionPool : public NoCopy
+{
+private:
+    /** The worker threads. */
+    WorkerPool m_workers;
+
+    /** Minimum number of bytes (message size times number of peers) for
+     *  which the worker threads are used. */
+    unsigned m_parallel_min_bytes;
+
+    /** Makes sure only one batch is encrypted in parallel at a time. */
+    std::mutex m_batch_mutex;
+
+public:
+    /** Default minimum number of bytes for which the worker threads are
+     *  used. Smaller batches are encrypted faster than the workers can be
+     *  woken up, see benchmark(). */
+    static const unsigned PARALLEL_MIN_BYTES = 32 * 1024;
+
+    EncryptionPool(unsigned num_threads,
+                   unsigned parallel_min_bytes = PARALLEL_MIN_BYTES);
+    // ------------------------------------------------------------------------
+    void encrypt(const std::vector<Crypto*>& crypto, BareNetworkString* data,
+                 bool reliable, std::vector<ENetPacket*>* packets);
+    // ------------------------------------------------------------------------
+    /** Returns the number of worker threads. */
+    unsigned getNumThreads() const    { return m_workers.getNumThreads(); }
+    // ------------------------------------------------------------------------
+    static unsigned getDefaultNumThreads();
+    // ------------------------------------------------------------------------
+    static void benchmark();
+};   // EncryptionPool
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "network/crypto.hpp"
 #include "network/protocols/client_lobby.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_peer.hpp"
 #include "utils/log.hpp"
 #include "utils/time.hpp"
@@ -42,6 +43,7 @@ constexpr bool isConnectionRequestPacket(unsigned char* data, size_t length)
 Event::Event(ENetEvent* event, std::shared_ptr<STKPeer> peer)
 {
     m_arrival_time = (double)StkTime::getTimeSinceEpoch();
+    m_receive_time = StkTime::getMonoTimeUs();
     m_pdi = PDI_TIMEOUT;
     m_peer = peer;
 
@@ -75,23 +77,24 @@ Event::Event(ENetEvent* event, std::shared_ptr<STKPeer> peer)
         {
             throw std::runtime_error("Unencrypted content at wrong state.");
         }
+        // The network string takes over the packet and uses its data
+        // without copying it, it is destroyed together with the string
         if (m_peer->getCrypto() && event->channelID == EVENT_CHANNEL_NORMAL)
         {
+            const uint64_t start = StkTime::getMonoTimeUs();
             m_data = m_peer->getCrypto()->decryptRecieve(event->packet);
+            ServerMetrics::addCryptoTime(StkTime::getMonoTimeUs() - start);
         }
         else
         {
-            m_data = new NetworkString(event->packet->data, 
-                (int)event->packet->dataLength);
+            m_data = new NetworkString(event->packet, 0);
         }
     }
     else
-        m_data = NULL;
-
-    if (event->packet)
     {
-        // we got all we need, just remove the data.
-        enet_packet_destroy(event->packet);
+        m_data = NULL;
+        if (event->packet)
+            enet_packet_destroy(event->packet);
     }
 
 }   // Event(ENetEvent)
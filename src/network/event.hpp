@@ -73,7 +73,8 @@ class Event
 private:
     LEAK_CHECK()
 
-    /** Copy of the data passed by the event. */
+    /** The data passed by the event, which uses the memory of the received
+     *  ENet packet. */
     NetworkString *m_data;
 
     /**  Type of the event. */
@@ -85,6 +86,10 @@ private:
     /** Arrivial time of the event, for timeouts. */
     double m_arrival_time;
 
+    /** Arrival time in microseconds (see StkTime::getMonoTimeUs), to
+     *  measure how long it takes until the event is handled. */
+    uint64_t m_receive_time;
+
     /** For disconnection event, a bit more info is provided. */
     PeerDisconnectInfo m_pdi;
 
@@ -108,7 +113,7 @@ public:
     const NetworkString& data() const { return *m_data; }
     // ------------------------------------------------------------------------
     /** \brief Get a non-const reference to the received data.
-     *  A copy of the message data. This is empty for events like
+     *  The message data. This is empty for events like
      *  connection or disconnections. */
     NetworkString& data() { return *m_data; }
     // ------------------------------------------------------------------------
@@ -120,6 +125,9 @@ public:
     /** Returns the arrival time of this event. */
     double getArrivalTime() const { return m_arrival_time; }
     // ------------------------------------------------------------------------
+    /** Returns the arrival time in microseconds. */
+    uint64_t getReceiveTime() const { return m_receive_time; }
+    // ------------------------------------------------------------------------
     PeerDisconnectInfo getPeerDisconnectInfo() const { return m_pdi; }
     // ------------------------------------------------------------------------
 
@@ -40,6 +40,12 @@ public:
      *  rewind, i.e. when going forward in time again.
      */
     virtual void rewind(BareNetworkString *buffer) = 0;
+
+    /** Returns the world kart id of the only kart affected by an event, or
+     *  -1 if the event can affect any kart. This is used to find the karts
+     *  which need to be updated in a partial rewind.
+     */
+    virtual int getEventKartId(BareNetworkString *buffer) const { return -1; }
 };   // EventRewinder
 #endif
 
@@ -0,0 +1,148 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include "network/load_statistics.hpp"
+
+#include "config/stk_config.hpp"
+#include "network/network_config.hpp"
+#include "network/rewind_manager.hpp"
+#include "network/stk_host.hpp"
+#include "network/stk_peer.hpp"
+#include "utils/log.hpp"
+#include "utils/string_utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+std::vector<float> LoadStatistics::m_tick_times;
+std::vector<float> LoadStatistics::m_tick_lateness;
+std::vector<float> LoadStatistics::m_tick_jitter;
+unsigned           LoadStatistics::m_skipped_ticks = 0;
+
+// ----------------------------------------------------------------------------
+/** Removes all tick times, called at the start of a race. */
+void LoadStatistics::reset()
+{
+    m_tick_times.clear();
+    m_tick_lateness.clear();
+    m_tick_jitter.clear();
+    m_skipped_ticks = 0;
+}   // reset
+
+// ----------------------------------------------------------------------------
+/** Returns the value below which the given percentage of the values are.
+ *  \param values The values, which are reordered.
+ *  \param percentile The percentage (0 to 100).
+ */
+float LoadStatistics::getPercentile(std::vector<float>* values,
+                                    float percentile)
+{
+    if (values->empty())
+        return 0.0f;
+    size_t n = (size_t)(percentile * 0.01f * (values->size() - 1) + 0.5f);
+    std::nth_element(values->begin(), values->begin() + n, values->end());
+    return (*values)[n];
+}   // getPercentile
+
+// ----------------------------------------------------------------------------
+/** Writes the 50, 90, 99, 99.9 percentile and maximum of the values.
+ *  \param out The stream to write to.
+ *  \param name Prefix of the names of the values written.
+ *  \param values The values.
+ */
+void LoadStatistics::dumpPercentiles(std::ostream& out,
+                                     const std::string& name,
+                                     const std::vector<float>& values)
+{
+    std::vector<float> sorted = values;
+    const float percentiles[] = { 50.0f, 90.0f, 99.0f, 99.9f, 100.0f };
+    const char* names[] = { "p50", "p90", "p99", "p999", "max" };
+    for (unsigned i = 0; i < 5; i++)
+    {
+        out << name << names[i] << " "
+            << getPercentile(&sorted, percentiles[i]) << "\n";
+    }
+}   // dumpPercentiles
+
+// ----------------------------------------------------------------------------
+/** Writes the tick time percentiles, the tick schedule if fixed rate ticks
+ *  are used, and the bandwidth of each peer.
+ *  \param out The stream to write to.
+ */
+void LoadStatistics::dump(std::ostream& out)
+{
+    double total = 0.0;
+    for (float t : m_tick_times)
+        total += t;
+    out << "tick_count " << m_tick_times.size() << "\n";
+    out << "tick_time_ms_average "
+        << (m_tick_times.empty() ? 0.0 : total / m_tick_times.size()) << "\n";
+    dumpPercentiles(out, "tick_time_ms_", m_tick_times);
+    if (!m_tick_lateness.empty())
+    {
+        dumpPercentiles(out, "tick_lateness_ms_", m_tick_lateness);
+        dumpPercentiles(out, "tick_jitter_ms_", m_tick_jitter);
+        out << "tick_skipped " << m_skipped_ticks << "\n";
+    }
+
+    if (!STKHost::existHost())
+        return;
+    for (auto& peer : STKHost::get()->getPeers())
+    {
+        const float seconds = std::max(peer->getConnectedTime(), 1.0f);
+        const std::string name = "peer_" +
+            StringUtils::toString(peer->getHostId());
+        out << name << "_bytes_sent " << peer->getBytesSent() << "\n";
+        out << name << "_bytes_received " << peer->getBytesReceived() << "\n";
+        out << name << "_kbit_per_second_sent "
+            << peer->getBytesSent() * 0.008f / seconds << "\n";
+        out << name << "_kbit_per_second_received "
+            << peer->getBytesReceived() * 0.008f / seconds << "\n";
+        out << name << "_ping " << peer->getAveragePing() << "\n";
+        if (peer->getInputCount() == 0)
+            continue;
+        out << name << "_input_actions " << peer->getInputCount() << "\n";
+        out << name << "_input_arrival_ms_average "
+            << stk_config->ticks2Time(1) * 1000.0f *
+               peer->getInputArrivalTicks() / peer->getInputCount() << "\n";
+        out << name << "_input_late " << peer->getInputLate() << "\n";
+        out << name << "_input_duplicates " << peer->getInputDuplicates()
+            << "\n";
+    }
+}   // dump
+
+// ----------------------------------------------------------------------------
+/** Writes the load and rewind statistics to the file set in NetworkConfig,
+ *  if any.
+ */
+void LoadStatistics::writeFile()
+{
+    const std::string& file_name =
+        NetworkConfig::get()->getLoadStatisticsFile();
+    if (file_name.empty())
+        return;
+    std::ofstream out(file_name.c_str());
+    if (!out.good())
+    {
+        Log::error("LoadStatistics", "Cannot write load statistics to '%s'.",
+                   file_name.c_str());
+        return;
+    }
+    dump(out);
+    RewindManager::dumpStatistics(out);
+}   // writeFile
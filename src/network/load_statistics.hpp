@@ -0,0 +1,81 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_LOAD_STATISTICS_HPP
+#define HEADER_LOAD_STATISTICS_HPP
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** \ingroup network
+ *  Collects statistics for network load tests: the time used to compute
+ *  each world tick, the bandwidth used by each connected peer (counted by
+ *  STKHost and STKPeer) and how early its actions arrive. Together with the rewind statistics (see
+ *  RewindManager) they are written to the file set with
+ *  NetworkConfig::setLoadStatisticsFile at the end of each networked race,
+ *  as 'name value' lines.
+ */
+class LoadStatistics
+{
+private:
+    /** Time of each tick in ms since the last reset. */
+    static std::vector<float> m_tick_times;
+
+    /** With fixed rate ticks on a server, how late (in ms) each tick was
+     *  started compared to its scheduled time. */
+    static std::vector<float> m_tick_lateness;
+
+    /** With fixed rate ticks, the difference (in ms) between the time
+     *  between two main loop iterations and the tick duration. */
+    static std::vector<float> m_tick_jitter;
+
+    /** Number of ticks skipped because the server was too late. */
+    static unsigned m_skipped_ticks;
+
+public:
+    static float getPercentile(std::vector<float>* sorted, float percentile);
+    // ------------------------------------------------------------------------
+    static void dumpPercentiles(std::ostream& out, const std::string& name,
+                                const std::vector<float>& values);
+    // ------------------------------------------------------------------------
+    static void reset();
+    // ------------------------------------------------------------------------
+    /** Adds the time (in ms) used to compute one tick, only called by the
+     *  main thread. */
+    static void addTickTime(float ms)           { m_tick_times.push_back(ms); }
+    // ------------------------------------------------------------------------
+    /** Adds the timing of a fixed rate tick (see MainLoop), only called by
+     *  the main thread.
+     *  \param lateness_ms Time the tick started after its scheduled time.
+     *  \param jitter_ms Deviation of the time since the previous tick from
+     *         the tick duration. */
+    static void addTickSchedule(float lateness_ms, float jitter_ms)
+    {
+        m_tick_lateness.push_back(lateness_ms);
+        m_tick_jitter.push_back(jitter_ms);
+    }   // addTickSchedule
+    // ------------------------------------------------------------------------
+    static void addSkippedTicks(unsigned ticks)    { m_skipped_ticks += ticks; }
+    // ------------------------------------------------------------------------
+    static void dump(std::ostream& out);
+    // ------------------------------------------------------------------------
+    static void writeFile();
+};   // LoadStatistics
+
+#endif
@@ -55,6 +55,10 @@ NetworkConfig::NetworkConfig()
         0 : stk_config->m_client_port;
     m_joined_server_version = 0;
     m_network_ai_tester = false;
+    m_simulated_latency = 0;
+    m_simulated_jitter = 0;
+    m_simulated_loss = 0.0f;
+    m_server_instance = 0;
 }   // NetworkConfig
 
 // ----------------------------------------------------------------------------
@@ -73,6 +73,29 @@ private:
 
     bool m_network_ai_tester;
 
+    /** Simulated network conditions for load tests: additional delay (in ms)
+     *  of all sent messages, maximum random additional delay (in ms), and
+     *  probability that an unreliable message is lost. */
+    unsigned m_simulated_latency;
+    unsigned m_simulated_jitter;
+    float m_simulated_loss;
+
+    /** If not empty, the load statistics are written to this file at the
+     *  end of each networked race. */
+    std::string m_load_statistics_file;
+
+    /** If not empty, all network events received by this host are written
+     *  to this file (see PacketCapture). */
+    std::string m_packet_capture_file;
+
+    /** If not empty, the server replays the events of this capture file
+     *  instead of receiving them from the network. */
+    std::string m_packet_replay_file;
+
+    /** Index of this server if several servers were started with
+     *  --server-instances, 0 for the first (or only) server. */
+    unsigned m_server_instance;
+
     /** The LAN port on which a client is waiting for a server connection. */
     uint16_t m_client_port;
 
@@ -199,6 +222,49 @@ public:
     // ------------------------------------------------------------------------
     bool isNetworkAITester() const { return m_network_ai_tester; }
     // ------------------------------------------------------------------------
+    /** Sets the simulated network conditions, see STKHost. */
+    void setSimulatedNetwork(unsigned latency, unsigned jitter, float loss)
+    {
+        m_simulated_latency = latency;
+        m_simulated_jitter = jitter;
+        m_simulated_loss = loss;
+    }   // setSimulatedNetwork
+    // ------------------------------------------------------------------------
+    /** Returns if network conditions are simulated. */
+    bool isSimulatingNetwork() const
+    {
+        return m_simulated_latency > 0 || m_simulated_jitter > 0 ||
+               m_simulated_loss > 0.0f;
+    }   // isSimulatingNetwork
+    // ------------------------------------------------------------------------
+    unsigned getSimulatedLatency() const      { return m_simulated_latency; }
+    // ------------------------------------------------------------------------
+    unsigned getSimulatedJitter() const        { return m_simulated_jitter; }
+    // ------------------------------------------------------------------------
+    float getSimulatedLoss() const               { return m_simulated_loss; }
+    // ------------------------------------------------------------------------
+    void setLoadStatisticsFile(const std::string& file)
+                                             { m_load_statistics_file = file; }
+    // ------------------------------------------------------------------------
+    const std::string& getLoadStatisticsFile() const
+                                              { return m_load_statistics_file; }
+    // ------------------------------------------------------------------------
+    void setPacketCaptureFile(const std::string& file)
+                                              { m_packet_capture_file = file; }
+    // ------------------------------------------------------------------------
+    const std::string& getPacketCaptureFile() const
+                                               { return m_packet_capture_file; }
+    // ------------------------------------------------------------------------
+    void setPacketReplayFile(const std::string& file)
+                                               { m_packet_replay_file = file; }
+    // ------------------------------------------------------------------------
+    const std::string& getPacketReplayFile() const
+                                                { return m_packet_replay_file; }
+    // ------------------------------------------------------------------------
+    void setServerInstance(unsigned instance)  { m_server_instance = instance; }
+    // ------------------------------------------------------------------------
+    unsigned getServerInstance() const             { return m_server_instance; }
+    // ------------------------------------------------------------------------
     void setCurrentUserId(uint32_t id) { m_cur_user_id = id ; }
     // ------------------------------------------------------------------------
     void setCurrentUserToken(const std::string& t) { m_cur_user_token = t; }
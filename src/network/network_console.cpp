@@ -18,6 +18,7 @@
 
 #include "network/network_config.hpp"
 #include "network/network_player_profile.hpp"
+#include "network/rewind_manager.hpp"
 #include "network/server_config.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
@@ -42,6 +43,8 @@ void showHelp()
     std::cout << "kickban #, kick and ban # peer of STKHost." << std::endl;
     std::cout << "listpeers, List all peers with host ID and IP." << std::endl;
     std::cout << "listban, List IP ban list of server." << std::endl;
+    std::cout << "rewindstats, Print rewind statistics of the last race."
+        << std::endl;
 }   // showHelp
 
 // ----------------------------------------------------------------------------
@@ -128,6 +131,10 @@ void mainLoop(STKHost* host)
                     ban.second << std::endl;
             }
         }
+        else if (str == "rewindstats")
+        {
+            RewindManager::dumpStatistics(std::cout);
+        }
         else
         {
             std::cout << "Unknown command: " << str << std::endl;
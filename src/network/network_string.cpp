@@ -17,10 +17,13 @@
 
 #include "network/network_string.hpp"
 
+#include "utils/log.hpp"
 #include "utils/string_utils.hpp"
+#include "utils/time.hpp"
 
 #include <algorithm>   // for std::min
 #include <iomanip>
+#include <memory>
 #include <ostream>
 
 // ============================================================================
@@ -44,8 +47,155 @@ void NetworkString::unitTesting()
     std::string log = slog.getLogMessage();
     assert(log=="0x000 | 00 01 02 03 04 05 06 07  08 09 0a 0b 0c 0d 0e 0f   | ................\n"
                 "0x010 | 10 11 12 13 14 15 16 17  18 19 1a 1b               | ............\n");
+
+    // Check that values are written in network byte order and read back
+    BareNetworkString values;
+    values.addUInt16(0x0102).addUInt32(0x03040506)
+          .addUInt64(0x0708090a0b0c0d0eULL).addFloat(-1.5f)
+          .add(Vec3(1.0f, 2.0f, 3.0f))
+          .add(btQuaternion(0.5f, -0.5f, 0.25f, 0.75f))
+          .encodeString(std::string("stk"));
+    for (unsigned int i = 0; i < 14; i++)
+        assert(values.getData()[i] == (char)(i + 1));
+    assert(values.getTotalSize() == 14 + 4 + 12 + 16 + 4);
+    assert(values.getUInt16() == 0x0102);
+    assert(values.getUInt32() == 0x03040506);
+    assert(values.getUInt64() == 0x0708090a0b0c0d0eULL);
+    assert(values.getFloat() == -1.5f);
+    assert(values.getVec3() == Vec3(1.0f, 2.0f, 3.0f));
+    assert(values.getQuat() == btQuaternion(0.5f, -0.5f, 0.25f, 0.75f));
+    std::string str;
+    values.decodeString(&str);
+    assert(str == "stk");
+    assert(values.size() == 0);
+    try
+    {
+        values.getUInt8();
+        assert(false);
+    }
+    catch (std::out_of_range&)
+    {
+    }
+
+    BareNetworkString negative;
+    negative.addUInt16((uint16_t)-2).addUInt8((uint8_t)-3);
+    assert(negative.getInt16() == -2);
+    assert(negative.getInt8() == -3);
+
+    const char bytes[] = "0123456789";
+    BareNetworkString raw;
+    raw.addBytes(bytes, 10);
+    char bytes_read[10];
+    raw.getBytes(bytes_read, 10);
+    assert(memcmp(bytes, bytes_read, 10) == 0);
+
+    // A received string uses the packet data, skipping the header bytes
+    NetworkString type(PROTOCOL_CONTROLLER_EVENTS);
+    type.setSynchronous(true);
+    std::vector<uint8_t> packet_data(8, 0xff);
+    packet_data.push_back(type.getData()[0]);
+    packet_data.insert(packet_data.end(), values.getData(),
+                       values.getData() + values.getTotalSize());
+    ENetPacket* packet = enet_packet_create(packet_data.data(),
+        packet_data.size(), ENET_PACKET_FLAG_RELIABLE);
+    NetworkString received(packet, 8);
+    assert(received.getProtocolType() == PROTOCOL_CONTROLLER_EVENTS);
+    assert(received.isSynchronous());
+    assert(received.getTotalSize() == values.getTotalSize() + 1);
+    assert(received.getData() == (char*)packet->data + 8);
+    assert(received.getUInt16() == 0x0102);
+
+    // Copies do not share the packet, and modifying the string copies the
+    // data before changing it
+    NetworkString copy(received);
+    assert(copy.getData() != received.getData());
+    assert(copy.getCurrentOffset() == received.getCurrentOffset());
+    assert(copy.getUInt32() == 0x03040506);
+    received.setSynchronous(false);
+    assert(!received.isSynchronous() && copy.isSynchronous());
+    received.addUInt8(42);
+    assert(received.getTotalSize() == values.getTotalSize() + 2);
+    assert(received.getUInt32() == 0x03040506);
+    assert(received.getBuffer().back() == 42);
+    NetworkString moved(std::move(copy));
+    assert(moved.getUInt64() == 0x0708090a0b0c0d0eULL);
 }   // unitTesting
 
+// ----------------------------------------------------------------------------
+/** Benchmark for receiving a message: it compares copying the received
+ *  packet into a new string (as done before received strings used the
+ *  packet data) with using the packet data, and measures the throughput
+ *  of reading and writing typical state data.
+ */
+void NetworkString::benchmark()
+{
+    const int num_messages = 100000;
+    // A state message with 10 karts, each having a transform and velocities
+    NetworkString state(PROTOCOL_CONTROLLER_EVENTS, 10 * 44);
+    for (unsigned i = 0; i < 10; i++)
+    {
+        state.add(Vec3(i * 1.0f, 2.0f, 3.0f))
+             .add(btQuaternion(0.0f, 0.0f, 0.0f, 1.0f))
+             .add(Vec3(0.5f, 0.0f, 0.0f)).addUInt32(i);
+    }
+    ENetPacket* packet = enet_packet_create(state.getData(),
+        state.getTotalSize(), ENET_PACKET_FLAG_RELIABLE);
+    const double mb = num_messages * (double)state.getTotalSize() / 1048576.0;
+
+    float sum = 0.0f;
+    auto read_state = [&sum](const NetworkString& ns)
+    {
+        for (unsigned i = 0; i < 10; i++)
+        {
+            sum += ns.getVec3().getX();
+            sum += ns.getQuat().getW();
+            sum += ns.getVec3().getX();
+            sum += (float)ns.getUInt32();
+        }
+    };   // read_state
+
+    // Both cases create the packet first, as enet does when receiving
+    double start = StkTime::getRealTime();
+    for (int i = 0; i < num_messages; i++)
+    {
+        ENetPacket* p = enet_packet_create(packet->data, packet->dataLength,
+                                           ENET_PACKET_FLAG_RELIABLE);
+        std::unique_ptr<NetworkString> ns(
+            new NetworkString(p->data, (int)p->dataLength));
+        enet_packet_destroy(p);
+        read_state(*ns);
+    }
+    const double copied = StkTime::getRealTime() - start;
+
+    start = StkTime::getRealTime();
+    for (int i = 0; i < num_messages; i++)
+    {
+        ENetPacket* p = enet_packet_create(packet->data, packet->dataLength,
+                                           ENET_PACKET_FLAG_RELIABLE);
+        std::unique_ptr<NetworkString> ns(new NetworkString(p, 0));
+        read_state(*ns);
+    }
+    const double borrowed = StkTime::getRealTime() - start;
+    enet_packet_destroy(packet);
+
+    start = StkTime::getRealTime();
+    for (int i = 0; i < num_messages; i++)
+    {
+        state.clear();
+        for (unsigned j = 0; j < 10; j++)
+        {
+            state.add(Vec3(j * 1.0f, 2.0f, 3.0f))
+                 .add(btQuaternion(0.0f, 0.0f, 0.0f, 1.0f))
+                 .add(Vec3(0.5f, 0.0f, 0.0f)).addUInt32(j);
+        }
+    }
+    const double written = StkTime::getRealTime() - start;
+
+    // The sum is printed so that reading is not optimised away
+    Log::info("NetworkString", "Receive copied %f MB/s, borrowed %f MB/s, "
+        "write %f MB/s (%f).", mb / copied, mb / borrowed, mb / written, sum);
+}   // benchmark
+
 // ============================================================================
 
 // ----------------------------------------------------------------------------
@@ -108,15 +258,17 @@ int BareNetworkString::decodeStringW(irr::core::stringw *out) const
 std::string BareNetworkString::getLogMessage(const std::string &indent) const
 {
     std::ostringstream oss;
-    for(unsigned int line=0; line<m_buffer.size(); line+=16)
+    const uint8_t* data = getRawData();
+    const unsigned int size = getTotalSize();
+    for(unsigned int line=0; line<size; line+=16)
     {
         oss << "0x" << std::hex << std::setw(3) << std::setfill('0') 
             << line << " | ";
-        unsigned int upper_limit = std::min(line+16, (unsigned int)m_buffer.size());
+        unsigned int upper_limit = std::min(line+16, size);
         for(unsigned int i=line; i<upper_limit; i++)
         {
             oss << std::hex << std::setfill('0') << std::setw(2) 
-                << int(m_buffer[i])<< ' ';
+                << int(data[i])<< ' ';
             if(i%8==7) oss << " ";
         }   // for i
         // fill with spaces if necessary to properly align ascii columns
@@ -130,7 +282,7 @@ std::string BareNetworkString::getLogMessage(const std::string &indent) const
         oss << " | ";
         for(unsigned int i=line; i<upper_limit; i++)
         {
-            uint8_t c = m_buffer[i];
+            uint8_t c = data[i];
             // Don't print tabs, and characters >=128, which are often shown
             // as more than one character.
             if(isprint(c) && c!=0x09 && c<=0x80)
@@ -141,7 +293,7 @@ std::string BareNetworkString::getLogMessage(const std::string &indent) const
         oss << "\n";
         // If it's not the last line, add the indentation in front
         // of the next line
-        if(line+16<m_buffer.size())
+        if(line+16<size)
             oss << indent;
     }   // for line
 
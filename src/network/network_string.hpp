@@ -29,6 +29,7 @@
 #include "utils/vec3.hpp"
 
 #include "LinearMath/btQuaternion.h"
+#include "enet/enet.h"
 
 #include "irrString.h"
 
@@ -56,7 +57,7 @@ private:
     LEAK_CHECK();
 
 protected:
-    /** The actual buffer. */
+    /** The actual buffer. Empty if the data of a packet is borrowed. */
     std::vector<uint8_t> m_buffer;
 
     /** To avoid copying the buffer when bytes are deleted (which only
@@ -67,30 +68,125 @@ protected:
     */
     mutable int m_current_offset;
 
+    /** A received packet whose data is used instead of m_buffer, so that
+     *  received messages do not need to be copied. The string owns the
+     *  packet and destroys it when it is deleted or modified. */
+    ENetPacket* m_packet;
+
+    /** Start and size of the borrowed data in m_packet. */
+    uint8_t* m_packet_data;
+    unsigned m_packet_size;
+
+    // ------------------------------------------------------------------------
+    /** Copies the data of a borrowed packet into m_buffer and releases the
+     *  packet, so the string can be modified. */
+    void ownData()
+    {
+        if (!m_packet)
+            return;
+        m_buffer.assign(m_packet_data, m_packet_data + m_packet_size);
+        enet_packet_destroy(m_packet);
+        m_packet = NULL;
+        m_packet_data = NULL;
+        m_packet_size = 0;
+    }   // ownData
+
+    // ------------------------------------------------------------------------
+    /** Returns the start of the data, either m_buffer or a borrowed
+     *  packet. */
+    uint8_t* getRawData()
+    {
+        return m_packet ? m_packet_data : m_buffer.data();
+    }   // getRawData
+    // ------------------------------------------------------------------------
+    const uint8_t* getRawData() const
+    {
+        return m_packet ? m_packet_data : m_buffer.data();
+    }   // getRawData
+    // ------------------------------------------------------------------------
+    /** Checks that len bytes can be read, and returns a pointer to them
+     *  while advancing the read position.
+     *  \throw std::out_of_range if the string does not contain enough data.
+     */
+    const uint8_t* readPointer(int len) const
+    {
+        if (m_current_offset < 0 || len < 0 ||
+            m_current_offset + len > (int)getTotalSize())
+            throw std::out_of_range("Read out of range.");
+        const uint8_t* p = getRawData() + m_current_offset;
+        m_current_offset += len;
+        return p;
+    }   // readPointer
+    // ------------------------------------------------------------------------
+    /** Appends len uninitialised bytes and returns a pointer to them, so
+     *  several values can be written after only one size check. */
+    uint8_t* appendPointer(unsigned len)
+    {
+        ownData();
+        const size_t size = m_buffer.size();
+        m_buffer.resize(size + len);
+        return m_buffer.data() + size;
+    }   // appendPointer
+    // ------------------------------------------------------------------------
+    /** Reads n bytes (in network byte order) at p into a single data type. */
+    template<typename T, size_t n>
+    static T load(const uint8_t* p)
+    {
+        T result = 0;
+        for (size_t i = 0; i < n; i++)
+            result = (T)((result << 8) | p[i]);
+        return result;
+    }   // load
+    // ------------------------------------------------------------------------
+    /** Writes the lowest n bytes of value (in network byte order) to p. */
+    template<typename T, size_t n>
+    static void store(uint8_t* p, T value)
+    {
+        for (size_t i = 0; i < n; i++)
+            p[i] = (uint8_t)(value >> (8 * (n - 1 - i)));
+    }   // store
+    // ------------------------------------------------------------------------
+    static float loadFloat(const uint8_t* p)
+    {
+        uint32_t u = load<uint32_t, 4>(p);
+        float f;
+        // Doig a "return *(float*)&u;" appears to be more efficient,
+        // but it can create incorrect code on higher optimisation: c++
+        // makes the assumption that pointer of different types never
+        // overlap. So the compiler can assume that the int pointer (&u)
+        // and float pointer do point to different aras, so there read
+        // (*(float*) can be done before the write to u (and then the
+        // write to u is basically a no-op and can be removed, too).
+        // Using a union of int and float is not valid either, there
+        // is no guarantee that writing to the int part of the union
+        // will affect the float part. So, an explicit memcpy is the
+        // more or less only portable guaranteed to be correct way of
+        // converting the int to a float.
+        memcpy(&f, &u, sizeof(float));
+        return f;
+    }   // loadFloat
+    // ------------------------------------------------------------------------
+    static void storeFloat(uint8_t* p, float f)
+    {
+        uint32_t u;
+        memcpy(&u, &f, sizeof(float));
+        store<uint32_t, 4>(p, u);
+    }   // storeFloat
     // ------------------------------------------------------------------------
     /** Returns a part of the network string as a std::string. This is an
     *  internal function only, the user should call decodeString(W) instead.
-    *  \param pos First position to be in the string.
     *  \param len Number of bytes to copy.
     */
     std::string getString(int len) const
     {
-        if (m_current_offset > (int)m_buffer.size() ||
-            m_current_offset + len > (int)m_buffer.size())
-            throw std::out_of_range("getString out of range.");
-
-        std::string a(m_buffer.begin() + (m_current_offset      ),
-                      m_buffer.begin() + (m_current_offset + len));
-        m_current_offset += len;
-        return a;
+        const uint8_t* p = readPointer(len);
+        return std::string((const char*)p, len);
     }   // getString
     // ------------------------------------------------------------------------
     /** Adds a std::string. Internal use only. */
     BareNetworkString& addString(const std::string& value)
     {
-        for (unsigned int i = 0; i < value.size(); i++)
-            m_buffer.push_back((uint8_t)(value[i]));
-        return *this;
+        return addBytes(value.data(), (unsigned)value.size());
     }   // addString
 
     // ------------------------------------------------------------------------
@@ -98,25 +194,23 @@ protected:
     template<typename T, size_t n>
     T get() const
     {
-        int a = n;
-        T result = 0;
-        m_current_offset += n;
-        int offset = m_current_offset -1;
-        while (a--)
-        {
-            result <<= 8; // offset one byte
-                          // add the data to result
-            result += m_buffer.at(offset - a);
-        }
-        return result;
+        return load<T, n>(readPointer(n));
     }   // get(int pos)
     // ------------------------------------------------------------------------
     /** Another function for n == 1 to surpress warnings in clang. */
     template<typename T>
     T get() const
     {
-        return m_buffer.at(m_current_offset++);
+        return *readPointer(1);
     }   // get
+    // ------------------------------------------------------------------------
+    /** Template to add a single data type as n bytes. */
+    template<typename T, size_t n>
+    BareNetworkString& put(T value)
+    {
+        store<T, n>(appendPointer(n), value);
+        return *this;
+    }   // put
 
 public:
 
@@ -125,12 +219,18 @@ public:
     {
         m_buffer.reserve(capacity);
         m_current_offset = 0;
+        m_packet = NULL;
+        m_packet_data = NULL;
+        m_packet_size = 0;
     }   // BareNetworkString
 
     // ------------------------------------------------------------------------
     BareNetworkString(const std::string &s)
     {
         m_current_offset = 0;
+        m_packet = NULL;
+        m_packet_data = NULL;
+        m_packet_size = 0;
         encodeString(s);
     }   // BareNetworkString
     // ------------------------------------------------------------------------
@@ -138,9 +238,65 @@ public:
     BareNetworkString(const char *data, int len)
     {
         m_current_offset = 0;
+        m_packet = NULL;
+        m_packet_data = NULL;
+        m_packet_size = 0;
         m_buffer.resize(len);
         memcpy(m_buffer.data(), data, len);
     }   // BareNetworkString
+    // ------------------------------------------------------------------------
+    /** Initialises the string with the data of a received packet without
+     *  copying it. The string takes over the packet.
+     *  \param packet The received packet.
+     *  \param offset Number of bytes at the start of the packet which are
+     *         not part of the string (e.g. the encryption header).
+     */
+    BareNetworkString(ENetPacket* packet, unsigned offset)
+    {
+        assert(offset <= packet->dataLength);
+        m_current_offset = 0;
+        m_packet = packet;
+        m_packet_data = packet->data + offset;
+        m_packet_size = (unsigned)(packet->dataLength - offset);
+    }   // BareNetworkString
+    // ------------------------------------------------------------------------
+    BareNetworkString(const BareNetworkString& other)
+    {
+        m_current_offset = other.m_current_offset;
+        m_packet = NULL;
+        m_packet_data = NULL;
+        m_packet_size = 0;
+        m_buffer.assign(other.getRawData(),
+                        other.getRawData() + other.getTotalSize());
+    }   // BareNetworkString
+    // ------------------------------------------------------------------------
+    BareNetworkString(BareNetworkString&& other)
+        : m_buffer(std::move(other.m_buffer))
+    {
+        m_current_offset = other.m_current_offset;
+        m_packet = other.m_packet;
+        m_packet_data = other.m_packet_data;
+        m_packet_size = other.m_packet_size;
+        other.m_packet = NULL;
+        other.m_packet_data = NULL;
+        other.m_packet_size = 0;
+    }   // BareNetworkString
+    // ------------------------------------------------------------------------
+    BareNetworkString& operator=(BareNetworkString other)
+    {
+        std::swap(m_buffer, other.m_buffer);
+        std::swap(m_current_offset, other.m_current_offset);
+        std::swap(m_packet, other.m_packet);
+        std::swap(m_packet_data, other.m_packet_data);
+        std::swap(m_packet_size, other.m_packet_size);
+        return *this;
+    }   // operator=
+    // ------------------------------------------------------------------------
+    ~BareNetworkString()
+    {
+        if (m_packet)
+            enet_packet_destroy(m_packet);
+    }   // ~BareNetworkString
 
     // ------------------------------------------------------------------------
     /** Allows to read a buffer from the beginning again. */
@@ -174,23 +330,38 @@ public:
     int decodeStringW(irr::core::stringw *out) const;
     std::string getLogMessage(const std::string &indent="") const;
     // ------------------------------------------------------------------------
-    /** Returns the internal buffer of the network string. */
-    std::vector<uint8_t>& getBuffer() { return m_buffer; }
+    /** Returns the internal buffer of the network string. If the data of
+     *  a received packet is borrowed, it is copied into the buffer first. */
+    std::vector<uint8_t>& getBuffer()
+    {
+        ownData();
+        return m_buffer;
+    }   // getBuffer
+
+    // ------------------------------------------------------------------------
+    /** Returns the internal buffer of the network string. If the data of
+     *  a received packet is borrowed, it is copied into the buffer first
+     *  (which does not change the content of the string). */
+    const std::vector<uint8_t>& getBuffer() const
+    {
+        const_cast<BareNetworkString*>(this)->ownData();
+        return m_buffer;
+    }   // getBuffer
 
     // ------------------------------------------------------------------------
     /** Returns a byte pointer to the content of the network string. */
-    char* getData() { return (char*)(m_buffer.data()); };
+    char* getData() { return (char*)getRawData(); };
 
     // ------------------------------------------------------------------------
     /** Returns a byte pointer to the content of the network string. */
-    const char* getData() const { return (char*)(m_buffer.data()); };
+    const char* getData() const { return (const char*)getRawData(); };
 
     // ------------------------------------------------------------------------
     /** Returns a byte pointer to the unread remaining content of the network
      *  string. */
     char* getCurrentData()
     {
-        return (char*)(m_buffer.data()+m_current_offset);
+        return (char*)(getRawData() + m_current_offset);
     }   // getCurrentData
 
     // ------------------------------------------------------------------------
@@ -198,33 +369,37 @@ public:
      *  string. */
     const char* getCurrentData() const
     {
-        return (char*)(m_buffer.data()+m_current_offset); 
+        return (const char*)(getRawData() + m_current_offset);
     }   // getCurrentData
     // ------------------------------------------------------------------------
     int getCurrentOffset() const                   { return m_current_offset; }
     // ------------------------------------------------------------------------
     /** Returns the remaining length of the network string. */
-    unsigned int size() const { return (int)m_buffer.size()-m_current_offset; }
+    unsigned int size() const { return getTotalSize() - m_current_offset; }
 
     // ------------------------------------------------------------------------
     /** Skips the specified number of bytes when reading. */
-    void skip(int n)
+    void skip(int n) const
     {
         m_current_offset += n;
         assert(m_current_offset >=0 &&
-               m_current_offset <= (int)m_buffer.size());
+               m_current_offset <= (int)getTotalSize());
     }   // skip
     // ------------------------------------------------------------------------
     /** Returns the send size, which is the full length of the buffer. A 
      *  difference to size() happens if the string to be sent was previously
      *  read, and has m_current_offset != 0. Even in this case the whole
      *  string must be sent. */
-    unsigned int getTotalSize() const { return (unsigned int)m_buffer.size(); }
+    unsigned int getTotalSize() const
+    {
+        return m_packet ? m_packet_size : (unsigned int)m_buffer.size();
+    }   // getTotalSize
     // ------------------------------------------------------------------------
     // All functions related to adding data to a network string
     /** Add 8 bit unsigned int. */
     BareNetworkString& addUInt8(const uint8_t value)
     {
+        ownData();
         m_buffer.push_back(value);
         return *this;
     }   // addUInt8
@@ -233,6 +408,7 @@ public:
     /** Adds a single character to the string. */
     BareNetworkString& addChar(const char value)
     {
+        ownData();
         m_buffer.push_back((uint8_t)(value));
         return *this;
     }   // addChar
@@ -240,54 +416,46 @@ public:
     /** Adds 16 bit unsigned int. */
     BareNetworkString& addUInt16(const uint16_t value)
     {
-        m_buffer.push_back((value >> 8) & 0xff);
-        m_buffer.push_back(value & 0xff);
-        return *this;
+        return put<uint16_t, 2>(value);
     }   // addUInt16
 
     // ------------------------------------------------------------------------
     /** Adds unsigned 32 bit integer. */
     BareNetworkString& addUInt32(const uint32_t& value)
     {
-        m_buffer.push_back((value >> 24) & 0xff);
-        m_buffer.push_back((value >> 16) & 0xff);
-        m_buffer.push_back((value >>  8) & 0xff);
-        m_buffer.push_back( value        & 0xff);
-        return *this;
+        return put<uint32_t, 4>(value);
     }   // addUInt32
 
     // ------------------------------------------------------------------------
     /** Adds unsigned 64 bit integer. */
     BareNetworkString& addUInt64(const uint64_t& value)
     {
-        m_buffer.push_back((value >> 56) & 0xff);
-        m_buffer.push_back((value >> 48) & 0xff);
-        m_buffer.push_back((value >> 40) & 0xff);
-        m_buffer.push_back((value >> 32) & 0xff);
-        m_buffer.push_back((value >> 24) & 0xff);
-        m_buffer.push_back((value >> 16) & 0xff);
-        m_buffer.push_back((value >>  8) & 0xff);
-        m_buffer.push_back( value        & 0xff);
-        return *this;
+        return put<uint64_t, 8>(value);
     }   // addUInt64
 
     // ------------------------------------------------------------------------
     /** Adds a 4 byte floating point value. */
     BareNetworkString& addFloat(const float value)
     {
-        uint32_t *p = (uint32_t*)&value;
-        return addUInt32(*p);
+        storeFloat(appendPointer(4), value);
+        return *this;
     }   // addFloat
 
+    // ------------------------------------------------------------------------
+    /** Adds len bytes without any conversion. */
+    BareNetworkString& addBytes(const void* data, unsigned len)
+    {
+        if (len > 0)
+            memcpy(appendPointer(len), data, len);
+        return *this;
+    }   // addBytes
+
     // ------------------------------------------------------------------------
     /** Adds the content of another network string. It only copies data which
      *  has not been 'removed' (i.e. skipped). */
     BareNetworkString& operator+=(BareNetworkString const& value)
     {
-        m_buffer.insert(m_buffer.end(),
-                       value.m_buffer.begin()+value.m_current_offset,
-                       value.m_buffer.end()   );
-        return *this;
+        return addBytes(value.getCurrentData(), value.size());
     }   // operator+=
 
     // ------------------------------------------------------------------------
@@ -300,15 +468,23 @@ public:
     /** Adds the xyz components of a Vec3 to the string. */
     BareNetworkString& add(const Vec3 &xyz)
     {
-        return addFloat(xyz.getX()).addFloat(xyz.getY()).addFloat(xyz.getZ());
+        uint8_t* p = appendPointer(12);
+        storeFloat(p,     xyz.getX());
+        storeFloat(p + 4, xyz.getY());
+        storeFloat(p + 8, xyz.getZ());
+        return *this;
     }   // add
 
     // ------------------------------------------------------------------------
     /** Adds the four components of a quaternion. */
     BareNetworkString& add(const btQuaternion &quat)
     {
-        return addFloat(quat.getX()).addFloat(quat.getY())
-              .addFloat(quat.getZ()).addFloat(quat.getW());
+        uint8_t* p = appendPointer(16);
+        storeFloat(p,      quat.getX());
+        storeFloat(p + 4,  quat.getY());
+        storeFloat(p + 8,  quat.getZ());
+        storeFloat(p + 12, quat.getW());
+        return *this;
     }   // add
     // ------------------------------------------------------------------------
     /** Adds a function to add a time ticks value. Use this function instead
@@ -340,59 +516,46 @@ public:
     /** Returns an unsigned 8-bit integer. */
     inline uint8_t getUInt8() const
     {
-        return m_buffer[m_current_offset++];
+        return *readPointer(1);
     }   // getUInt8
     // ------------------------------------------------------------------------
     /** Returns an unsigned 8-bit integer. */
     inline int8_t getInt8() const
     {
-        return m_buffer[m_current_offset++];
+        return (int8_t)*readPointer(1);
     }   // getInt8
     // ------------------------------------------------------------------------
     /** Gets a 4 byte floating point value. */
     float getFloat() const
     {
-        uint32_t u = getUInt32();
-        float f;
-        // Doig a "return *(float*)&u;" appears to be more efficient,
-        // but it can create incorrect code on higher optimisation: c++
-        // makes the assumption that pointer of different types never
-        // overlap. So the compiler can assume that the int pointer (&u)
-        // and float pointer do point to different aras, so there read
-        // (*(float*) can be done before the write to u (and then the
-        // write to u is basically a no-op and can be removed, too).
-        // Using a union of int and float is not valid either, there
-        // is no guarantee that writing to the int part of the union
-        // will affect the float part. So, an explicit memcpy is the
-        // more or less only portable guaranteed to be correct way of
-        // converting the int to a float.
-        memcpy(&f, &u, sizeof(float));
-        return f;
+        return loadFloat(readPointer(4));
     }   // getFloat
 
     // ------------------------------------------------------------------------
     /** Gets a Vec3. */
     Vec3 getVec3() const
     {
-        Vec3 r;
-        r.setX(getFloat());
-        r.setY(getFloat());
-        r.setZ(getFloat());
-        return r;
+        const uint8_t* p = readPointer(12);
+        return Vec3(loadFloat(p), loadFloat(p + 4), loadFloat(p + 8));
     }   // getVec3
 
     // ------------------------------------------------------------------------
     /** Gets a bullet quaternion. */
     btQuaternion getQuat() const
     {
-        btQuaternion q;
-        q.setX(getFloat());
-        q.setY(getFloat());
-        q.setZ(getFloat());
-        q.setW(getFloat());
-        return q;
+        const uint8_t* p = readPointer(16);
+        return btQuaternion(loadFloat(p),     loadFloat(p + 4),
+                            loadFloat(p + 8), loadFloat(p + 12));
     }   // getQuat
     // ------------------------------------------------------------------------
+    /** Copies len bytes without any conversion. */
+    void getBytes(void* out, unsigned len) const
+    {
+        const uint8_t* p = readPointer(len);
+        if (len > 0)
+            memcpy(out, p, len);
+    }   // getBytes
+    // ------------------------------------------------------------------------
 
 };   // class BareNetworkString
 
@@ -417,6 +580,7 @@ class NetworkString : public BareNetworkString
 {
 public:
     static void unitTesting();
+    static void benchmark();
         
     /** Constructor for a message to be sent. It sets the 
      *  protocol type of this message. It adds 1 byte to the capacity:
@@ -437,10 +601,20 @@ public:
         m_current_offset = 1;   // ignore type
     }   // NetworkString
 
+    // ------------------------------------------------------------------------
+    /** Constructor for a received message, which uses the data of the
+     *  packet without copying it (see BareNetworkString). */
+    NetworkString(ENetPacket* packet, unsigned offset)
+        : BareNetworkString(packet, offset)
+    {
+        m_current_offset = 1;   // ignore type
+    }   // NetworkString
+
     // ------------------------------------------------------------------------
     /** Empties the string, but does not reset the pre-allocated size. */
     void clear()
     {
+        ownData();
         m_buffer.erase(m_buffer.begin() + 1, m_buffer.end());
         m_current_offset = 1;
     }   // clear
@@ -448,7 +622,9 @@ public:
     /** Returns the protocol type of this message. */
     ProtocolType getProtocolType() const
     {
-        return (ProtocolType)(m_buffer.at(0) & ~PROTOCOL_SYNCHRONOUS);
+        if (getTotalSize() == 0)
+            throw std::out_of_range("Missing protocol type.");
+        return (ProtocolType)(getRawData()[0] & ~PROTOCOL_SYNCHRONOUS);
     }   // getProtocolType
 
     // ------------------------------------------------------------------------
@@ -456,15 +632,16 @@ public:
     void setSynchronous(bool b)
     {
         if(b)
-            m_buffer[0] |= PROTOCOL_SYNCHRONOUS;
+            getRawData()[0] |= PROTOCOL_SYNCHRONOUS;
         else
-            m_buffer[0] &= ~PROTOCOL_SYNCHRONOUS;
+            getRawData()[0] &= ~PROTOCOL_SYNCHRONOUS;
     }   // setSynchronous
     // ------------------------------------------------------------------------
     /** Returns if this message is synchronous or not. */
     bool isSynchronous() const
     {
-        return (m_buffer[0] & PROTOCOL_SYNCHRONOUS) == PROTOCOL_SYNCHRONOUS;
+        return getTotalSize() > 0 &&
+            (getRawData()[0] & PROTOCOL_SYNCHRONOUS) == PROTOCOL_SYNCHRONOUS;
     }   // isSynchronous
 
 };   // class NetworkString
@@ -0,0 +1,192 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "network/packet_capture.hpp"
+
+#include "network/event.hpp"
+#include "network/stk_peer.hpp"
+#include "utils/log.hpp"
+#include "utils/time.hpp"
+
+#include <string.h>
+
+namespace
+{
+    const char CAPTURE_MAGIC[4] = { 'S', 'T', 'K', 'C' };
+}
+
+// ----------------------------------------------------------------------------
+/** Opens a capture file.
+ *  \param file_name Name of the capture file.
+ *  \param write True to create a new capture, false to read an existing one.
+ */
+PacketCapture::PacketCapture(const std::string& file_name, bool write)
+{
+    m_start_time = StkTime::getRealTimeMs();
+    if (write)
+    {
+        m_output.open(file_name, std::ios::out | std::ios::binary |
+                                 std::ios::trunc);
+        if (!m_output.is_open())
+        {
+            Log::error("PacketCapture", "Can't create capture file '%s'.",
+                       file_name.c_str());
+            return;
+        }
+        m_output.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        m_output.put((char)CAPTURE_VERSION);
+        return;
+    }
+
+    m_input.open(file_name, std::ios::in | std::ios::binary);
+    if (!m_input.is_open())
+    {
+        Log::error("PacketCapture", "Can't open capture file '%s'.",
+                   file_name.c_str());
+        return;
+    }
+    char header[sizeof(CAPTURE_MAGIC) + 1];
+    if (!m_input.read(header, sizeof(header)) ||
+        memcmp(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+        (uint8_t)header[sizeof(CAPTURE_MAGIC)] != CAPTURE_VERSION)
+    {
+        Log::error("PacketCapture", "'%s' is not a supported capture file.",
+                   file_name.c_str());
+        m_input.close();
+    }
+}   // PacketCapture
+
+// ----------------------------------------------------------------------------
+/** Writes one record to the capture file. The parameters which are not used
+ *  by the type of the record are ignored.
+ */
+void PacketCapture::write(CaptureType type, uint32_t host_id, uint32_t ip,
+                          uint16_t port, uint32_t disconnect_info,
+                          uint8_t channel, const uint8_t* data, unsigned size)
+{
+    if (!m_output.is_open())
+        return;
+
+    m_record.getBuffer().clear();
+    m_record.addUInt8(type)
+        .addUInt32((uint32_t)(StkTime::getRealTimeMs() - m_start_time))
+        .addUInt32(host_id);
+    switch (type)
+    {
+    case CT_CONNECT:
+        m_record.addUInt32(ip).addUInt16(port);
+        break;
+    case CT_DISCONNECT:
+        m_record.addUInt32(disconnect_info);
+        break;
+    case CT_MESSAGE:
+        m_record.addUInt8(channel).addUInt32(size).addBytes(data, size);
+        break;
+    }
+    m_output.write(m_record.getData(), m_record.getTotalSize());
+    if (type != CT_MESSAGE)
+        m_output.flush();
+}   // write
+
+// ----------------------------------------------------------------------------
+/** Writes a received event, this must be called before the event is handled
+ *  by the protocols, since they read (and may modify) the data.
+ *  \param event The event.
+ *  \param channel The channel on which a message was received.
+ */
+void PacketCapture::writeEvent(const Event& event, uint8_t channel)
+{
+    const STKPeer* peer = event.getPeer();
+    switch (event.getType())
+    {
+    case EVENT_TYPE_CONNECTED:
+        write(CT_CONNECT, peer->getHostId(), peer->getAddress().getIP(),
+              peer->getAddress().getPort());
+        break;
+    case EVENT_TYPE_DISCONNECTED:
+        write(CT_DISCONNECT, peer->getHostId(), 0, 0,
+              (uint32_t)event.getPeerDisconnectInfo());
+        break;
+    case EVENT_TYPE_MESSAGE:
+        write(CT_MESSAGE, peer->getHostId(), 0, 0, 0, channel,
+              (const uint8_t*)event.data().getData(),
+              event.data().getTotalSize());
+        break;
+    }
+}   // writeEvent
+
+// ----------------------------------------------------------------------------
+/** Reads size bytes from the capture file into buffer, returns false at the
+ *  end of the file. */
+bool PacketCapture::readBytes(unsigned size, BareNetworkString* buffer)
+{
+    buffer->getBuffer().resize(size);
+    buffer->reset();
+    if (size == 0)
+        return true;
+    return (bool)m_input.read((char*)buffer->getBuffer().data(), size);
+}   // readBytes
+
+// ----------------------------------------------------------------------------
+/** Reads the next record of the capture file.
+ *  \param event The record is stored here.
+ *  \return False at the end of the file (or if the file is truncated).
+ */
+bool PacketCapture::read(CapturedEvent* event)
+{
+    if (!m_input.is_open() || !readBytes(9, &m_record))
+        return false;
+
+    event->m_type = (CaptureType)m_record.getUInt8();
+    event->m_time = m_record.getUInt32();
+    event->m_host_id = m_record.getUInt32();
+    event->m_ip = 0;
+    event->m_port = 0;
+    event->m_disconnect_info = 0;
+    event->m_channel = 0;
+    event->m_data.clear();
+    switch (event->m_type)
+    {
+    case CT_CONNECT:
+        if (!readBytes(6, &m_record))
+            return false;
+        event->m_ip = m_record.getUInt32();
+        event->m_port = m_record.getUInt16();
+        return true;
+    case CT_DISCONNECT:
+        if (!readBytes(4, &m_record))
+            return false;
+        event->m_disconnect_info = m_record.getUInt32();
+        return true;
+    case CT_MESSAGE:
+    {
+        if (!readBytes(5, &m_record))
+            return false;
+        event->m_channel = m_record.getUInt8();
+        const unsigned size = m_record.getUInt32();
+        event->m_data.resize(size);
+        if (size == 0)
+            return true;
+        return (bool)m_input.read((char*)event->m_data.data(), size);
+    }
+    }
+    Log::error("PacketCapture", "Invalid record type %d in capture file.",
+               event->m_type);
+    return false;
+}   // read
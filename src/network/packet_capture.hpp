@@ -0,0 +1,105 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_PACKET_CAPTURE_HPP
+#define HEADER_PACKET_CAPTURE_HPP
+
+#include "network/network_string.hpp"
+#include "utils/no_copy.hpp"
+#include "utils/types.hpp"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+class Event;
+
+/** \ingroup network
+ *  Writes the network events received by a host to a capture file, or reads
+ *  them back to replay them (see STKHost::replayLoop). Each record contains
+ *  the type of the event, the time in ms since the capture was started and
+ *  the host id of the peer, followed by the address of a connecting peer,
+ *  the disconnect info of a disconnecting peer or the channel and the
+ *  (decrypted) data of a message.
+ */
+class PacketCapture : public NoCopy
+{
+public:
+    enum CaptureType : uint8_t
+    {
+        CT_CONNECT    = 0,
+        CT_DISCONNECT = 1,
+        CT_MESSAGE    = 2
+    };
+
+    /** One event read from a capture file. */
+    struct CapturedEvent
+    {
+        CaptureType m_type;
+        /** Time in ms since the start of the capture. */
+        uint32_t m_time;
+        uint32_t m_host_id;
+        /** Address of a connecting peer. */
+        uint32_t m_ip;
+        uint16_t m_port;
+        /** PeerDisconnectInfo of a disconnecting peer. */
+        uint32_t m_disconnect_info;
+        uint8_t m_channel;
+        /** Data of a message, including the protocol type. */
+        std::vector<uint8_t> m_data;
+    };
+
+private:
+    /** Version of the file format, increased on incompatible changes. */
+    static const uint8_t CAPTURE_VERSION = 1;
+
+    std::ofstream m_output;
+
+    std::ifstream m_input;
+
+    /** Time the capture was started, the records store the time relative
+     *  to it. */
+    uint64_t m_start_time;
+
+    /** Reused for writing the records. */
+    BareNetworkString m_record;
+
+    bool readBytes(unsigned size, BareNetworkString* buffer);
+
+public:
+    PacketCapture(const std::string& file_name, bool write);
+    // ------------------------------------------------------------------------
+    void write(CaptureType type, uint32_t host_id, uint32_t ip = 0,
+               uint16_t port = 0, uint32_t disconnect_info = 0,
+               uint8_t channel = 0, const uint8_t* data = NULL,
+               unsigned size = 0);
+    // ------------------------------------------------------------------------
+    void writeEvent(const Event& event, uint8_t channel);
+    // ------------------------------------------------------------------------
+    bool read(CapturedEvent* event);
+    // ------------------------------------------------------------------------
+    /** Returns if the file could be opened (and for reading, if it is a
+     *  capture file of a supported version). */
+    bool isOpen() const
+    {
+        return m_output.is_open() || m_input.is_open();
+    }   // isOpen
+};   // PacketCapture
+
+#endif
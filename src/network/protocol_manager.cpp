@@ -20,6 +20,7 @@
 
 #include "network/event.hpp"
 #include "network/protocol.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_peer.hpp"
 #include "utils/log.hpp"
 #include "utils/profiler.hpp"
@@ -64,7 +65,12 @@ std::shared_ptr<ProtocolManager> ProtocolManager::createInstance()
 ProtocolManager::ProtocolManager()
 {
     m_exit.store(false);
+    m_next_event_sequence.store(0);
+    m_num_async_events.store(0);
     m_all_protocols.resize(PROTOCOL_MAX);
+    m_async_events.resize(CONNECTION_EVENTS + 1);
+    for (unsigned i = 0; i <= CONNECTION_EVENTS; i++)
+        m_async_inbox.emplace_back(new MPSCRingBuffer<QueuedEvent>(1024));
 }   // ProtocolManager
 
 // ----------------------------------------------------------------------------
@@ -83,12 +89,18 @@ ProtocolManager::~ProtocolManager()
     m_sync_events_to_process.getData().clear();
     m_sync_events_to_process.unlock();
 
-    m_async_events_to_process.lock();
-    for (EventList::iterator i = m_async_events_to_process.getData().begin();
-                             i!= m_async_events_to_process.getData().end(); ++i)
-        delete *i;
-    m_async_events_to_process.getData().clear();
-    m_async_events_to_process.unlock();
+    for (unsigned i = 0; i < m_async_inbox.size(); i++)
+    {
+        QueuedEvent event;
+        while (m_async_inbox[i]->pop(&event))
+            delete event.second;
+        for (QueuedEvent& event : m_async_events[i])
+            delete event.second;
+        m_async_events[i].clear();
+    }
+    for (QueuedEvent& event : m_retry_connection_events)
+        delete event.second;
+    m_retry_connection_events.clear();
 
     m_requests.lock();
     m_requests.getData().clear();
@@ -115,23 +127,35 @@ void ProtocolManager::abort()
 // ----------------------------------------------------------------------------
 /** \brief Function that processes incoming events.
  *  This function is called by the network manager each time there is an
- *  incoming packet.
+ *  incoming packet. Asynchronous events must only be added by one thread,
+ *  otherwise connection events can not be kept in order with messages.
  */
 void ProtocolManager::propagateEvent(Event* event)
 {
+    if (event->getType() == EVENT_TYPE_MESSAGE &&
+        (event->data().getTotalSize() == 0 ||
+         event->data().getProtocolType() >= PROTOCOL_MAX))
+    {
+        Log::warn("ProtocolManager", "Message with invalid protocol type "
+            "from %s.", event->getPeer()->getAddress().toString().c_str());
+        delete event;
+        return;
+    }
+
     if (event->isSynchronous())
     {
         m_sync_events_to_process.lock();
         m_sync_events_to_process.getData().push_back(event);
         m_sync_events_to_process.unlock();
+        return;
     }
-    else
-    {
-        m_async_events_to_process.lock();
-        m_async_events_to_process.getData().push_back(event);
-        m_async_events_to_process.unlock();
-    }
-    return;
+
+    const unsigned index = getEventIndex(event);
+    const QueuedEvent queued(m_next_event_sequence.fetch_add(1), event);
+    m_num_async_events.fetch_add(1);
+    // If the inbox is full the event is kept in its overflow list, so the
+    // network thread never waits for the ProtocolManager thread
+    m_async_inbox[index]->push(queued);
 }   // propagateEvent
 
 // ----------------------------------------------------------------------------
@@ -374,20 +398,41 @@ bool ProtocolManager::OneProtocolType::notifyEvent(Event *event)
 /** Sends the event to the corresponding protocol. Returns true if the event
  *  can be ignored, or false otherwise.
  */
-bool ProtocolManager::sendEvent(Event* event)
+bool ProtocolManager::sendEvent(Event* event, bool lock_protocols)
 {
+    // Asynchronous events are handled while the protocols of the type are
+    // locked, so they are not handled at the same time as the synchronous
+    // update of these protocols
+    auto notify = [event, lock_protocols](OneProtocolType& opt)
+    {
+        if (!lock_protocols)
+            return opt.notifyEvent(event);
+        opt.lock();
+        bool done = false;
+        try
+        {
+            done = opt.notifyEvent(event);
+        }
+        catch (...)
+        {
+            opt.unlock();
+            throw;
+        }
+        opt.unlock();
+        return done;
+    };
+
     bool can_be_deleted = false;
     if (event->getType() == EVENT_TYPE_MESSAGE)
     {
-        OneProtocolType &opt =
-            m_all_protocols.at(event->data().getProtocolType());
-        can_be_deleted = opt.notifyEvent(event);
+        can_be_deleted =
+            notify(m_all_protocols.at(event->data().getProtocolType()));
     }
     else   // connect or disconnect event --> test all protocols
     {
         for (unsigned int i = 0; i < m_all_protocols.size(); i++)
         {
-            can_be_deleted |= m_all_protocols.at(i).notifyEvent(event);
+            can_be_deleted |= notify(m_all_protocols[i]);
         }
     }
     return can_be_deleted || StkTime::getTimeSinceEpoch() - event->getArrivalTime()
@@ -437,7 +482,7 @@ void ProtocolManager::update(int ticks)
         bool can_be_deleted = true;
         try
         {
-            can_be_deleted = sendEvent(*i);
+            can_be_deleted = sendEvent(*i, /*lock_protocols*/false);
         }
         catch (std::exception& e)
         {
@@ -449,6 +494,8 @@ void ProtocolManager::update(int ticks)
         m_sync_events_to_process.lock();
         if (can_be_deleted)
         {
+            ServerMetrics::addEventLatency(getEventIndex(*i),
+                StkTime::getMonoTimeUs() - (*i)->getReceiveTime());
             delete *i;
             i = m_sync_events_to_process.getData().erase(i);
         }
@@ -470,6 +517,150 @@ void ProtocolManager::update(int ticks)
     }
 }   // update
 
+// ----------------------------------------------------------------------------
+/** Returns the number of events and requests waiting to be processed, used
+ *  for the server metrics.
+ *  \param sync_events Events waiting for the main thread.
+ *  \param async_events Events waiting for the protocol manager thread.
+ *  \param requests Protocol requests waiting to be handled.
+ */
+void ProtocolManager::getQueueSizes(unsigned* sync_events,
+                                    unsigned* async_events,
+                                    unsigned* requests)
+{
+    m_sync_events_to_process.lock();
+    *sync_events = (unsigned)m_sync_events_to_process.getData().size();
+    m_sync_events_to_process.unlock();
+    *async_events = m_num_async_events.load();
+    m_requests.lock();
+    *requests = (unsigned)m_requests.getData().size();
+    m_requests.unlock();
+}   // getQueueSizes
+
+// ----------------------------------------------------------------------------
+/** Returns the index of the asynchronous inbox of an event, which is the
+ *  protocol type of a message or CONNECTION_EVENTS. */
+unsigned ProtocolManager::getEventIndex(const Event* event)
+{
+    if (event->getType() == EVENT_TYPE_MESSAGE)
+        return event->data().getProtocolType();
+    return CONNECTION_EVENTS;
+}   // getEventIndex
+
+// ----------------------------------------------------------------------------
+/** Delivers an asynchronous event to its protocols, and deletes it if it was
+ *  handled (or is too old).
+ *  \return True if the event was deleted, false if it must be kept.
+ */
+bool ProtocolManager::deliverAsyncEvent(Event* event)
+{
+    bool result = true;
+    try
+    {
+        result = sendEvent(event, /*lock_protocols*/true);
+    }
+    catch (std::exception& e)
+    {
+        const std::string& name = event->getPeer()->getAddress().toString();
+        Log::error("ProtocolManager", "Asynchronous event "
+            "error from %s: %s", name.c_str(), e.what());
+        Log::error("ProtocolManager", event->data().getLogMessage().c_str());
+    }
+    if (!result)
+    {
+        // This should only happen if the protocol has not been started
+        // or already terminated (e.g. late ping answer)
+        return false;
+    }
+    ServerMetrics::addEventLatency(getEventIndex(event),
+        StkTime::getMonoTimeUs() - event->getReceiveTime());
+    delete event;
+    m_num_async_events.fetch_sub(1);
+    return true;
+}   // deliverAsyncEvent
+
+// ----------------------------------------------------------------------------
+/** Moves all events from the lock-free inboxes to the lists of events to
+ *  deliver. */
+void ProtocolManager::pollAsyncInboxes()
+{
+    QueuedEvent event;
+    for (unsigned i = 0; i < m_async_inbox.size(); i++)
+    {
+        while (m_async_inbox[i]->pop(&event))
+            m_async_events[i].push_back(event);
+    }
+}   // pollAsyncInboxes
+
+// ----------------------------------------------------------------------------
+/** Delivers the events of one protocol type which were received before the
+ *  next connection event. While the events of other protocols are
+ *  delivered, new game and controller events are delivered in between.
+ *  \param index The protocol type.
+ */
+void ProtocolManager::deliverAsyncEvents(unsigned index)
+{
+    const bool game_events = index == PROTOCOL_CONTROLLER_EVENTS ||
+                             index == PROTOCOL_GAME_EVENTS;
+    std::deque<QueuedEvent>& events = m_async_events[index];
+    const std::deque<QueuedEvent>& connection_events =
+        m_async_events[CONNECTION_EVENTS];
+    std::vector<QueuedEvent> kept;
+    while (!events.empty() && (connection_events.empty() ||
+           events.front().first < connection_events.front().first))
+    {
+        const QueuedEvent event = events.front();
+        events.pop_front();
+        if (!deliverAsyncEvent(event.second))
+            kept.push_back(event);
+        if (!game_events)
+        {
+            pollAsyncInboxes();
+            deliverAsyncEvents(PROTOCOL_CONTROLLER_EVENTS);
+            deliverAsyncEvents(PROTOCOL_GAME_EVENTS);
+        }
+    }
+    events.insert(events.begin(), kept.begin(), kept.end());
+}   // deliverAsyncEvents
+
+// ----------------------------------------------------------------------------
+/** Delivers all asynchronous events, called by the ProtocolManager thread.
+ *  Game and controller events are delivered first. A connection event is
+ *  delivered after all messages received before it, and before all later
+ *  messages.
+ */
+void ProtocolManager::deliverAllAsyncEvents()
+{
+    pollAsyncInboxes();
+    for (auto it = m_retry_connection_events.begin();
+         it != m_retry_connection_events.end();)
+    {
+        if (deliverAsyncEvent(it->second))
+            it = m_retry_connection_events.erase(it);
+        else
+            it++;
+    }
+
+    std::deque<QueuedEvent>& connection_events =
+        m_async_events[CONNECTION_EVENTS];
+    while (true)
+    {
+        deliverAsyncEvents(PROTOCOL_CONTROLLER_EVENTS);
+        deliverAsyncEvents(PROTOCOL_GAME_EVENTS);
+        for (unsigned i = 0; i < PROTOCOL_MAX; i++)
+        {
+            if (i != PROTOCOL_CONTROLLER_EVENTS && i != PROTOCOL_GAME_EVENTS)
+                deliverAsyncEvents(i);
+        }
+        if (connection_events.empty())
+            break;
+        const QueuedEvent event = connection_events.front();
+        connection_events.pop_front();
+        if (!deliverAsyncEvent(event.second))
+            m_retry_connection_events.push_back(event);
+    }
+}   // deliverAllAsyncEvents
+
 // ----------------------------------------------------------------------------
 /** \brief Updates the manager.
  *  This function processes the events queue, notifies the concerned
@@ -484,42 +675,7 @@ void ProtocolManager::asynchronousUpdate()
     PROFILER_PUSH_CPU_MARKER("Message delivery", 255, 0, 0);
     // First deliver asynchronous messages for all protocols
     // =====================================================
-    m_async_events_to_process.lock();
-    EventList::iterator i = m_async_events_to_process.getData().begin();
-    while (i != m_async_events_to_process.getData().end())
-    {
-        m_async_events_to_process.unlock();
-
-        m_all_protocols[(*i)->getType()].lock();
-        bool result = true;
-        try
-        {
-            result = sendEvent(*i);
-        }
-        catch (std::exception& e)
-        {
-            const std::string& name = (*i)->getPeer()->getAddress().toString();
-            Log::error("ProtocolManager", "Asynchronous event "
-                "error from %s: %s", name.c_str(), e.what());
-            Log::error("ProtocolManager",
-                (*i)->data().getLogMessage().c_str());
-        }
-        m_all_protocols[(*i)->getType()].unlock();
-
-        m_async_events_to_process.lock();
-        if (result)
-        {
-            delete *i;
-            i = m_async_events_to_process.getData().erase(i);
-        }
-        else
-        {
-            // This should only happen if the protocol has not been started
-            // or already terminated (e.g. late ping answer)
-            ++i;
-        }
-    }   // while i != m_events_to_process.end()
-    m_async_events_to_process.unlock();
+    deliverAllAsyncEvents();
 
     PROFILER_POP_CPU_MARKER();
     PROFILER_PUSH_CPU_MARKER("Message delivery", 255, 0, 0);
@@ -25,14 +25,17 @@
 
 #include "network/network_string.hpp"
 #include "network/protocol.hpp"
+#include "utils/mpsc_ring_buffer.hpp"
 #include "utils/no_copy.hpp"
 #include "utils/singleton.hpp"
 #include "utils/synchronised.hpp"
 #include "utils/types.hpp"
 
 #include <atomic>
+#include <deque>
 #include <list>
 #include <memory>
+#include <utility>
 #include <vector>
 #include <thread>
 
@@ -109,8 +112,11 @@ public:
  *  frequently, so synchronous updates should be avoided as much as possible.
  *  The sender selects if a message is synchronous or asynchronous. The
  *  network layer (separate thread) calls propagateEvent in the
- *  ProtocolManager, which will add the event to the synchronous or
- *  asynchornous queue.
+ *  ProtocolManager, which will add the event to the synchronous queue or
+ *  to the lock-free asynchronous inbox of its protocol type. The
+ *  asynchronous events of the game and controller protocols are delivered
+ *  before (and in between) the events of the other protocols, so e.g. many
+ *  players joining at once do not delay the actions of racing players.
  *  Protocol start/pause/... requests are also stored in a separate queue,
  *  which is thread-safe, and requests will be handled by the ProtocolManager
  *  thread, to ensure that they are processed independently from the
@@ -205,9 +211,36 @@ private:
      *  (i.e. from the main thread). */
     Synchronised<EventList> m_sync_events_to_process;
 
+    /** An asynchronous event with its sequence number, which is increased
+     *  for each event. */
+    typedef std::pair<uint64_t, Event*> QueuedEvent;
+
+    /** Index of the inbox for connect and disconnect events, which are
+     *  delivered to all protocol types. */
+    static const unsigned CONNECTION_EVENTS = PROTOCOL_MAX;
+
     /** Contains the network events to pass asynchronously to protocols
-    *  (i.e. from the separate ProtocolManager thread). */
-    Synchronised<EventList> m_async_events_to_process;
+     *  (i.e. from the separate ProtocolManager thread), one lock-free
+     *  inbox for each protocol type and one for connection events. They
+     *  are written by the network thread. */
+    std::vector<std::unique_ptr<MPSCRingBuffer<QueuedEvent> > > m_async_inbox;
+
+    /** The asynchronous events taken from the inboxes which are not
+     *  delivered yet, only used by the ProtocolManager thread. */
+    std::vector<std::deque<QueuedEvent> > m_async_events;
+
+    /** Connection events which were already delivered once, but which are
+     *  still waiting for a protocol to handle them. Unlike the events in
+     *  m_async_events they do not delay later messages any more. */
+    std::deque<QueuedEvent> m_retry_connection_events;
+
+    /** Sequence number of the next asynchronous event. A connection event
+     *  is only delivered after all earlier messages, and before all later
+     *  messages. */
+    std::atomic<uint64_t> m_next_event_sequence;
+
+    /** Number of asynchronous events not delivered yet. */
+    std::atomic<unsigned> m_num_async_events;
 
     /** Contains the requests to start/pause etc... protocols. */
     Synchronised< std::vector<ProtocolRequest> > m_requests;
@@ -221,7 +254,12 @@ private:
     /*! Single instance of protocol manager.*/
     static std::weak_ptr<ProtocolManager> m_protocol_manager;
 
-    bool         sendEvent(Event* event);
+    bool         sendEvent(Event* event, bool lock_protocols);
+    bool         deliverAsyncEvent(Event* event);
+    void         pollAsyncInboxes();
+    void         deliverAsyncEvents(unsigned index);
+    void         deliverAllAsyncEvents();
+    static unsigned getEventIndex(const Event* event);
 
     virtual void startProtocol(std::shared_ptr<Protocol> protocol);
     virtual void terminateProtocol(std::shared_ptr<Protocol> protocol);
@@ -243,6 +281,8 @@ public:
     void      requestTerminate(std::shared_ptr<Protocol> protocol);
     void      findAndTerminate(ProtocolType type);
     void      update(int ticks);
+    void      getQueueSizes(unsigned* sync_events, unsigned* async_events,
+                            unsigned* requests);
     // ------------------------------------------------------------------------
     bool isExiting() const                            { return m_exit.load(); }
     // ------------------------------------------------------------------------
@@ -17,6 +17,7 @@
 
 #include "network/protocols/game_protocol.hpp"
 
+#include "config/stk_config.hpp"
 #include "items/item_manager.hpp"
 #include "items/network_item_manager.hpp"
 #include "karts/abstract_kart.hpp"
@@ -30,12 +31,18 @@
 #include "network/protocol_manager.hpp"
 #include "network/rewind_info.hpp"
 #include "network/rewind_manager.hpp"
+#include "network/server_config.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_host.hpp"
 #include "network/stk_peer.hpp"
+#include "race/race_manager.hpp"
 #include "utils/log.hpp"
 #include "utils/time.hpp"
 #include "main_loop.hpp"
 
+#include <algorithm>
+#include <limits>
+
 // ============================================================================
 std::weak_ptr<GameProtocol> GameProtocol::m_game_protocol;
 // ============================================================================
@@ -57,37 +64,59 @@ GameProtocol::GameProtocol()
             : Protocol( PROTOCOL_CONTROLLER_EVENTS)
 {
     m_data_to_send = getNetworkString();
-
+    m_first_sent_sequence = 1;
+    m_rewinder_table_size = 0;
 }   // GameProtocol
 
 //-----------------------------------------------------------------------------
 GameProtocol::~GameProtocol()
 {
     delete m_data_to_send;
+    for (auto& p : m_waiting_states)
+        delete p.second;
 }   // ~GameProtocol
 
 //-----------------------------------------------------------------------------
 /** Synchronous update - will send all commands collected during the last
- *  frame (and could optional only send messages every N frames).
+ *  frame, together with all actions sent during the last
+ *  ACTION_REDUNDANCY_MS. The message is sent unreliable, so a lost message
+ *  does not delay later actions until ENet resends it.
  */
 void GameProtocol::sendActions()
 {
-    if (m_all_actions.size() == 0) return;   // nothing to do
+    if (m_all_actions.empty() && m_sent_actions.empty())
+        return;   // nothing to do
+
+    m_sent_actions.insert(m_sent_actions.end(), m_all_actions.begin(),
+                          m_all_actions.end());
+    m_all_actions.clear();
+    const int oldest_ticks = World::getWorld() ?
+        World::getWorld()->getTicksSinceStart() -
+        stk_config->time2Ticks(ACTION_REDUNDANCY_MS * 0.001f) : 0;
+    while (!m_sent_actions.empty() &&
+           (m_sent_actions.front().m_ticks < oldest_ticks ||
+            m_sent_actions.size() > 255))
+    {
+        if (m_sent_actions.front().m_ticks >= oldest_ticks)
+        {
+            Log::warn("GameProtocol", "Too many actions unsent %d.",
+                      (int)m_sent_actions.size());
+        }
+        m_sent_actions.pop_front();
+        m_first_sent_sequence++;
+    }
+    if (m_sent_actions.empty())
+        return;
 
     // Clear left-over data from previous frame. This way the network
     // string will increase till it reaches maximum size necessary
     m_data_to_send->clear();
-    if (m_all_actions.size() > 255)
-    {
-        Log::warn("GameProtocol",
-            "Too many actions unsent %d.", (int)m_all_actions.size());
-        m_all_actions.resize(255);
-    }
     m_data_to_send->addUInt8(GP_CONTROLLER_ACTION)
-                   .addUInt8(uint8_t(m_all_actions.size()));
+                   .addUInt8(uint8_t(m_sent_actions.size()))
+                   .addUInt32(m_first_sent_sequence);
 
     // Add all actions
-    for (auto& a : m_all_actions)
+    for (auto& a : m_sent_actions)
     {
         if (Network::m_connection_debug)
         {
@@ -101,11 +130,9 @@ void GameProtocol::sendActions()
         const auto& c = compressAction(a);
         m_data_to_send->addUInt8(std::get<0>(c)).addUInt16(std::get<1>(c))
             .addUInt16(std::get<2>(c)).addUInt16(std::get<3>(c));
-    }   // for a in m_all_actions
+    }   // for a in m_sent_actions
 
-    // FIXME: for now send reliable
-    sendToServer(m_data_to_send, /*reliable*/ true);
-    m_all_actions.clear();
+    sendToServer(m_data_to_send, /*reliable*/ false);
 }   // sendActions
 
 //-----------------------------------------------------------------------------
@@ -124,6 +151,8 @@ bool GameProtocol::notifyEventAsynchronous(Event* event)
     case GP_ADJUST_TIME:       handleAdjustTime(event);       break;
     //case GP_ITEM_UPDATE:       handleItemUpdate(event);       break;
     case GP_ITEM_CONFIRMATION: handleItemEventConfirmation(event); break;
+    case GP_STATE_CONFIRMATION: handleStateConfirmation(event);   break;
+    case GP_REWINDER_TABLE:    handleRewinderTable(event);    break;
     default: Log::error("GameProtocol",
                         "Received unknown message type %d - ignored.",
                         message_type);                        break;
@@ -168,20 +197,60 @@ void GameProtocol::controllerAction(int kart_id, PlayerAction action,
 // ----------------------------------------------------------------------------
 /** Called when a controller event is received - either on the server from
  *  a client, or on a client from the server. It sorts the event into the
- *  RewindManager's network event queue. The server will also send this 
- *  event immediately to all clients (except to the original sender).
+ *  RewindManager's network event queue. Since a client sends each action
+ *  several times, the server ignores the actions it has already received
+ *  (using their sequence numbers), and sends only the new actions
+ *  immediately to all clients (except to the original sender).
  */
 void GameProtocol::handleControllerAction(Event *event)
 {
     NetworkString &data = event->data();
     uint8_t count = data.getUInt8();
+    const uint32_t first_sequence = data.getUInt32();
     bool will_trigger_rewind = false;
     //int rewind_delta = 0;
     int cur_ticks = 0;
     const int not_rewound = RewindManager::get()->getNotRewoundWorldTicks();
+
+    const bool is_server = NetworkConfig::get()->isServer();
+    uint32_t last_sequence = 0;
+    NetworkString* new_actions = NULL;
+    unsigned count_offset = 0;
+    if (is_server)
+    {
+        auto it = m_received_sequence.find(event->getPeerSP());
+        if (it != m_received_sequence.end())
+        {
+            last_sequence = it->second;
+        }
+        else
+        {
+            for (it = m_received_sequence.begin();
+                 it != m_received_sequence.end();)
+            {
+                if (it->first.expired())
+                    it = m_received_sequence.erase(it);
+                else
+                    it++;
+            }
+        }
+        new_actions = getNetworkString();
+        new_actions->addUInt8(GP_CONTROLLER_ACTION);
+        count_offset = (unsigned)new_actions->getBuffer().size();
+        new_actions->addUInt8(0)
+            .addUInt32(std::max(first_sequence, last_sequence + 1));
+    }
+    unsigned new_count = 0;
     for (unsigned int i = 0; i < count; i++)
     {
         cur_ticks = data.getUInt32();
+        if (is_server && first_sequence + i <= last_sequence)
+        {
+            // Already received in a previous message
+            data.skip(8);
+            event->getPeer()->addInputDuplicate();
+            continue;
+        }
         // Since this is running in a thread, it might be called during
         // a rewind, i.e. with an incorrect world time. So the event
         // time needs to be compared with the World time independent
@@ -197,6 +266,7 @@ void GameProtocol::handleControllerAction(Event *event)
         {
             Log::warn("GameProtocol", "Wrong kart id %d from %s.",
                 kart_id, event->getPeer()->getAddress().toString().c_str());
+            delete new_actions;
             return;
         }
 
@@ -216,6 +286,13 @@ void GameProtocol::handleControllerAction(Event *event)
         s->addUInt8(kart_id).addUInt8(w).addUInt16(x).addUInt16(y)
             .addUInt16(z);
         RewindManager::get()->addNetworkEvent(this, s, cur_ticks);
+        if (is_server)
+        {
+            new_actions->addUInt32(cur_ticks).addUInt8(kart_id).addUInt8(w)
+                .addUInt16(x).addUInt16(y).addUInt16(z);
+            event->getPeer()->addInputArrival(not_rewound - cur_ticks);
+            new_count++;
+        }
     }
 
     if (data.size() > 0)
@@ -223,12 +300,22 @@ void GameProtocol::handleControllerAction(Event *event)
         Log::warn("GameProtocol",
                   "Received invalid controller data - remains %d",data.size());
     }
-    if (NetworkConfig::get()->isServer())
+    if (is_server)
     {
-        // Send update to all clients except the original sender if the event
-        // is after the server time
-        if (!will_trigger_rewind)
-            STKHost::get()->sendPacketExcept(event->getPeer(), &data, false);
+        if (new_count > 0)
+        {
+            m_received_sequence[event->getPeerSP()] =
+                first_sequence + count - 1;
+        }
+        // Send the new actions to all clients except the original sender if
+        // the events are after the server time
+        new_actions->getBuffer()[count_offset] = (uint8_t)new_count;
+        if (new_count > 0 && !will_trigger_rewind)
+        {
+            STKHost::get()->sendPacketExcept(event->getPeer(), new_actions,
+                                             false);
+        }
+        delete new_actions;
 
         // FIXME unless there is a network jitter more than 100ms (more than
         // server delay), time adjust is not necessary
@@ -331,65 +418,371 @@ void GameProtocol::handleItemEventConfirmation(Event *event)
 }   // handleItemEventConfirmation
 
 // ----------------------------------------------------------------------------
-/** Called by the server before assembling a new message containing the full
- *  state of the race to be sent to a client.
+/** Sends a confirmation to the server that the state at the given time has
+ *  been received, so that the server can use it as baseline for the delta
+ *  compression of the next states sent to this client.
+ *  \param ticks Time in ticks of the received state.
  */
-void GameProtocol::startNewState()
+void GameProtocol::sendStateConfirmation(int ticks)
 {
-    assert(NetworkConfig::get()->isServer());
-    m_data_to_send->clear();
-    m_data_to_send->addUInt8(GP_STATE)
-        .addUInt32(World::getWorld()->getTicksSinceStart());
-}   // startNewState
+    assert(NetworkConfig::get()->isClient());
+    NetworkString *ns = getNetworkString(5);
+    ns->addUInt8(GP_STATE_CONFIRMATION).addUInt32(ticks);
+    // This message can be sent unreliable, if it gets lost the server will
+    // only use an older baseline (or a full state) for the next states.
+    sendToServer(ns, /*reliable*/false);
+    delete ns;
+}   // sendStateConfirmation
 
 // ----------------------------------------------------------------------------
-/** Called by a server to add data to the current state. The data in buffer
- *  is copied, so the data can be freed after this call/.
- *  \param buffer Adds the data in the buffer to the current state.
+/** Handles a state confirmation from a client, which becomes the baseline
+ *  for the next states sent to that client.
+ *  \param event The data from the client.
  */
-void GameProtocol::addState(BareNetworkString *buffer)
+void GameProtocol::handleStateConfirmation(Event *event)
 {
     assert(NetworkConfig::get()->isServer());
-    m_data_to_send->addUInt16(buffer->size());
-    (*m_data_to_send) += *buffer;
-}   // addState
+    int ticks = event->data().getTime();
+    std::weak_ptr<STKPeer> peer = event->getPeerSP();
+    std::lock_guard<std::mutex> lock(m_confirmed_state_mutex);
+    auto it = m_confirmed_state_ticks.find(peer);
+    if (it == m_confirmed_state_ticks.end())
+        m_confirmed_state_ticks[peer] = ticks;
+    else if (ticks > it->second)
+        it->second = ticks;
+}   // handleStateConfirmation
 
 // ----------------------------------------------------------------------------
-/** Called by a server to finalize the current state, which add updated
- *  names of rewinder using to the beginning of state buffer
- *  \param cur_rewinder List of current rewinder using.
+/** Returns the saved state at the given time, or NULL if it does not exist
+ *  (anymore).
+ *  \param ticks Time in ticks of the state.
  */
-void GameProtocol::finalizeState(std::vector<std::string>& cur_rewinder)
+const StateSnapshot* GameProtocol::findSavedState(int ticks) const
 {
-    assert(NetworkConfig::get()->isServer());
-    auto& buffer = m_data_to_send->getBuffer();
-    auto pos = buffer.begin() + 1/*protocol type*/ + 1 /*gp event type*/+
-        4/*time*/;
-
-    m_data_to_send->reset();
-    std::vector<uint8_t> names;
-    names.push_back((uint8_t)cur_rewinder.size());
-    for (std::string& name : cur_rewinder)
+    if (ticks < 0)
+        return NULL;
+    for (auto it = m_saved_states.rbegin(); it != m_saved_states.rend(); it++)
     {
-        names.push_back((uint8_t)name.size());
-        std::vector<uint8_t> rewinder(name.begin(), name.end());
-        names.insert(names.end(), rewinder.begin(), rewinder.end());
+        if (it->getTicks() == ticks)
+            return &(*it);
     }
-    buffer.insert(pos, names.begin(), names.end());
-}   // finalizeState
+    return NULL;
+}   // findSavedState
+
+// ----------------------------------------------------------------------------
+/** Called by the server before assembling a new state of the race to be
+ *  sent to the clients.
+ *  \return The snapshot the rewinders write their states to.
+ */
+StateSnapshot* GameProtocol::startNewState()
+{
+    assert(NetworkConfig::get()->isServer());
+    m_current_state.reset(World::getWorld()->getTicksSinceStart());
+    return &m_current_state;
+}   // startNewState
 
 // ----------------------------------------------------------------------------
 /** Called when the last state information has been added and the message
- *  can be sent to the clients.
+ *  can be sent to the clients. Each client receives the state delta
+ *  compressed against the latest state it has confirmed, or the full state
+ *  if no such state is available anymore. The item state only contains the
+ *  item events the client has not confirmed yet.
  */
 void GameProtocol::sendState()
 {
     assert(NetworkConfig::get()->isServer());
-    sendMessageToPeers(m_data_to_send, /*reliable*/false);
+    // Keep the latest 3 seconds of states, which is long enough for any
+    // client with a ping below the maximum allowed one to confirm a state
+    m_saved_states.emplace_back();
+    std::swap(m_saved_states.back(), m_current_state);
+    const unsigned max_saved_states = stk_config->m_network_state_frequeny * 3;
+    while (m_saved_states.size() > max_saved_states)
+    {
+        // Reuse the memory of the oldest state for the next state
+        std::swap(m_saved_states.front(), m_current_state);
+        m_saved_states.pop_front();
+    }
+    const StateSnapshot& state = m_saved_states.back();
+
+    std::vector<std::shared_ptr<STKPeer> > peers;
+    for (auto& peer : STKHost::get()->getPeers())
+    {
+        if (peer->isValidated() && !peer->isWaitingForGame())
+            peers.push_back(peer);
+    }
+    sendRewinderTable(peers);
+    // The client needs this many rewinder table entries to use the state
+    const uint16_t table_size =
+        (uint16_t)RewindManager::get()->getRewinderNames().size();
+    if (ServerConfig::m_state_relevance_distance > 0.0f)
+    {
+        sendRelevantStates(peers, state, table_size);
+        return;
+    }
+
+    // Group peers by their baseline and item event window, so each
+    // different message (especially the full state) is only encoded once
+    NetworkItemManager* nim =
+        static_cast<NetworkItemManager*>(ItemManager::get());
+    std::map<std::pair<int, int>, std::vector<std::shared_ptr<STKPeer> > >
+        peers_by_baseline;
+    std::unique_lock<std::mutex> ul(m_confirmed_state_mutex);
+    for (auto it = m_confirmed_state_ticks.begin();
+         it != m_confirmed_state_ticks.end();)
+    {
+        if (it->first.expired())
+            it = m_confirmed_state_ticks.erase(it);
+        else
+            it++;
+    }
+    for (auto& peer : peers)
+    {
+        int baseline = -1;
+        auto it = m_confirmed_state_ticks.find(peer);
+        if (it != m_confirmed_state_ticks.end() && findSavedState(it->second))
+            baseline = it->second;
+        peers_by_baseline[std::make_pair(baseline,
+            nim->getEventWindowStart(peer))].push_back(peer);
+    }
+    ul.unlock();
+
+    for (auto& p : peers_by_baseline)
+    {
+        const int baseline = p.first.first;
+        m_item_window.getBuffer().clear();
+        m_item_window.reset();
+        nim->saveEventWindow(&m_item_window, p.first.second);
+        m_data_to_send->clear();
+        m_data_to_send->addUInt8(GP_STATE).addUInt32(state.getTicks())
+            .addUInt32(baseline).addUInt16(table_size);
+        state.encode(m_data_to_send, findSavedState(baseline),
+                     nim->getRewinderId(), &m_item_window);
+        ServerMetrics::addStateMessage(m_data_to_send->getTotalSize());
+        std::vector<STKPeer*> send_to;
+        for (auto& peer : p.second)
+            send_to.push_back(peer.get());
+        STKHost::get()->sendPacketToPeers(send_to, m_data_to_send,
+                                          /*reliable*/false);
+    }
 }   // sendState
 
 // ----------------------------------------------------------------------------
-/** Called when a new full state is received form the server.
+/** Sends a different state to each client, in which the karts far away from
+ *  all karts of the client are only included in every second or fourth
+ *  state. The karts of the client and all other rewinders are included in
+ *  each state. The states are saved for each client and delta compressed
+ *  against the latest state the client has confirmed. The client uses its
+ *  own prediction for the karts omitted from a state.
+ *  \param peers All peers which receive states.
+ *  \param state The complete state of the race.
+ *  \param table_size Number of rewinder table entries used by the state.
+ */
+void GameProtocol::sendRelevantStates(
+                          const std::vector<std::shared_ptr<STKPeer> >& peers,
+                          const StateSnapshot& state, uint16_t table_size)
+{
+    World* world = World::getWorld();
+    NetworkItemManager* nim =
+        static_cast<NetworkItemManager*>(ItemManager::get());
+    const float distance = ServerConfig::m_state_relevance_distance;
+    const unsigned max_saved_states = stk_config->m_network_state_frequeny * 3;
+
+    // The world kart id of each rewinder id of a kart
+    std::map<uint16_t, unsigned> kart_rewinders;
+    for (unsigned i = 0; i < world->getNumKarts(); i++)
+    {
+        Rewinder* r = dynamic_cast<Rewinder*>(world->getKart(i));
+        if (r)
+            kart_rewinders[r->getRewinderId()] = i;
+    }
+
+    std::unique_lock<std::mutex> ul(m_confirmed_state_mutex);
+    for (auto it = m_confirmed_state_ticks.begin();
+         it != m_confirmed_state_ticks.end();)
+    {
+        if (it->first.expired())
+            it = m_confirmed_state_ticks.erase(it);
+        else
+            it++;
+    }
+    std::vector<int> confirmed_ticks(peers.size(), -1);
+    for (unsigned i = 0; i < peers.size(); i++)
+    {
+        auto it = m_confirmed_state_ticks.find(peers[i]);
+        if (it != m_confirmed_state_ticks.end())
+            confirmed_ticks[i] = it->second;
+    }
+    ul.unlock();
+
+    for (auto it = m_peer_states.begin(); it != m_peer_states.end();)
+    {
+        if (it->first.expired())
+            it = m_peer_states.erase(it);
+        else
+            it++;
+    }
+
+    std::vector<unsigned> interval(world->getNumKarts());
+    for (unsigned i = 0; i < peers.size(); i++)
+    {
+        // Find the number of states after which each kart is sent again,
+        // using the distance to the nearest kart of this client. Spectators
+        // receive all karts.
+        std::vector<Vec3> own_karts;
+        for (unsigned k = 0; k < world->getNumKarts(); k++)
+        {
+            if (race_manager->getKartInfo(k).getHostId() ==
+                (int)peers[i]->getHostId())
+                own_karts.push_back(world->getKart(k)->getXYZ());
+        }
+        for (unsigned k = 0; k < world->getNumKarts(); k++)
+        {
+            float min_distance = own_karts.empty() ? 0.0f :
+                std::numeric_limits<float>::max();
+            for (const Vec3& xyz : own_karts)
+            {
+                min_distance = std::min(min_distance,
+                    (world->getKart(k)->getXYZ() - xyz).length());
+            }
+            interval[k] = min_distance > 3.0f * distance ? 4 :
+                          min_distance > distance ? 2 : 1;
+        }
+
+        // Reuse the memory of the oldest state for the next state
+        PeerStates& ps = m_peer_states[peers[i]];
+        StateSnapshot next;
+        if (ps.m_sent_states.size() >= max_saved_states)
+        {
+            std::swap(next, ps.m_sent_states.front());
+            ps.m_sent_states.pop_front();
+        }
+        next.reset(state.getTicks());
+        for (unsigned j = 0; j < state.getNumStates(); j++)
+        {
+            const uint16_t id = state.getRewinderId(j);
+            if (id == nim->getRewinderId())
+            {
+                nim->saveEventWindow(next.getBuffer(),
+                                     nim->getEventWindowStart(peers[i]));
+                next.addState(id);
+                continue;
+            }
+            // Karts sent at a reduced rate are spread over the states
+            auto kart = kart_rewinders.find(id);
+            if (kart != kart_rewinders.end() &&
+                (ps.m_num_states + kart->second) % interval[kart->second] != 0)
+                continue;
+            next.copyState(state, j);
+        }
+        ps.m_num_states++;
+
+        const StateSnapshot* baseline = NULL;
+        for (const StateSnapshot& s : ps.m_sent_states)
+        {
+            if (s.getTicks() == confirmed_ticks[i])
+                baseline = &s;
+        }
+        m_data_to_send->clear();
+        m_data_to_send->addUInt8(GP_STATE).addUInt32(state.getTicks())
+            .addUInt32(baseline ? baseline->getTicks() : -1)
+            .addUInt16(table_size);
+        next.encode(m_data_to_send, baseline);
+        ServerMetrics::addStateMessage(m_data_to_send->getTotalSize());
+        ps.m_sent_states.push_back(std::move(next));
+        std::vector<STKPeer*> send_to(1, peers[i].get());
+        STKHost::get()->sendPacketToPeers(send_to, m_data_to_send,
+                                          /*reliable*/false);
+    }
+}   // sendRelevantStates
+
+// ----------------------------------------------------------------------------
+/** Sends the unique identities of all rewinder ids each client has not
+ *  received yet. This only happens when new rewinders were added (e.g. a
+ *  projectile was fired), state messages then only contain rewinder ids.
+ *  The message is sent reliable, since a rewinder id is never sent again.
+ *  \param peers All peers which receive states.
+ */
+void GameProtocol::sendRewinderTable(
+                         const std::vector<std::shared_ptr<STKPeer> >& peers)
+{
+    const std::vector<std::string>& names =
+        RewindManager::get()->getRewinderNames();
+    for (auto it = m_rewinder_table_sent.begin();
+         it != m_rewinder_table_sent.end();)
+    {
+        if (it->first.expired())
+            it = m_rewinder_table_sent.erase(it);
+        else
+            it++;
+    }
+
+    // Group peers by the number of entries they have received, usually all
+    // of them have received the same
+    std::map<unsigned, std::vector<std::shared_ptr<STKPeer> > > peers_by_sent;
+    for (auto& peer : peers)
+    {
+        unsigned& sent = m_rewinder_table_sent[peer];
+        if (sent < names.size())
+        {
+            peers_by_sent[sent].push_back(peer);
+            sent = (unsigned)names.size();
+        }
+    }
+
+    for (auto& p : peers_by_sent)
+    {
+        NetworkString* ns = getNetworkString();
+        ns->addUInt8(GP_REWINDER_TABLE).addUInt16((uint16_t)p.first)
+            .addUInt16((uint16_t)(names.size() - p.first));
+        for (unsigned i = p.first; i < names.size(); i++)
+            ns->encodeString(names[i]);
+        std::vector<STKPeer*> send_to;
+        for (auto& peer : p.second)
+            send_to.push_back(peer.get());
+        STKHost::get()->sendPacketToPeers(send_to, ns, /*reliable*/true);
+        delete ns;
+    }
+}   // sendRewinderTable
+
+// ----------------------------------------------------------------------------
+/** Called on the client when new rewinder table entries are received from
+ *  the server.
+ *  \param event The message with the first rewinder id and the unique
+ *         identities of the following rewinder ids.
+ */
+void GameProtocol::handleRewinderTable(Event *event)
+{
+    if (!World::getWorld())
+        return;
+
+    assert(NetworkConfig::get()->isClient());
+    if (!checkDataSize(event, 4)) return;
+    NetworkString &data = event->data();
+    uint16_t first_id = data.getUInt16();
+    unsigned count = data.getUInt16();
+    std::vector<std::string> names(count);
+    for (unsigned i = 0; i < count; i++)
+        data.decodeString(&names[i]);
+    RewindManager::get()->addRewinderNames(first_id, names);
+    m_rewinder_table_size = std::max(m_rewinder_table_size,
+                                     (unsigned)first_id + count);
+
+    // The names are merged by the RewindManager before these states are
+    // restored
+    while (!m_waiting_states.empty() &&
+           m_waiting_states.front().first <= m_rewinder_table_size)
+    {
+        RewindManager::get()->addNetworkRewindInfo(
+            m_waiting_states.front().second);
+        m_waiting_states.pop_front();
+    }
+}   // handleRewinderTable
+
+// ----------------------------------------------------------------------------
+/** Called when a new state is received form the server. It is reconstructed
+ *  from its baseline if it is delta compressed, and then confirmed to the
+ *  server. If it uses rewinder ids whose table entries have not arrived yet,
+ *  it is only restored after the entries arrive.
  */
 void GameProtocol::handleState(Event *event)
 {
@@ -400,21 +793,57 @@ void GameProtocol::handleState(Event *event)
     assert(NetworkConfig::get()->isClient());
     NetworkString &data = event->data();
     int ticks          = data.getUInt32();
+    int baseline_ticks = (int)data.getUInt32();
+    unsigned table_size = data.getUInt16();
 
-    // Check for updated rewinder using
-    unsigned rewinder_size = data.getUInt8();
-    std::vector<std::string> rewinder_using;
-    for (unsigned i = 0; i < rewinder_size; i++)
+    const StateSnapshot* baseline = NULL;
+    if (baseline_ticks != -1)
     {
-        std::string name;
-        data.decodeString(&name);
-        rewinder_using.push_back(name);
+        baseline = findSavedState(baseline_ticks);
+        // This can happen if this state arrives after a later state which
+        // used a newer baseline, it is too old to be useful anyway.
+        if (!baseline)
+        {
+            Log::debug("GameProtocol", "Missing baseline %d for state %d.",
+                baseline_ticks, ticks);
+            return;
+        }
     }
+    StateSnapshot state(ticks);
+    state.decode(data, baseline);
+
+    // The server only uses confirmed states newer than the baseline it
+    // used for this state, so older states are not needed anymore.
+    while (!m_saved_states.empty() &&
+           m_saved_states.front().getTicks() < baseline_ticks)
+        m_saved_states.pop_front();
+    std::vector<uint8_t> buffer;
+    state.getFullState(&buffer);
+    std::vector<uint16_t> rewinder_using = state.getRewinderUsing();
+    m_saved_states.push_back(std::move(state));
+    // Keep more states than the server does, so a baseline used by the
+    // server is always available
+    const unsigned max_saved_states = stk_config->m_network_state_frequeny * 6;
+    while (m_saved_states.size() > max_saved_states)
+        m_saved_states.pop_front();
+    sendStateConfirmation(ticks);
 
     // The memory for bns will be handled in the RewindInfoState object
-    RewindInfoState* ris = new RewindInfoState(ticks, data.getCurrentOffset(),
-        rewinder_using, data.getBuffer());
-    RewindManager::get()->addNetworkRewindInfo(ris);
+    RewindInfoState* ris = new RewindInfoState(ticks, 0, rewinder_using,
+        buffer);
+    if (table_size <= m_rewinder_table_size)
+    {
+        RewindManager::get()->addNetworkRewindInfo(ris);
+        return;
+    }
+    Log::debug("GameProtocol", "State %d waits for rewinder table %d.",
+        ticks, table_size);
+    m_waiting_states.emplace_back(table_size, ris);
+    while (m_waiting_states.size() > max_saved_states)
+    {
+        delete m_waiting_states.front().second;
+        m_waiting_states.pop_front();
+    }
 }   // handleState
 
 // ----------------------------------------------------------------------------
@@ -449,6 +878,16 @@ void GameProtocol::rewind(BareNetworkString *buffer)
     }
 }   // rewind
 
+// ----------------------------------------------------------------------------
+/** Returns the kart a controller action event is for.
+ *  \param buffer Pointer to the saved event information.
+ */
+int GameProtocol::getEventKartId(BareNetworkString *buffer) const
+{
+    buffer->reset();
+    return buffer->getUInt8();
+}   // getEventKartId
+
 // ----------------------------------------------------------------------------
 void GameProtocol::addInitialTicks(STKPeer* p, int ticks)
 {
@@ -21,18 +21,23 @@
 
 #include "network/event_rewinder.hpp"
 #include "network/protocol.hpp"
+#include "network/state_snapshot.hpp"
 
 #include "input/input.hpp"                // for PlayerAction
 #include "utils/cpp2011.hpp"
 #include "utils/singleton.hpp"
 
 #include <cstdlib>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <tuple>
 
 class BareNetworkString;
 class NetworkString;
+class RewindInfoState;
 class STKPeer;
 
 class GameProtocol : public Protocol
@@ -45,7 +50,9 @@ private:
            GP_STATE,
            GP_ITEM_UPDATE,
            GP_ITEM_CONFIRMATION,
-           GP_ADJUST_TIME
+           GP_ADJUST_TIME,
+           GP_STATE_CONFIRMATION,
+           GP_REWINDER_TABLE
     };
 
     /** A network string that collects all information from the server to be sent
@@ -70,10 +77,90 @@ private:
     // List of all kart actions to send to the server
     std::vector<Action> m_all_actions;
 
+    /** Actions are sent unreliable, and each message contains all actions
+     *  of this time (in ms), so a lost message does not delay the actions
+     *  until it is resent. */
+    static const int ACTION_REDUNDANCY_MS = 100;
+
+    /** On a client all actions sent during the last ACTION_REDUNDANCY_MS,
+     *  which are sent again in the next message. */
+    std::deque<Action> m_sent_actions;
+
+    /** Sequence number of the first action in m_sent_actions. Each action
+     *  sent by a client has a sequence number, which the server uses to
+     *  ignore actions it has already received. */
+    uint32_t m_first_sent_sequence;
+
+    /** On the server the sequence number of the last action received from
+     *  each client. Only used by the thread handling the events. */
+    std::map<std::weak_ptr<STKPeer>, uint32_t,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_received_sequence;
+
+    /** The state currently being assembled on the server. The rewinders
+     *  write directly into its buffer, and it reuses the memory of the
+     *  oldest saved state. */
+    StateSnapshot m_current_state;
+
+    /** On the server the latest states sent, on the client the latest
+     *  states received. They are used as baseline for delta compression. */
+    std::deque<StateSnapshot> m_saved_states;
+
+    /** Stores on the server the latest state ticks confirmed by each client,
+     *  used to select the baseline of the next state sent to it. */
+    std::map<std::weak_ptr<STKPeer>, int,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_confirmed_state_ticks;
+
+    /** Protects m_confirmed_state_ticks, which is updated by the protocol
+     *  manager thread. */
+    std::mutex m_confirmed_state_mutex;
+
+    /** Stores on the server the number of rewinder table entries sent to
+     *  each client, so that only new rewinder ids are sent. */
+    std::map<std::weak_ptr<STKPeer>, unsigned,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_rewinder_table_sent;
+
+    /** On the client the number of rewinder table entries received. */
+    unsigned m_rewinder_table_size;
+
+    /** On the client the states which use rewinder ids of table entries not
+     *  received yet, with the table size they need. The table is sent
+     *  reliable but the states unreliable, so a state can arrive first. The
+     *  states are added to the RewindManager once the table arrives. */
+    std::deque<std::pair<unsigned, RewindInfoState*> > m_waiting_states;
+
+    /** The item events sent to a group of clients, reused for each state. */
+    BareNetworkString m_item_window;
+
+    /** The states sent to a client if distant karts are sent at a reduced
+     *  rate (see ServerConfig::m_state_relevance_distance), since each
+     *  client then receives different states. */
+    struct PeerStates
+    {
+        /** The latest states sent, used as baseline like m_saved_states. */
+        std::deque<StateSnapshot> m_sent_states;
+
+        /** Number of states sent, used to select the karts which are
+         *  included in a state. */
+        unsigned m_num_states;
+
+        PeerStates() : m_num_states(0) {}
+    };   // struct PeerStates
+
+    std::map<std::weak_ptr<STKPeer>, PeerStates,
+        std::owner_less<std::weak_ptr<STKPeer> > > m_peer_states;
+
     void handleControllerAction(Event *event);
     void handleState(Event *event);
     void handleAdjustTime(Event *event);
     void handleItemEventConfirmation(Event *event);
+    void handleStateConfirmation(Event *event);
+    void handleRewinderTable(Event *event);
+    void sendRewinderTable(
+                        const std::vector<std::shared_ptr<STKPeer> >& peers);
+    const StateSnapshot* findSavedState(int ticks) const;
+    void sendRelevantStates(
+                        const std::vector<std::shared_ptr<STKPeer> >& peers,
+                        const StateSnapshot& state, uint16_t table_size);
     static std::weak_ptr<GameProtocol> m_game_protocol;
     std::map<STKPeer*, int> m_initial_ticks;
     std::map<STKPeer*, double> m_last_adjustments;
@@ -108,15 +195,15 @@ public:
     void sendActions();
     void controllerAction(int kart_id, PlayerAction action,
                           int value, int val_l, int val_r);
-    void startNewState();
-    void addState(BareNetworkString *buffer);
+    StateSnapshot* startNewState();
     void sendState();
-    void finalizeState(std::vector<std::string>& cur_rewinder);
     void adjustTimeForClient(STKPeer *peer, int ticks);
     void sendItemEventConfirmation(int ticks);
+    void sendStateConfirmation(int ticks);
 
     virtual void undo(BareNetworkString *buffer) OVERRIDE;
     virtual void rewind(BareNetworkString *buffer) OVERRIDE;
+    virtual int getEventKartId(BareNetworkString *buffer) const OVERRIDE;
     // ------------------------------------------------------------------------
     virtual void setup() OVERRIDE {};
     // ------------------------------------------------------------------------
@@ -125,7 +125,9 @@ ServerLobby::~ServerLobby()
         unregisterServer(true/*now*/);
     }
     delete m_result_ns;
-    if (m_save_server_config)
+    // Additional servers of --server-instances use a changed port and name
+    if (m_save_server_config &&
+        NetworkConfig::get()->getServerInstance() == 0)
         ServerConfig::writeServerConfigToDisk();
 }   // ~ServerLobby
 
@@ -21,7 +21,6 @@
 #include "network/network_config.hpp"
 #include "network/rewinder.hpp"
 #include "network/rewind_manager.hpp"
-#include "items/projectile_manager.hpp"
 
 /** Constructor for a state: it only takes the size, and allocates a buffer
  *  for all state info.
@@ -47,7 +46,7 @@ void RewindInfo::setTicks(int ticks)
 
 // ============================================================================
 RewindInfoState::RewindInfoState(int ticks, int start_offset,
-                                 std::vector<std::string>& rewinder_using,
+                                 std::vector<uint16_t>& rewinder_using,
                                  std::vector<uint8_t>& buffer)
                : RewindInfo(ticks, true/*is_confirmed*/)
 {
@@ -77,23 +76,15 @@ void RewindInfoState::restore()
 {
     m_buffer->reset();
     m_buffer->skip(m_start_offset);
-    for (const std::string& name : m_rewinder_using)
+    for (uint16_t id : m_rewinder_using)
     {
         const uint16_t data_size = m_buffer->getUInt16();
         const unsigned current_offset_now = m_buffer->getCurrentOffset();
-        std::shared_ptr<Rewinder> r =
-            RewindManager::get()->getRewinder(name);
-
-        if (!r)
-        {
-            // For now we only need to get missing rewinder from
-            // projectile_manager
-            r = projectile_manager->addRewinderFromNetworkState(name);
-        }
+        RewindManager::get()->addStateSize(id, data_size);
+        std::shared_ptr<Rewinder> r = RewindManager::get()->getRewinder(id);
         if (!r)
         {
-            Log::error("RewindInfoState", "Missing rewinder %s",
-                name.c_str());
+            Log::error("RewindInfoState", "Missing rewinder %d", id);
             m_buffer->skip(data_size);
             continue;
         }
@@ -120,6 +111,34 @@ void RewindInfoState::restore()
     }   // for all rewinder
 }   // restore
 
+// ----------------------------------------------------------------------------
+/** Finds the state of a rewinder in this state.
+ *  \param id Rewinder id of the rewinder.
+ *  \param size On return the size of the state.
+ *  \return The state data, or NULL if there is no state for the rewinder.
+ */
+const uint8_t* RewindInfoState::findState(uint16_t id, unsigned* size) const
+{
+    const uint8_t* data = (const uint8_t*)m_buffer->getBuffer().data();
+    unsigned offset = m_start_offset;
+    for (uint16_t rewinder_id : m_rewinder_using)
+    {
+        if (offset + 2 > m_buffer->getBuffer().size())
+            return NULL;
+        unsigned data_size = (data[offset] << 8) | data[offset + 1];
+        offset += 2;
+        if (rewinder_id == id)
+        {
+            if (offset + data_size > m_buffer->getBuffer().size())
+                return NULL;
+            *size = data_size;
+            return data + offset;
+        }
+        offset += data_size;
+    }
+    return NULL;
+}   // findState
+
 // ============================================================================
 RewindInfoEvent::RewindInfoEvent(int ticks, EventRewinder *event_rewinder,
                                  BareNetworkString *buffer, bool is_confirmed)
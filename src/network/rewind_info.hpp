@@ -84,6 +84,10 @@ public:
     /** If this RewindInfo is an event. Subclasses will overwrite this. */
     virtual bool isState() const { return false; }
     // ------------------------------------------------------------------------
+    /** Returns the world kart id of the only kart affected by this event,
+     *  or -1 if it can affect any kart. */
+    virtual int getKartId() const { return -1; }
+    // ------------------------------------------------------------------------
 };   // RewindInfo
 
 // ============================================================================
@@ -92,7 +96,7 @@ public:
 class RewindInfoState: public RewindInfo
 {
 private:
-    std::vector<std::string> m_rewinder_using;
+    std::vector<uint16_t> m_rewinder_using;
 
     int m_start_offset;
 
@@ -102,7 +106,7 @@ private:
 public:
     // ------------------------------------------------------------------------
     RewindInfoState(int ticks, int start_offset,
-                    std::vector<std::string>& rewinder_using,
+                    std::vector<uint16_t>& rewinder_using,
                     std::vector<uint8_t>& buffer);
     // ------------------------------------------------------------------------
     RewindInfoState(int ticks, BareNetworkString *buffer, bool is_confirmed);
@@ -111,6 +115,12 @@ public:
     // ------------------------------------------------------------------------
     virtual void restore();
     // ------------------------------------------------------------------------
+    const uint8_t* findState(uint16_t id, unsigned* size) const;
+    // ------------------------------------------------------------------------
+    /** Returns the rewinder ids of all states. */
+    const std::vector<uint16_t>& getRewinderUsing() const
+                                                   { return m_rewinder_using; }
+    // ------------------------------------------------------------------------
     /** Returns a pointer to the state buffer. */
     BareNetworkString *getBuffer() const { return m_buffer; }
     // ------------------------------------------------------------------------
@@ -174,6 +184,13 @@ public:
     // ------------------------------------------------------------------------
     /** Returns the buffer with the event information in it. */
     BareNetworkString *getBuffer() { return m_buffer; }
+    // ------------------------------------------------------------------------
+    virtual int getKartId() const
+    {
+        if (!m_event_rewinder || !m_buffer)
+            return -1;
+        return m_event_rewinder->getEventKartId(m_buffer);
+    }   // getKartId
 };   // class RewindIndoEvent
 
 
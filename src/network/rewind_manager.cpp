@@ -18,22 +18,40 @@
 
 #include "network/rewind_manager.hpp"
 
+#include "config/stk_config.hpp"
+#include "config/user_config.hpp"
 #include "graphics/irr_driver.hpp"
+#include "items/attachment.hpp"
+#include "items/item_manager.hpp"
+#include "items/powerup.hpp"
+#include "items/projectile_manager.hpp"
+#include "karts/abstract_kart.hpp"
 #include "modes/world.hpp"
+#include "network/dummy_rewinder.hpp"
+#include "network/load_statistics.hpp"
 #include "network/network_config.hpp"
 #include "network/network_string.hpp"
 #include "network/protocols/game_protocol.hpp"
 #include "network/rewinder.hpp"
 #include "network/rewind_info.hpp"
+#include "network/state_snapshot.hpp"
 #include "physics/physics.hpp"
+#include "physics/stk_dynamics_world.hpp"
+#include "physics/user_pointer.hpp"
 #include "race/history.hpp"
 #include "utils/log.hpp"
 #include "utils/profiler.hpp"
+#include "utils/time.hpp"
+
+#include "LinearMath/btAabbUtil2.h"
 
 #include <algorithm>
+#include <fstream>
+#include <string.h>
 
 RewindManager* RewindManager::m_rewind_manager = NULL;
 bool           RewindManager::m_enable_rewind_manager = false;
+Synchronised<RewindManager::Statistics> RewindManager::m_statistics;
 
 /** Creates the singleton. */
 RewindManager *RewindManager::create()
@@ -52,6 +70,93 @@ void RewindManager::destroy()
     m_rewind_manager = NULL;
 }   // destroy
 
+// ----------------------------------------------------------------------------
+/** Benchmark for saving states on the server. The states of 8 karts, the
+ *  item manager and a few physical objects are saved into two reused
+ *  snapshots (like GameProtocol does), and it is counted how often the
+ *  snapshots had to allocate memory after the first states. For comparison
+ *  the states are then saved into a new buffer for each rewinder, which is
+ *  copied into the snapshot.
+ */
+void RewindManager::benchmark()
+{
+    /** Writes a state of a fixed size. */
+    class BenchmarkRewinder : public DummyRewinder
+    {
+    private:
+        unsigned m_size;
+    public:
+        BenchmarkRewinder(unsigned size) : m_size(size) {}
+        virtual bool saveState(BareNetworkString* buffer)
+        {
+            for (unsigned i = 0; i < m_size; i++)
+                buffer->addUInt8((uint8_t)i);
+            return true;
+        }
+    };   // BenchmarkRewinder
+
+    const bool was_enabled = m_enable_rewind_manager;
+    m_enable_rewind_manager = true;
+    const bool was_created = m_rewind_manager != NULL;
+    if (!was_created)
+        create();
+
+    std::vector<std::shared_ptr<Rewinder> > all_rewinder;
+    for (unsigned i = 0; i < 8; i++)
+        all_rewinder.push_back(std::make_shared<BenchmarkRewinder>(110));
+    all_rewinder.push_back(std::make_shared<BenchmarkRewinder>(24));
+    for (unsigned i = 0; i < 4; i++)
+        all_rewinder.push_back(std::make_shared<BenchmarkRewinder>(40));
+    for (auto& r : all_rewinder)
+        r->rewinderAdd();
+
+    const int num_states = 100000;
+    const int warm_up = 10;
+    StateSnapshot states[2];
+    int allocations = 0;
+    double start = StkTime::getRealTime();
+    for (int i = 0; i < num_states; i++)
+    {
+        StateSnapshot& state = states[i % 2];
+        const size_t capacity = state.getCapacity();
+        state.reset(i);
+        get()->saveState(&state);
+        if (i >= warm_up && state.getCapacity() != capacity)
+            allocations++;
+    }
+    double time = StkTime::getRealTime() - start;
+    Log::info("RewindManager", "Saved %d states of %d bytes: %f us per "
+        "state, %f allocations per state.", num_states,
+        states[0].getDataSize(), time * 1e6 / num_states,
+        (float)allocations / (num_states - warm_up));
+
+    start = StkTime::getRealTime();
+    for (int i = 0; i < num_states; i++)
+    {
+        StateSnapshot& state = states[i % 2];
+        state.reset(i);
+        for (auto& r : all_rewinder)
+        {
+            BareNetworkString* buffer = new BareNetworkString();
+            r->saveState(buffer);
+            std::vector<uint8_t>& data = state.getBuffer()->getBuffer();
+            data.insert(data.end(), buffer->getBuffer().begin(),
+                        buffer->getBuffer().end());
+            state.addState(r->getRewinderId());
+            delete buffer;
+        }
+    }
+    time = StkTime::getRealTime() - start;
+    Log::info("RewindManager", "With a new buffer for each rewinder: %f us "
+        "per state.", time * 1e6 / num_states);
+
+    all_rewinder.clear();
+    get()->clearExpiredRewinder();
+    if (!was_created)
+        destroy();
+    m_enable_rewind_manager = was_enabled;
+}   // benchmark
+
 // ============================================================================
 /** The constructor.
  */
@@ -69,6 +174,21 @@ RewindManager::~RewindManager()
     for (RewindInfoEventFunction* rief : m_pending_rief)
         delete rief;
     m_pending_rief.clear();
+
+    const std::string& file_name = UserConfigParams::m_rewind_statistics_file;
+    if (m_enable_rewind_manager && !file_name.empty())
+    {
+        std::ofstream out(file_name.c_str());
+        if (out.good())
+            dumpStatistics(out);
+        else
+        {
+            Log::error("RewindManager", "Cannot write rewind statistics "
+                "to '%s'.", file_name.c_str());
+        }
+    }
+    if (m_enable_rewind_manager)
+        LoadStatistics::writeFile();
 }   // ~RewindManager
 
 // ----------------------------------------------------------------------------
@@ -80,6 +200,17 @@ void RewindManager::reset()
     m_not_rewound_ticks.store(0);
     m_overall_state_size = 0;
     m_last_saved_state = -1;  // forces initial state save
+    m_latest_event_function_ticks = -1;
+    m_predicted_states.clear();
+    m_kart_states_omitted = false;
+    m_omitted_karts.clear();
+    m_skipped_karts.clear();
+    m_rewind_budget_used = 0.0;
+    m_rewind_budget_time = StkTime::getRealTime();
+    m_deferred_rewind_ticks = -1;
+    m_deferred_since_ticks = -1;
+    resetStatistics();
+    LoadStatistics::reset();
     m_state_frequency =
         stk_config->getPhysicsFPS() / stk_config->m_network_state_frequeny;
 
@@ -150,26 +281,30 @@ void RewindManager::saveState()
     auto gp = GameProtocol::lock();
     if (!gp)
         return;
-    gp->startNewState();
+    saveState(gp->startNewState());
+    PROFILER_POP_CPU_MARKER();
+}   // saveState
 
-    m_overall_state_size = 0;
-    std::vector<std::string> rewinder_using;
+// ----------------------------------------------------------------------------
+/** Lets all rewinders write their state directly into the buffer of the
+ *  given snapshot.
+ *  \param state The snapshot to save the states in.
+ */
+void RewindManager::saveState(StateSnapshot* state)
+{
+    BareNetworkString* buffer = state->getBuffer();
     for (auto& p : m_all_rewinder)
     {
-        // TODO: check if it's worth passing in a sufficiently large buffer from
-        // GameProtocol - this would save the copy operation.
-        BareNetworkString* buffer = NULL;
-        if (auto r = p.second.lock())
-            buffer = r->saveState(&rewinder_using);
-        if (buffer != NULL)
+        auto r = p.lock();
+        const size_t start = buffer->getBuffer().size();
+        if (r && r->saveState(buffer))
         {
-            m_overall_state_size += buffer->size();
-            gp->addState(buffer);
+            state->addState(r->getRewinderId());
+            addStateSize(r->getRewinderId(),
+                         unsigned(buffer->getBuffer().size() - start));
         }
-        delete buffer;    // buffer can be freed
     }
-    gp->finalizeState(rewinder_using);
-    PROFILER_POP_CPU_MARKER();
+    m_overall_state_size = state->getDataSize();
 }   // saveState
 
 // ----------------------------------------------------------------------------
@@ -198,9 +333,15 @@ void RewindManager::update(int ticks_not_used)
         auto& ret = m_local_state[ticks];
         for (auto& p : m_all_rewinder)
         {
-            if (auto r = p.second.lock())
+            if (auto r = p.lock())
                 ret.push_back(r->getLocalStateRestoreFunction());
         }
+        if (UserConfigParams::m_partial_rewind || m_kart_states_omitted)
+        {
+            StateSnapshot& state = m_predicted_states[ticks];
+            state.reset(ticks);
+            saveKartStates(&state, NULL);
+        }
     }
     else
     {
@@ -224,6 +365,8 @@ void RewindManager::playEventsTill(int world_ticks, int *ticks)
     // possible rewind, some RewindInfoEventFunction can be created during
     // rewind
     mergeRewindInfoEventFunction();
+    // The rewinder table must be up to date before states are restored
+    mergeRewinderNames();
     bool needs_rewind;
     int rewind_ticks;
 
@@ -233,11 +376,24 @@ void RewindManager::playEventsTill(int world_ticks, int *ticks)
     // be getTime()+dt - world time has not been updated yet).
     m_rewind_queue.mergeNetworkData(world_ticks, &needs_rewind, &rewind_ticks);
 
-    if (needs_rewind)
+    // A deferred rewind is merged with the rewind for a newer state. Older
+    // states are removed from the queue once a newer confirmed state is
+    // received, so always the newest state is used.
+    if (m_deferred_rewind_ticks != -1)
+    {
+        if (!needs_rewind || rewind_ticks < m_deferred_rewind_ticks)
+            rewind_ticks = m_deferred_rewind_ticks;
+        needs_rewind = true;
+    }
+
+    if (needs_rewind && !deferRewind(rewind_ticks, world_ticks))
     {
         Log::setPrefix("Rewind");
         PROFILER_PUSH_CPU_MARKER("Rewind", 128, 128, 128);
+        const double start = StkTime::getRealTime();
         rewindTo(rewind_ticks, world_ticks);
+        addRewindStatistics(world_ticks - rewind_ticks,
+                            StkTime::getRealTime() - start);
         // This should replay everything up to 'now'
         assert(World::getWorld()->getTicksSinceStart() == world_ticks);
         PROFILER_POP_CPU_MARKER();
@@ -267,10 +423,90 @@ bool RewindManager::addRewinder(std::shared_ptr<Rewinder> rewinder)
     // Maximum 1 bit to store no of rewinder used
     if (m_all_rewinder.size() == 255)
         return false;
-    m_all_rewinder[rewinder->getUniqueIdentity()] = rewinder;
+    if (NetworkConfig::get()->isServer())
+    {
+        // Rewinder ids and the size of the rewinder table are sent as 16 bit
+        // integer, and ids are never reused in the same race so that a late
+        // state can not refer to a wrong rewinder
+        if (m_rewinder_names.size() >= 65535)
+            return false;
+        rewinder->setRewinderId((uint16_t)m_rewinder_names.size());
+        m_rewinder_names.push_back(rewinder->getUniqueIdentity());
+        m_rewinder_by_id.push_back(rewinder);
+    }
+    m_all_rewinder.push_back(rewinder);
     return true;
 }   // addRewinder
 
+// ----------------------------------------------------------------------------
+/** Finds the rewinder of a rewinder id which is not cached yet. This is only
+ *  used on the client, where the unique identity received in the rewinder
+ *  table is used to find the local rewinder (or to create a missing
+ *  projectile). The rewinder is then cached for the next states.
+ *  \param id Rewinder id assigned by the server.
+ */
+std::shared_ptr<Rewinder> RewindManager::findRewinder(uint16_t id)
+{
+    if (NetworkConfig::get()->isServer() || id >= m_rewinder_names.size() ||
+        m_rewinder_names[id].empty())
+        return nullptr;
+
+    const std::string& name = m_rewinder_names[id];
+    std::shared_ptr<Rewinder> rewinder;
+    for (auto& p : m_all_rewinder)
+    {
+        auto r = p.lock();
+        if (r && r->getUniqueIdentity() == name)
+        {
+            rewinder = r;
+            break;
+        }
+    }
+    // For now we only need to get missing rewinder from projectile_manager
+    if (!rewinder)
+        rewinder = projectile_manager->addRewinderFromNetworkState(name);
+    if (!rewinder)
+        return nullptr;
+
+    if (id >= m_rewinder_by_id.size())
+        m_rewinder_by_id.resize(id + 1);
+    m_rewinder_by_id[id] = rewinder;
+    return rewinder;
+}   // findRewinder
+
+// ----------------------------------------------------------------------------
+/** Adds rewinder table entries received from the server. This function is
+ *  threadsafe so can be called by the network thread, the entries are
+ *  merged by the main thread before states are restored.
+ *  \param first_id Rewinder id of the first name.
+ *  \param names Unique identities of consecutive rewinder ids.
+ */
+void RewindManager::addRewinderNames(uint16_t first_id,
+                                     const std::vector<std::string>& names)
+{
+    m_pending_rewinder_names.lock();
+    for (unsigned i = 0; i < names.size(); i++)
+    {
+        m_pending_rewinder_names.getData()
+            .emplace_back((uint16_t)(first_id + i), names[i]);
+    }
+    m_pending_rewinder_names.unlock();
+}   // addRewinderNames
+
+// ----------------------------------------------------------------------------
+void RewindManager::mergeRewinderNames()
+{
+    m_pending_rewinder_names.lock();
+    for (auto& p : m_pending_rewinder_names.getData())
+    {
+        if (p.first >= m_rewinder_names.size())
+            m_rewinder_names.resize(p.first + 1);
+        std::swap(m_rewinder_names[p.first], p.second);
+    }
+    m_pending_rewinder_names.getData().clear();
+    m_pending_rewinder_names.unlock();
+}   // mergeRewinderNames
+
 // ----------------------------------------------------------------------------
 /** Rewinds to the specified time, then goes forward till the current
  *  World::getTime() is reached again: it will replay everything before
@@ -291,10 +527,16 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks)
     // the rewind.
     for (auto& p : m_all_rewinder)
     {
-        if (auto r = p.second.lock())
+        if (auto r = p.lock())
             r->saveTransform();
     }
 
+    // For a partial rewind the state of all karts is saved, so that the
+    // karts not affected by the rewind can be set back to it
+    const bool partial_rewind = UserConfigParams::m_partial_rewind;
+    if (partial_rewind)
+        saveKartsBeforeRewind();
+
     // Then undo the rewind infos going backwards in time
     // --------------------------------------------------
     m_is_rewinding = true;
@@ -342,17 +584,38 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks)
     }
 
     // A loop in case that we should split states into several smaller ones:
+    const RewindInfoState* confirmed_state = NULL;
     while (current && current->getTicks() == exact_rewind_ticks && 
            current->isState()                                        )
     {
+        if (!confirmed_state && current->isConfirmed())
+            confirmed_state = static_cast<RewindInfoState*>(current);
         current->restore();
         m_rewind_queue.next();
         current = m_rewind_queue.getCurrent();
     }
+    if (confirmed_state)
+        restoreOmittedKarts(confirmed_state, exact_rewind_ticks);
+
+    if (partial_rewind && confirmed_state)
+    {
+        skipUnaffectedKarts(confirmed_state, exact_rewind_ticks,
+                            now_ticks);
+    }
+    m_rewind_queue.clearLateEventKarts();
 
     // Now go forward through the list of rewind infos till we reach 'now':
     while (world->getTicksSinceStart() < now_ticks)
     { 
+        // Replace the predicted states of the karts that are updated
+        auto predicted = m_predicted_states.find(world->getTicksSinceStart());
+        if (predicted != m_predicted_states.end())
+        {
+            StateSnapshot state(predicted->first);
+            saveKartStates(&state, &predicted->second);
+            std::swap(state, predicted->second);
+        }
+
         m_rewind_queue.replayAllEvents(world->getTicksSinceStart());
 
         // Now simulate the next time step
@@ -365,10 +628,14 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks)
 
     }   // while (world->getTicks() < current_ticks)
 
+    restoreSkippedKarts();
+    m_predicted_states.erase(m_predicted_states.begin(),
+        m_predicted_states.upper_bound(exact_rewind_ticks));
+
     // Now compute the errors which need to be visually smoothed
     for (auto& p : m_all_rewinder)
     {
-        if (auto r = p.second.lock())
+        if (auto r = p.lock())
             r->computeError();
     }
 
@@ -377,6 +644,504 @@ void RewindManager::rewindTo(int rewind_ticks, int now_ticks)
     mergeRewindInfoEventFunction();
 }   // rewindTo
 
+// ----------------------------------------------------------------------------
+/** Saves the states of all karts, using the world kart id as rewinder id.
+ *  \param state The snapshot to save the states in.
+ *  \param previous If not NULL, the states of karts skipped in the current
+ *         partial rewind are copied from this snapshot instead.
+ */
+void RewindManager::saveKartStates(StateSnapshot* state,
+                                   const StateSnapshot* previous)
+{
+    World* world = World::getWorld();
+    for (unsigned i = 0; i < world->getNumKarts(); i++)
+    {
+        if (previous && isKartSkipped(i))
+        {
+            unsigned size = 0;
+            const uint8_t* data = previous->getState(i, &size);
+            if (data)
+            {
+                std::vector<uint8_t>& buffer = state->getBuffer()->getBuffer();
+                buffer.insert(buffer.end(), data, data + size);
+                state->addState(i);
+            }
+            continue;
+        }
+        Rewinder* r = dynamic_cast<Rewinder*>(world->getKart(i));
+        if (r && r->saveState(state->getBuffer()))
+            state->addState(i);
+    }
+}   // saveKartStates
+
+// ----------------------------------------------------------------------------
+/** Saves the state, bounding box and the items of all karts before a
+ *  partial rewind.
+ */
+void RewindManager::saveKartsBeforeRewind()
+{
+    World* world = World::getWorld();
+    m_kart_state.reset(world->getTicksSinceStart());
+    saveKartStates(&m_kart_state, NULL);
+
+    m_kart_info.resize(world->getNumKarts());
+    for (unsigned i = 0; i < world->getNumKarts(); i++)
+    {
+        AbstractKart* kart = world->getKart(i);
+        KartInfo& info = m_kart_info[i];
+        btVector3 min, max;
+        kart->getBody()->getAabb(min, max);
+        info.m_min = min;
+        info.m_max = max;
+        info.m_powerup_type = kart->getPowerup()->getType();
+        info.m_powerup_num = kart->getPowerup()->getNum();
+        info.m_attachment_type = kart->getAttachment()->getType();
+        info.m_has_animation = kart->getKartAnimation() != NULL;
+        Rewinder* r = dynamic_cast<Rewinder*>(kart);
+        info.m_local_state = r ? r->getLocalStateRestoreFunction() : nullptr;
+    }
+}   // saveKartsBeforeRewind
+
+// ----------------------------------------------------------------------------
+/** Finds the karts which do not need to be updated in a rewind, and sets
+ *  them back to the state they had before the rewind. A kart is skipped if
+ *  its confirmed state is the same as the state predicted by this client,
+ *  no event in the past was received for it, and it can not have interacted
+ *  with any other kart, flyable, physical object or item during the rewind.
+ *  The latter is tested by checking the overlap of the bounding boxes of
+ *  the kart at the rewind time and before the rewind (plus a margin). Since
+ *  powerups and attachments can affect any kart, no kart is skipped if one
+ *  of these was changed.
+ *  \param state The confirmed state restored.
+ *  \param rewind_ticks Ticks of the confirmed state.
+ *  \param now_ticks Ticks to which the world is updated in this rewind.
+ */
+void RewindManager::skipUnaffectedKarts(const RewindInfoState* state,
+                                        int rewind_ticks, int now_ticks)
+{
+    const std::set<int>& late_event_karts =
+        m_rewind_queue.getLateEventKarts();
+    if (late_event_karts.count(-1) > 0 ||
+        m_latest_event_function_ticks >= rewind_ticks)
+        return;
+    auto predicted = m_predicted_states.find(rewind_ticks);
+    if (predicted == m_predicted_states.end())
+        return;
+
+    World* world = World::getWorld();
+    const unsigned num_karts = world->getNumKarts();
+    if (m_kart_info.size() != num_karts)
+        return;
+
+    // First find all karts with the same confirmed and predicted state,
+    // which includes the karts omitted from the confirmed state
+    m_skipped_karts.assign(num_karts, false);
+    for (unsigned i = 0; i < m_omitted_karts.size(); i++)
+    {
+        unsigned current_size = 0;
+        if (m_omitted_karts[i] && m_kart_state.getState(i, &current_size))
+            m_skipped_karts[i] = true;
+    }
+    for (uint16_t id : state->getRewinderUsing())
+    {
+        AbstractKart* kart = dynamic_cast<AbstractKart*>(getRewinder(id).get());
+        if (!kart)
+            continue;
+        const unsigned kart_id = kart->getWorldKartId();
+        unsigned confirmed_size = 0, predicted_size = 0, current_size = 0;
+        const uint8_t* confirmed = state->findState(id, &confirmed_size);
+        const uint8_t* predicted_state =
+            predicted->second.getState(kart_id, &predicted_size);
+        if (confirmed && predicted_state &&
+            confirmed_size == predicted_size &&
+            memcmp(confirmed, predicted_state, confirmed_size) == 0 &&
+            m_kart_state.getState(kart_id, &current_size))
+        {
+            m_skipped_karts[kart_id] = true;
+        }
+    }
+
+    // Then the bounding box of each kart during the rewind
+    const float margin = 2.0f;
+    const float dt = stk_config->ticks2Time(now_ticks - rewind_ticks);
+    std::vector<std::pair<Vec3, Vec3> > kart_box(num_karts);
+    for (unsigned i = 0; i < num_karts; i++)
+    {
+        AbstractKart* kart = world->getKart(i);
+        const KartInfo& info = m_kart_info[i];
+        if (info.m_powerup_type != kart->getPowerup()->getType() ||
+            info.m_powerup_num != kart->getPowerup()->getNum() ||
+            info.m_attachment_type != kart->getAttachment()->getType())
+        {
+            m_skipped_karts.clear();
+            return;
+        }
+        if (late_event_karts.count(i) > 0 || info.m_has_animation ||
+            kart->getKartAnimation() || kart->isEliminated())
+            m_skipped_karts[i] = false;
+
+        btVector3 min, max;
+        kart->getBody()->getAabb(min, max);
+        min.setMin(info.m_min);
+        max.setMax(info.m_max);
+        kart_box[i].first = min - Vec3(margin, margin, margin);
+        kart_box[i].second = max + Vec3(margin, margin, margin);
+    }
+
+    // All other moving objects are always updated
+    std::vector<std::pair<Vec3, Vec3> > object_box;
+    const btCollisionObjectArray& all_objects =
+        Physics::getInstance()->getPhysicsWorld()->getCollisionObjectArray();
+    for (int i = 0; i < all_objects.size(); i++)
+    {
+        const btCollisionObject* object = all_objects[i];
+        const UserPointer* up = (UserPointer*)object->getUserPointer();
+        if (object->isStaticOrKinematicObject() ||
+            (up && up->is(UserPointer::UP_KART)))
+            continue;
+        const btRigidBody* body = btRigidBody::upcast(object);
+        float distance = margin;
+        if (body)
+            distance += body->getLinearVelocity().length() * dt;
+        btVector3 min, max;
+        object->getCollisionShape()->getAabb(object->getWorldTransform(),
+                                             min, max);
+        const Vec3 d(distance, distance, distance);
+        object_box.emplace_back(min - d, max + d);
+    }
+
+    ItemManager* item_manager = ItemManager::get();
+    for (unsigned i = 0; i < num_karts; i++)
+    {
+        if (!m_skipped_karts[i])
+            continue;
+        for (auto& box : object_box)
+        {
+            if (TestAabbAgainstAabb2(kart_box[i].first, kart_box[i].second,
+                                     box.first, box.second))
+            {
+                m_skipped_karts[i] = false;
+                break;
+            }
+        }
+        for (unsigned j = 0; m_skipped_karts[i] &&
+             j < item_manager->getNumberOfItems(); j++)
+        {
+            const Item* item = item_manager->getItem(j);
+            if (item && TestPointAgainstAabb2(kart_box[i].first,
+                                              kart_box[i].second,
+                                              item->getXYZ()))
+                m_skipped_karts[i] = false;
+        }
+    }
+
+    // A kart which might interact with an updated kart must be updated too
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (unsigned i = 0; i < num_karts; i++)
+        {
+            if (!m_skipped_karts[i])
+                continue;
+            for (unsigned j = 0; j < num_karts; j++)
+            {
+                if (m_skipped_karts[j] || world->getKart(j)->isEliminated())
+                    continue;
+                if (TestAabbAgainstAabb2(kart_box[i].first,
+                                         kart_box[i].second,
+                                         kart_box[j].first,
+                                         kart_box[j].second))
+                {
+                    m_skipped_karts[i] = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (std::find(m_skipped_karts.begin(), m_skipped_karts.end(), true) ==
+        m_skipped_karts.end())
+    {
+        m_skipped_karts.clear();
+        return;
+    }
+
+    // Skipped karts keep the state they had before the rewind, and are
+    // removed from the physics, so that the updated karts can not hit them
+    for (unsigned i = 0; i < num_karts; i++)
+    {
+        if (!m_skipped_karts[i])
+            continue;
+        restoreKartState(i);
+        Physics::getInstance()->removeKart(world->getKart(i));
+    }
+}   // skipUnaffectedKarts
+
+// ----------------------------------------------------------------------------
+/** Restores the state a kart had before the current rewind.
+ *  \param kart_id World kart id of the kart.
+ */
+void RewindManager::restoreKartState(unsigned kart_id)
+{
+    AbstractKart* kart = World::getWorld()->getKart(kart_id);
+    Rewinder* r = dynamic_cast<Rewinder*>(kart);
+    unsigned size = 0;
+    const uint8_t* data = m_kart_state.getState(kart_id, &size);
+    if (!r || !data)
+        return;
+    m_restore_buffer.getBuffer().assign(data, data + size);
+    m_restore_buffer.reset();
+    r->restoreState(&m_restore_buffer, size);
+}   // restoreKartState
+
+// ----------------------------------------------------------------------------
+/** Restores the karts which the server omitted from a confirmed state,
+ *  because they are far away from the karts of this client, to the state
+ *  this client predicted for them. Their last confirmed state is then
+ *  older, and is corrected by the next state which contains them.
+ *  \param state The confirmed state restored.
+ *  \param rewind_ticks Ticks of the confirmed state.
+ */
+void RewindManager::restoreOmittedKarts(const RewindInfoState* state,
+                                        int rewind_ticks)
+{
+    World* world = World::getWorld();
+    m_omitted_karts.assign(world->getNumKarts(), true);
+    for (uint16_t id : state->getRewinderUsing())
+    {
+        AbstractKart* kart = dynamic_cast<AbstractKart*>(getRewinder(id).get());
+        if (kart)
+            m_omitted_karts[kart->getWorldKartId()] = false;
+    }
+
+    auto predicted = m_predicted_states.find(rewind_ticks);
+    for (unsigned i = 0; i < m_omitted_karts.size(); i++)
+    {
+        if (!m_omitted_karts[i])
+            continue;
+        // Save the predicted states from now on
+        m_kart_states_omitted = true;
+        Rewinder* r = dynamic_cast<Rewinder*>(world->getKart(i));
+        unsigned size = 0;
+        const uint8_t* data = predicted == m_predicted_states.end() ?
+            NULL : predicted->second.getState(i, &size);
+        if (!r || !data)
+        {
+            // This only happens in the first state which omits karts, the
+            // kart then keeps its current state
+            m_omitted_karts[i] = false;
+            continue;
+        }
+        m_restore_buffer.getBuffer().assign(data, data + size);
+        m_restore_buffer.reset();
+        r->restoreState(&m_restore_buffer, size);
+    }
+}   // restoreOmittedKarts
+
+// ----------------------------------------------------------------------------
+/** Sets the karts skipped in a partial rewind back to the state they had
+ *  before the rewind (events replayed during the rewind might have changed
+ *  e.g. their controls), and adds them to the physics again.
+ */
+void RewindManager::restoreSkippedKarts()
+{
+    for (unsigned i = 0; i < m_skipped_karts.size(); i++)
+    {
+        if (!m_skipped_karts[i])
+            continue;
+        restoreKartState(i);
+        if (m_kart_info[i].m_local_state)
+            m_kart_info[i].m_local_state();
+        Physics::getInstance()->addKart(World::getWorld()->getKart(i));
+    }
+    m_skipped_karts.clear();
+}   // restoreSkippedKarts
+
+// ----------------------------------------------------------------------------
+/** Checks if a rewind should be deferred because the rewind budget is
+ *  exceeded. The budget is a leaky bucket: the time spent on rewinds is
+ *  added to it, and it drains with the configured rate (in ms per second).
+ *  A rewind is never deferred for longer than two state intervals, so that
+ *  the difference to the server does not grow too large.
+ *  \param rewind_ticks Ticks of the state to rewind to.
+ *  \param world_ticks Current world ticks.
+ *  \return True if the rewind is deferred.
+ */
+bool RewindManager::deferRewind(int rewind_ticks, int world_ticks)
+{
+    const double budget = UserConfigParams::m_rewind_budget * 0.001;
+    const double now = StkTime::getRealTime();
+    m_rewind_budget_used = std::max(0.0, m_rewind_budget_used -
+        (now - m_rewind_budget_time) * budget);
+    m_rewind_budget_time = now;
+
+    if (budget <= 0.0 || m_rewind_budget_used <= budget ||
+        (m_deferred_since_ticks != -1 &&
+         world_ticks - m_deferred_since_ticks >= 2 * m_state_frequency))
+    {
+        m_deferred_rewind_ticks = -1;
+        m_deferred_since_ticks = -1;
+        return false;
+    }
+
+    if (m_deferred_since_ticks == -1)
+        m_deferred_since_ticks = world_ticks;
+    m_deferred_rewind_ticks = rewind_ticks;
+    m_statistics.lock();
+    m_statistics.getData().m_deferred_rewinds++;
+    m_statistics.unlock();
+    return true;
+}   // deferRewind
+
+// ----------------------------------------------------------------------------
+/** Returns the histogram bucket of a value, see STATISTICS_BUCKETS.
+ */
+unsigned RewindManager::getStatisticsBucket(double value)
+{
+    unsigned bucket = 0;
+    double limit = 1.0;
+    while (bucket < STATISTICS_BUCKETS - 1 && value >= limit)
+    {
+        bucket++;
+        limit *= 2.0;
+    }
+    return bucket;
+}   // getStatisticsBucket
+
+// ----------------------------------------------------------------------------
+/** Resets all rewind and state size statistics.
+ */
+void RewindManager::resetStatistics()
+{
+    m_statistics.lock();
+    Statistics& s = m_statistics.getData();
+    s.m_rewinds = 0;
+    s.m_deferred_rewinds = 0;
+    s.m_rewound_ticks = 0;
+    s.m_max_rewound_ticks = 0;
+    s.m_rewind_time = 0.0;
+    s.m_max_rewind_time = 0.0;
+    std::fill(s.m_ticks_histogram, s.m_ticks_histogram + STATISTICS_BUCKETS,
+              0);
+    std::fill(s.m_time_histogram, s.m_time_histogram + STATISTICS_BUCKETS,
+              0);
+    s.m_start_time = StkTime::getRealTime();
+    s.m_second_start = s.m_start_time;
+    s.m_rewinds_in_second = 0;
+    s.m_max_rewinds_per_second = 0;
+    s.m_state_sizes.clear();
+    m_statistics.unlock();
+}   // resetStatistics
+
+// ----------------------------------------------------------------------------
+/** Adds a rewind to the statistics, and its time to the rewind budget.
+ *  \param rewound_ticks Number of ticks replayed.
+ *  \param time Wall time of the rewind in seconds.
+ */
+void RewindManager::addRewindStatistics(int rewound_ticks, double time)
+{
+    m_rewind_budget_used += time;
+
+    m_statistics.lock();
+    Statistics& s = m_statistics.getData();
+    s.m_rewinds++;
+    s.m_rewound_ticks += rewound_ticks;
+    s.m_max_rewound_ticks = std::max(s.m_max_rewound_ticks, rewound_ticks);
+    s.m_rewind_time += time;
+    s.m_max_rewind_time = std::max(s.m_max_rewind_time, time);
+    s.m_ticks_histogram[getStatisticsBucket(rewound_ticks)]++;
+    s.m_time_histogram[getStatisticsBucket(time * 1000.0)]++;
+
+    const double now = StkTime::getRealTime();
+    if (now - s.m_second_start >= 1.0)
+    {
+        s.m_second_start = now;
+        s.m_rewinds_in_second = 0;
+    }
+    s.m_rewinds_in_second++;
+    s.m_max_rewinds_per_second = std::max(s.m_max_rewinds_per_second,
+                                          s.m_rewinds_in_second);
+    m_statistics.unlock();
+}   // addRewindStatistics
+
+// ----------------------------------------------------------------------------
+/** Adds the size of a state saved (server) or restored (client) by a
+ *  rewinder to the statistics.
+ *  \param id Rewinder id.
+ *  \param size Size of the state in bytes.
+ */
+void RewindManager::addStateSize(uint16_t id, unsigned size)
+{
+    m_statistics.lock();
+    std::vector<StateSizeStatistics>& sizes =
+        m_statistics.getData().m_state_sizes;
+    if (id >= sizes.size())
+        sizes.resize(id + 1);
+    StateSizeStatistics& stats = sizes[id];
+    if (stats.m_states == 0 && id < m_rewinder_names.size())
+        stats.m_name = m_rewinder_names[id];
+    stats.m_bytes += size;
+    stats.m_states++;
+    m_statistics.unlock();
+}   // addStateSize
+
+// ----------------------------------------------------------------------------
+/** Writes the rewind statistics in a machine-readable format: one
+ *  'name value' pair per line, histograms use cumulative buckets with an
+ *  upper bound 'le'. This can be called from any thread, the statistics
+ *  of the last race are kept till the next race starts.
+ *  \param out The stream to write to.
+ */
+void RewindManager::dumpStatistics(std::ostream& out)
+{
+    m_statistics.lock();
+    const Statistics& s = m_statistics.getData();
+    const double elapsed = StkTime::getRealTime() - s.m_start_time;
+    out << "rewind_count " << s.m_rewinds << "\n";
+    out << "rewind_deferred_count " << s.m_deferred_rewinds << "\n";
+    out << "rewind_ticks_total " << s.m_rewound_ticks << "\n";
+    out << "rewind_ticks_max " << s.m_max_rewound_ticks << "\n";
+    out << "rewind_time_seconds_total " << s.m_rewind_time << "\n";
+    out << "rewind_time_seconds_max " << s.m_max_rewind_time << "\n";
+    out << "rewinds_per_second "
+        << (elapsed > 0.0 ? s.m_rewinds / elapsed : 0.0) << "\n";
+    out << "rewinds_per_second_max " << s.m_max_rewinds_per_second << "\n";
+
+    const char* names[] = { "rewind_ticks_bucket", "rewind_time_ms_bucket" };
+    const uint64_t* histograms[] = { s.m_ticks_histogram,
+                                     s.m_time_histogram };
+    for (unsigned h = 0; h < 2; h++)
+    {
+        uint64_t count = 0;
+        unsigned limit = 1;
+        for (unsigned i = 0; i < STATISTICS_BUCKETS; i++, limit *= 2)
+        {
+            count += histograms[h][i];
+            out << names[h] << "{le=\"";
+            if (i == STATISTICS_BUCKETS - 1)
+                out << "+Inf";
+            else
+                out << limit;
+            out << "\"} " << count << "\n";
+        }
+    }
+
+    for (unsigned id = 0; id < s.m_state_sizes.size(); id++)
+    {
+        const StateSizeStatistics& stats = s.m_state_sizes[id];
+        if (stats.m_states == 0)
+            continue;
+        out << "state_bytes_average{id=\"" << id << "\",rewinder=\""
+            << stats.m_name << "\"} " << stats.m_bytes / stats.m_states
+            << "\n";
+        out << "state_count{id=\"" << id << "\",rewinder=\""
+            << stats.m_name << "\"} " << stats.m_states << "\n";
+    }
+    m_statistics.unlock();
+}   // dumpStatistics
+
 // ----------------------------------------------------------------------------
 bool RewindManager::useLocalEvent() const
 {
@@ -388,6 +1153,10 @@ bool RewindManager::useLocalEvent() const
 void RewindManager::mergeRewindInfoEventFunction()
 {
     for (RewindInfoEventFunction* rief : m_pending_rief)
+    {
+        m_latest_event_function_ticks =
+            std::max(m_latest_event_function_ticks, rief->getTicks());
         m_rewind_queue.insertRewindInfo(rief);
+    }
     m_pending_rief.clear();
 }   // mergeRewindInfoEventFunction
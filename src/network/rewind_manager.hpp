@@ -19,15 +19,20 @@
 #ifndef HEADER_REWIND_MANAGER_HPP
 #define HEADER_REWIND_MANAGER_HPP
 
+#include "network/network_string.hpp"
 #include "network/rewind_queue.hpp"
+#include "network/state_snapshot.hpp"
 #include "utils/ptr_vector.hpp"
 #include "utils/synchronised.hpp"
+#include "utils/vec3.hpp"
 
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
 #include <functional>
 #include <memory>
 #include <map>
+#include <ostream>
 #include <set>
 #include <string>
 #include <vector>
@@ -35,6 +40,7 @@
 class Rewinder;
 class RewindInfo;
 class RewindInfoEventFunction;
+class RewindInfoState;
 class EventRewinder;
 
 /** \ingroup network
@@ -80,6 +86,19 @@ class EventRewinder;
  *        - `rewindToEvent()` if the RewindInfo is an event
  *     3. Do one step of world simulation, using the updated (confirmed)
  *        states and newly set events (e.g. kart input).
+ *  If partial rewinds are enabled, a client also keeps the states of all
+ *  karts it predicted. Karts whose confirmed state is the same as the
+ *  predicted one, and which can not have interacted with any other kart or
+ *  object that is updated, are skipped in step 3: they are set back to the
+ *  state they had before the rewind, and removed from the physics world
+ *  while the other karts are updated.
+ *
+ *  The rewind manager also collects statistics about rewinds (number of
+ *  rewinds, rewound ticks and wall time) and about the size of the state
+ *  of each rewinder, see dumpStatistics(). If a rewind budget is set, a
+ *  client that spent more time on rewinds than the budget allows defers a
+ *  rewind for a received state, so that it is merged with the rewind for
+ *  the next state.
  */
 
 class RewindManager
@@ -95,7 +114,23 @@ private:
     std::map<int, std::vector<std::function<void()> > > m_local_state;
 
     /** A list of all objects that can be rewound. */
-    std::map<std::string, std::weak_ptr<Rewinder> > m_all_rewinder;
+    std::vector<std::weak_ptr<Rewinder> > m_all_rewinder;
+
+    /** Rewinders indexed by their rewinder id. On the server it is filled
+     *  when a rewinder is added, on the client it caches the rewinders
+     *  found for the ids used in state messages. */
+    std::vector<std::weak_ptr<Rewinder> > m_rewinder_by_id;
+
+    /** Unique identity of each rewinder id used in this race. On the server
+     *  the ids are assigned in the order rewinders are added and never
+     *  reused, and the table is sent to the clients with GameProtocol.
+     *  On the client it is the table received from the server. */
+    std::vector<std::string> m_rewinder_names;
+
+    /** Rewinder table entries received by the network thread, which are
+     *  merged into m_rewinder_names by the main thread. */
+    Synchronised<std::vector<std::pair<uint16_t, std::string> > >
+        m_pending_rewinder_names;
 
     /** The queue that stores all rewind infos. */
     RewindQueue m_rewind_queue;
@@ -119,29 +154,141 @@ private:
 
     std::vector<RewindInfoEventFunction*> m_pending_rief;
 
+    /** Ticks of the latest RewindInfoEventFunction added. These can not be
+     *  assigned to a single kart, so no kart is skipped in a rewind to an
+     *  earlier time. */
+    int m_latest_event_function_ticks;
+
+    /** The states of all karts predicted by a client at the ticks a state
+     *  is saved, using the world kart id as rewinder id. */
+    std::map<int, StateSnapshot> m_predicted_states;
+
+    /** True if the server omitted karts from a state (see
+     *  ServerConfig::m_state_relevance_distance). The client then saves its
+     *  predicted kart states, and uses them for the omitted karts. */
+    bool m_kart_states_omitted;
+
+    /** For each world kart id if the kart was omitted from the confirmed
+     *  state of the current rewind, and its predicted state was used. */
+    std::vector<bool> m_omitted_karts;
+
+    /** Information about a kart before a partial rewind. */
+    struct KartInfo
+    {
+        /** Bounding box of the kart. */
+        Vec3 m_min, m_max;
+        int  m_powerup_type;
+        int  m_powerup_num;
+        int  m_attachment_type;
+        bool m_has_animation;
+        /** Restores the local state of the kart. */
+        std::function<void()> m_local_state;
+    };
+    std::vector<KartInfo> m_kart_info;
+
+    /** The states of all karts before a partial rewind, using the world kart
+     *  id as rewinder id. */
+    StateSnapshot m_kart_state;
+
+    /** Used to restore a state of m_kart_state. */
+    BareNetworkString m_restore_buffer;
+
+    /** For each world kart id if the kart is skipped in the current partial
+     *  rewind. Empty if no partial rewind is done. */
+    std::vector<bool> m_skipped_karts;
+
+    /** Number of buckets in the histograms of the rewind statistics. Bucket
+     *  i counts values less than 2^i, the last one all larger values. */
+    static const unsigned STATISTICS_BUCKETS = 10;
+
+    /** State size statistics of one rewinder. */
+    struct StateSizeStatistics
+    {
+        std::string m_name;
+        uint64_t    m_bytes;
+        uint64_t    m_states;
+        StateSizeStatistics() : m_bytes(0), m_states(0) {}
+    };
+
+    /** Rewind statistics. They are static, since they are read by the
+     *  network console thread, which does not know when the rewind manager
+     *  of a race is destroyed. */
+    struct Statistics
+    {
+        uint64_t m_rewinds;
+        uint64_t m_deferred_rewinds;
+        uint64_t m_rewound_ticks;
+        int      m_max_rewound_ticks;
+        double   m_rewind_time;
+        double   m_max_rewind_time;
+        uint64_t m_ticks_histogram[STATISTICS_BUCKETS];
+        uint64_t m_time_histogram[STATISTICS_BUCKETS];
+        /** Real time at which the statistics were reset. */
+        double   m_start_time;
+        /** Real time at which the current one second interval started. */
+        double   m_second_start;
+        unsigned m_rewinds_in_second;
+        unsigned m_max_rewinds_per_second;
+        /** State sizes indexed by rewinder id. */
+        std::vector<StateSizeStatistics> m_state_sizes;
+    };
+    static Synchronised<Statistics> m_statistics;
+
+    /** Time in seconds spent on rewinds which was not yet compensated by
+     *  the rewind budget (leaky bucket). */
+    double m_rewind_budget_used;
+
+    /** Real time at which the rewind budget was last updated. */
+    double m_rewind_budget_time;
+
+    /** Ticks of a state to which a rewind was deferred because the rewind
+     *  budget was exceeded, or -1. */
+    int m_deferred_rewind_ticks;
+
+    /** World ticks at which the first deferred rewind was requested. */
+    int m_deferred_since_ticks;
+
     RewindManager();
    ~RewindManager();
     // ------------------------------------------------------------------------
     void clearExpiredRewinder()
     {
-        for (auto it = m_all_rewinder.begin(); it != m_all_rewinder.end();)
-        {
-            if (it->second.expired())
-            {
-                it = m_all_rewinder.erase(it);
-                continue;
-            }
-            it++;
-        }
+        m_all_rewinder.erase(std::remove_if(m_all_rewinder.begin(),
+            m_all_rewinder.end(), [](const std::weak_ptr<Rewinder>& r)
+            { return r.expired(); }), m_all_rewinder.end());
     }
     // ------------------------------------------------------------------------
     void mergeRewindInfoEventFunction();
+    // ------------------------------------------------------------------------
+    void mergeRewinderNames();
+    // ------------------------------------------------------------------------
+    void saveKartStates(StateSnapshot* state, const StateSnapshot* previous);
+    // ------------------------------------------------------------------------
+    void saveKartsBeforeRewind();
+    // ------------------------------------------------------------------------
+    void skipUnaffectedKarts(const RewindInfoState* state, int rewind_ticks,
+                             int now_ticks);
+    // ------------------------------------------------------------------------
+    void restoreKartState(unsigned kart_id);
+    // ------------------------------------------------------------------------
+    void restoreOmittedKarts(const RewindInfoState* state, int rewind_ticks);
+    // ------------------------------------------------------------------------
+    void restoreSkippedKarts();
+    // ------------------------------------------------------------------------
+    bool deferRewind(int rewind_ticks, int world_ticks);
+    // ------------------------------------------------------------------------
+    void addRewindStatistics(int rewound_ticks, double time);
+    // ------------------------------------------------------------------------
+    void resetStatistics();
+    // ------------------------------------------------------------------------
+    static unsigned getStatisticsBucket(double value);
 
 public:
     // First static functions to manage rewinding.
     // ===========================================
     static RewindManager *create();
     static void destroy();
+    static void benchmark();
     // ------------------------------------------------------------------------
     /** En- or disables rewinding. */
     static void setEnable(bool m) { m_enable_rewind_manager = m; }
@@ -169,22 +316,43 @@ public:
                          BareNetworkString *buffer, int ticks);
     void addNetworkState(BareNetworkString *buffer, int ticks);
     void saveState();
+    void saveState(StateSnapshot* state);
     // ------------------------------------------------------------------------
-    std::shared_ptr<Rewinder> getRewinder(const std::string& name)
+    std::shared_ptr<Rewinder> getRewinder(uint16_t id)
     {
-        auto it = m_all_rewinder.find(name);
-        if (it != m_all_rewinder.end())
+        if (id < m_rewinder_by_id.size())
         {
-            if (auto r = it->second.lock())
+            if (auto r = m_rewinder_by_id[id].lock())
                 return r;
         }
-        return nullptr;
+        return findRewinder(id);
     }
     // ------------------------------------------------------------------------
+    std::shared_ptr<Rewinder> findRewinder(uint16_t id);
+    // ------------------------------------------------------------------------
+    void addStateSize(uint16_t id, unsigned size);
+    // ------------------------------------------------------------------------
+    static void dumpStatistics(std::ostream& out);
+    // ------------------------------------------------------------------------
     bool addRewinder(std::shared_ptr<Rewinder> rewinder);
     // ------------------------------------------------------------------------
+    void addRewinderNames(uint16_t first_id,
+                          const std::vector<std::string>& names);
+    // ------------------------------------------------------------------------
+    /** Returns the unique identities of all rewinder ids assigned by the
+     *  server so far, indexed by rewinder id. */
+    const std::vector<std::string>& getRewinderNames() const
+                                                   { return m_rewinder_names; }
+    // ------------------------------------------------------------------------
     /** Returns true if currently a rewind is happening. */
     bool isRewinding() const { return m_is_rewinding; }
+    // ------------------------------------------------------------------------
+    /** Returns true if the kart is not updated in the current partial
+     *  rewind. */
+    bool isKartSkipped(unsigned kart_id) const
+    {
+        return kart_id < m_skipped_karts.size() && m_skipped_karts[kart_id];
+    }   // isKartSkipped
 
     // ------------------------------------------------------------------------
     int getNotRewoundWorldTicks() const
@@ -28,9 +28,11 @@
 
 #include <algorithm>
 
-/** The RewindQueue stores one TimeStepInfo for each time step done.
- *  The TimeStepInfo stores all states and events to be used at the
- *  given timestep. 
+/** The RewindQueue stores all states and events to be used at each time
+ *  step in a ring buffer indexed by ticks, so adding a RewindInfo does not
+ *  need to search for its position, and old RewindInfo are removed a whole
+ *  time step at a time. The entries of the ring buffer keep their memory
+ *  when they are reused for a later time step.
  *  All network events (i.e. new states or client events) are stored in a
  *  separate list m_network_events. At the very start of a new time step
  *  a new TimeStepInfo object is added. Then all network events that are
@@ -73,15 +75,116 @@ void RewindQueue::reset()
     m_network_events.getData().clear();
     m_network_events.unlock();
 
-    AllRewindInfo::const_iterator i;
-    for (i = m_all_rewind_info.begin(); i != m_all_rewind_info.end(); ++i)
-        delete *i;
-
-    m_all_rewind_info.clear();
-    m_current = m_all_rewind_info.end();
+    for (TickRewindInfo& tri : m_all_rewind_info)
+    {
+        for (RewindInfo* ri : tri)
+            delete ri;
+        tri.clear();
+    }
+    if (m_all_rewind_info.empty())
+        m_all_rewind_info.resize(64);
+
+    m_ring_start = 0;
+    m_first_ticks = 0;
+    m_num_ticks = 0;
+    m_current_ticks = getEndTicks();
+    m_current_index = 0;
     m_latest_confirmed_state_time = -1;
+    m_late_event_karts.clear();
 }   // reset
 
+// ----------------------------------------------------------------------------
+/** Resizes the ring buffer, which moves the entry for m_first_ticks to the
+ *  front.
+ *  \param size New size, must be a power of two and at least m_num_ticks.
+ */
+void RewindQueue::resizeRing(unsigned size)
+{
+    assert(size >= m_num_ticks && (size & (size - 1)) == 0);
+    const unsigned old_size = (unsigned)m_all_rewind_info.size();
+    std::vector<TickRewindInfo> ring(size);
+    for (unsigned i = 0; i < old_size && i < size; i++)
+    {
+        std::swap(ring[i],
+                  m_all_rewind_info[(m_ring_start + i) & (old_size - 1)]);
+    }
+    std::swap(ring, m_all_rewind_info);
+    m_ring_start = 0;
+}   // resizeRing
+
+// ----------------------------------------------------------------------------
+/** Returns the RewindInfo at the given ticks, and extends the ring buffer
+ *  (at the front or the back) if the ticks are not stored yet.
+ *  \param ticks The ticks to add.
+ */
+RewindQueue::TickRewindInfo& RewindQueue::addTicks(int ticks)
+{
+    if (m_num_ticks == 0)
+    {
+        m_first_ticks = ticks;
+        m_num_ticks = 1;
+        return getTicks(ticks);
+    }
+
+    unsigned needed;
+    if (ticks < m_first_ticks)
+        needed = getEndTicks() - ticks;
+    else if (ticks >= getEndTicks())
+        needed = ticks - m_first_ticks + 1;
+    else
+        return getTicks(ticks);
+
+    unsigned size = (unsigned)m_all_rewind_info.size();
+    while (size < needed)
+        size *= 2;
+    if (size != m_all_rewind_info.size())
+        resizeRing(size);
+
+    if (ticks < m_first_ticks)
+    {
+        m_ring_start = (m_ring_start - (m_first_ticks - ticks)) & (size - 1);
+        m_first_ticks = ticks;
+    }
+    m_num_ticks = needed;
+    return getTicks(ticks);
+}   // addTicks
+
+// ----------------------------------------------------------------------------
+/** Moves the current position forward to the first RewindInfo at or after
+ *  it, or to the end if there is none.
+ */
+void RewindQueue::findCurrent()
+{
+    while (m_current_ticks < getEndTicks() &&
+           m_current_index >= getTicks(m_current_ticks).size())
+    {
+        m_current_ticks++;
+        m_current_index = 0;
+    }
+}   // findCurrent
+
+// ----------------------------------------------------------------------------
+/** Sets the current element to be the previous one.
+ *  \return False if there is no previous element, in which case the current
+ *          element is not changed.
+ */
+bool RewindQueue::previous()
+{
+    if (m_current_index > 0 && m_current_ticks < getEndTicks())
+    {
+        m_current_index--;
+        return true;
+    }
+    int ticks = std::min(m_current_ticks, getEndTicks()) - 1;
+    while (ticks >= m_first_ticks && getTicks(ticks).empty())
+        ticks--;
+    if (ticks < m_first_ticks)
+        return false;
+    m_current_ticks = ticks;
+    m_current_index = (unsigned)getTicks(ticks).size() - 1;
+    return true;
+}   // previous
+
 // ----------------------------------------------------------------------------
 /** Inserts a RewindInfo object in the list of all events at the correct time.
  *  If there are several RewindInfo at the exact same time, state RewindInfo
@@ -93,23 +196,27 @@ void RewindQueue::reset()
  */
 void RewindQueue::insertRewindInfo(RewindInfo *ri)
 {
-    AllRewindInfo::iterator i = m_all_rewind_info.end();
-
-    while (i != m_all_rewind_info.begin())
+    const bool has_current = hasMoreRewindInfo();
+    TickRewindInfo& tri = addTicks(ri->getTicks());
+    unsigned index = 0;
+    if (ri->isEvent())
     {
-        AllRewindInfo::iterator i_prev = i;
-        i_prev--;
-        // Now test if 'ri' needs to be inserted after the
-        // previous element, i.e. before the current element:
-        if ((*i_prev)->getTicks() < ri->getTicks()) break;
-        if ((*i_prev)->getTicks() == ri->getTicks() &&
-            ri->isEvent()                              ) break;
-        i = i_prev;
+        index = (unsigned)tri.size();
+        tri.push_back(ri);
     }
-    if(m_current == m_all_rewind_info.end())
-        m_current = m_all_rewind_info.insert(i, ri);
     else
-        m_all_rewind_info.insert(i, ri);  
+        tri.insert(tri.begin(), ri);
+
+    if (!has_current)
+    {
+        m_current_ticks = ri->getTicks();
+        m_current_index = index;
+    }
+    else if (m_current_ticks == ri->getTicks() && index <= m_current_index)
+    {
+        // Keep the current element, the new one was inserted before it
+        m_current_index++;
+    }
 }   // insertRewindInfo
 
 // ----------------------------------------------------------------------------
@@ -256,6 +363,12 @@ void RewindQueue::mergeNetworkData(int world_ticks, bool *needs_rewind,
 
         insertRewindInfo(*i);
 
+        if (NetworkConfig::get()->isClient() &&
+            (*i)->getTicks() < world_ticks && (*i)->isEvent())
+        {
+            m_late_event_karts.insert((*i)->getKartId());
+        }
+
         // Check if a rewind is necessary, i.e. a message is received in the
         // past of client (server never rewinds). Even if
         // getTicks()==world_ticks (which should not happen in reality, since
@@ -319,21 +432,29 @@ void RewindQueue::mergeNetworkData(int world_ticks, bool *needs_rewind,
  */
 void RewindQueue::cleanupOldRewindInfo(int ticks)
 {
-    auto i = m_all_rewind_info.begin();
-
-    while ( (*i)->getTicks() < ticks)
+    while (m_num_ticks > 0 && m_first_ticks < ticks)
     {
-        if (m_current == i) next();
-        delete *i;
-        i = m_all_rewind_info.erase(i);
+        TickRewindInfo& tri = getTicks(m_first_ticks);
+        for (RewindInfo* ri : tri)
+            delete ri;
+        tri.clear();
+        m_ring_start = (m_ring_start + 1) & (m_all_rewind_info.size() - 1);
+        m_first_ticks++;
+        m_num_ticks--;
     }
 
+    if (m_current_ticks < m_first_ticks)
+    {
+        m_current_ticks = m_first_ticks;
+        m_current_index = 0;
+        findCurrent();
+    }
 }   // cleanupOldRewindInfo
 
 // ----------------------------------------------------------------------------
 bool RewindQueue::isEmpty() const
 {
-    return m_current == m_all_rewind_info.end();
+    return !hasMoreRewindInfo();
 }   // isEmpty
 
 // ----------------------------------------------------------------------------
@@ -341,9 +462,24 @@ bool RewindQueue::isEmpty() const
  */
 bool RewindQueue::hasMoreRewindInfo() const
 {
-    return m_current != m_all_rewind_info.end();
+    return m_current_ticks < getEndTicks();
 }   // hasMoreRewindInfo
 
+// ----------------------------------------------------------------------------
+/** Returns all RewindInfo in the order in which they are handled. Used in
+ *  unit testing.
+ */
+std::vector<RewindInfo*> RewindQueue::getAllRewindInfo() const
+{
+    std::vector<RewindInfo*> all;
+    for (int ticks = m_first_ticks; ticks < getEndTicks(); ticks++)
+    {
+        const TickRewindInfo& tri = getTicks(ticks);
+        all.insert(all.end(), tri.begin(), tri.end());
+    }
+    return all;
+}   // getAllRewindInfo
+
 // ----------------------------------------------------------------------------
 /** Rewinds the rewind queue and undos all events/states stored. It stops
  *  when the first confirmed state is reached that was recorded before the
@@ -354,28 +490,30 @@ bool RewindQueue::hasMoreRewindInfo() const
 int RewindQueue::undoUntil(int undo_ticks)
 {
     // A rewind is done after a state in the past is inserted. This function
-    // makes sure that m_current is not end()
-    //assert(m_current != m_all_rewind_info.end());
-    assert(!m_all_rewind_info.empty());
-    m_current = m_all_rewind_info.end();
-    m_current--;
-    while((*m_current)->getTicks() > undo_ticks ||
-        (*m_current)->isEvent() || !(*m_current)->isConfirmed())
+    // makes sure that the current element is not at the end
+    m_current_ticks = getEndTicks();
+    m_current_index = 0;
+    assert(m_num_ticks > 0);
+    previous();
+    RewindInfo* current = getCurrent();
+    while (current->getTicks() > undo_ticks ||
+           current->isEvent() || !current->isConfirmed())
     {
         // Undo all events and states from the current time
-        (*m_current)->undo();
-        if(m_current == m_all_rewind_info.begin())
+        current->undo();
+        if (!previous())
         {
             // This shouldn't happen, but add some debug info just in case
             Log::error("undoUntil",
                        "At %d rewinding to %d current = %d = begin",
                        World::getWorld()->getTicksSinceStart(), undo_ticks, 
-                       (*m_current)->getTicks());
+                       current->getTicks());
+            break;
         }
-        m_current--;
+        current = getCurrent();
     }
 
-    return (*m_current)->getTicks();
+    return current->getTicks();
 }   // undoUntil
 
 // ----------------------------------------------------------------------------
@@ -385,11 +523,12 @@ int RewindQueue::undoUntil(int undo_ticks)
 void RewindQueue::replayAllEvents(int ticks)
 {
     // Replay all events that happened at the current time step
-    while ( hasMoreRewindInfo() && (*m_current)->getTicks() == ticks )
+    while ( hasMoreRewindInfo() && m_current_ticks == ticks )
     {
-        if ((*m_current)->isEvent())
-            (*m_current)->replay();
-        m_current++;
+        RewindInfo* current = getCurrent();
+        if (current->isEvent())
+            current->replay();
+        next();
     }   // while current->getTIcks == ticks
 
 }   // replayAllEvents
@@ -415,57 +554,86 @@ void RewindQueue::unitTesting()
     assert(!q0.hasMoreRewindInfo());
 
     q0.addLocalState(NULL, /*confirmed*/true, 0);
-    assert(q0.m_all_rewind_info.front()->isState());
-    assert(!q0.m_all_rewind_info.front()->isEvent());
+    assert(q0.getAllRewindInfo().front()->isState());
+    assert(!q0.getAllRewindInfo().front()->isEvent());
     assert(q0.hasMoreRewindInfo());
     assert(q0.undoUntil(0) == 0);
 
     q0.addNetworkEvent(dummy_rewinder.get(), NULL, 0);
     // Network events are not immediately merged
-    assert(q0.m_all_rewind_info.size() == 1);
+    assert(q0.getAllRewindInfo().size() == 1);
 
     bool needs_rewind;
     int rewind_ticks;
     int world_ticks = 0;
     q0.mergeNetworkData(world_ticks, &needs_rewind, &rewind_ticks);
     assert(q0.hasMoreRewindInfo());
-    assert(q0.m_all_rewind_info.size() == 2);
-    AllRewindInfo::iterator rii = q0.m_all_rewind_info.begin();
-    assert((*rii)->isState());
-    rii++;
-    assert((*rii)->isEvent());
+    std::vector<RewindInfo*> all = q0.getAllRewindInfo();
+    assert(all.size() == 2);
+    assert(all[0]->isState());
+    assert(all[1]->isEvent());
 
     // Another state must be sorted before the event:
     q0.addNetworkState(NULL, 0);
     assert(q0.hasMoreRewindInfo());
     q0.mergeNetworkData(world_ticks, &needs_rewind, &rewind_ticks);
-    assert(q0.m_all_rewind_info.size() == 3);
-    rii = q0.m_all_rewind_info.begin();
-    assert((*rii)->isState());
-    rii++;
-    assert((*rii)->isState());
-    rii++;
-    assert((*rii)->isEvent());
+    all = q0.getAllRewindInfo();
+    assert(all.size() == 3);
+    assert(all[0]->isState());
+    assert(all[1]->isState());
+    assert(all[2]->isEvent());
 
     // Test time base comparisons: adding an event to the end
     q0.addLocalEvent(dummy_rewinder.get(), NULL, true, 4);
     // Then adding an earlier event
     q0.addLocalEvent(dummy_rewinder.get(), NULL, false, 1);
-    // rii points to the 3rd element, the ones added just now
-    // should be elements4 and 5:
-    rii++;
-    assert((*rii)->getTicks()==1);
-    rii++;
-    assert((*rii)->getTicks()==4);
+    // The ones added just now should be elements 4 and 5:
+    all = q0.getAllRewindInfo();
+    assert(all.size() == 5);
+    assert(all[3]->getTicks()==1);
+    assert(all[4]->getTicks()==4);
 
     // Now test inserting an event first, then the state
     RewindQueue q1;
     q1.addLocalEvent(NULL, NULL, true, 5);
     q1.addLocalState(NULL, true, 5);
-    rii = q1.m_all_rewind_info.begin();
-    assert((*rii)->isState());
-    rii++;
-    assert((*rii)->isEvent());
+    all = q1.getAllRewindInfo();
+    assert(all[0]->isState());
+    assert(all[1]->isEvent());
+
+    // Inserting before the first ticks stored must keep the sorting order
+    q1.addLocalEvent(NULL, NULL, true, 2);
+    all = q1.getAllRewindInfo();
+    assert(all.size() == 3);
+    assert(all[0]->getTicks() == 2);
+    assert(all[1]->getTicks() == 5 && all[1]->isState());
+
+    // Ring buffer growth and wrap around: add more ticks than the initial
+    // size, remove old ones so that the start wraps around, and add again
+    RewindQueue q2;
+    for (int i = 0; i < 200; i++)
+        q2.addLocalEvent(NULL, NULL, true, i);
+    q2.cleanupOldRewindInfo(150);
+    assert(q2.getAllRewindInfo().size() == 50);
+    assert(q2.getCurrent()->getTicks() == 150);
+    for (int i = 200; i < 300; i += 2)
+        q2.addLocalEvent(NULL, NULL, true, i);
+    all = q2.getAllRewindInfo();
+    assert(all.size() == 100);
+    for (unsigned i = 1; i < all.size(); i++)
+        assert(all[i - 1]->getTicks() < all[i]->getTicks());
+    for (unsigned i = 0; i < all.size(); i++)
+    {
+        assert(q2.getCurrent() == all[i]);
+        q2.next();
+    }
+    assert(!q2.hasMoreRewindInfo());
+
+    // Undoing must skip ticks without any RewindInfo
+    q2.addLocalState(NULL, true, 298);
+    q2.addLocalEvent(dummy_rewinder.get(), new BareNetworkString(), true, 310);
+    assert(q2.undoUntil(305) == 298);
+    assert(q2.getCurrent()->isState());
 
     // Bugs seen before
     // ----------------
@@ -484,20 +652,27 @@ void RewindQueue::unitTesting()
     //    event, that m_current pooints to the first event, otherwise
     //    events with same time stamp will not be handled correctly.
     //    At this stage current points to the event at time 2 from above
-    AllRewindInfo::iterator current_old = b1.m_current;
+    RewindInfo* current_old = b1.getCurrent();
     b1.addLocalEvent(NULL, NULL, true, 2);
     // Make sure that current was not modified, i.e. the new event at time
     // 2 was added at the end of the list:
-    if (current_old != b1.m_current)
-        Log::fatal("RewindQueue", "current_old != b1.m_current");
+    if (current_old != b1.getCurrent())
+        Log::fatal("RewindQueue", "current_old != b1.getCurrent()");
 
     // This should not trigger an exception, now current points to the
     // second event at the same time:
     b1.next();
-    assert(ri->getTicks() == 2);
-    assert(ri->isEvent());
+    assert(b1.getCurrent()->getTicks() == 2);
+    assert(b1.getCurrent()->isEvent());
     b1.next();
-    assert(b1.m_current == b1.m_all_rewind_info.end());
+    assert(!b1.hasMoreRewindInfo());
+
+    // A state inserted at the ticks of the current element is inserted
+    // before it, current must still point to the same element
+    b1.addLocalEvent(NULL, NULL, true, 3);
+    current_old = b1.getCurrent();
+    b1.addLocalState(NULL, true, 3);
+    assert(b1.getCurrent() == current_old);
 
     // 3) Test that if cleanupOldRewindInfo is called, it will if necessary
     //    adjust m_current to point to the latest confirmed state.
@@ -506,7 +681,6 @@ void RewindQueue::unitTesting()
     b2.addNetworkState(NULL, 2);
     b2.addNetworkState(NULL, 3);
     b2.mergeNetworkData(4, &needs_rewind, &rewind_ticks);
-    assert((*b2.m_current)->getTicks() == 3);
-
+    assert(b2.getCurrent()->getTicks() == 3);
 
 }   // unitTesting
@@ -22,7 +22,7 @@
 #include "utils/synchronised.hpp"
 
 #include <assert.h>
-#include <list>
+#include <set>
 #include <vector>
 
 class BareNetworkString;
@@ -37,9 +37,23 @@ class RewindQueue
 {
 private:
 
-    typedef std::list<RewindInfo*> AllRewindInfo;
+    /** All RewindInfo at the same ticks: first the states (the last added
+     *  state first), then all events in the order they were added. */
+    typedef std::vector<RewindInfo*> TickRewindInfo;
 
-    AllRewindInfo m_all_rewind_info;
+    /** A ring buffer with one entry for each ticks from m_first_ticks on.
+     *  Its size is always a power of two. Entries which are not in use are
+     *  empty, but keep their memory so that it can be reused. */
+    std::vector<TickRewindInfo> m_all_rewind_info;
+
+    /** Index in m_all_rewind_info of the entry for m_first_ticks. */
+    unsigned m_ring_start;
+
+    /** Ticks of the first entry in the ring buffer. */
+    int m_first_ticks;
+
+    /** Number of ticks stored in the ring buffer. */
+    unsigned m_num_ticks;
 
     /** The list of all events received from the network. They are stored
      *  in a separate thread (so this data structure is thread-save), and
@@ -49,14 +63,46 @@ private:
     typedef std::vector<RewindInfo*> AllNetworkRewindInfo;
     Synchronised<AllNetworkRewindInfo> m_network_events;
 
-    /** Iterator to the curren time step info to be handled. */
-    AllRewindInfo::iterator m_current;
+    /** Ticks and index in its TickRewindInfo of the current RewindInfo to be
+     *  handled. If all RewindInfo have been handled, m_current_ticks is
+     *  the ticks after the last entry in the ring buffer. */
+    int m_current_ticks;
+    unsigned m_current_index;
 
     /** Time at which the latest confirmed state is at. */
     int m_latest_confirmed_state_time;
 
+    /** World kart ids of all karts for which an event in the past was
+     *  received from the network (-1 for an event that can affect any
+     *  kart). Since the local prediction did not know about these events,
+     *  these karts must be updated in the next rewind. */
+    std::set<int> m_late_event_karts;
+
 
     void cleanupOldRewindInfo(int ticks);
+    TickRewindInfo& addTicks(int ticks);
+    void resizeRing(unsigned size);
+    void findCurrent();
+    bool previous();
+    // ------------------------------------------------------------------------
+    /** Returns the ticks after the last ticks in the ring buffer. */
+    int getEndTicks() const       { return m_first_ticks + (int)m_num_ticks; }
+    // ------------------------------------------------------------------------
+    /** Returns the RewindInfo at the given ticks, which must be stored in the
+     *  ring buffer. */
+    TickRewindInfo& getTicks(int ticks)
+    {
+        assert(ticks >= m_first_ticks && ticks < getEndTicks());
+        return m_all_rewind_info[(m_ring_start + ticks - m_first_ticks) &
+                                 (m_all_rewind_info.size() - 1)];
+    }   // getTicks
+    // ------------------------------------------------------------------------
+    const TickRewindInfo& getTicks(int ticks) const
+    {
+        return const_cast<RewindQueue*>(this)->getTicks(ticks);
+    }   // getTicks
+    // ------------------------------------------------------------------------
+    std::vector<RewindInfo*> getAllRewindInfo() const;
 
 public:
         static void unitTesting();
@@ -91,12 +137,22 @@ public:
         return m_latest_confirmed_state_time;
     }
     // ------------------------------------------------------------------------
+    /** Returns the karts for which an event in the past was received since
+     *  the last call to clearLateEventKarts(). */
+    const std::set<int>& getLateEventKarts() const
+    {
+        return m_late_event_karts;
+    }
+    // ------------------------------------------------------------------------
+    void clearLateEventKarts()                   { m_late_event_karts.clear(); }
+    // ------------------------------------------------------------------------
     /** Sets the current element to be the next one and returns the next
      *  RewindInfo element. */
     void next()
     {
-        assert(m_current != m_all_rewind_info.end());
-        m_current++;
+        assert(hasMoreRewindInfo());
+        m_current_index++;
+        findCurrent();
         return;
     }   // operator++
 
@@ -105,11 +161,11 @@ public:
      *  least one more RewindInfo (see hasMoreRewindInfo()). */
     RewindInfo* getCurrent()
     {
-        return (m_current != m_all_rewind_info.end() ) ? *m_current : NULL;
+        return hasMoreRewindInfo() ? getTicks(m_current_ticks)[m_current_index]
+                                   : NULL;
     }   // getNext
 
 };   // RewindQueue
 
 
 #endif
-
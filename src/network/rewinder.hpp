@@ -19,6 +19,8 @@
 #ifndef HEADER_REWINDER_HPP
 #define HEADER_REWINDER_HPP
 
+#include "utils/types.hpp"
+
 #include <cassert>
 #include <functional>
 #include <string>
@@ -34,8 +36,16 @@ protected:
 private:
     std::string m_unique_identity;
 
+    /** Compact id of this rewinder used in state messages, assigned by the
+     *  RewindManager on the server when this rewinder is added. */
+    uint16_t m_rewinder_id;
+
 public:
-    Rewinder(const std::string& ui = "")             { m_unique_identity = ui; }
+    Rewinder(const std::string& ui = "")
+    {
+        m_unique_identity = ui;
+        m_rewinder_id = 0;
+    }
 
     virtual ~Rewinder() {}
 
@@ -48,12 +58,14 @@ public:
      *  caused by the rewind (which is then visually smoothed over time). */
     virtual void computeError() = 0;
 
-    /** Provides a copy of the state of the object in one memory buffer.
-     *  The memory is managed by the RewindManager.
-     *  \param[out] ru The unique identity of rewinder writing to.
-     *  \return The address of the memory buffer with the state.
+    /** Appends a copy of the state of the object to the given buffer. The
+     *  buffer is owned by the caller and reused for all states, so no memory
+     *  needs to be allocated for saving a state.
+     *  \param buffer The buffer to write the state to.
+     *  \return False if no state is saved for this object (in which case
+     *          nothing must be written to the buffer).
      */
-    virtual BareNetworkString* saveState(std::vector<std::string>* ru) = 0;
+    virtual bool saveState(BareNetworkString* buffer) = 0;
 
     /** Called when an event needs to be undone. This is called while going
      *  backwards for rewinding - all stored events will get an 'undo' call.
@@ -90,6 +102,12 @@ public:
         return m_unique_identity;
     }
     // -------------------------------------------------------------------------
+    /** Returns the id of this rewinder used in state messages. */
+    uint16_t getRewinderId() const                   { return m_rewinder_id; }
+    // -------------------------------------------------------------------------
+    /** Called by the RewindManager on the server to set the rewinder id. */
+    void setRewinderId(uint16_t id)                    { m_rewinder_id = id; }
+    // -------------------------------------------------------------------------
     bool rewinderAdd();
     // -------------------------------------------------------------------------
     template<typename T> std::shared_ptr<T> getShared()
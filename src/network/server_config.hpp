@@ -251,6 +251,48 @@ namespace ServerConfig
         "kick-high-ping-players",
         "Kick players whose ping is above max-ping."));
 
+    SERVER_CFG_PREFIX FloatServerConfigParam m_state_relevance_distance
+        SERVER_CFG_DEFAULT(FloatServerConfigParam(0.0f,
+        "state-relevance-distance",
+        "Karts farther away (in m) from all karts of a player are sent to "
+        "this player only in every second state, and karts farther away "
+        "than 3 times this distance only in every fourth state, which "
+        "reduces the upload bandwidth of servers with many players. "
+        "0 sends all karts in every state."));
+
+    SERVER_CFG_PREFIX BoolServerConfigParam m_fixed_rate_ticks
+        SERVER_CFG_DEFAULT(BoolServerConfigParam(false,
+        "fixed-rate-ticks",
+        "Schedule each tick of a server without graphics at its exact time "
+        "(instead of sleeping 1 ms in the main loop), which keeps the ticks "
+        "evenly spaced and reduces rewinds and time adjustments of "
+        "clients."));
+
+    SERVER_CFG_PREFIX IntServerConfigParam m_max_catch_up_ticks
+        SERVER_CFG_DEFAULT(IntServerConfigParam(3, "max-catch-up-ticks",
+        "Maximum number of ticks computed at once with fixed-rate-ticks if "
+        "the server is late. If it is more than 1 second late, the missed "
+        "ticks are skipped."));
+
+    SERVER_CFG_PREFIX IntServerConfigParam m_kart_update_threads
+        SERVER_CFG_DEFAULT(IntServerConfigParam(-1, "kart-update-threads",
+        "Number of worker threads used to find the track sector of each kart "
+        "in races with at least 8 karts. The results are the same as "
+        "without worker threads. -1 uses one thread less than the number of "
+        "cores (at most 3), 0 disables the worker threads."));
+
+    SERVER_CFG_PREFIX StringServerConfigParam m_metrics_file
+        SERVER_CFG_DEFAULT(StringServerConfigParam("", "metrics-file",
+        "If not empty, a snapshot of the server load (tick time "
+        "percentiles, ping and jitter of each player, bytes per protocol, "
+        "encryption time, rewinds, state size and protocol queue sizes) is "
+        "written to this file every metrics-interval seconds, as 'name "
+        "value' lines."));
+
+    SERVER_CFG_PREFIX FloatServerConfigParam m_metrics_interval
+        SERVER_CFG_DEFAULT(FloatServerConfigParam(5.0f, "metrics-interval",
+        "Time in seconds between two snapshots written to metrics-file."));
+
     SERVER_CFG_PREFIX StringToUIntServerConfigParam m_server_ip_ban_list
         SERVER_CFG_DEFAULT(StringToUIntServerConfigParam("server-ip-ban-list",
         "ip: IP in X.X.X.X/Y (CIDR) format for banning, use Y of 32 for a "
@@ -269,7 +311,7 @@ namespace ServerConfig
 
     // ========================================================================
     /** Server version, will be advanced if there are protocol changes. */
-    static const uint32_t m_server_version = 1;
+    static const uint32_t m_server_version = 2;
     // ========================================================================
     void loadServerConfig(const std::string& path = "");
     // ------------------------------------------------------------------------
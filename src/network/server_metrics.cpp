@@ -0,0 +1,172 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "network/server_metrics.hpp"
+
+#include "io/file_manager.hpp"
+#include "network/load_statistics.hpp"
+#include "network/protocol_manager.hpp"
+#include "network/rewind_manager.hpp"
+#include "network/server_config.hpp"
+#include "network/stk_host.hpp"
+#include "network/stk_peer.hpp"
+#include "utils/log.hpp"
+#include "utils/string_utils.hpp"
+#include "utils/time.hpp"
+
+#include <algorithm>
+#include <ostream>
+#include <map>
+#include <string>
+
+std::vector<float>    ServerMetrics::m_tick_times;
+std::atomic<uint64_t> ServerMetrics::m_bytes_sent[PROTOCOL_MAX];
+std::atomic<uint64_t> ServerMetrics::m_bytes_received[PROTOCOL_MAX];
+std::atomic<uint64_t> ServerMetrics::m_crypto_time(0);
+std::atomic<uint64_t> ServerMetrics::m_events[PROTOCOL_MAX + 1];
+std::atomic<uint64_t> ServerMetrics::m_event_latency[PROTOCOL_MAX + 1];
+std::atomic<uint64_t> ServerMetrics::m_max_event_latency[PROTOCOL_MAX + 1];
+unsigned              ServerMetrics::m_state_messages = 0;
+uint64_t              ServerMetrics::m_state_bytes = 0;
+unsigned              ServerMetrics::m_max_state_bytes = 0;
+uint64_t              ServerMetrics::m_start_time = 0;
+uint64_t              ServerMetrics::m_next_write_time = 0;
+
+// ----------------------------------------------------------------------------
+/** Writes the metrics file if metrics are enabled and the interval since
+ *  the last snapshot has passed. Called by the main thread of a server in
+ *  each frame. The file is written under a temporary name and then renamed,
+ *  so a reader never sees a partially written snapshot.
+ */
+void ServerMetrics::update()
+{
+    const std::string file_name = ServerConfig::m_metrics_file;
+    if (file_name.empty())
+    {
+        m_tick_times.clear();
+        return;
+    }
+    const uint64_t now = StkTime::getRealTimeMs();
+    if (m_start_time == 0)
+        m_start_time = now;
+    if (now < m_next_write_time)
+        return;
+    m_next_write_time = now +
+        (uint64_t)(std::max((float)ServerConfig::m_metrics_interval, 0.1f) *
+                   1000.0f);
+
+    // The next snapshot starts a new interval even if this one could not be
+    // written, so the tick times do not grow without limit
+    file_manager->writeFileAtomic(file_name,
+                                  [](std::ostream& out) { dump(out); });
+    m_tick_times.clear();
+    m_state_messages = 0;
+    m_state_bytes = 0;
+    m_max_state_bytes = 0;
+}   // update
+
+// ----------------------------------------------------------------------------
+/** Adds the time (in ms) used to compute one tick, only called by the main
+ *  thread. The time is only kept if metrics are enabled.
+ */
+void ServerMetrics::addTickTime(float ms)
+{
+    if (!((std::string)ServerConfig::m_metrics_file).empty())
+        m_tick_times.push_back(ms);
+}   // addTickTime
+
+// ----------------------------------------------------------------------------
+/** Writes the current snapshot.
+ *  \param out The stream to write to.
+ */
+void ServerMetrics::dump(std::ostream& out)
+{
+    const uint64_t now = StkTime::getRealTimeMs();
+    out << "time " << StkTime::getTimeSinceEpoch() << "\n";
+    out << "uptime_seconds " << (now - m_start_time) / 1000 << "\n";
+
+    double total = 0.0;
+    for (float t : m_tick_times)
+        total += t;
+    out << "tick_count " << m_tick_times.size() << "\n";
+    out << "tick_time_ms_average "
+        << (m_tick_times.empty() ? 0.0 : total / m_tick_times.size()) << "\n";
+    LoadStatistics::dumpPercentiles(out, "tick_time_ms_", m_tick_times);
+
+    const char* protocol_names[PROTOCOL_MAX + 1] =
+        { "none", "connection", "lobby", "game_events", "controller_events",
+          "silent", "connect_disconnect" };
+    for (unsigned i = 0; i <= PROTOCOL_MAX; i++)
+    {
+        const std::string name = std::string("protocol_") +
+            protocol_names[i];
+        if (i < PROTOCOL_MAX)
+        {
+            out << name << "_bytes_sent " << m_bytes_sent[i].load() << "\n";
+            out << name << "_bytes_received " << m_bytes_received[i].load()
+                << "\n";
+        }
+        // Handled events and their latency since the last snapshot
+        const uint64_t events = m_events[i].exchange(0);
+        const uint64_t latency = m_event_latency[i].exchange(0);
+        out << name << "_events " << events << "\n";
+        out << name << "_event_latency_ms_average "
+            << (events == 0 ? 0.0 : latency * 0.001 / events) << "\n";
+        out << name << "_event_latency_ms_max "
+            << m_max_event_latency[i].exchange(0) * 0.001 << "\n";
+    }
+    out << "crypto_ms " << m_crypto_time.load() / 1000 << "\n";
+
+    out << "state_messages " << m_state_messages << "\n";
+    out << "state_bytes_average "
+        << (m_state_messages == 0 ? 0 : m_state_bytes / m_state_messages)
+        << "\n";
+    out << "state_bytes_max " << m_max_state_bytes << "\n";
+
+    if (auto pm = ProtocolManager::lock())
+    {
+        unsigned sync_events = 0, async_events = 0, requests = 0;
+        pm->getQueueSizes(&sync_events, &async_events, &requests);
+        out << "queue_sync_events " << sync_events << "\n";
+        out << "queue_async_events " << async_events << "\n";
+        out << "queue_requests " << requests << "\n";
+    }
+
+    if (STKHost::existHost())
+    {
+        auto peers = STKHost::get()->getPeers();
+        const std::map<uint32_t, uint32_t> pings =
+            STKHost::get()->getPeerPings();
+        out << "peers " << peers.size() << "\n";
+        for (auto& peer : peers)
+        {
+            const std::string name = "peer_" +
+                StringUtils::toString(peer->getHostId());
+            auto ping = pings.find(peer->getHostId());
+            out << name << "_ping "
+                << (ping == pings.end() ? 0 : ping->second) << "\n";
+            out << name << "_ping_average " << peer->getAveragePing() << "\n";
+            out << name << "_jitter " << peer->getPingVariance() << "\n";
+            out << name << "_bytes_sent " << peer->getBytesSent() << "\n";
+            out << name << "_bytes_received " << peer->getBytesReceived()
+                << "\n";
+        }
+    }
+    RewindManager::dumpStatistics(out);
+}   // dump
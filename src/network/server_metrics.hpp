@@ -0,0 +1,127 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_SERVER_METRICS_HPP
+#define HEADER_SERVER_METRICS_HPP
+
+#include "network/protocol.hpp"
+#include "utils/types.hpp"
+
+#include <atomic>
+#include <ostream>
+#include <vector>
+
+/** \ingroup network
+ *  Collects the load of a running server and periodically writes a snapshot
+ *  of it as 'name value' lines to the file set with the server config
+ *  option metrics-file, so that external tools can monitor many servers.
+ *  Tick time percentiles, event latencies and state message sizes are
+ *  computed over the interval since the previous snapshot, all byte counts
+ *  and the encryption time are totals since the server was started. Bytes
+ *  and events are counted from several threads, so they use atomics.
+ */
+class ServerMetrics
+{
+private:
+    /** Time (in ms) used to compute each tick since the last snapshot. */
+    static std::vector<float> m_tick_times;
+
+    /** Bytes (including encryption overhead) sent and received for each
+     *  protocol type. */
+    static std::atomic<uint64_t> m_bytes_sent[PROTOCOL_MAX];
+    static std::atomic<uint64_t> m_bytes_received[PROTOCOL_MAX];
+
+    /** Time in microseconds spent encrypting and decrypting messages. */
+    static std::atomic<uint64_t> m_crypto_time;
+
+    /** Number of events handled since the last snapshot for each protocol
+     *  type (and connection events at index PROTOCOL_MAX), and the total
+     *  and maximum time in microseconds from receiving them to handling
+     *  them. */
+    static std::atomic<uint64_t> m_events[PROTOCOL_MAX + 1];
+    static std::atomic<uint64_t> m_event_latency[PROTOCOL_MAX + 1];
+    static std::atomic<uint64_t> m_max_event_latency[PROTOCOL_MAX + 1];
+
+    /** Number and total size of the state messages sent since the last
+     *  snapshot, and the largest one. */
+    static unsigned m_state_messages;
+    static uint64_t m_state_bytes;
+    static unsigned m_max_state_bytes;
+
+    /** Time at which the server was started and the next snapshot is
+     *  written, in ms. */
+    static uint64_t m_start_time;
+    static uint64_t m_next_write_time;
+
+    static void dump(std::ostream& out);
+
+public:
+    static void update();
+    // ------------------------------------------------------------------------
+    static void addTickTime(float ms);
+    // ------------------------------------------------------------------------
+    static void addBytesSent(ProtocolType type, unsigned bytes)
+    {
+        if (type < PROTOCOL_MAX)
+            m_bytes_sent[type].fetch_add(bytes, std::memory_order_relaxed);
+    }   // addBytesSent
+    // ------------------------------------------------------------------------
+    static void addBytesReceived(ProtocolType type, unsigned bytes)
+    {
+        if (type < PROTOCOL_MAX)
+        {
+            m_bytes_received[type].fetch_add(bytes,
+                                             std::memory_order_relaxed);
+        }
+    }   // addBytesReceived
+    // ------------------------------------------------------------------------
+    /** Adds the time (in microseconds) used to encrypt or decrypt
+     *  messages. */
+    static void addCryptoTime(uint64_t us)
+    {
+        m_crypto_time.fetch_add(us, std::memory_order_relaxed);
+    }   // addCryptoTime
+    // ------------------------------------------------------------------------
+    /** Adds the time from receiving an event to handling it.
+     *  \param index The protocol type of a message, or PROTOCOL_MAX for a
+     *         connect or disconnect event.
+     *  \param us The time in microseconds. */
+    static void addEventLatency(unsigned index, uint64_t us)
+    {
+        if (index > PROTOCOL_MAX)
+            return;
+        m_events[index].fetch_add(1, std::memory_order_relaxed);
+        m_event_latency[index].fetch_add(us, std::memory_order_relaxed);
+        uint64_t max = m_max_event_latency[index].load();
+        while (us > max &&
+               !m_max_event_latency[index].compare_exchange_weak(max, us)) {}
+    }   // addEventLatency
+    // ------------------------------------------------------------------------
+    /** Adds the size of an encoded state message, only called by the main
+     *  thread. */
+    static void addStateMessage(unsigned bytes)
+    {
+        m_state_messages++;
+        m_state_bytes += bytes;
+        if (bytes > m_max_state_bytes)
+            m_max_state_bytes = bytes;
+    }   // addStateMessage
+};   // ServerMetrics
+
+#endif
@@ -0,0 +1,295 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include "network/state_quantizer.hpp"
+
+#include "network/bit_packer.hpp"
+#include "network/network_string.hpp"
+#include "utils/mini_glm.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// ============================================================================
+/** Creates the description of a quantized value.
+ *  \param min Smallest value that can be stored, should be an integer.
+ *  \param max Largest value that can be stored.
+ *  \param precision_exponent The values are stored as multiples of
+ *         2^precision_exponent. If this would need more than 24 bits (which
+ *         could not be dequantized exactly), a lower precision is used.
+ */
+QuantizedFloat::QuantizedFloat(float min, float max, int precision_exponent)
+{
+    m_min = min;
+    while (true)
+    {
+        m_precision = ldexpf(1.0f, precision_exponent);
+        const double steps = std::ceil(((double)max - min) / m_precision);
+        m_bits = 1;
+        while ((double)(uint64_t(1) << m_bits) <= steps)
+            m_bits++;
+        if (m_bits <= 24)
+            break;
+        precision_exponent++;
+    }
+    m_scale = 1.0f / m_precision;
+    m_max_value = (uint32_t(1) << m_bits) - 1;
+}   // QuantizedFloat
+
+// ----------------------------------------------------------------------------
+/** Returns the value to store for f, values outside of the range are
+ *  clamped. */
+uint32_t QuantizedFloat::quantize(float f) const
+{
+    const float v = (f - m_min) * m_scale;
+    // This also handles NaN, for which all comparisons are false
+    if (!(v > 0.0f))
+        return 0;
+    if (v >= (float)m_max_value)
+        return m_max_value;
+    return (uint32_t)((double)v + 0.5);
+}   // quantize
+
+// ----------------------------------------------------------------------------
+/** Writes f, and replaces it with the value the receiver will read. */
+void QuantizedFloat::write(BitWriter* writer, float* f) const
+{
+    const uint32_t value = quantize(*f);
+    writer->write(value, m_bits);
+    *f = dequantize(value);
+}   // write
+
+// ----------------------------------------------------------------------------
+float QuantizedFloat::read(BitReader* reader) const
+{
+    return dequantize(reader->read(m_bits));
+}   // read
+
+// ============================================================================
+QuantizedFloat StateQuantizer::m_position[3] =
+{
+    QuantizedFloat(-1024.0f, 1024.0f, POSITION_PRECISION_EXPONENT),
+    QuantizedFloat(-1024.0f, 1024.0f, POSITION_PRECISION_EXPONENT),
+    QuantizedFloat(-1024.0f, 1024.0f, POSITION_PRECISION_EXPONENT)
+};
+QuantizedFloat StateQuantizer::m_rotation(-1.0f, 1.0f,
+                                          ROTATION_PRECISION_EXPONENT);
+
+// ----------------------------------------------------------------------------
+/** Sets the range of positions from the bounding box of the current track.
+ *  The bounds are rounded to full units, so the server and all clients
+ *  use the same range even if the bounding box is computed slightly
+ *  differently.
+ */
+void StateQuantizer::setTrackBounds(const Vec3& min, const Vec3& max)
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        m_position[i] =
+            QuantizedFloat(std::floor(min[i]) - POSITION_MARGIN,
+                           std::ceil(max[i]) + POSITION_MARGIN,
+                           POSITION_PRECISION_EXPONENT);
+    }
+}   // setTrackBounds
+
+// ----------------------------------------------------------------------------
+void StateQuantizer::writePosition(BitWriter* writer, Vec3* xyz)
+{
+    for (unsigned i = 0; i < 3; i++)
+        m_position[i].write(writer, &(*xyz)[i]);
+}   // writePosition
+
+// ----------------------------------------------------------------------------
+Vec3 StateQuantizer::readPosition(BitReader* reader)
+{
+    const float x = m_position[0].read(reader);
+    const float y = m_position[1].read(reader);
+    const float z = m_position[2].read(reader);
+    return Vec3(x, y, z);
+}   // readPosition
+
+// ----------------------------------------------------------------------------
+/** Computes the rotation from the index of the largest component and the
+ *  stored values of the other three components. Used by the sender and the
+ *  receiver, so both get exactly the same rotation.
+ */
+btQuaternion StateQuantizer::decodeRotation(unsigned largest,
+                                            const uint32_t* values)
+{
+    float c[4];
+    float sum = 0.0f;
+    unsigned j = 0;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        if (i == largest)
+            continue;
+        c[i] = m_rotation.dequantize(values[j++]);
+        sum += c[i] * c[i];
+    }
+    c[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+    btQuaternion q(c[0], c[1], c[2], c[3]);
+    return q.normalize();
+}   // decodeRotation
+
+// ----------------------------------------------------------------------------
+/** Writes a rotation as the index of its largest component (which is not
+ *  stored, it is computed from the others) and the three other components.
+ */
+void StateQuantizer::writeRotation(BitWriter* writer, btQuaternion* q)
+{
+    const btQuaternion n = q->normalized();
+    unsigned largest = 0;
+    for (unsigned i = 1; i < 4; i++)
+    {
+        if (fabsf(n[i]) > fabsf(n[largest]))
+            largest = i;
+    }
+    // q and -q are the same rotation, so the largest component can always
+    // be positive
+    const float sign = n[largest] < 0.0f ? -1.0f : 1.0f;
+    writer->write(largest, 2);
+    uint32_t values[3];
+    unsigned j = 0;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        if (i == largest)
+            continue;
+        values[j] = m_rotation.quantize(n[i] * sign);
+        writer->write(values[j], m_rotation.getBits());
+        j++;
+    }
+    *q = decodeRotation(largest, values);
+}   // writeRotation
+
+// ----------------------------------------------------------------------------
+btQuaternion StateQuantizer::readRotation(BitReader* reader)
+{
+    const unsigned largest = reader->read(2);
+    uint32_t values[3];
+    for (unsigned i = 0; i < 3; i++)
+        values[i] = reader->read(m_rotation.getBits());
+    return decodeRotation(largest, values);
+}   // readRotation
+
+// ----------------------------------------------------------------------------
+void StateQuantizer::writeHalfVec3(BitWriter* writer, Vec3* v)
+{
+    for (unsigned i = 0; i < 3; i++)
+    {
+        const short h = MiniGLM::toFloat16((*v)[i]);
+        writer->write((uint16_t)h, 16);
+        (*v)[i] = MiniGLM::toFloat32(h);
+    }
+}   // writeHalfVec3
+
+// ----------------------------------------------------------------------------
+Vec3 StateQuantizer::readHalfVec3(BitReader* reader)
+{
+    const float x = MiniGLM::toFloat32((short)reader->read(16));
+    const float y = MiniGLM::toFloat32((short)reader->read(16));
+    const float z = MiniGLM::toFloat32((short)reader->read(16));
+    return Vec3(x, y, z);
+}   // readHalfVec3
+
+// ----------------------------------------------------------------------------
+void StateQuantizer::unitTesting()
+{
+    // Bit packing with different sizes, followed by byte aligned data
+    BareNetworkString bits;
+    {
+        BitWriter writer(&bits);
+        writer.write(5, 3);
+        writer.writeBool(true);
+        writer.write(0xdeadbeef, 32);
+        writer.write(0x1234, 17);
+        writer.write(0, 1);
+    }
+    bits.addUInt8(0x42);
+    assert(bits.getTotalSize() == 8);
+    {
+        BitReader reader(&bits);
+        assert(reader.read(3) == 5);
+        assert(reader.readBool());
+        assert(reader.read(32) == 0xdeadbeef);
+        assert(reader.read(17) == 0x1234);
+        assert(reader.read(1) == 0);
+    }
+    assert(bits.getUInt8() == 0x42);
+
+    // Quantized values: rounding, clamping and exact dequantization
+    QuantizedFloat qf(-10.0f, 10.0f, -4);
+    assert(qf.getBits() == 9);
+    assert(qf.quantize(-10.0f) == 0);
+    assert(qf.quantize(-20.0f) == 0);
+    assert(qf.quantize(std::nanf("")) == 0);
+    assert(qf.quantize(100.0f) == 511);
+    assert(qf.dequantize(qf.quantize(1.03f)) == 1.0f);
+    assert(qf.dequantize(qf.quantize(1.04f)) == 1.0625f);
+    for (float f = -10.0f; f <= 10.0f; f += 0.013f)
+    {
+        assert(fabsf(qf.dequantize(qf.quantize(f)) - f) <=
+               qf.getPrecision() * 0.5f);
+        assert(qf.quantize(qf.dequantize(qf.quantize(f))) ==
+               qf.quantize(f));
+    }
+    // A range needing more than 24 bits uses a lower precision
+    assert(QuantizedFloat(0.0f, 100000.0f, -9).getBits() == 24);
+
+    // The server writes a state and continues with the values it wrote, a
+    // client reads the state. Both must have exactly the same values, and
+    // saving these values again must give the same data, so an unchanged
+    // object has the same state on the server and all clients.
+    StateQuantizer::setTrackBounds(Vec3(-123.4f, -5.5f, -300.0f),
+                                   Vec3(250.7f, 40.0f, 12.3f));
+    for (int i = 0; i < 200; i++)
+    {
+        const float a = i * 0.37f;
+        Vec3 xyz(sinf(a) * 180.0f + 60.0f, cosf(a) * 20.0f,
+                 sinf(a * 0.3f) * 150.0f - 140.0f);
+        btQuaternion q(Vec3(sinf(a), 1.0f, cosf(a * 1.7f)).normalize(),
+                       a * 2.1f);
+        Vec3 velocity(sinf(a) * 30.0f, a - 40.0f, 0.01f * i);
+
+        BareNetworkString server;
+        {
+            BitWriter writer(&server);
+            StateQuantizer::writePosition(&writer, &xyz);
+            StateQuantizer::writeRotation(&writer, &q);
+            StateQuantizer::writeHalfVec3(&writer, &velocity);
+        }
+
+        BareNetworkString client(server.getData(), server.getTotalSize());
+        BitReader reader(&client);
+        BareNetworkString client_values, server_values;
+        client_values.add(StateQuantizer::readPosition(&reader));
+        client_values.add(StateQuantizer::readRotation(&reader));
+        client_values.add(StateQuantizer::readHalfVec3(&reader));
+        server_values.add(xyz).add(q).add(velocity);
+        assert(client.size() == 0);
+        assert(client_values.getBuffer() == server_values.getBuffer());
+
+        BareNetworkString again;
+        {
+            BitWriter writer(&again);
+            StateQuantizer::writePosition(&writer, &xyz);
+            StateQuantizer::writeRotation(&writer, &q);
+            StateQuantizer::writeHalfVec3(&writer, &velocity);
+        }
+        assert(again.getBuffer() == server.getBuffer());
+    }
+}   // unitTesting
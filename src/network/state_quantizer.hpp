@@ -0,0 +1,115 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_STATE_QUANTIZER_HPP
+#define HEADER_STATE_QUANTIZER_HPP
+
+#include "utils/types.hpp"
+#include "utils/vec3.hpp"
+
+#include "LinearMath/btQuaternion.h"
+
+class BitReader;
+class BitWriter;
+
+/** \ingroup network
+ *  Describes how a float value of a state is quantized: values between a
+ *  minimum and a maximum are stored as multiples of a precision, using as
+ *  many bits as the range needs. The precision is a power of two and the
+ *  minimum should be an integer, then the dequantized values are computed
+ *  exactly, and quantizing them again gives the same value.
+ */
+class QuantizedFloat
+{
+private:
+    float    m_min;
+    float    m_precision;
+    /** 1 / m_precision. */
+    float    m_scale;
+    uint32_t m_max_value;
+    unsigned m_bits;
+
+public:
+    QuantizedFloat(float min = -1.0f, float max = 1.0f,
+                   int precision_exponent = -8);
+    // ------------------------------------------------------------------------
+    uint32_t quantize(float f) const;
+    // ------------------------------------------------------------------------
+    float dequantize(uint32_t value) const
+    {
+        return m_min + (float)value * m_precision;
+    }   // dequantize
+    // ------------------------------------------------------------------------
+    void write(BitWriter* writer, float* f) const;
+    // ------------------------------------------------------------------------
+    float read(BitReader* reader) const;
+    // ------------------------------------------------------------------------
+    unsigned getBits() const                               { return m_bits; }
+    // ------------------------------------------------------------------------
+    float getPrecision() const                        { return m_precision; }
+};   // QuantizedFloat
+
+// ============================================================================
+/** \ingroup network
+ *  The quantization used for the physics values in network states, which
+ *  any rewinder can use with a BitWriter and BitReader:
+ *  - positions are stored relative to the bounds of the current track,
+ *  - rotations store the three smallest components of the quaternion,
+ *  - velocities and similar vectors are stored as half floats.
+ *  The write functions replace the written value with the value the
+ *  receiver will read, so the sender can continue with exactly the same
+ *  values as the receivers.
+ */
+class StateQuantizer
+{
+private:
+    static QuantizedFloat m_position[3];
+    static QuantizedFloat m_rotation;
+
+    static btQuaternion decodeRotation(unsigned largest,
+                                       const uint32_t* values);
+
+public:
+    /** Precision of positions: 2^-9 m, i.e. about 2 mm. */
+    static const int POSITION_PRECISION_EXPONENT = -9;
+
+    /** Precision of the three smallest quaternion components. */
+    static const int ROTATION_PRECISION_EXPONENT = -14;
+
+    /** Positions this far outside of the track bounds can still be stored
+     *  (e.g. falling karts before they are rescued). */
+    static const int POSITION_MARGIN = 64;
+
+    static void setTrackBounds(const Vec3& min, const Vec3& max);
+    // ------------------------------------------------------------------------
+    static void writePosition(BitWriter* writer, Vec3* xyz);
+    // ------------------------------------------------------------------------
+    static Vec3 readPosition(BitReader* reader);
+    // ------------------------------------------------------------------------
+    static void writeRotation(BitWriter* writer, btQuaternion* q);
+    // ------------------------------------------------------------------------
+    static btQuaternion readRotation(BitReader* reader);
+    // ------------------------------------------------------------------------
+    static void writeHalfVec3(BitWriter* writer, Vec3* v);
+    // ------------------------------------------------------------------------
+    static Vec3 readHalfVec3(BitReader* reader);
+    // ------------------------------------------------------------------------
+    static void unitTesting();
+};   // StateQuantizer
+
+#endif
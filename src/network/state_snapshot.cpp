@@ -0,0 +1,390 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#include "network/state_snapshot.hpp"
+
+#include "network/network_string.hpp"
+
+#include <stdexcept>
+#include <string.h>
+
+// ----------------------------------------------------------------------------
+/** Clears all saved states and sets the time of this snapshot.
+ *  \param ticks World ticks at which this snapshot is taken.
+ */
+void StateSnapshot::reset(int ticks)
+{
+    m_ticks = ticks;
+    m_rewinder_using.clear();
+    m_data.getBuffer().clear();
+    m_data.reset();
+    m_offsets.clear();
+    m_offsets.push_back(0);
+}   // reset
+
+// ----------------------------------------------------------------------------
+/** Adds the data written to the buffer of this snapshot (see getBuffer())
+ *  since the previous call as the state of the given rewinder.
+ *  \param id Rewinder id of the rewinder which wrote the state.
+ */
+void StateSnapshot::addState(uint16_t id)
+{
+    m_rewinder_using.push_back(id);
+    m_offsets.push_back(m_data.getTotalSize());
+}   // addState
+
+// ----------------------------------------------------------------------------
+/** Adds a state of another snapshot to this snapshot.
+ *  \param from The snapshot to copy the state from.
+ *  \param index Index of the state in the other snapshot.
+ */
+void StateSnapshot::copyState(const StateSnapshot& from, unsigned index)
+{
+    const uint8_t* data = from.getData() + from.m_offsets[index];
+    m_data.getBuffer().insert(m_data.getBuffer().end(), data,
+                              data + from.m_offsets[index + 1] -
+                              from.m_offsets[index]);
+    addState(from.m_rewinder_using[index]);
+}   // copyState
+
+// ----------------------------------------------------------------------------
+/** Returns the index of the state of the rewinder with the given id, or
+ *  -1 if it is not in this snapshot. Since the rewinder order rarely changes
+ *  between two snapshots, the hint index is tested first.
+ *  \param id Rewinder id of the rewinder.
+ *  \param hint Index to check first.
+ */
+int StateSnapshot::findRewinder(uint16_t id, unsigned hint) const
+{
+    if (hint < m_rewinder_using.size() && m_rewinder_using[hint] == id)
+        return (int)hint;
+    for (unsigned i = 0; i < m_rewinder_using.size(); i++)
+    {
+        if (m_rewinder_using[i] == id)
+            return (int)i;
+    }
+    return -1;
+}   // findRewinder
+
+// ----------------------------------------------------------------------------
+/** Returns the state of a rewinder in this snapshot.
+ *  \param id Rewinder id of the rewinder.
+ *  \param size On return the size of the state.
+ *  \return The state data, or NULL if the rewinder has no state.
+ */
+const uint8_t* StateSnapshot::getState(uint16_t id, unsigned* size) const
+{
+    int i = findRewinder(id, id);
+    if (i == -1)
+        return NULL;
+    *size = m_offsets[i + 1] - m_offsets[i];
+    return getData() + m_offsets[i];
+}   // getState
+
+// ----------------------------------------------------------------------------
+/** Writes the difference between a state and its baseline as a sequence of
+ *  (number of bytes to copy from baseline, number of new bytes, new bytes).
+ *  A single unchanged byte between changed bytes is kept in the run of new
+ *  bytes, since starting a new run would take two bytes.
+ */
+void StateSnapshot::encodeDelta(const uint8_t* cur, const uint8_t* base,
+                                unsigned size, BareNetworkString* out)
+{
+    unsigned i = 0;
+    while (i < size)
+    {
+        unsigned same = 0;
+        while (i + same < size && same < 255 && cur[i + same] == base[i + same])
+            same++;
+        i += same;
+        unsigned diff = 0;
+        while (i + diff < size && diff < 255)
+        {
+            if (cur[i + diff] == base[i + diff] &&
+                (i + diff + 1 >= size ||
+                 cur[i + diff + 1] == base[i + diff + 1]))
+                break;
+            diff++;
+        }
+        out->addUInt8((uint8_t)same).addUInt8((uint8_t)diff);
+        for (unsigned j = 0; j < diff; j++)
+            out->addUInt8(cur[i + j]);
+        i += diff;
+    }
+}   // encodeDelta
+
+// ----------------------------------------------------------------------------
+/** Reconstructs a state from its baseline and the runs written by
+ *  encodeDelta.
+ */
+void StateSnapshot::decodeDelta(const BareNetworkString& in,
+                                const uint8_t* base, unsigned size,
+                                uint8_t* out)
+{
+    unsigned i = 0;
+    while (i < size)
+    {
+        if (in.size() < 2)
+            throw std::out_of_range("Delta state out of range.");
+        unsigned same = in.getUInt8();
+        unsigned diff = in.getUInt8();
+        if (i + same + diff > size || in.size() < diff)
+            throw std::out_of_range("Delta state out of range.");
+        memcpy(out + i, base + i, same);
+        i += same;
+        memcpy(out + i, in.getCurrentData(), diff);
+        in.skip(diff);
+        i += diff;
+    }
+}   // decodeDelta
+
+// ----------------------------------------------------------------------------
+/** Writes all rewinder ids and states of this snapshot into a state
+ *  message. If a baseline is given, each state that also exists in the
+ *  baseline with the same size is delta encoded against it, otherwise the
+ *  full state is written.
+ *  \param out The message to append to.
+ *  \param baseline The snapshot confirmed by the receiving client, or NULL
+ *         to write a full (key frame) state.
+ *  \param replace_id Id of a rewinder whose state depends on the receiving
+ *         client, or -1. Its state is always written in full from
+ *         replacement, since the client's copy of the baseline can differ.
+ *  \param replacement The state to write for rewinder replace_id.
+ */
+void StateSnapshot::encode(BareNetworkString* out,
+                           const StateSnapshot* baseline, int replace_id,
+                           const BareNetworkString* replacement) const
+{
+    out->addUInt8((uint8_t)m_rewinder_using.size());
+    for (uint16_t id : m_rewinder_using)
+        out->addUInt16(id);
+
+    for (unsigned i = 0; i < m_rewinder_using.size(); i++)
+    {
+        const uint8_t* cur = getData() + m_offsets[i];
+        unsigned size = m_offsets[i + 1] - m_offsets[i];
+        if (m_rewinder_using[i] == replace_id)
+        {
+            cur = (const uint8_t*)replacement->getData();
+            size = replacement->getTotalSize();
+            out->addUInt8(SE_FULL).addUInt16((uint16_t)size);
+            out->getBuffer().insert(out->getBuffer().end(), cur, cur + size);
+            continue;
+        }
+        int j = baseline ? baseline->findRewinder(m_rewinder_using[i], i) : -1;
+        if (j != -1 &&
+            baseline->m_offsets[j + 1] - baseline->m_offsets[j] == size)
+        {
+            const uint8_t* base = baseline->getData() +
+                baseline->m_offsets[j];
+            if (memcmp(cur, base, size) == 0)
+            {
+                out->addUInt8(SE_SAME);
+                continue;
+            }
+            // Fall back to the full state if the delta is not smaller
+            const unsigned start = out->getTotalSize();
+            out->addUInt8(SE_DELTA);
+            encodeDelta(cur, base, size, out);
+            if (out->getTotalSize() - start < size + 3)
+                continue;
+            out->getBuffer().resize(start);
+        }
+        out->addUInt8(SE_FULL).addUInt16((uint16_t)size);
+        out->getBuffer().insert(out->getBuffer().end(), cur, cur + size);
+    }
+}   // encode
+
+// ----------------------------------------------------------------------------
+/** Reads all rewinder ids and states from a state message written by
+ *  encode(). The ticks of this snapshot must be set before with reset().
+ *  \param in The message, with the read offset at the start of the
+ *         rewinder ids.
+ *  \param baseline The snapshot the message was encoded against, or NULL if
+ *         it is a full state.
+ */
+void StateSnapshot::decode(const BareNetworkString& in,
+                           const StateSnapshot* baseline)
+{
+    unsigned count = in.getUInt8();
+    m_rewinder_using.resize(count);
+    for (unsigned i = 0; i < count; i++)
+        m_rewinder_using[i] = in.getUInt16();
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        uint8_t encoding = in.getUInt8();
+        if (encoding == SE_FULL)
+        {
+            unsigned size = in.getUInt16();
+            if (in.size() < size)
+                throw std::out_of_range("Full state out of range.");
+            const uint8_t* data = (const uint8_t*)in.getCurrentData();
+            m_data.getBuffer().insert(m_data.getBuffer().end(), data,
+                                      data + size);
+            in.skip(size);
+            m_offsets.push_back(m_data.getTotalSize());
+            continue;
+        }
+
+        int j = baseline ? baseline->findRewinder(m_rewinder_using[i], i) : -1;
+        if (j == -1)
+            throw std::invalid_argument("Missing baseline state.");
+        const unsigned size = baseline->m_offsets[j + 1] -
+            baseline->m_offsets[j];
+        const uint8_t* base = baseline->getData() + baseline->m_offsets[j];
+        std::vector<uint8_t>& data = m_data.getBuffer();
+        const unsigned start = (unsigned)data.size();
+        data.resize(start + size);
+        if (encoding == SE_SAME)
+            memcpy(data.data() + start, base, size);
+        else if (encoding == SE_DELTA)
+            decodeDelta(in, base, size, data.data() + start);
+        else
+            throw std::invalid_argument("Unknown state encoding.");
+        m_offsets.push_back((unsigned)data.size());
+    }
+}   // decode
+
+// ----------------------------------------------------------------------------
+/** Writes all states in the format used by RewindInfoState, i.e. each state
+ *  prefixed by its size as 16 bit integer.
+ *  \param out The buffer to fill.
+ */
+void StateSnapshot::getFullState(std::vector<uint8_t>* out) const
+{
+    out->clear();
+    out->reserve(getDataSize() + 2 * getNumStates());
+    for (unsigned i = 0; i < getNumStates(); i++)
+    {
+        const unsigned size = m_offsets[i + 1] - m_offsets[i];
+        out->push_back((size >> 8) & 0xff);
+        out->push_back(size & 0xff);
+        out->insert(out->end(), getData() + m_offsets[i],
+                    getData() + m_offsets[i + 1]);
+    }
+}   // getFullState
+
+// ----------------------------------------------------------------------------
+/** Returns the number of bytes allocated by this snapshot. Since snapshots
+ *  are reused, this only changes if a state needed more memory than any
+ *  state saved before.
+ */
+size_t StateSnapshot::getCapacity() const
+{
+    return m_data.getBuffer().capacity() +
+        m_rewinder_using.capacity() * sizeof(uint16_t) +
+        m_offsets.capacity() * sizeof(unsigned);
+}   // getCapacity
+
+// ----------------------------------------------------------------------------
+/** Unit testing function. Tests that full, delta and unchanged states are
+ *  reconstructed correctly on the receiving side.
+ */
+void StateSnapshot::unitTesting()
+{
+    StateSnapshot baseline(1);
+    for (unsigned i = 0; i < 40; i++)
+        baseline.getBuffer()->addUInt8((uint8_t)i);
+    baseline.addState(0);
+    baseline.getBuffer()->addFloat(1.0f).addFloat(2.0f).addFloat(3.0f);
+    baseline.addState(1);
+    baseline.getBuffer()->addUInt16(7);
+    baseline.addState(2);
+
+    // Rewinder 1 changes a few bytes, rewinder 0 is unchanged and rewinder 2
+    // changes its size. The order of rewinders is different to the baseline.
+    StateSnapshot cur(2);
+    cur.getBuffer()->addFloat(1.0f).addFloat(2.5f).addFloat(3.0f);
+    cur.addState(1);
+    for (unsigned i = 0; i < 40; i++)
+        cur.getBuffer()->addUInt8((uint8_t)i);
+    cur.addState(0);
+    cur.getBuffer()->addUInt16(7).addUInt16(8);
+    cur.addState(2);
+
+    BareNetworkString full, delta;
+    cur.encode(&full, NULL);
+    cur.encode(&delta, &baseline);
+    assert(delta.size() < full.size());
+
+    StateSnapshot from_full(2), from_delta(2);
+    from_full.decode(full, NULL);
+    from_delta.decode(delta, &baseline);
+    assert(full.size() == 0);
+    assert(delta.size() == 0);
+    assert(from_full.m_rewinder_using == cur.m_rewinder_using);
+    assert(from_delta.m_rewinder_using == cur.m_rewinder_using);
+    assert(from_full.m_data.getBuffer() == cur.m_data.getBuffer());
+    assert(from_delta.m_data.getBuffer() == cur.m_data.getBuffer());
+    assert(from_delta.m_offsets == cur.m_offsets);
+
+    unsigned size = 0;
+    const uint8_t* state = from_delta.getState(2, &size);
+    assert(state && size == 4 && state[1] == 7 && state[3] == 8);
+    assert(from_delta.getState(3, &size) == NULL);
+
+    // A replaced state is written in full, even if the baseline has the same
+    // state, and the other states are still delta encoded
+    BareNetworkString replacement, replaced;
+    replacement.addUInt8(42).addUInt8(43).addUInt8(44);
+    cur.encode(&replaced, &baseline, 1, &replacement);
+    StateSnapshot from_replaced(2);
+    from_replaced.decode(replaced, &baseline);
+    state = from_replaced.getState(1, &size);
+    assert(state && size == 3 && state[0] == 42 && state[2] == 44);
+    state = from_replaced.getState(2, &size);
+    assert(state && size == 4 && state[3] == 8);
+
+    // A snapshot with only some of the states, e.g. without the karts far
+    // away from a client, can be encoded and decoded against its baseline
+    StateSnapshot partial(2);
+    partial.copyState(cur, 2);
+    partial.copyState(cur, 0);
+    BareNetworkString partial_delta;
+    partial.encode(&partial_delta, &baseline);
+    StateSnapshot from_partial(2);
+    from_partial.decode(partial_delta, &baseline);
+    assert(from_partial.getNumStates() == 2);
+    assert(from_partial.getRewinderId(0) == 2);
+    assert(from_partial.getState(0, &size) == NULL);
+    state = from_partial.getState(2, &size);
+    assert(state && size == 4 && state[3] == 8);
+
+    // A reused snapshot does not need to allocate memory for a state which
+    // is not larger than a previous one
+    const size_t capacity = cur.getCapacity();
+    cur.reset(3);
+    cur.getBuffer()->addUInt16(7).addUInt16(8);
+    cur.addState(2);
+    assert(cur.getCapacity() == capacity);
+
+    // A delta state can not be decoded without its baseline
+    delta.reset();
+    StateSnapshot missing(2);
+    bool has_exception = false;
+    try
+    {
+        missing.decode(delta, NULL);
+    }
+    catch (std::exception&)
+    {
+        has_exception = true;
+    }
+    assert(has_exception);
+}   // unitTesting
@@ -0,0 +1,121 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_STATE_SNAPSHOT_HPP
+#define HEADER_STATE_SNAPSHOT_HPP
+
+#include "network/network_string.hpp"
+#include "utils/types.hpp"
+
+#include <vector>
+
+/** \ingroup network
+ *  Stores the states of all rewinders taken at the same world ticks, each
+ *  state stored one after another in one continuous buffer. The server keeps
+ *  the latest snapshots, and uses the latest one confirmed by a client as
+ *  baseline to delta compress the next state sent to that client. The client
+ *  keeps the snapshots it decoded so that it can apply the deltas again.
+ *  A rewinder state is encoded either in full, as a list of byte runs that
+ *  are copied from or differ from the baseline, or as unchanged.
+ *  On the server the rewinders write their states directly into the buffer
+ *  of a snapshot, and snapshots are reused, so that after the first few
+ *  states no memory needs to be allocated for saving a state.
+ */
+class StateSnapshot
+{
+public:
+    /** How a single rewinder state is encoded in a state message. */
+    enum StateEncoding : uint8_t
+    {
+        SE_FULL  = 0,  //!< Full state data follows.
+        SE_DELTA = 1,  //!< Runs of copied and new bytes against baseline.
+        SE_SAME  = 2   //!< State is identical to the baseline.
+    };
+
+private:
+    /** World ticks at which this snapshot was taken. */
+    int m_ticks;
+
+    /** Rewinder ids of all rewinders in this snapshot. */
+    std::vector<uint16_t> m_rewinder_using;
+
+    /** The states of all rewinders. */
+    BareNetworkString m_data;
+
+    /** Offset of each rewinder state in m_data, with one additional entry
+     *  at the end so that the size of state i is m_offsets[i+1]-m_offsets[i].
+     */
+    std::vector<unsigned> m_offsets;
+
+    // ------------------------------------------------------------------------
+    const uint8_t* getData() const
+                               { return (const uint8_t*)m_data.getData(); }
+    // ------------------------------------------------------------------------
+    int findRewinder(uint16_t id, unsigned hint) const;
+    // ------------------------------------------------------------------------
+    static void encodeDelta(const uint8_t* cur, const uint8_t* base,
+                            unsigned size, BareNetworkString* out);
+    // ------------------------------------------------------------------------
+    static void decodeDelta(const BareNetworkString& in, const uint8_t* base,
+                            unsigned size, uint8_t* out);
+
+public:
+    static void unitTesting();
+    // ------------------------------------------------------------------------
+    StateSnapshot(int ticks = -1)                         { reset(ticks); }
+    // ------------------------------------------------------------------------
+    void reset(int ticks);
+    // ------------------------------------------------------------------------
+    void addState(uint16_t id);
+    // ------------------------------------------------------------------------
+    void copyState(const StateSnapshot& from, unsigned index);
+    // ------------------------------------------------------------------------
+    void encode(BareNetworkString* out, const StateSnapshot* baseline,
+                int replace_id = -1,
+                const BareNetworkString* replacement = NULL) const;
+    // ------------------------------------------------------------------------
+    void decode(const BareNetworkString& in, const StateSnapshot* baseline);
+    // ------------------------------------------------------------------------
+    void getFullState(std::vector<uint8_t>* out) const;
+    // ------------------------------------------------------------------------
+    const uint8_t* getState(uint16_t id, unsigned* size) const;
+    // ------------------------------------------------------------------------
+    size_t getCapacity() const;
+    // ------------------------------------------------------------------------
+    /** Returns the buffer rewinders write their states to, see addState. */
+    BareNetworkString* getBuffer()                          { return &m_data; }
+    // ------------------------------------------------------------------------
+    const std::vector<uint16_t>& getRewinderUsing() const
+                                                   { return m_rewinder_using; }
+    // ------------------------------------------------------------------------
+    /** Returns the world ticks at which this snapshot was taken. */
+    int getTicks() const                                    { return m_ticks; }
+    // ------------------------------------------------------------------------
+    /** Returns the rewinder id of the state with the given index. */
+    uint16_t getRewinderId(unsigned index) const
+                                            { return m_rewinder_using[index]; }
+    // ------------------------------------------------------------------------
+    /** Returns the number of rewinder states in this snapshot. */
+    unsigned getNumStates() const  { return (unsigned)m_offsets.size() - 1; }
+    // ------------------------------------------------------------------------
+    /** Returns the size in bytes of all rewinder states together. */
+    unsigned getDataSize() const        { return m_data.getTotalSize(); }
+
+};   // class StateSnapshot
+
+#endif
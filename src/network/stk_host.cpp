@@ -21,6 +21,9 @@
 #include "config/stk_config.hpp"
 #include "config/user_config.hpp"
 #include "io/file_manager.hpp"
+#include "main_loop.hpp"
+#include "network/crypto.hpp"
+#include "network/encryption_pool.hpp"
 #include "network/event.hpp"
 #include "network/game_setup.hpp"
 #include "network/network_config.hpp"
@@ -31,6 +34,7 @@
 #include "network/protocols/server_lobby.hpp"
 #include "network/protocol_manager.hpp"
 #include "network/server_config.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_peer.hpp"
 #include "utils/log.hpp"
 #include "utils/separate_process.hpp"
@@ -261,7 +265,7 @@ constexpr bool isPingPacket(unsigned char* data, size_t length)
 // ============================================================================
 /** The constructor for a server or client.
  */
-STKHost::STKHost(bool server)
+STKHost::STKHost(bool server) : m_enet_cmd(4096)
 {
     init();
     m_host_id = std::numeric_limits<uint32_t>::max();
@@ -297,7 +301,11 @@ STKHost::STKHost(bool server)
     }
     setPrivatePort();
     if (server)
+    {
         Log::info("STKHost", "Server port is %d", m_private_port);
+        m_encryption_pool.reset(
+            new EncryptionPool(EncryptionPool::getDefaultNumThreads()));
+    }
 }   // STKHost
 
 // ----------------------------------------------------------------------------
@@ -322,6 +330,28 @@ void STKHost::init()
     }
 
     Log::info("STKHost", "Host initialized.");
+
+    m_listening_thread_waiting.store(false);
+    m_wake_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+    if (m_wake_socket != ENET_SOCKET_NULL)
+    {
+        m_wake_address.host = ENET_HOST_TO_NET_32(0x7f000001);
+        m_wake_address.port = 0;
+        if (enet_socket_bind(m_wake_socket, &m_wake_address) != 0 ||
+            enet_socket_get_address(m_wake_socket, &m_wake_address) != 0 ||
+            enet_socket_set_option(m_wake_socket, ENET_SOCKOPT_NONBLOCK, 1)
+            != 0)
+        {
+            enet_socket_destroy(m_wake_socket);
+            m_wake_socket = ENET_SOCKET_NULL;
+        }
+    }
+    if (m_wake_socket == ENET_SOCKET_NULL)
+    {
+        Log::warn("STKHost", "No wake up socket available, packets will be "
+            "sent with a delay of up to 10 ms.");
+    }
+
     Network::openLog();  // Open packet log file
     ProtocolManager::createInstance();
 
@@ -347,11 +377,172 @@ STKHost::~STKHost()
     Network::closeLog();
     stopListening();
 
+    ENetCommand command;
+    while (m_enet_cmd.pop(&command))
+    {
+        if (std::get<3>(command) == ECT_SEND_PACKET)
+            enet_packet_destroy(std::get<1>(command));
+    }
+    if (m_wake_socket != ENET_SOCKET_NULL)
+        enet_socket_destroy(m_wake_socket);
+
     delete m_network;
     enet_deinitialize();
     delete m_separate_process;
 }   // ~STKHost
 
+//-----------------------------------------------------------------------------
+/** Adds a command to be executed by the listening thread, without waking it
+ *  up (see wakeListeningThread). This can be called from any thread.
+ *  \param command The command.
+ */
+void STKHost::queueEnetCommand(const ENetCommand& command)
+{
+    // If the queue is full the command is kept in its overflow list, so the
+    // caller (which can be the listening thread itself) never waits
+    m_enet_cmd.push(command);
+}   // queueEnetCommand
+
+//-----------------------------------------------------------------------------
+/** Wakes up the listening thread if it is waiting for network events, so
+ *  that it executes the queued commands. This can be called from any
+ *  thread.
+ */
+void STKHost::wakeListeningThread()
+{
+    // Together with the fence in waitForNetwork this makes sure that either
+    // the listening thread sees the new command before waiting, or this
+    // thread sees that it is waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_wake_socket == ENET_SOCKET_NULL ||
+        !m_listening_thread_waiting.exchange(false))
+        return;
+    uint8_t wake = 0;
+    ENetBuffer buffer;
+    buffer.data = &wake;
+    buffer.dataLength = 1;
+    enet_socket_send(m_wake_socket, &m_wake_address, &buffer, 1);
+}   // wakeListeningThread
+
+//-----------------------------------------------------------------------------
+/** Called from the listening thread to wait till a network event is
+ *  received, a command is added, or the timeout is reached.
+ *  \param host The ENet host to wait for.
+ *  \param timeout Maximum time to wait in ms.
+ */
+void STKHost::waitForNetwork(ENetHost* host, uint32_t timeout)
+{
+    m_listening_thread_waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_enet_cmd.empty())
+    {
+        m_listening_thread_waiting.store(false);
+        return;
+    }
+
+    ENetSocketSet read_set;
+    ENET_SOCKETSET_EMPTY(read_set);
+    ENET_SOCKETSET_ADD(read_set, host->socket);
+    ENetSocket max_socket = host->socket;
+    if (m_wake_socket != ENET_SOCKET_NULL)
+    {
+        ENET_SOCKETSET_ADD(read_set, m_wake_socket);
+        max_socket = std::max(max_socket, m_wake_socket);
+    }
+    enet_socketset_select(max_socket, &read_set, NULL, timeout);
+    m_listening_thread_waiting.store(false);
+
+    if (m_wake_socket != ENET_SOCKET_NULL &&
+        ENET_SOCKETSET_CHECK(read_set, m_wake_socket))
+    {
+        uint8_t wake[16];
+        ENetBuffer buffer;
+        buffer.data = wake;
+        buffer.dataLength = sizeof(wake);
+        while (enet_socket_receive(m_wake_socket, NULL, &buffer, 1) > 0) {}
+    }
+}   // waitForNetwork
+
+//-----------------------------------------------------------------------------
+/** Executes a command in the listening thread.
+ *  \param host The ENet host.
+ *  \param command The command.
+ */
+void STKHost::executeEnetCommand(ENetHost* host, const ENetCommand& command)
+{
+    switch (std::get<3>(command))
+    {
+    case ECT_SEND_PACKET:
+        enet_peer_send(std::get<0>(command), (uint8_t)std::get<2>(command),
+            std::get<1>(command));
+        break;
+    case ECT_DISCONNECT:
+        enet_peer_disconnect(std::get<0>(command), std::get<2>(command));
+        break;
+    case ECT_RESET:
+    {
+        // Flush enet before reset (so previous command is send)
+        enet_host_flush(host);
+        enet_peer_reset(std::get<0>(command));
+        // Remove the stk peer of it
+        std::lock_guard<std::mutex> lock(m_peers_mutex);
+        m_peers.erase(std::get<0>(command));
+        break;
+    }
+    }
+}   // executeEnetCommand
+
+//-----------------------------------------------------------------------------
+/** Delays a command to simulate the network conditions set in
+ *  NetworkConfig, or drops it if it is an unreliable packet which is lost.
+ *  The commands keep their order, since reliable messages must not be
+ *  reordered, so the jitter only changes the delay between messages.
+ *  \param command The command.
+ */
+void STKHost::delayEnetCommand(const ENetCommand& command)
+{
+    const NetworkConfig* config = NetworkConfig::get();
+    if (std::get<3>(command) == ECT_SEND_PACKET &&
+        (std::get<1>(command)->flags & ENET_PACKET_FLAG_RELIABLE) == 0 &&
+        std::uniform_real_distribution<float>()(m_simulation_random) <
+        config->getSimulatedLoss())
+    {
+        enet_packet_destroy(std::get<1>(command));
+        return;
+    }
+    uint64_t time = StkTime::getRealTimeMs() + config->getSimulatedLatency();
+    if (config->getSimulatedJitter() > 0)
+    {
+        time += std::uniform_int_distribution<unsigned>(0,
+            config->getSimulatedJitter())(m_simulation_random);
+    }
+    if (!m_delayed_enet_cmd.empty())
+        time = std::max(time, m_delayed_enet_cmd.back().first);
+    m_delayed_enet_cmd.emplace_back(time, command);
+}   // delayEnetCommand
+
+//-----------------------------------------------------------------------------
+/** Executes all delayed commands which are due.
+ *  \param host The ENet host.
+ *  \param timeout Maximum time to wait for network events.
+ *  \return Time to wait for network events, which is shortened so that the
+ *          next delayed command is executed in time.
+ */
+uint32_t STKHost::executeDelayedEnetCommands(ENetHost* host, uint32_t timeout)
+{
+    const uint64_t now = StkTime::getRealTimeMs();
+    while (!m_delayed_enet_cmd.empty() &&
+           m_delayed_enet_cmd.front().first <= now)
+    {
+        executeEnetCommand(host, m_delayed_enet_cmd.front().second);
+        m_delayed_enet_cmd.pop_front();
+    }
+    if (m_delayed_enet_cmd.empty())
+        return timeout;
+    return (uint32_t)std::min<uint64_t>(timeout,
+        m_delayed_enet_cmd.front().first - now);
+}   // executeDelayedEnetCommands
+
 //-----------------------------------------------------------------------------
 /** Called from the main thread when the network infrastructure is to be shut
  *  down.
@@ -670,7 +861,29 @@ bool STKHost::connect(const TransportAddress& address)
 void STKHost::startListening()
 {
     m_exit_timeout.store(std::numeric_limits<uint64_t>::max());
-    m_listening_thread = std::thread(std::bind(&STKHost::mainLoop, this));
+    const NetworkConfig* nc = NetworkConfig::get();
+    if (!m_packet_capture && !nc->getPacketCaptureFile().empty())
+    {
+        m_packet_capture.reset(new PacketCapture(nc->getPacketCaptureFile(),
+                                                 /*write*/true));
+        if (m_packet_capture->isOpen())
+        {
+            Log::info("STKHost", "Capturing received packets to '%s'.",
+                      nc->getPacketCaptureFile().c_str());
+        }
+        else
+            m_packet_capture.reset();
+    }
+    if (nc->isServer() && !nc->getPacketReplayFile().empty())
+    {
+        m_listening_thread =
+            std::thread(std::bind(&STKHost::replayLoop, this));
+    }
+    else
+    {
+        m_listening_thread =
+            std::thread(std::bind(&STKHost::mainLoop, this));
+    }
 }   // startListening
 
 // ----------------------------------------------------------------------------
@@ -699,6 +912,14 @@ void STKHost::mainLoop()
     ENetEvent event;
     ENetHost* host = m_network->getENetHost();
     const bool is_server = NetworkConfig::get()->isServer();
+    const bool simulate_network = NetworkConfig::get()->isSimulatingNetwork();
+    if (simulate_network)
+    {
+        Log::info("STKHost", "Simulating network with %u ms latency, %u ms "
+            "jitter and %f%% loss.", NetworkConfig::get()->getSimulatedLatency(),
+            NetworkConfig::get()->getSimulatedJitter(),
+            NetworkConfig::get()->getSimulatedLoss() * 100.0f);
+    }
 
     // A separate network connection (socket) to handle LAN requests.
     Network* direct_socket = NULL;
@@ -780,10 +1001,8 @@ void STKHost::mainLoop()
                             " %d ms, kick.",
                             p.second->getAddress().toString().c_str(),
                             ap, max_ping);
-                        std::lock_guard<std::mutex> lock(m_enet_cmd_mutex);
-                        m_enet_cmd.emplace_back(p.second->getENetPeer(),
-                            (ENetPacket*)NULL, PDI_BAD_CONNECTION,
-                            ECT_DISCONNECT);
+                        enet_peer_disconnect(p.second->getENetPeer(),
+                            PDI_BAD_CONNECTION);
                     }
                 }
                 BareNetworkString ping_packet;
@@ -832,35 +1051,22 @@ void STKHost::mainLoop()
                 enet_packet_destroy(packet);
         }
 
-        std::list<std::tuple<ENetPeer*, ENetPacket*, uint32_t,
-            ENetCommandType> > copied_list;
-        std::unique_lock<std::mutex> lock(m_enet_cmd_mutex);
-        std::swap(copied_list, m_enet_cmd);
-        lock.unlock();
-        for (auto& p : copied_list)
+        ENetCommand p;
+        while (m_enet_cmd.pop(&p))
         {
-            switch (std::get<3>(p))
-            {
-            case ECT_SEND_PACKET:
-                enet_peer_send(std::get<0>(p), (uint8_t)std::get<2>(p),
-                    std::get<1>(p));
-                break;
-            case ECT_DISCONNECT:
-                enet_peer_disconnect(std::get<0>(p), std::get<2>(p));
-                break;
-            case ECT_RESET:
-                // Flush enet before reset (so previous command is send)
-                enet_host_flush(host);
-                enet_peer_reset(std::get<0>(p));
-                // Remove the stk peer of it
-                std::lock_guard<std::mutex> lock(m_peers_mutex);
-                m_peers.erase(std::get<0>(p));
-                break;
-            }
+            if (simulate_network)
+                delayEnetCommand(p);
+            else
+                executeEnetCommand(host, p);
         }
+        uint32_t wait_timeout = 10;
+        if (simulate_network)
+            wait_timeout = executeDelayedEnetCommands(host, wait_timeout);
 
+        // Handle all received events (this also sends the packets of the
+        // commands above), then wait for the next event or command
         bool need_ping_update = false;
-        while (enet_host_service(host, &event, 10) != 0)
+        while (enet_host_service(host, &event, 0) > 0)
         {
             if (!is_server &&
                 last_ping_time_update_for_client < StkTime::getRealTimeMs())
@@ -927,6 +1133,7 @@ void STKHost::mainLoop()
             if (!stk_event && m_peers.find(event.peer) != m_peers.end())
             {
                 auto& peer = m_peers.at(event.peer);
+                peer->addBytesReceived((unsigned)event.packet->dataLength);
                 if (isPingPacket(event.packet->data, event.packet->dataLength))
                 {
                     if (!is_server)
@@ -964,6 +1171,7 @@ void STKHost::mainLoop()
                     enet_packet_destroy(event.packet);
                     continue;
                 }
+                const unsigned size = (unsigned)event.packet->dataLength;
                 try
                 {
                     stk_event = new Event(&event, peer);
@@ -974,6 +1182,11 @@ void STKHost::mainLoop()
                     enet_packet_destroy(event.packet);
                     continue;
                 }
+                if (stk_event->data().getTotalSize() > 0)
+                {
+                    ServerMetrics::addBytesReceived(
+                        stk_event->data().getProtocolType(), size);
+                }
             }
             else if (!stk_event)
             {
@@ -994,6 +1207,9 @@ void STKHost::mainLoop()
 #endif
             }   // if message event
 
+            if (m_packet_capture)
+                m_packet_capture->writeEvent(*stk_event, event.channelID);
+
             // notify for the event now.
             auto pm = ProtocolManager::lock();
             if (pm && !pm->isExiting())
@@ -1001,11 +1217,168 @@ void STKHost::mainLoop()
             else
                 delete stk_event;
         }   // while enet_host_service
+        if (m_exit_timeout.load() > StkTime::getRealTimeMs())
+            waitForNetwork(host, wait_timeout);
     }   // while m_exit_timeout.load() > StkTime::getRealTimeMs()
+    for (auto& delayed : m_delayed_enet_cmd)
+    {
+        if (std::get<3>(delayed.second) == ECT_SEND_PACKET)
+            enet_packet_destroy(std::get<1>(delayed.second));
+    }
+    m_delayed_enet_cmd.clear();
     delete direct_socket;
     Log::info("STKHost", "Listening has been stopped.");
 }   // mainLoop
 
+// ----------------------------------------------------------------------------
+/** Thread function of a server which replays a capture file (see
+ *  PacketCapture) instead of using the network: the captured events are
+ *  passed to the protocols at the same time (relative to the start of
+ *  listening) at which they were received, and all packets sent by the
+ *  server are discarded. The server exits at the end of the capture.
+ */
+void STKHost::replayLoop()
+{
+    VS::setThreadName("STKHost");
+    const std::string& file_name = NetworkConfig::get()->getPacketReplayFile();
+    PacketCapture replay(file_name, /*write*/false);
+    if (!replay.isOpen())
+    {
+        requestShutdown();
+        return;
+    }
+    Log::info("STKHost", "Replaying packets from '%s'.", file_name.c_str());
+
+    // The ENet peers of the captured host ids
+    std::map<uint32_t, ENetPeer*> enet_peers;
+    PacketCapture::CapturedEvent captured;
+    bool has_event = replay.read(&captured);
+    const uint64_t start_time = StkTime::getRealTimeMs();
+    while (m_exit_timeout.load() > StkTime::getRealTimeMs())
+    {
+        ENetCommand command;
+        while (m_enet_cmd.pop(&command))
+        {
+            switch (std::get<3>(command))
+            {
+            case ECT_SEND_PACKET:
+                enet_packet_destroy(std::get<1>(command));
+                break;
+            case ECT_DISCONNECT:
+                // The disconnect event is part of the capture
+                std::get<0>(command)->state = ENET_PEER_STATE_DISCONNECTED;
+                if (m_exit_timeout.load() !=
+                    std::numeric_limits<uint64_t>::max())
+                    m_exit_timeout.store(0);
+                break;
+            case ECT_RESET:
+            {
+                std::get<0>(command)->state = ENET_PEER_STATE_DISCONNECTED;
+                std::lock_guard<std::mutex> lock(m_peers_mutex);
+                m_peers.erase(std::get<0>(command));
+                break;
+            }
+            }
+        }
+
+        if (!has_event)
+        {
+            Log::info("STKHost", "Replay of '%s' finished.",
+                      file_name.c_str());
+            main_loop->abort();
+            break;
+        }
+        const uint64_t now = StkTime::getRealTimeMs() - start_time;
+        if (captured.m_time > now)
+        {
+            StkTime::sleep((int)std::min<uint64_t>(captured.m_time - now, 10));
+            continue;
+        }
+        replayEvent(captured, &enet_peers);
+        has_event = replay.read(&captured);
+    }   // while m_exit_timeout.load() > StkTime::getRealTimeMs()
+    Log::info("STKHost", "Listening has been stopped.");
+}   // replayLoop
+
+// ----------------------------------------------------------------------------
+/** Creates the event of a captured record like mainLoop() does for a
+ *  received ENet event, and passes it to the protocols.
+ *  \param captured The record of the capture file.
+ *  \param enet_peers The ENet peers of the host ids in the capture.
+ */
+void STKHost::replayEvent(const PacketCapture::CapturedEvent& captured,
+                          std::map<uint32_t, ENetPeer*>* enet_peers)
+{
+    ENetEvent event;
+    memset(&event, 0, sizeof(event));
+    Event* stk_event = NULL;
+    if (captured.m_type == PacketCapture::CT_CONNECT)
+    {
+        ENetPeer* enet_peer = new ENetPeer();
+        memset(enet_peer, 0, sizeof(ENetPeer));
+        enet_peer->address =
+            TransportAddress(captured.m_ip, captured.m_port).toEnetAddress();
+        enet_peer->state = ENET_PEER_STATE_CONNECTED;
+        m_replay_peers.emplace_back(enet_peer);
+        (*enet_peers)[captured.m_host_id] = enet_peer;
+
+        event.type = ENET_EVENT_TYPE_CONNECT;
+        event.peer = enet_peer;
+        auto stk_peer = std::make_shared<STKPeer>
+            (enet_peer, this, m_next_unique_host_id++);
+        std::unique_lock<std::mutex> lock(m_peers_mutex);
+        m_peers[enet_peer] = stk_peer;
+        lock.unlock();
+        stk_event = new Event(&event, stk_peer);
+    }
+    else
+    {
+        auto it = enet_peers->find(captured.m_host_id);
+        if (it == enet_peers->end() ||
+            m_peers.find(it->second) == m_peers.end())
+            return;
+        event.peer = it->second;
+        std::shared_ptr<STKPeer> peer = m_peers.at(event.peer);
+        if (captured.m_type == PacketCapture::CT_DISCONNECT)
+        {
+            event.type = ENET_EVENT_TYPE_DISCONNECT;
+            event.data = captured.m_disconnect_info;
+            event.peer->state = ENET_PEER_STATE_DISCONNECTED;
+            stk_event = new Event(&event, peer);
+            std::lock_guard<std::mutex> lock(m_peers_mutex);
+            m_peers.erase(event.peer);
+        }
+        else
+        {
+            // The captured data is already decrypted, and the replayed
+            // peers never have a crypto
+            event.type = ENET_EVENT_TYPE_RECEIVE;
+            event.channelID = EVENT_CHANNEL_NORMAL;
+            event.packet = enet_packet_create(captured.m_data.data(),
+                captured.m_data.size(), ENET_PACKET_FLAG_RELIABLE);
+            peer->addBytesReceived((unsigned)captured.m_data.size());
+            try
+            {
+                stk_event = new Event(&event, peer);
+            }
+            catch (std::exception& e)
+            {
+                Log::warn("STKHost", "%s", e.what());
+                enet_packet_destroy(event.packet);
+                return;
+            }
+        }
+    }
+
+    if (m_packet_capture)
+        m_packet_capture->writeEvent(*stk_event, event.channelID);
+    auto pm = ProtocolManager::lock();
+    if (pm && !pm->isExiting())
+        pm->propagateEvent(stk_event);
+    else
+        delete stk_event;
+}   // replayEvent
+
 // ----------------------------------------------------------------------------
 /** Handles a direct request given to a socket. This is typically a LAN 
  *  request, but can also be used if the server is public (i.e. not behind
@@ -1141,11 +1514,13 @@ bool STKHost::isConnectedTo(const TransportAddress& peer)
 void STKHost::sendPacketToAllPeersInServer(NetworkString *data, bool reliable)
 {
     std::lock_guard<std::mutex> lock(m_peers_mutex);
+    std::vector<STKPeer*> peers;
     for (auto p : m_peers)
     {
         if (p.second->isValidated())
-            p.second->sendPacket(data, reliable);
+            peers.push_back(p.second.get());
     }
+    sendPacketToPeers(peers, data, reliable);
 }   // sendPacketToAllPeersInServer
 
 //-----------------------------------------------------------------------------
@@ -1156,13 +1531,83 @@ void STKHost::sendPacketToAllPeersInServer(NetworkString *data, bool reliable)
 void STKHost::sendPacketToAllPeers(NetworkString *data, bool reliable)
 {
     std::lock_guard<std::mutex> lock(m_peers_mutex);
+    std::vector<STKPeer*> peers;
     for (auto p : m_peers)
     {
         if (p.second->isValidated() && !p.second->isWaitingForGame())
-            p.second->sendPacket(data, reliable);
+            peers.push_back(p.second.get());
     }
+    sendPacketToPeers(peers, data, reliable);
 }   // sendPacketToAllPeers
 
+//-----------------------------------------------------------------------------
+/** Sends the same data encrypted to several peers. The packets for all
+ *  peers are encrypted together (on a server possibly by several threads,
+ *  see EncryptionPool), and then added to the ENet commands, waking up the
+ *  listening thread only once.
+ *  \param peers The peers to send the data to. The caller must make sure
+ *         they are not deleted while sending.
+ *  \param data Data to sent.
+ *  \param reliable If the data should be sent reliable or now.
+ */
+void STKHost::sendPacketToPeers(const std::vector<STKPeer*>& peers,
+                                NetworkString *data, bool reliable)
+{
+    std::vector<STKPeer*> encrypted_peers;
+    std::vector<Crypto*> crypto;
+    std::vector<std::pair<STKPeer*, ENetPacket*> > packets;
+    for (STKPeer* peer : peers)
+    {
+        if (!peer->canSendPacket())
+            continue;
+        if (peer->getCrypto())
+        {
+            encrypted_peers.push_back(peer);
+            crypto.push_back(peer->getCrypto());
+        }
+        else
+        {
+            packets.emplace_back(peer,
+                STKPeer::createUnencryptedPacket(data, reliable));
+        }
+    }
+
+    if (!crypto.empty())
+    {
+        std::vector<ENetPacket*> encrypted;
+        const uint64_t start = StkTime::getMonoTimeUs();
+        if (m_encryption_pool)
+            m_encryption_pool->encrypt(crypto, data, reliable, &encrypted);
+        else
+        {
+            for (Crypto* c : crypto)
+                encrypted.push_back(c->encryptSend(*data, reliable));
+        }
+        ServerMetrics::addCryptoTime(StkTime::getMonoTimeUs() - start);
+        for (unsigned i = 0; i < encrypted_peers.size(); i++)
+            packets.emplace_back(encrypted_peers[i], encrypted[i]);
+    }
+
+    for (auto& p : packets)
+    {
+        if (!p.second)
+            continue;
+        if (Network::m_connection_debug)
+        {
+            Log::verbose("STKHost", "sending packet of size %d to %s at %lf",
+                p.second->dataLength,
+                p.first->getAddress().toString().c_str(),
+                StkTime::getRealTime());
+        }
+        p.first->addBytesSent((unsigned)p.second->dataLength);
+        ServerMetrics::addBytesSent(data->getProtocolType(),
+                                    (unsigned)p.second->dataLength);
+        queueEnetCommand(ENetCommand(p.first->getENetPeer(), p.second,
+            EVENT_CHANNEL_NORMAL, ECT_SEND_PACKET));
+    }
+    wakeListeningThread();
+}   // sendPacketToPeers
+
 //-----------------------------------------------------------------------------
 /** Sends data to all validated peers except the specified currently in game
  *  \param peer Peer which will not receive the message.
@@ -1173,15 +1618,17 @@ void STKHost::sendPacketExcept(STKPeer* peer, NetworkString *data,
                                bool reliable)
 {
     std::lock_guard<std::mutex> lock(m_peers_mutex);
+    std::vector<STKPeer*> peers;
     for (auto p : m_peers)
     {
         STKPeer* stk_peer = p.second.get();
         if (!stk_peer->isSamePeer(peer) && p.second->isValidated() &&
             !p.second->isWaitingForGame())
         {
-            stk_peer->sendPacket(data, reliable);
+            peers.push_back(stk_peer);
         }
     }
+    sendPacketToPeers(peers, data, reliable);
 }   // sendPacketExcept
 
 //-----------------------------------------------------------------------------
@@ -1194,12 +1641,14 @@ void STKHost::sendPacketToAllPeersWith(std::function<bool(STKPeer*)> predicate,
                                        NetworkString* data, bool reliable)
 {
     std::lock_guard<std::mutex> lock(m_peers_mutex);
+    std::vector<STKPeer*> peers;
     for (auto p : m_peers)
     {
         STKPeer* stk_peer = p.second.get();
         if (predicate(stk_peer))
-            stk_peer->sendPacket(data, reliable);
+            peers.push_back(stk_peer);
     }
+    sendPacketToPeers(peers, data, reliable);
 }   // sendPacketToAllPeersWith
 
 //-----------------------------------------------------------------------------
@@ -24,7 +24,9 @@
 
 #include "network/network.hpp"
 #include "network/network_string.hpp"
+#include "network/packet_capture.hpp"
 #include "network/transport_address.hpp"
+#include "utils/mpsc_ring_buffer.hpp"
 #include "utils/synchronised.hpp"
 #include "utils/time.hpp"
 
@@ -37,14 +39,18 @@
 #include <enet/enet.h>
 
 #include <atomic>
+#include <deque>
 #include <list>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <random>
 #include <thread>
 #include <tuple>
+#include <vector>
 
+class EncryptionPool;
 class GameSetup;
 class LobbyProtocol;
 class NetworkPlayerProfile;
@@ -89,14 +95,45 @@ private:
     /** Make sure the removing or adding a peer is thread-safe. */
     mutable std::mutex m_peers_mutex;
 
+    typedef std::tuple</*peer receive*/ENetPeer*,
+        /*packet to send*/ENetPacket*, /*integer data*/uint32_t,
+        ENetCommandType> ENetCommand;
+
     /** Let (atm enet_peer_send and enet_peer_disconnect) run in the listening
      *  thread. */
-    std::list<std::tuple</*peer receive*/ENetPeer*,
-        /*packet to send*/ENetPacket*, /*integer data*/uint32_t,
-        ENetCommandType> > m_enet_cmd;
+    MPSCRingBuffer<ENetCommand> m_enet_cmd;
+
+    /** Commands delayed to simulate network latency (see
+     *  NetworkConfig::setSimulatedNetwork), with the time in ms at which
+     *  they are executed. Only used by the listening thread. */
+    std::deque<std::pair<uint64_t, ENetCommand> > m_delayed_enet_cmd;
+
+    /** Random numbers for the simulated jitter and loss. */
+    std::mt19937 m_simulation_random;
+
+    /** Socket on the loopback interface, a datagram sent to it wakes up the
+     *  listening thread while it waits for network events, so commands are
+     *  executed immediately. ENET_SOCKET_NULL if it can not be created. */
+    ENetSocket m_wake_socket;
+
+    /** Address of \ref m_wake_socket. */
+    ENetAddress m_wake_address;
+
+    /** True while the listening thread waits for network events (or is
+     *  about to), i.e. when it needs to be woken up for a new command. */
+    std::atomic_bool m_listening_thread_waiting;
+
+    /** Encrypts messages sent to several peers, only used on a server. */
+    std::unique_ptr<EncryptionPool> m_encryption_pool;
+
+    /** Writes all received events if a capture file is set in
+     *  NetworkConfig. Only used by the listening thread. */
+    std::unique_ptr<PacketCapture> m_packet_capture;
 
-    /** Protect \ref m_enet_cmd from multiple threads usage. */
-    std::mutex m_enet_cmd_mutex;
+    /** The ENet peers created for the peers of a replayed capture (which are
+     *  never connected). They are only deleted with the host, since the
+     *  STKPeers can be used by protocols after they disconnected. */
+    std::vector<std::unique_ptr<ENetPeer> > m_replay_peers;
 
     /** The list of peers connected to this instance. */
     std::map<ENetPeer*, std::shared_ptr<STKPeer> > m_peers;
@@ -156,6 +193,11 @@ private:
                                    std::map<std::string, uint64_t>& ctp);
     // ------------------------------------------------------------------------
     void mainLoop();
+    // ------------------------------------------------------------------------
+    void replayLoop();
+    // ------------------------------------------------------------------------
+    void replayEvent(const PacketCapture::CapturedEvent& captured,
+                     std::map<uint32_t, ENetPeer*>* enet_peers);
 
 public:
     /** If a network console should be started. */
@@ -217,6 +259,9 @@ public:
     // ------------------------------------------------------------------------
     void sendPacketToAllPeers(NetworkString *data, bool reliable = true);
     // ------------------------------------------------------------------------
+    void sendPacketToPeers(const std::vector<STKPeer*>& peers,
+                           NetworkString *data, bool reliable = true);
+    // ------------------------------------------------------------------------
     void sendPacketToAllPeersWith(std::function<bool(STKPeer*)> predicate,
                                   NetworkString* data, bool reliable = true);
     // ------------------------------------------------------------------------
@@ -253,11 +298,23 @@ public:
     // ------------------------------------------------------------------------
     void setErrorMessage(const irr::core::stringw &message);
     // ------------------------------------------------------------------------
+    void queueEnetCommand(const ENetCommand& command);
+    // ------------------------------------------------------------------------
+    void wakeListeningThread();
+    // ------------------------------------------------------------------------
+    void waitForNetwork(ENetHost* host, uint32_t timeout);
+    // ------------------------------------------------------------------------
+    void executeEnetCommand(ENetHost* host, const ENetCommand& command);
+    // ------------------------------------------------------------------------
+    void delayEnetCommand(const ENetCommand& command);
+    // ------------------------------------------------------------------------
+    uint32_t executeDelayedEnetCommands(ENetHost* host, uint32_t timeout);
+    // ------------------------------------------------------------------------
     void addEnetCommand(ENetPeer* peer, ENetPacket* packet, uint32_t i,
                         ENetCommandType ect)
     {
-        std::lock_guard<std::mutex> lock(m_enet_cmd_mutex);
-        m_enet_cmd.emplace_back(peer, packet, i, ect);
+        queueEnetCommand(ENetCommand(peer, packet, i, ect));
+        wakeListeningThread();
     }
     // ------------------------------------------------------------------------
     /** Returns the last error (or "" if no error has happened). */
@@ -23,6 +23,7 @@
 #include "network/event.hpp"
 #include "network/network_config.hpp"
 #include "network/network_string.hpp"
+#include "network/server_metrics.hpp"
 #include "network/stk_host.hpp"
 #include "network/transport_address.hpp"
 #include "utils/log.hpp"
@@ -40,8 +41,15 @@ STKPeer::STKPeer(ENetPeer *enet_peer, STKHost* host, uint32_t host_id)
     m_connected_time      = StkTime::getRealTimeMs();
     m_validated.store(false);
     m_average_ping.store(0);
+    m_ping_variance.store(0);
     m_waiting_for_game.store(true);
     m_disconnected.store(false);
+    m_bytes_sent.store(0);
+    m_bytes_received.store(0);
+    m_input_count.store(0);
+    m_input_arrival_ticks.store(0);
+    m_input_late.store(0);
+    m_input_duplicates.store(0);
 }   // STKPeer
 
 //-----------------------------------------------------------------------------
@@ -94,25 +102,19 @@ void STKPeer::reset()
  */
 void STKPeer::sendPacket(NetworkString *data, bool reliable, bool encrypted)
 {
-    TransportAddress a(m_enet_peer->address);
-    // Enet will reuse a disconnected peer so we check here to avoid sending
-    // to wrong peer
-    if (m_enet_peer->state != ENET_PEER_STATE_CONNECTED ||
-        a != m_peer_address)
+    if (!canSendPacket())
         return;
 
     ENetPacket* packet = NULL;
     if (m_crypto && encrypted)
     {
+        const uint64_t start = StkTime::getMonoTimeUs();
         packet = m_crypto->encryptSend(*data, reliable);
+        ServerMetrics::addCryptoTime(StkTime::getMonoTimeUs() - start);
     }
     else
     {
-        packet = enet_packet_create(data->getData(),
-            data->getTotalSize(), (reliable ?
-            ENET_PACKET_FLAG_RELIABLE :
-            (ENET_PACKET_FLAG_UNSEQUENCED |
-            ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT)));
+        packet = createUnencryptedPacket(data, reliable);
     }
 
     if (packet)
@@ -120,15 +122,43 @@ void STKPeer::sendPacket(NetworkString *data, bool reliable, bool encrypted)
         if (Network::m_connection_debug)
         {
             Log::verbose("STKPeer", "sending packet of size %d to %s at %lf",
-                packet->dataLength, a.toString().c_str(),
+                packet->dataLength, m_peer_address.toString().c_str(),
                 StkTime::getRealTime());
         }
+        addBytesSent((unsigned)packet->dataLength);
+        ServerMetrics::addBytesSent(data->getProtocolType(),
+                                    (unsigned)packet->dataLength);
         m_host->addEnetCommand(m_enet_peer, packet,
                 encrypted ? EVENT_CHANNEL_NORMAL : EVENT_CHANNEL_UNENCRYPTED,
                 ECT_SEND_PACKET);
     }
 }   // sendPacket
 
+//-----------------------------------------------------------------------------
+/** Returns if a packet can be sent to this peer.
+ */
+bool STKPeer::canSendPacket() const
+{
+    TransportAddress a(m_enet_peer->address);
+    // Enet will reuse a disconnected peer so we check here to avoid sending
+    // to wrong peer
+    return m_enet_peer->state == ENET_PEER_STATE_CONNECTED &&
+        a == m_peer_address;
+}   // canSendPacket
+
+//-----------------------------------------------------------------------------
+/** Creates an ENet packet with the unencrypted message.
+ *  \param data The message.
+ *  \param reliable If the packet should be sent reliable.
+ */
+ENetPacket* STKPeer::createUnencryptedPacket(NetworkString *data,
+                                             bool reliable)
+{
+    return enet_packet_create(data->getData(), data->getTotalSize(),
+        (reliable ? ENET_PACKET_FLAG_RELIABLE :
+        (ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT)));
+}   // createUnencryptedPacket
+
 //-----------------------------------------------------------------------------
 /** Returns if the peer is connected or not.
  */
@@ -156,10 +186,12 @@ bool STKPeer::isSamePeer(const ENetPeer* peer) const
 
 //-----------------------------------------------------------------------------
 /** Returns the ping to this peer from host, it waits for 3 seconds for a
- *  stable ping returned by enet measured in ms.
+ *  stable ping returned by enet measured in ms. Only called by the listening
+ *  thread, which also updates the average ping and the ping variance here.
  */
 uint32_t STKPeer::getPing()
 {
+    m_ping_variance.store(m_enet_peer->roundTripTimeVariance);
     if (getConnectedTime() < 3.0f)
     {
         m_average_ping.store(m_enet_peer->roundTripTime);
@@ -90,10 +90,27 @@ protected:
 
     std::atomic<uint32_t> m_average_ping;
 
+    /** Round trip time variance of enet, updated by the listening thread. */
+    std::atomic<uint32_t> m_ping_variance;
+
     std::set<unsigned> m_available_kart_ids;
 
     std::string m_user_version;
 
+    /** Number of bytes sent to and received from this peer, for the load
+     *  statistics. */
+    std::atomic<uint64_t> m_bytes_sent;
+    std::atomic<uint64_t> m_bytes_received;
+
+    /** Number of actions received from this peer, the sum of their arrival
+     *  times (in ticks after the tick of each action, see
+     *  addInputArrival), the number of actions which arrived too late, and
+     *  the number of actions received more than once. */
+    std::atomic<uint64_t> m_input_count;
+    std::atomic<int64_t>  m_input_arrival_ticks;
+    std::atomic<uint64_t> m_input_late;
+    std::atomic<uint64_t> m_input_duplicates;
+
 public:
     STKPeer(ENetPeer *enet_peer, STKHost* host, uint32_t host_id);
     // ------------------------------------------------------------------------
@@ -102,6 +119,11 @@ public:
     void sendPacket(NetworkString *data, bool reliable = true,
                     bool encrypted = true);
     // ------------------------------------------------------------------------
+    bool canSendPacket() const;
+    // ------------------------------------------------------------------------
+    static ENetPacket* createUnencryptedPacket(NetworkString *data,
+                                               bool reliable);
+    // ------------------------------------------------------------------------
     void disconnect();
     // ------------------------------------------------------------------------
     void kick();
@@ -179,6 +201,11 @@ public:
     // ------------------------------------------------------------------------
     uint32_t getAveragePing() const           { return m_average_ping.load(); }
     // ------------------------------------------------------------------------
+    /** Returns the variance of the round trip time measured by enet, which
+     *  is a measure of the jitter of this peer. It is updated together with
+     *  the ping by the listening thread. */
+    uint32_t getPingVariance() const         { return m_ping_variance.load(); }
+    // ------------------------------------------------------------------------
     ENetPeer* getENetPeer() const                       { return m_enet_peer; }
     // ------------------------------------------------------------------------
     void setWaitingForGame(bool val)         { m_waiting_for_game.store(val); }
@@ -194,6 +221,44 @@ public:
     bool availableKartID(unsigned id)
         { return m_available_kart_ids.find(id) != m_available_kart_ids.end(); }
     // ------------------------------------------------------------------------
+    void addBytesSent(unsigned bytes)
+                { m_bytes_sent.fetch_add(bytes, std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    void addBytesReceived(unsigned bytes)
+            { m_bytes_received.fetch_add(bytes, std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    uint64_t getBytesSent() const
+                       { return m_bytes_sent.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    uint64_t getBytesReceived() const
+                   { return m_bytes_received.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    /** Called on the server for each new action received from this peer.
+     *  \param ticks Server world ticks at the arrival minus the ticks of the
+     *         action, i.e. negative if the action arrived in time. */
+    void addInputArrival(int ticks)
+    {
+        m_input_count.fetch_add(1, std::memory_order_relaxed);
+        m_input_arrival_ticks.fetch_add(ticks, std::memory_order_relaxed);
+        if (ticks > 0)
+            m_input_late.fetch_add(1, std::memory_order_relaxed);
+    }   // addInputArrival
+    // ------------------------------------------------------------------------
+    void addInputDuplicate()
+                { m_input_duplicates.fetch_add(1, std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    uint64_t getInputCount() const
+                      { return m_input_count.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    int64_t getInputArrivalTicks() const
+              { return m_input_arrival_ticks.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    uint64_t getInputLate() const
+                       { return m_input_late.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
+    uint64_t getInputDuplicates() const
+                 { return m_input_duplicates.load(std::memory_order_relaxed); }
+    // ------------------------------------------------------------------------
     void setUserVersion(const std::string& uv)         { m_user_version = uv; }
     // ------------------------------------------------------------------------
     const std::string& getUserVersion() const        { return m_user_version; }
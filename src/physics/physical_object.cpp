@@ -801,23 +801,21 @@ void PhysicalObject::computeError()
 }   // computeError
 
 // ----------------------------------------------------------------------------
-BareNetworkString* PhysicalObject::saveState(std::vector<std::string>* ru)
+bool PhysicalObject::saveState(BareNetworkString* buffer)
 {
     btTransform cur_transform = m_body->getWorldTransform();
     if ((cur_transform.getOrigin() - m_last_transform.getOrigin())
         .length() < 0.01f &&
         (m_body->getLinearVelocity() - m_last_lv).length() < 0.01f &&
         (m_body->getLinearVelocity() - m_last_av).length() < 0.01f)
-        return nullptr;
+        return false;
 
-    ru->push_back(getUniqueIdentity());
-    BareNetworkString *buffer = new BareNetworkString();
     m_last_transform = cur_transform;
     m_last_lv = m_body->getLinearVelocity();
     m_last_av = m_body->getAngularVelocity();
     CompressNetworkBody::compress(m_last_transform, m_last_lv, m_last_av,
         buffer, m_body, m_motion_state);
-    return buffer;
+    return true;
 }   // saveState
 
 // ----------------------------------------------------------------------------
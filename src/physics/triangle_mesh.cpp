@@ -19,14 +19,90 @@
 #include "physics/triangle_mesh.hpp"
 
 #include "config/stk_config.hpp"
+#include "io/file_manager.hpp"
 #include "physics/physics.hpp"
 #include "utils/constants.hpp"
+#include "utils/fnv_hash.hpp"
+#include "utils/log.hpp"
 #include "utils/time.hpp"
 
 #include "btBulletDynamicsCommon.h"
 
+#include <cstdio>
 #include <fstream>
 
+namespace
+{
+    /** Identifies a file with a cached BVH, and its version. */
+    const uint32_t BVH_CACHE_MAGIC   = 0x42564843;
+    const uint32_t BVH_CACHE_VERSION = 1;
+
+    /** Gives access to the (protected) unquantized nodes of a BVH. */
+    class BvhNodeAccess : public btOptimizedBvh
+    {
+    public:
+        static const NodeArray& getNodes(const btQuantizedBvh* bvh)
+        {
+            return bvh->*(&BvhNodeAccess::m_contiguousNodes);
+        }   // getNodes
+    };   // BvhNodeAccess
+
+    // ------------------------------------------------------------------------
+    /** Checks that the nodes of a loaded BVH only refer to existing nodes
+     *  and triangles, so that a raycast never accesses memory outside of
+     *  the BVH or the mesh, even if the cache file is damaged.
+     *  \param bvh The BVH.
+     *  \param triangles Number of triangles of the mesh.
+     */
+    bool isValidBvh(btOptimizedBvh* bvh, unsigned int triangles)
+    {
+        if (bvh->isQuantized())
+        {
+            const QuantizedNodeArray &nodes = bvh->getQuantizedNodeArray();
+            for (int i = 0; i < nodes.size(); i++)
+            {
+                const btQuantizedBvhNode &node = nodes[i];
+                if (node.isLeafNode())
+                {
+                    if (node.getPartId() != 0 ||
+                        node.getTriangleIndex() >= (int)triangles)
+                        return false;
+                }
+                else if (node.getEscapeIndex() <= 0 ||
+                         i + node.getEscapeIndex() > nodes.size())
+                    return false;
+            }
+            const BvhSubtreeInfoArray &subtrees = bvh->getSubtreeInfoArray();
+            for (int i = 0; i < subtrees.size(); i++)
+            {
+                if (subtrees[i].m_rootNodeIndex < 0 ||
+                    subtrees[i].m_subtreeSize < 0 ||
+                    subtrees[i].m_rootNodeIndex + subtrees[i].m_subtreeSize
+                    > nodes.size())
+                    return false;
+            }
+            return true;
+        }
+
+        // Unquantized leaves have an escape index of -1
+        const NodeArray &nodes = BvhNodeAccess::getNodes(bvh);
+        for (int i = 0; i < nodes.size(); i++)
+        {
+            const btOptimizedBvhNode &node = nodes[i];
+            if (node.m_escapeIndex == -1)
+            {
+                if (node.m_subPart != 0 || node.m_triangleIndex < 0 ||
+                    node.m_triangleIndex >= (int)triangles)
+                    return false;
+            }
+            else if (node.m_escapeIndex <= 0 ||
+                     i + node.m_escapeIndex > nodes.size())
+                return false;
+        }
+        return true;
+    }   // isValidBvh
+}
+
 // -----------------------------------------------------------------------------
 /** Constructor: Initialises all data structures with zero.
  */
@@ -36,6 +112,7 @@ TriangleMesh::TriangleMesh(bool can_be_transformed) : m_mesh()
     m_free_body          = true;
     m_motion_state       = NULL;
     m_can_be_transformed = can_be_transformed;
+    m_quantized_bvh      = stk_config->m_quantized_bvh;
     // FIXME: on VS in release mode this statement actually overwrites
     // part of the data of m_mesh, causing a crash later. Debugging
     // shows that apparently m_collision_shape is at the same address
@@ -43,6 +120,7 @@ TriangleMesh::TriangleMesh(bool can_be_transformed) : m_mesh()
     // (and m_mesh->m_weldingThreshold at m_normals
     m_collision_shape  = NULL;
     m_collision_object = NULL;
+    m_bvh_buffer       = NULL;
     m_user_pointer.set(this);
 }   // TriangleMesh
 
@@ -85,13 +163,167 @@ void TriangleMesh::addTriangle(const btVector3 &t1, const btVector3 &t2,
     m_p1p2p3.push_back(edge1.cross(edge2).length2());
 }   // addTriangle
 
+// -----------------------------------------------------------------------------
+/** Computes a hash of all triangles, which identifies the cached BVH of this
+ *  mesh.
+ */
+uint64_t TriangleMesh::getTriangleHash() const
+{
+    FnvHash hash;
+    const unsigned int count = (unsigned int)m_triangleIndex2Material.size();
+    hash.add(&count, sizeof(count));
+    for (unsigned int i = 0; i < count; i++)
+    {
+        btVector3 p[3];
+        getTriangle(i, &p[0], &p[1], &p[2]);
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            const float xyz[3] = { p[j].getX(), p[j].getY(), p[j].getZ() };
+            hash.add(xyz, sizeof(xyz));
+        }
+    }
+    return hash.get();
+}   // getTriangleHash
+
+// -----------------------------------------------------------------------------
+std::string TriangleMesh::getBvhCacheFile(uint64_t hash) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "bvh-%016llx.bin", (unsigned long long)hash);
+    return file_manager->getCachedDataDir() + name;
+}   // getBvhCacheFile
+
+// -----------------------------------------------------------------------------
+/** Loads a BVH saved by saveCachedBvh. The BVH is created in a buffer which
+ *  is stored in m_bvh_buffer.
+ *  \param file_name Name of the cache file.
+ *  \param hash Hash of the triangles, which must match the saved hash.
+ *  \param quantized If the BVH must use quantized bounding boxes.
+ *  \return The BVH, or NULL if the file does not exist or is invalid.
+ */
+btOptimizedBvh* TriangleMesh::loadCachedBvh(const std::string &file_name,
+                                            uint64_t hash, bool quantized)
+{
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    if (!in.good())
+        return NULL;
+
+    uint32_t magic = 0, version = 0, scalar_size = 0, triangles = 0;
+    uint32_t size = 0;
+    uint64_t saved_hash = 0;
+    in.read((char*)&magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&scalar_size, sizeof(scalar_size));
+    in.read((char*)&triangles, sizeof(triangles));
+    in.read((char*)&saved_hash, sizeof(saved_hash));
+    in.read((char*)&size, sizeof(size));
+    if (!in.good() || magic != BVH_CACHE_MAGIC ||
+        version != BVH_CACHE_VERSION || scalar_size != sizeof(btScalar) ||
+        triangles != m_triangleIndex2Material.size() || saved_hash != hash ||
+        size < sizeof(btOptimizedBvh))
+    {
+        Log::warn("TriangleMesh", "Ignoring outdated BVH cache '%s'.",
+                  file_name.c_str());
+        return NULL;
+    }
+
+    // Check the size before allocating memory for it
+    const std::streamoff start = in.tellg();
+    in.seekg(0, std::ios::end);
+    const std::streamoff end = in.tellg();
+    in.seekg(start);
+    if (start < 0 || end - start != (std::streamoff)size)
+    {
+        Log::warn("TriangleMesh", "Ignoring invalid BVH cache '%s'.",
+                  file_name.c_str());
+        return NULL;
+    }
+
+    void* buffer = btAlignedAlloc(size, 16);
+    in.read((char*)buffer, size);
+    if (!in.good())
+    {
+        Log::warn("TriangleMesh", "Ignoring invalid BVH cache '%s'.",
+                  file_name.c_str());
+        btAlignedFree(buffer);
+        return NULL;
+    }
+
+    // The BVH is created directly in the buffer
+    btOptimizedBvh* bvh = (btOptimizedBvh*)
+        btOptimizedBvh::deSerializeInPlace(buffer, size, !IS_LITTLE_ENDIAN);
+    if (bvh == NULL || bvh->calculateSerializeBufferSize() != size)
+    {
+        Log::warn("TriangleMesh", "Failed to load serialized BVH '%s'.",
+                  file_name.c_str());
+        btAlignedFree(buffer);
+        return NULL;
+    }
+    if (bvh->isQuantized() != quantized)
+    {
+        btAlignedFree(buffer);
+        return NULL;
+    }
+
+    if (!isValidBvh(bvh, triangles))
+    {
+        Log::warn("TriangleMesh", "Ignoring invalid BVH cache '%s'.",
+                  file_name.c_str());
+        btAlignedFree(buffer);
+        return NULL;
+    }
+    m_bvh_buffer = buffer;
+    return bvh;
+}   // loadCachedBvh
+
+// -----------------------------------------------------------------------------
+/** Saves a BVH, so it does not need to be built again the next time the same
+ *  triangles are loaded. The file is written atomically, so a partially
+ *  written file is never loaded.
+ *  \param file_name Name of the cache file.
+ *  \param hash Hash of the triangles.
+ *  \param bvh The BVH to save.
+ */
+void TriangleMesh::saveCachedBvh(const std::string &file_name, uint64_t hash,
+                                 const btOptimizedBvh *bvh) const
+{
+    const uint32_t size = bvh->calculateSerializeBufferSize();
+    void* buffer = btAlignedAlloc(size, 16);
+    if (!bvh->serialize(buffer, size, !IS_LITTLE_ENDIAN))
+    {
+        btAlignedFree(buffer);
+        return;
+    }
+
+    file_manager->writeFileAtomic(file_name,
+                                  [this, hash, buffer, size](std::ostream& out)
+    {
+        const uint32_t magic = BVH_CACHE_MAGIC;
+        const uint32_t version = BVH_CACHE_VERSION;
+        const uint32_t scalar_size = sizeof(btScalar);
+        const uint32_t triangles =
+            (uint32_t)m_triangleIndex2Material.size();
+        out.write((const char*)&magic, sizeof(magic));
+        out.write((const char*)&version, sizeof(version));
+        out.write((const char*)&scalar_size, sizeof(scalar_size));
+        out.write((const char*)&triangles, sizeof(triangles));
+        out.write((const char*)&hash, sizeof(hash));
+        out.write((const char*)&size, sizeof(size));
+        out.write((const char*)buffer, size);
+    });
+    btAlignedFree(buffer);
+}   // saveCachedBvh
+
 // -----------------------------------------------------------------------------
 /** Creates a collision body only, which can be used for raycasting, but
  *  has no physical properties.
- *  @param serialized_bhv if non-null, load the serialized bhv from file instead
- *                        of builing it on the fly
+ *  \param use_bvh_cache If true, the BVH is loaded from the cache if these
+ *         triangles were used before, otherwise it is built and saved in the
+ *         cache. This should only be used for large meshes which are loaded
+ *         again, e.g. the track.
  */
-void TriangleMesh::createCollisionShape(bool create_collision_object, const char* serialized_bhv)
+void TriangleMesh::createCollisionShape(bool create_collision_object,
+                                        bool use_bvh_cache)
 {
     if(m_triangleIndex2Material.size()==0)
     {
@@ -104,53 +336,31 @@ void TriangleMesh::createCollisionShape(bool create_collision_object, const char
     // Now convert the triangle mesh into a static rigid body
     btBvhTriangleMeshShape* bhv_triangle_mesh;
 
-    if (serialized_bhv != NULL)
+    // Quantized nodes can only store triangle indices up to 2^21
+    const bool quantized = m_quantized_bvh &&
+        m_triangleIndex2Material.size() < (1u << (31 - MAX_NUM_PARTS_IN_BITS));
+
+    std::string cache_file;
+    uint64_t hash = 0;
+    btOptimizedBvh* bvh = NULL;
+    if (use_bvh_cache)
     {
-        FILE *f = fopen(serialized_bhv, "rb");
-        fseek(f, 0, SEEK_END);
-        long pos = ftell(f);
-        assert(pos != -1L);
-        fseek(f, 0, SEEK_SET);
-
-        void* bytes = btAlignedAlloc(pos, 16);
-        fread(bytes, pos, 1, f);
-        fclose(f);
-
-        btOptimizedBvh* bhv = btOptimizedBvh::deSerializeInPlace(bytes, pos, !IS_LITTLE_ENDIAN);
-        if (bhv == NULL)
-        {
-            Log::warn("TriangleMesh", "Failed to load serialized BHV");
-            bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, false /* useQuantizedAabbCompression */);
-        }
-        else
-        {
-            bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, false /* useQuantizedAabbCompression */,
-                                                           false /* buildBvh */);
-            bhv_triangle_mesh->setOptimizedBvh( bhv );
-        }
-        // Do *NOT* free the bytes, 'deSerializeInPlace' makes the btOptimizedBvh object
-        // directly at this memory location
-        //free(bytes);
+        hash = getTriangleHash();
+        cache_file = getBvhCacheFile(hash);
+        bvh = loadCachedBvh(cache_file, hash, quantized);
+    }
 
+    if (bvh != NULL)
+    {
+        bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, quantized,
+                                                       false /* buildBvh */);
+        bhv_triangle_mesh->setOptimizedBvh(bvh);
     }
     else
     {
-        bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, false /* useQuantizedAabbCompression */);
-
-        /*
-         // code to serialize triangle mesh
-        btOptimizedBvh* bvh = bhv_triangle_mesh->getOptimizedBvh();
-        unsigned int ssize = bvh->calculateSerializeBufferSize();
-        char* buffer = (char*)btAlignedAlloc(ssize, 16);
-        bool success = bvh->serialize(buffer, ssize, !IS_LITTLE_ENDIAN);
-        printf("serialization success = %i\n", success);
-
-        std::ofstream fileout("/tmp/btOptimizedBvh");
-        fileout.write(buffer, ssize);
-        fileout.close();
-
-        btAlignedFree(buffer);
-         */
+        bhv_triangle_mesh = new btBvhTriangleMeshShape(&m_mesh, quantized);
+        if (use_bvh_cache)
+            saveCachedBvh(cache_file, hash, bhv_triangle_mesh->getOptimizedBvh());
     }
 
     m_collision_shape = bhv_triangle_mesh;
@@ -177,16 +387,16 @@ void TriangleMesh::createCollisionShape(bool create_collision_object, const char
  *  for height of terrain detection).
  *  \param friction Friction to be used for this TriangleMesh.
  *  \param flags Additional collision flags (default 0).
- *  \param serializedBhv if non-NULL, the bhv is deserialized instead of
- *                       being calculated on the fly
+ *  \param use_bvh_cache If the BVH is loaded from and saved in the cache,
+ *         see createCollisionShape.
  */
 void TriangleMesh::createPhysicalBody(float friction,
                                       btCollisionObject::CollisionFlags flags,
-                                      const char* serializedBhv)
+                                      bool use_bvh_cache)
 {
     // We need the collision shape, but not the collision object (since
     // this will be created when the dynamics body is anyway).
-    createCollisionShape(/*create_collision_object*/false, serializedBhv);
+    createCollisionShape(/*create_collision_object*/false, use_bvh_cache);
     btTransform startTransform;
     startTransform.setIdentity();
     m_motion_state = new btDefaultMotionState(startTransform);
@@ -229,6 +439,12 @@ void TriangleMesh::removeAll()
     }
     delete m_collision_shape;
     m_collision_shape = NULL;
+    // A BVH loaded from the cache is not owned by the collision shape
+    if (m_bvh_buffer)
+    {
+        btAlignedFree(m_bvh_buffer);
+        m_bvh_buffer = NULL;
+    }
 }   // removeAll
 
 // -----------------------------------------------------------------------------
@@ -403,3 +619,94 @@ bool TriangleMesh::castRay(const btVector3 &from, const btVector3 &to,
     return ray_callback.hasHit();
 
 }   // castRay
+
+// ----------------------------------------------------------------------------
+/** Benchmark for the BVH of a large static mesh with and without quantized
+ *  bounding boxes. The mesh is a hilly terrain of 180000 triangles with
+ *  40000 triangles of small objects on it, which is about the size of a
+ *  large track. For each mode it measures the time to build the BVH, its
+ *  memory and the throughput of short downward raycasts, like the raycasts
+ *  of the wheels.
+ */
+void TriangleMesh::benchmark()
+{
+    const int grid = 300;
+    const int num_rays = 1000000;
+    const btVector3 up(0, 1, 0);
+    for (int quantized = 0; quantized < 2; quantized++)
+    {
+        TriangleMesh mesh(/*can_be_transformed*/false);
+        mesh.m_quantized_bvh = quantized == 1;
+        for (int z = 0; z < grid; z++)
+        {
+            for (int x = 0; x < grid; x++)
+            {
+                btVector3 p[4];
+                for (int i = 0; i < 4; i++)
+                {
+                    const float px = (x + i % 2) * 2.0f;
+                    const float pz = (z + i / 2) * 2.0f;
+                    p[i] = btVector3(px, sinf(px * 0.05f) * cosf(pz * 0.03f)
+                                         * 10.0f, pz);
+                }
+                mesh.addTriangle(p[0], p[2], p[1], up, up, up, NULL);
+                mesh.addTriangle(p[1], p[2], p[3], up, up, up, NULL);
+            }
+        }
+        // Small boxes (without bottom) on the terrain
+        for (int i = 0; i < 4000; i++)
+        {
+            const btVector3 c((float)(i * 7919 % (grid * 2)), 0.0f,
+                              (float)(i * 104729 % (grid * 2)));
+            const float h = sinf(c.getX() * 0.05f) * cosf(c.getZ() * 0.03f)
+                          * 10.0f;
+            btVector3 b[8];
+            for (int j = 0; j < 8; j++)
+            {
+                b[j] = btVector3(c.getX() + (j & 1 ? 1.0f : -1.0f),
+                                 h + (j & 4 ? 1.5f : -0.5f),
+                                 c.getZ() + (j & 2 ? 1.0f : -1.0f));
+            }
+            const int faces[5][4] = { {4, 5, 6, 7}, {0, 1, 4, 5},
+                                      {2, 3, 6, 7}, {0, 2, 4, 6},
+                                      {1, 3, 5, 7} };
+            for (int f = 0; f < 5; f++)
+            {
+                const int* q = faces[f];
+                mesh.addTriangle(b[q[0]], b[q[1]], b[q[2]], up, up, up, NULL);
+                mesh.addTriangle(b[q[1]], b[q[3]], b[q[2]], up, up, up, NULL);
+            }
+        }
+
+        double start = StkTime::getRealTime();
+        mesh.createCollisionShape();
+        const double build = StkTime::getRealTime() - start;
+        const btOptimizedBvh* bvh =
+            ((btBvhTriangleMeshShape*)mesh.m_collision_shape)
+            ->getOptimizedBvh();
+
+        int hits = 0;
+        btVector3 xyz, normal;
+        const Material* material;
+        start = StkTime::getRealTime();
+        for (int i = 0; i < num_rays; i++)
+        {
+            // Spread the rays over the terrain, the products do not fit
+            // into an int
+            const float x = (float)((uint64_t)i * 7919 % (grid * 200))
+                          * 0.01f;
+            const float z = (float)((uint64_t)i * 104729 % (grid * 200))
+                          * 0.01f;
+            const float h = sinf(x * 0.05f) * cosf(z * 0.03f) * 10.0f;
+            if (mesh.castRay(btVector3(x, h + 1.0f, z),
+                             btVector3(x, h - 1.0f, z), &xyz, &material,
+                             &normal))
+                hits++;
+        }
+        const double rays = StkTime::getRealTime() - start;
+        Log::info("TriangleMesh", "%s BVH: build %f s, %u KB, %f raycasts "
+            "per second (%d hits).", quantized ? "Quantized" : "Unquantized",
+            build, bvh->calculateSerializeBufferSize() / 1024,
+            num_rays / rays, hits);
+    }
+}   // benchmark
@@ -19,13 +19,16 @@
 #ifndef HEADER_TRIANGLE_MESH_HPP
 #define HEADER_TRIANGLE_MESH_HPP
 
+#include <string>
 #include <vector>
 #include "btBulletDynamicsCommon.h"
 
 #include "physics/user_pointer.hpp"
 #include "utils/aligned_array.hpp"
+#include "utils/types.hpp"
 
 class Material;
+class btOptimizedBvh;
 
 /**
  * \brief A special class to store a triangle mesh with a separate material per triangle.
@@ -57,6 +60,22 @@ private:
      *  to the current transform of the body. */
     bool m_can_be_transformed;
 
+    /** If the BVH uses quantized bounding boxes, which need less memory
+     *  and make raycasts faster. */
+    bool m_quantized_bvh;
+
+    /** If the BVH was loaded from the cache, the memory it is stored in
+     *  (the BVH is created in this memory, so it must be kept as long as
+     *  the collision shape exists). */
+    void                        *m_bvh_buffer;
+
+    uint64_t getTriangleHash() const;
+    std::string getBvhCacheFile(uint64_t hash) const;
+    btOptimizedBvh* loadCachedBvh(const std::string &file_name,
+                                  uint64_t hash, bool quantized);
+    void saveCachedBvh(const std::string &file_name, uint64_t hash,
+                       const btOptimizedBvh *bvh) const;
+
 public:
     class RigidBodyTriangleMesh : public btRigidBody
     {
@@ -72,15 +91,17 @@ public:
 
          TriangleMesh(bool can_be_transformed);
         ~TriangleMesh();
+    static void benchmark();
     void addTriangle(const btVector3 &t1, const btVector3 &t2,
                      const btVector3 &t3, const btVector3 &n1,
                      const btVector3 &n2, const btVector3 &n3,
                      const Material* m);
-    void createCollisionShape(bool create_collision_object=true, const char* serialized_bhv=NULL);
+    void createCollisionShape(bool create_collision_object=true,
+                              bool use_bvh_cache=false);
     void createPhysicalBody(float friction,
                             btCollisionObject::CollisionFlags flags=
                                (btCollisionObject::CollisionFlags)0,
-                            const char* serializedBhv = NULL);
+                            bool use_bvh_cache=false);
     void removeAll();
     void removeCollisionObject();
     btVector3 getInterpolatedNormal(unsigned int index,
@@ -25,20 +25,53 @@
 #include "tracks/arena_node.hpp"
 #include "tracks/track.hpp"
 #include "tracks/track_manager.hpp"
+#include "utils/fnv_hash.hpp"
 #include "utils/log.hpp"
+#include "utils/worker_pool.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
 #include <queue>
+#include <thread>
+
+namespace
+{
+    /** Identifies a file with cached shortest paths, and its version. */
+    const uint32_t NAVMESH_CACHE_MAGIC   = 0x4e41564d;
+    const uint32_t NAVMESH_CACHE_VERSION = 1;
+}
 
 // -----------------------------------------------------------------------------
 ArenaGraph::ArenaGraph(const std::string &navmesh, const XMLNode *node)
           : Graph()
 {
     loadNavmesh(navmesh);
-    buildGraph();
-    // Compute shortest distance from all nodes
-    for (unsigned int i = 0; i < getNumNodes(); i++)
-        computeDijkstra(i);
+    createSpatialIndex();
+
+    // Large navmeshes take a while to compute, so the result is cached for
+    // the content of the navmesh file
+    std::string cache_file;
+    uint64_t hash = 0;
+    if (getNumNodes() >= MIN_NODES_FOR_CACHE)
+    {
+        hash = hashFile(navmesh);
+        if (hash != 0)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "navmesh-%016llx.bin",
+                     (unsigned long long)hash);
+            cache_file = file_manager->getCachedDataDir() + name;
+        }
+    }
+    if (cache_file.empty() || !loadShortestPaths(cache_file, hash))
+    {
+        computeShortestPaths();
+        if (!cache_file.empty())
+            saveShortestPaths(cache_file, hash);
+    }
 
     setNearbyNodesOfAllNodes();
     if (node && race_manager->getMinorMode() == RaceManager::MINOR_MODE_SOCCER)
@@ -175,49 +208,202 @@ void ArenaGraph::loadNavmesh(const std::string &navmesh)
 }   // loadNavmesh
 
 // ----------------------------------------------------------------------------
-void ArenaGraph::buildGraph()
+/** Returns the edges of the graph with their lengths (the distance between
+ *  the centers of the nodes): the edges of node i are
+ *  edges[first_edge[i]] to edges[first_edge[i+1]-1].
+ */
+void ArenaGraph::getEdges(std::vector<unsigned>* first_edge,
+                          std::vector<std::pair<int, float> >* edges) const
 {
-    const unsigned int n_nodes = getNumNodes();
-
-    m_distance_matrix = std::vector<std::vector<float>>
-        (n_nodes, std::vector<float>(n_nodes, 9999.9f));
-    for (unsigned int i = 0; i < n_nodes; i++)
+    const unsigned int n = getNumNodes();
+    first_edge->resize(n + 1);
+    edges->clear();
+    for (unsigned int i = 0; i < n; i++)
     {
+        (*first_edge)[i] = (unsigned)edges->size();
         ArenaNode* cur_node = getNode(i);
         for (const int& adjacent : cur_node->getAdjacentNodes())
         {
             Vec3 diff = getNode(adjacent)->getCenter() - cur_node->getCenter();
-            float distance = diff.length();
-            m_distance_matrix[i][adjacent] = distance;
+            edges->push_back(std::make_pair(adjacent, diff.length()));
         }
-        m_distance_matrix[i][i] = 0.0f;
     }
+    (*first_edge)[n] = (unsigned)edges->size();
+}   // getEdges
 
-    // Allocate and initialise the previous node data structure:
-    m_parent_node = std::vector<std::vector<int16_t>>
-        (n_nodes, std::vector<int16_t>(n_nodes, Graph::UNKNOWN_SECTOR));
-    for (unsigned int i = 0; i < n_nodes; i++)
+// ----------------------------------------------------------------------------
+/** Computes the shortest paths between all nodes with a Dijkstra search from
+ *  each node. The searches are independent, so large graphs run them in
+ *  parallel. The distances are then stored with a fixed precision.
+ */
+void ArenaGraph::computeShortestPaths()
+{
+    const unsigned int n = getNumNodes();
+    std::vector<unsigned> first_edge;
+    std::vector<std::pair<int, float> > edges;
+    getEdges(&first_edge, &edges);
+
+    m_distance_matrix.resize(n * n);
+    m_parent_node.resize(n * n);
+    std::atomic<bool> clamped(false);
+    auto compute = [&](unsigned source)
     {
-        for (unsigned int j = 0; j < n_nodes; j++)
+        std::vector<float> distance(n);
+        computeDijkstra(source, first_edge, edges, distance.data(),
+                        m_parent_node.data() + source * n);
+        uint16_t* row = m_distance_matrix.data() + source * n;
+        for (unsigned int j = 0; j < n; j++)
         {
-            if (i == j || m_distance_matrix[i][j] >= 9899.9f)
-                m_parent_node[i][j] = -1;
+            if (m_parent_node[source * n + j] == -1 && j != source)
+            {
+                row[j] = UNREACHABLE_DISTANCE;
+                continue;
+            }
+            const double d = (double)distance[j] * DISTANCE_SCALE + 0.5;
+            if (d >= (double)(UNREACHABLE_DISTANCE - 1))
+            {
+                row[j] = UNREACHABLE_DISTANCE - 1;
+                clamped.store(true);
+            }
             else
-                m_parent_node[i][j] = i;
-        }   // for j
-    }   // for i
+                row[j] = (uint16_t)d;
+        }
+    };
+
+    if (n >= MIN_NODES_FOR_CACHE)
+    {
+        const int cores = (int)std::thread::hardware_concurrency();
+        WorkerPool pool((unsigned)std::max(std::min(cores - 1, 7), 0),
+                        "ArenaGraph");
+        pool.run(n, compute);
+    }
+    else
+    {
+        for (unsigned int i = 0; i < n; i++)
+            compute(i);
+    }
+    if (clamped.load())
+    {
+        Log::warn("ArenaGraph", "Some distances are longer than %f, they "
+            "are clamped.", (float)(UNREACHABLE_DISTANCE - 1) / DISTANCE_SCALE);
+    }
+}   // computeShortestPaths
 
-}   // buildGraph
+// ----------------------------------------------------------------------------
+/** Computes a 64-bit FNV-1a hash of the content of a file, which identifies
+ *  the cached shortest paths of a navmesh. Returns 0 if the file can not be
+ *  read.
+ */
+uint64_t ArenaGraph::hashFile(const std::string &file_name)
+{
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    if (!in.good())
+        return 0;
+    FnvHash hash;
+    char buffer[4096];
+    while (in)
+    {
+        in.read(buffer, sizeof(buffer));
+        hash.add(buffer, (size_t)in.gcount());
+    }
+    return hash.get();
+}   // hashFile
+
+// ----------------------------------------------------------------------------
+/** Loads the shortest paths saved by saveShortestPaths.
+ *  \param file_name Name of the cache file.
+ *  \param hash Hash of the navmesh file, which must match the saved hash.
+ *  \return True if the shortest paths were loaded.
+ */
+bool ArenaGraph::loadShortestPaths(const std::string &file_name,
+                                   uint64_t hash)
+{
+    std::ifstream in(file_name.c_str(), std::ios::binary);
+    if (!in.good())
+        return false;
+
+    uint32_t magic = 0, version = 0, n = 0;
+    uint64_t saved_hash = 0;
+    in.read((char*)&magic, sizeof(magic));
+    in.read((char*)&version, sizeof(version));
+    in.read((char*)&saved_hash, sizeof(saved_hash));
+    in.read((char*)&n, sizeof(n));
+    if (!in.good() || magic != NAVMESH_CACHE_MAGIC ||
+        version != NAVMESH_CACHE_VERSION || saved_hash != hash ||
+        n != getNumNodes())
+    {
+        Log::warn("ArenaGraph", "Ignoring outdated cache file '%s'.",
+                  file_name.c_str());
+        return false;
+    }
+
+    std::vector<uint16_t> distance(n * n);
+    std::vector<int16_t> parent(n * n);
+    in.read((char*)distance.data(), distance.size() * sizeof(uint16_t));
+    in.read((char*)parent.data(), parent.size() * sizeof(int16_t));
+    if (!in.good() || in.peek() != EOF)
+    {
+        Log::warn("ArenaGraph", "Ignoring invalid cache file '%s'.",
+                  file_name.c_str());
+        return false;
+    }
+    for (int16_t p : parent)
+    {
+        if (p < -1 || p >= (int)n)
+        {
+            Log::warn("ArenaGraph", "Ignoring invalid cache file '%s'.",
+                      file_name.c_str());
+            return false;
+        }
+    }
+    m_distance_matrix.swap(distance);
+    m_parent_node.swap(parent);
+    return true;
+}   // loadShortestPaths
+
+// ----------------------------------------------------------------------------
+/** Saves the shortest paths, so they don't have to be computed again the next
+ *  time this navmesh is loaded. The file is written atomically, so a
+ *  partially written file is never loaded.
+ *  \param file_name Name of the cache file.
+ *  \param hash Hash of the navmesh file.
+ */
+void ArenaGraph::saveShortestPaths(const std::string &file_name,
+                                   uint64_t hash) const
+{
+    file_manager->writeFileAtomic(file_name, [this, hash](std::ostream& out)
+    {
+        const uint32_t magic = NAVMESH_CACHE_MAGIC;
+        const uint32_t version = NAVMESH_CACHE_VERSION;
+        const uint32_t n = getNumNodes();
+        out.write((const char*)&magic, sizeof(magic));
+        out.write((const char*)&version, sizeof(version));
+        out.write((const char*)&hash, sizeof(hash));
+        out.write((const char*)&n, sizeof(n));
+        out.write((const char*)m_distance_matrix.data(),
+                  m_distance_matrix.size() * sizeof(uint16_t));
+        out.write((const char*)m_parent_node.data(),
+                  m_parent_node.size() * sizeof(int16_t));
+    });
+}   // saveShortestPaths
 
 // ----------------------------------------------------------------------------
 /** Dijkstra shortest path computation. It computes the shortest distance from
  *  the specified node 'source' to all other nodes. At the end of the
- *  computation, m_distance_matrix[i][j] stores the shortest path distance from
- *  source to j and m_parent_node[source][j] stores the last vertex visited on
- *  the shortest path from i to j before visiting j. Suppose the shortest path
- *  from i to j is i->......->k->j  then m_parent_node[i][j] = k
+ *  computation, distance[j] stores the shortest path distance from source to
+ *  j and parent[j] stores the last vertex visited on the shortest path from
+ *  source to j before visiting j. Suppose the shortest path from source to j
+ *  is source->......->k->j  then parent[j] = k. It only uses the arguments
+ *  and the nodes, so it can be called for different sources in parallel.
+ *  \param source The start node.
+ *  \param first_edge, edges The edges of the graph, see getEdges.
+ *  \param distance Array of getNumNodes() entries to store the distances.
+ *  \param parent Array of getNumNodes() entries to store the parent nodes.
  */
-void ArenaGraph::computeDijkstra(int source)
+void ArenaGraph::computeDijkstra(int source,
+                                 const std::vector<unsigned>& first_edge,
+                                 const std::vector<std::pair<int, float> >& edges,
+                                 float* distance, int16_t* parent) const
 {
     // Stores the distance (float) to 'source' from a specified node (int)
     typedef std::pair<int, float> IndDistPair;
@@ -231,10 +417,17 @@ void ArenaGraph::computeDijkstra(int source)
         }
     };
 
+    const unsigned int n = getNumNodes();
+    for (unsigned int i = 0; i < n; i++)
+    {
+        distance[i] = 9999.9f;
+        parent[i] = -1;
+    }
+    distance[source] = 0.0f;
+
     std::priority_queue<IndDistPair, std::vector<IndDistPair>, Shortest> queue;
     IndDistPair begin(source, 0.0f);
     queue.push(begin);
-    const unsigned int n = getNumNodes();
     std::vector<bool> visited;
     visited.resize(n, false);
     while (!queue.empty())
@@ -246,20 +439,21 @@ void ArenaGraph::computeDijkstra(int source)
         if (visited[cur_index]) continue;
         visited[cur_index] = true;
 
-        for (const int& adjacent : getNode(cur_index)->getAdjacentNodes())
+        for (unsigned e = first_edge[cur_index]; e < first_edge[cur_index + 1];
+             e++)
         {
+            const int adjacent = edges[e].first;
             // Distance already computed, can be ignored
             if (visited[adjacent]) continue;
 
-            float new_dist =
-                current.second + m_distance_matrix[cur_index][adjacent];
-            if (new_dist < m_distance_matrix[source][adjacent])
+            float new_dist = current.second + edges[e].second;
+            if (new_dist < distance[adjacent])
             {
-                m_distance_matrix[source][adjacent] = new_dist;
-                m_parent_node[source][adjacent] = cur_index;
+                distance[adjacent] = new_dist;
+                parent[adjacent] = cur_index;
+                IndDistPair pair(adjacent, new_dist);
+                queue.push(pair);
             }
-            IndDistPair pair(adjacent, new_dist);
-            queue.push(pair);
         }
     }
 }   // computeDijkstra
@@ -268,15 +462,33 @@ void ArenaGraph::computeDijkstra(int source)
 /** THIS FUNCTION IS ONLY USED FOR UNIT-TESTING, to verify that the new
  *  Dijkstra algorithm gives the same results.
  *  computeFloydWarshall() computes the shortest distance between any two
- *  nodes. At the end of the computation, m_distance_matrix[i][j] stores the
- *  shortest path distance from i to j and m_parent_node[i][j] stores the last
- *  vertex visited on the shortest path from i to j before visiting j. Suppose
- *  the shortest path from i to j is i->......->k->j  then
- *  m_parent_node[i][j] = k
+ *  nodes. At the end of the computation, distance[i*n+j] stores the shortest
+ *  path distance from i to j and parent[i*n+j] stores the last vertex visited
+ *  on the shortest path from i to j before visiting j. Suppose the shortest
+ *  path from i to j is i->......->k->j  then parent[i*n+j] = k
  */
-void ArenaGraph::computeFloydWarshall()
+void ArenaGraph::computeFloydWarshall(std::vector<float>* distance,
+                                      std::vector<int16_t>* parent) const
 {
     unsigned int n = getNumNodes();
+    std::vector<unsigned> first_edge;
+    std::vector<std::pair<int, float> > edges;
+    getEdges(&first_edge, &edges);
+
+    std::vector<float>& d = *distance;
+    std::vector<int16_t>& p = *parent;
+    d.assign(n * n, 9999.9f);
+    p.assign(n * n, -1);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        for (unsigned e = first_edge[i]; e < first_edge[i + 1]; e++)
+        {
+            d[i * n + edges[e].first] = edges[e].second;
+            p[i * n + edges[e].first] = i;
+        }
+        d[i * n + i] = 0.0f;
+        p[i * n + i] = -1;
+    }
 
     for (unsigned int k = 0; k < n; k++)
     {
@@ -284,12 +496,10 @@ void ArenaGraph::computeFloydWarshall()
         {
             for (unsigned int j = 0; j < n; j++)
             {
-                if ((m_distance_matrix[i][k] + m_distance_matrix[k][j]) <
-                    m_distance_matrix[i][j])
+                if ((d[i * n + k] + d[k * n + j]) < d[i * n + j])
                 {
-                    m_distance_matrix[i][j] =
-                        m_distance_matrix[i][k] + m_distance_matrix[k][j];
-                    m_parent_node[i][j] = m_parent_node[k][j];
+                    d[i * n + j] = d[i * n + k] + d[k * n + j];
+                    p[i * n + j] = p[k * n + j];
                 }
             }
         }
@@ -336,22 +546,27 @@ void ArenaGraph::setNearbyNodesOfAllNodes()
 {
     // Only save the nearby 8 nodes
     const unsigned int try_count = 8;
-    for (unsigned int i = 0; i < getNumNodes(); i++)
+    const unsigned int n = getNumNodes();
+    // Larger than all stored distances, including unreachable nodes
+    const uint32_t skip = 0xffffffff;
+    std::vector<uint32_t> dist(n);
+    for (unsigned int i = 0; i < n; i++)
     {
         // Get the distance to all nodes at i
         ArenaNode* cur_node = getNode(i);
         std::vector<int> nearby_nodes;
-        std::vector<float> dist = m_distance_matrix[i];
+        std::copy(m_distance_matrix.begin() + i * n,
+                  m_distance_matrix.begin() + (i + 1) * n, dist.begin());
 
         // Skip the same node
-        dist[i] = 999999.0f;
+        dist[i] = skip;
         for (unsigned int j = 0; j < try_count; j++)
         {
-            std::vector<float>::iterator it =
+            std::vector<uint32_t>::iterator it =
                 std::min_element(dist.begin(), dist.end());
             const int pos = int(it - dist.begin());
             nearby_nodes.push_back(pos);
-            dist[pos] = 999999.0f;
+            dist[pos] = skip;
         }
         cur_node->setNearbyNodes(nearby_nodes);
     }
@@ -362,14 +577,14 @@ void ArenaGraph::setNearbyNodesOfAllNodes()
 /** Determines the full path from 'from' to 'to' and returns it in a
  *  std::vector (in reverse order). Used only for unit testing.
  */
-std::vector<int16_t> ArenaGraph::getPathFromTo(int from, int to,
-                      const std::vector< std::vector< int16_t > >& parent_node)
+std::vector<int16_t> ArenaGraph::getPathFromTo(int from, int to, unsigned n,
+                                       const std::vector<int16_t>& parent_node)
 {
     std::vector<int16_t> path;
     path.push_back(to);
     while(from!=to)
     {
-        to = parent_node[from][to];
+        to = parent_node[from * n + to];
         path.push_back(to);
     }
     return path;
@@ -380,7 +595,9 @@ std::vector<int16_t> ArenaGraph::getPathFromTo(int from, int to,
  *  Instead of using hand-tuned test cases we use the tested, verified and
  *  easier to understand Floyd-Warshall algorithm to compute the distances,
  *  and check if the (significanty faster) Dijkstra algorithm gives the same
- *  results. For now we use the cave mesh as test case.
+ *  results. It also checks the stored (quantized) distances, and that the
+ *  cached shortest paths are loaded unchanged. For now we use the cave mesh
+ *  as test case.
  */
 void ArenaGraph::unitTesting()
 {
@@ -392,30 +609,57 @@ void ArenaGraph::unitTesting()
     double e = StkTime::getRealTime();
     Log::error("Time", "Dijkstra       %lf", e-s);
 
-    // Save the Dijkstra results
-    std::vector< std::vector< float > > distance_matrix = ag->m_distance_matrix;
-    std::vector< std::vector< int16_t > > parent_node = ag->m_parent_node;
-    ag->buildGraph();
+    const unsigned int n = ag->getNumNodes();
+    std::vector<unsigned> first_edge;
+    std::vector<std::pair<int, float> > edges;
+    ag->getEdges(&first_edge, &edges);
+    std::vector<float> distance_matrix(n * n);
+    std::vector<int16_t> parent_node(n * n);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        ag->computeDijkstra(i, first_edge, edges, distance_matrix.data() + i * n,
+                            parent_node.data() + i * n);
+    }
 
     // Now compute results with Floyd-Warshall
+    std::vector<float> fw_distance;
+    std::vector<int16_t> fw_parent;
     s = StkTime::getRealTime();
-    ag->computeFloydWarshall();
+    ag->computeFloydWarshall(&fw_distance, &fw_parent);
     e = StkTime::getRealTime();
     Log::error("Time", "Floyd-Warshall %lf", e-s);
 
     int error_count = 0;
-    for(unsigned int i=0; i<ag->m_distance_matrix.size(); i++)
+    for(unsigned int i=0; i<n; i++)
     {
-        for(unsigned int j=0; j<ag->m_distance_matrix[i].size(); j++)
+        for(unsigned int j=0; j<n; j++)
         {
-            if(ag->m_distance_matrix[i][j] - distance_matrix[i][j] > 0.001f)
+            const float dijkstra = distance_matrix[i * n + j];
+            if(fw_distance[i * n + j] - dijkstra > 0.001f)
             {
                 Log::error("ArenaGraph",
                            "Incorrect distance %d, %d: Dijkstra: %f F.W.: %f",
-                           i, j, distance_matrix[i][j], ag->m_distance_matrix[i][j]);
+                           i, j, dijkstra, fw_distance[i * n + j]);
                 error_count++;
             }    // if distance is too different
 
+            // The stored distances are rounded to the precision
+            if (dijkstra < 9999.0f &&
+                fabsf(ag->getDistance(i, j) - dijkstra) >
+                0.5f / DISTANCE_SCALE + 0.0001f)
+            {
+                Log::error("ArenaGraph",
+                           "Incorrect stored distance %d, %d: %f %f",
+                           i, j, ag->getDistance(i, j), dijkstra);
+                error_count++;
+            }
+            if (ag->m_parent_node[i * n + j] != parent_node[i * n + j])
+            {
+                Log::error("ArenaGraph", "Incorrect stored parent %d, %d",
+                           i, j);
+                error_count++;
+            }
+
             // Unortunately it happens frequently that there are different
             // shortest path with the same length. And Dijkstra might find
             // a different path then Floyd-Warshall. So the test for parent
@@ -424,16 +668,18 @@ void ArenaGraph::unitTesting()
             // debugging in the feature
 #undef TEST_PARENT_POLY_EVEN_THOUGH_MANY_FALSE_POSITIVES
 #ifdef TEST_PARENT_POLY_EVEN_THOUGH_MANY_FALSE_POSITIVES
-            if(ag->m_parent_node[i][j] != parent_node[i][j])
+            if(fw_parent[i * n + j] != parent_node[i * n + j])
             {
                 error_count++;
-                std::vector<int16_t> dijkstra_path = getPathFromTo(i, j, parent_node);
-                std::vector<int16_t> floyd_path = getPathFromTo(i, j, ag->m_parent_node);
+                std::vector<int16_t> dijkstra_path =
+                    getPathFromTo(i, j, n, parent_node);
+                std::vector<int16_t> floyd_path =
+                    getPathFromTo(i, j, n, fw_parent);
                 if(dijkstra_path.size()!=floyd_path.size())
                 {
                     Log::error("ArenaGraph",
                                "Incorrect path length %d, %d: Dijkstra: %d F.W.: %d",
-                               i, j, parent_node[i][j], ag->m_parent_node[i][j]);
+                               i, j, parent_node[i * n + j], fw_parent[i * n + j]);
                     continue;
                 }
                 Log::error("ArenaGraph", "Path problems from %d to %d:",
@@ -451,6 +697,30 @@ void ArenaGraph::unitTesting()
         }   // for j
     }   // for i
 
+    // The cached shortest paths must be loaded unchanged, and only for the
+    // same navmesh
+    const std::string cache_file = file_manager->getTempFileName(
+        file_manager->getCachedDataDir() + "navmesh-unit-test.bin");
+    const std::vector<uint16_t> saved_distance = ag->m_distance_matrix;
+    const std::vector<int16_t> saved_parent = ag->m_parent_node;
+    ag->saveShortestPaths(cache_file, 1234);
+    const bool loaded_other_hash = ag->loadShortestPaths(cache_file, 4321);
+    ag->m_distance_matrix.clear();
+    ag->m_parent_node.clear();
+    const bool loaded = ag->loadShortestPaths(cache_file, 1234);
+    std::remove(cache_file.c_str());
+    if (loaded_other_hash || !loaded ||
+        ag->m_distance_matrix != saved_distance ||
+        ag->m_parent_node != saved_parent)
+    {
+        Log::error("ArenaGraph", "Incorrect cached shortest paths.");
+        error_count++;
+    }
+    assert(!loaded_other_hash);
+    assert(loaded);
+
+    if (error_count > 0)
+        Log::error("ArenaGraph", "%d errors in unit test.", error_count);
     delete ag;
 
 }   // unitTesting
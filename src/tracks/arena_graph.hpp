@@ -34,11 +34,23 @@ class XMLNode;
 class ArenaGraph : public Graph
 {
 private:
-    /** The actual graph data structure, it is an adjacency matrix. */
-    std::vector<std::vector<float>> m_distance_matrix;
+    /** Distances are stored as multiples of 1 / DISTANCE_SCALE m. */
+    static const int DISTANCE_SCALE = 32;
 
-    /** The matrix that is used to store computed shortest paths. */
-    std::vector<std::vector<int16_t>> m_parent_node;
+    /** Stored distance of nodes which can not be reached. */
+    static const uint16_t UNREACHABLE_DISTANCE = 0xffff;
+
+    /** Graphs with at least this many nodes compute the shortest paths
+     *  in parallel and cache them on disk. */
+    static const unsigned MIN_NODES_FOR_CACHE = 64;
+
+    /** The shortest distances between all nodes, m_distance_matrix[i*n+j]
+     *  is the distance from i to j in multiples of 1 / DISTANCE_SCALE. */
+    std::vector<uint16_t> m_distance_matrix;
+
+    /** m_parent_node[i*n+j] is the last node before j on the shortest path
+     *  from i to j, or -1 if j is i or can not be reached. */
+    std::vector<int16_t> m_parent_node;
 
     /** Used in soccer mode to colorize the goal lines in minimap. */
     std::set<int> m_red_node;
@@ -50,16 +62,28 @@ private:
     // ------------------------------------------------------------------------
     void loadNavmesh(const std::string &navmesh);
     // ------------------------------------------------------------------------
-    void buildGraph();
+    void getEdges(std::vector<unsigned>* first_edge,
+                  std::vector<std::pair<int, float> >* edges) const;
+    // ------------------------------------------------------------------------
+    void computeShortestPaths();
+    // ------------------------------------------------------------------------
+    bool loadShortestPaths(const std::string &file_name, uint64_t hash);
+    // ------------------------------------------------------------------------
+    void saveShortestPaths(const std::string &file_name, uint64_t hash) const;
     // ------------------------------------------------------------------------
     void setNearbyNodesOfAllNodes();
     // ------------------------------------------------------------------------
-    void computeDijkstra(int n);
+    void computeDijkstra(int source, const std::vector<unsigned>& first_edge,
+                         const std::vector<std::pair<int, float> >& edges,
+                         float* distance, int16_t* parent) const;
+    // ------------------------------------------------------------------------
+    void computeFloydWarshall(std::vector<float>* distance,
+                              std::vector<int16_t>* parent) const;
     // ------------------------------------------------------------------------
-    void computeFloydWarshall();
+    static uint64_t hashFile(const std::string &file_name);
     // ------------------------------------------------------------------------
-    static std::vector<int16_t> getPathFromTo(int from, int to,
-                     const std::vector< std::vector< int16_t > >& parent_node);
+    static std::vector<int16_t> getPathFromTo(int from, int to, unsigned n,
+                                      const std::vector<int16_t>& parent_node);
     // ------------------------------------------------------------------------
     virtual bool hasLapLine() const OVERRIDE                  { return false; }
     // ------------------------------------------------------------------------
@@ -77,14 +101,14 @@ public:
     ArenaNode* getNode(unsigned int i) const;
     // ------------------------------------------------------------------------
     /** Returns the next node on the shortest path from i to j.
-     *  Note: m_parent_node[j][i] contains the parent of i on path from j to i,
-     *  which is the next node on the path from i to j (undirected graph)
+     *  Note: m_parent_node[j*n+i] contains the parent of i on path from j to
+     *  i, which is the next node on the path from i to j (undirected graph)
      */
     int getNextNode(int i, int j) const
     {
         if (i == Graph::UNKNOWN_SECTOR || j == Graph::UNKNOWN_SECTOR)
             return Graph::UNKNOWN_SECTOR;
-        return (int)(m_parent_node[j][i]);
+        return (int)(m_parent_node[j * getNumNodes() + i]);
     }
     // ------------------------------------------------------------------------
     /** Returns the distance between any two nodes */
@@ -92,7 +116,10 @@ public:
     {
         if (from == Graph::UNKNOWN_SECTOR || to == Graph::UNKNOWN_SECTOR)
             return 99999.0f;
-        return m_distance_matrix[from][to];
+        const uint16_t d = m_distance_matrix[from * getNumNodes() + to];
+        if (d == UNREACHABLE_DISTANCE)
+            return 9999.9f;
+        return (float)d / DISTANCE_SCALE;
     }
 
 };   // ArenaGraph
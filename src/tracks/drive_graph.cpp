@@ -254,6 +254,7 @@ void DriveGraph::load(const std::string &quad_file_name,
             m_lap_length = l;
     }
 
+    createSpatialIndex();
     loadBoundingBoxNodes();
 
 }   // load
@@ -27,12 +27,20 @@
 #include "graphics/sp/sp_mesh_buffer.hpp"
 #include "modes/profile_world.hpp"
 #include "race/race_manager.hpp"
+#include "io/file_manager.hpp"
+#include "tracks/arena_graph.hpp"
 #include "tracks/arena_node_3d.hpp"
 #include "tracks/drive_node_2d.hpp"
+#include "tracks/drive_graph.hpp"
 #include "tracks/drive_node_3d.hpp"
 #include "tracks/track.hpp"
+#include "tracks/track_manager.hpp"
 #include "utils/log.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 const int Graph::UNKNOWN_SECTOR = -1;
 const float Graph::MIN_HEIGHT_TESTING = -1.0f;
 const float Graph::MAX_HEIGHT_TESTING = 5.0f;
@@ -48,6 +56,10 @@ Graph::Graph()
     m_bb_min      = Vec3( 99999,  99999,  99999);
     m_bb_max      = Vec3(-99999, -99999, -99999);
     memset(m_bb_nodes, 0, 4 * sizeof(int));
+    m_grid_min_x  = m_grid_min_z = 0.0f;
+    m_grid_cell_size = 1.0f;
+    m_grid_width  = m_grid_height = 0;
+    m_use_spatial_index = true;
 }  // Graph
 
 // -----------------------------------------------------------------------------
@@ -615,6 +627,16 @@ void Graph::findRoadSector(const Vec3& xyz, int *sector,
         return;
     }   // if still on same quad
 
+    if (!all_sectors && m_use_spatial_index && !m_grid_cell_start.empty())
+    {
+        // Test the nodes in the same order as the loop below, starting
+        // with the node after the current one
+        const int first = *sector < (int)m_all_nodes.size() - 1
+                        ? *sector + 1 : 0;
+        *sector = findRoadSectorInGrid(xyz, first, ignore_vertical);
+        return;
+    }
+
     // Now we search through all quads, starting with
     // the current one
     int indx       = *sector;
@@ -681,6 +703,22 @@ int Graph::findOutOfRoadSector(const Vec3& xyz, const int curr_sector,
                                std::vector<int> *all_sectors,
                                bool ignore_vertical) const
 {
+    int cell_x, cell_z;
+    if (!all_sectors && m_use_spatial_index && !m_grid_cell_start.empty() &&
+        getGridCell(xyz, &cell_x, &cell_z))
+    {
+        // Same order of the nodes as in the loop below (which is only used
+        // to break ties)
+        int first = 0;
+        if (curr_sector != UNKNOWN_SECTOR)
+        {
+            first = curr_sector - 10;
+            if (first < 0) first += getNumNodes();
+        }
+        first = first + 1 == (int)getNumNodes() ? 0 : first + 1;
+        return findOutOfRoadSectorInGrid(xyz, first, ignore_vertical);
+    }
+
     int count = (all_sectors!=NULL) ? (int)all_sectors->size() : getNumNodes();
     int current_sector = 0;
     if(curr_sector != UNKNOWN_SECTOR && !all_sectors)
@@ -774,3 +812,358 @@ void Graph::loadBoundingBoxNodes()
     m_bb_nodes[3] = findOutOfRoadSector(Vec3(m_bb_max.x(), 0, m_bb_max.z()),
         -1/*curr_sector*/, NULL/*all_sectors*/, true/*ignore_vertical*/);
 }   // loadBoundingBoxNodes
+
+//-----------------------------------------------------------------------------
+/** Creates the grid used by findRoadSector and findOutOfRoadSector. Must be
+ *  called after all nodes are created. The bounding box of each node is
+ *  enlarged by the height of the box used by 3d nodes in pointInside (which
+ *  can be tilted), so each node is stored in all cells in which a point can
+ *  be inside of it.
+ */
+void Graph::createSpatialIndex()
+{
+    m_grid_cell_start.clear();
+    m_grid_nodes.clear();
+    m_grid_min_height.clear();
+    m_grid_max_height.clear();
+    m_grid_width = m_grid_height = 0;
+    // Testing all nodes is fast enough for small graphs
+    const unsigned int num_nodes = getNumNodes();
+    if (num_nodes < 32)
+        return;
+
+    const float margin = MAX_HEIGHT_TESTING + 1.0f;
+    std::vector<float> node_min_x(num_nodes), node_max_x(num_nodes);
+    std::vector<float> node_min_z(num_nodes), node_max_z(num_nodes);
+    float min_x = 99999.0f, max_x = -99999.0f;
+    float min_z = 99999.0f, max_z = -99999.0f;
+    float total_size = 0.0f;
+    for (unsigned int i = 0; i < num_nodes; i++)
+    {
+        const Quad& q = *m_all_nodes[i];
+        node_min_x[i] = node_max_x[i] = q[0].getX();
+        node_min_z[i] = node_max_z[i] = q[0].getZ();
+        for (unsigned int j = 1; j < 4; j++)
+        {
+            node_min_x[i] = std::min(node_min_x[i], q[j].getX());
+            node_max_x[i] = std::max(node_max_x[i], q[j].getX());
+            node_min_z[i] = std::min(node_min_z[i], q[j].getZ());
+            node_max_z[i] = std::max(node_max_z[i], q[j].getZ());
+        }
+        node_min_x[i] -= margin;
+        node_max_x[i] += margin;
+        node_min_z[i] -= margin;
+        node_max_z[i] += margin;
+        min_x = std::min(min_x, node_min_x[i]);
+        max_x = std::max(max_x, node_max_x[i]);
+        min_z = std::min(min_z, node_min_z[i]);
+        max_z = std::max(max_z, node_max_z[i]);
+        total_size += std::max(node_max_x[i] - node_min_x[i],
+                               node_max_z[i] - node_min_z[i]);
+    }
+
+    // Cells about the size of a node, but not more than 4 cells per node
+    // (e.g. for a few small nodes far apart)
+    const float area = (max_x - min_x) * (max_z - min_z);
+    m_grid_cell_size = std::max(total_size / num_nodes,
+                                sqrtf(area / (4.0f * num_nodes)));
+    m_grid_min_x  = min_x;
+    m_grid_min_z  = min_z;
+    m_grid_width  = (int)((max_x - min_x) / m_grid_cell_size) + 1;
+    m_grid_height = (int)((max_z - min_z) / m_grid_cell_size) + 1;
+
+    // First count the nodes of each cell, then store them
+    const unsigned int num_cells = m_grid_width * m_grid_height;
+    std::vector<unsigned int> count(num_cells + 1, 0);
+    const float unlimited = std::numeric_limits<float>::max();
+    m_grid_min_height.resize(num_cells, unlimited);
+    m_grid_max_height.resize(num_cells, -unlimited);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (unsigned int i = 0; i < num_nodes; i++)
+        {
+            int x0, z0, x1, z1;
+            getGridCell(Vec3(node_min_x[i], 0, node_min_z[i]), &x0, &z0);
+            getGridCell(Vec3(node_max_x[i], 0, node_max_z[i]), &x1, &z1);
+            for (int z = z0; z <= z1; z++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    const unsigned int cell = z * m_grid_width + x;
+                    if (pass == 1)
+                    {
+                        m_grid_nodes[count[cell]++] = i;
+                        continue;
+                    }
+                    count[cell + 1]++;
+                    const Quad* q = m_all_nodes[i];
+                    if (q->isIgnored())
+                        continue;
+                    if (q->is3DQuad())
+                    {
+                        m_grid_min_height[cell] = -unlimited;
+                        m_grid_max_height[cell] = unlimited;
+                    }
+                    else
+                    {
+                        m_grid_min_height[cell] =
+                            std::min(m_grid_min_height[cell], q->getMinHeight());
+                        m_grid_max_height[cell] =
+                            std::max(m_grid_max_height[cell], q->getMinHeight());
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (unsigned int i = 0; i < num_cells; i++)
+                count[i + 1] += count[i];
+            m_grid_cell_start = count;
+            m_grid_nodes.resize(count[num_cells]);
+        }
+    }
+    Log::debug("Graph", "Spatial index with %dx%d cells of %f m, %d entries.",
+               m_grid_width, m_grid_height, m_grid_cell_size,
+               (int)m_grid_nodes.size());
+}   // createSpatialIndex
+
+//-----------------------------------------------------------------------------
+/** Computes the grid cell of a point (ignoring its height). Points outside
+ *  of the grid are clamped to the closest cell.
+ *  \return True if the point is inside of the grid.
+ */
+bool Graph::getGridCell(const Vec3& xyz, int* x, int* z) const
+{
+    const float fx = (xyz.getX() - m_grid_min_x) / m_grid_cell_size;
+    const float fz = (xyz.getZ() - m_grid_min_z) / m_grid_cell_size;
+    const bool inside = fx >= 0.0f && fz >= 0.0f &&
+                        fx < (float)m_grid_width && fz < (float)m_grid_height;
+    *x = fx < 0.0f ? 0 : std::min((int)fx, m_grid_width - 1);
+    *z = fz < 0.0f ? 0 : std::min((int)fz, m_grid_height - 1);
+    return inside;
+}   // getGridCell
+
+//-----------------------------------------------------------------------------
+/** Returns the same node as the loop in findRoadSector, i.e. the first node
+ *  containing xyz when testing all nodes starting with node first, but only
+ *  tests the nodes of the grid cell of xyz.
+ */
+int Graph::findRoadSectorInGrid(const Vec3& xyz, int first,
+                                bool ignore_vertical) const
+{
+    int x, z;
+    if (!getGridCell(xyz, &x, &z))
+        return UNKNOWN_SECTOR;
+
+    const int num_nodes = getNumNodes();
+    const unsigned int cell = z * m_grid_width + x;
+    int best = UNKNOWN_SECTOR;
+    int best_order = num_nodes;
+    for (unsigned int i = m_grid_cell_start[cell];
+         i < m_grid_cell_start[cell + 1]; i++)
+    {
+        const int node = m_grid_nodes[i];
+        const int order = (node - first + num_nodes) % num_nodes;
+        if (order < best_order &&
+            m_all_nodes[node]->pointInside(xyz, ignore_vertical))
+        {
+            best = node;
+            best_order = order;
+        }
+    }
+    return best;
+}   // findRoadSectorInGrid
+
+//-----------------------------------------------------------------------------
+/** Returns the same node as findOutOfRoadSector without a list of nodes to
+ *  test: the node closest to xyz (where ties are broken by the order of the
+ *  nodes starting at first). The grid cells are tested in rings around the
+ *  cell of xyz, till all nodes not tested yet must be further away than the
+ *  closest node found. xyz must be inside of the grid.
+ */
+int Graph::findOutOfRoadSectorInGrid(const Vec3& xyz, int first,
+                                     bool ignore_vertical) const
+{
+    int cell_x, cell_z;
+    getGridCell(xyz, &cell_x, &cell_z);
+    const int num_nodes = getNumNodes();
+    const float unlimited = std::numeric_limits<float>::max();
+
+    // See findOutOfRoadSector for the two phases
+    for (int phase = 0; phase < 2; phase++)
+    {
+        int   min_sector = UNKNOWN_SECTOR;
+        int   min_order  = num_nodes;
+        float min_dist_2 = 999999.0f*999999.0f;
+        for (int r = 0; ; r++)
+        {
+            for (int z = std::max(cell_z - r, 0);
+                 z <= std::min(cell_z + r, m_grid_height - 1); z++)
+            {
+                // Only the border of the ring, the inside is done already
+                const bool border = z == cell_z - r || z == cell_z + r;
+                const int step = border ? 1 : 2 * r;
+                for (int x = cell_x - r; x <= cell_x + r; x += step)
+                {
+                    if (x < 0 || x >= m_grid_width) continue;
+                    const unsigned int cell = z * m_grid_width + x;
+                    // Skip cells without nodes at the height tested in
+                    // phase 0 (see below)
+                    if (phase == 0 && !ignore_vertical &&
+                        (xyz.getY() - m_grid_max_height[cell] >= 5.0f ||
+                         xyz.getY() - m_grid_min_height[cell] <= -1.0f))
+                        continue;
+                    for (unsigned int i = m_grid_cell_start[cell];
+                         i < m_grid_cell_start[cell + 1]; i++)
+                    {
+                        const int node = m_grid_nodes[i];
+                        const Quad* q = m_all_nodes[node];
+                        if (q->isIgnored()) continue;
+                        const float dist_2 = q->getDistance2FromPoint(xyz);
+                        const int order =
+                            (node - first + num_nodes) % num_nodes;
+                        // Nodes can be in several cells
+                        const bool closer = dist_2 < min_dist_2 ||
+                            (dist_2 == min_dist_2 && order < min_order &&
+                             min_sector != UNKNOWN_SECTOR);
+                        if (!closer)
+                            continue;
+                        const float dist = xyz.getY() - q->getMinHeight();
+                        if (phase == 1 || (dist < 5.0f && dist>-1.0f) ||
+                            q->is3DQuad() || ignore_vertical)
+                        {
+                            min_dist_2 = dist_2;
+                            min_sector = node;
+                            min_order  = order;
+                        }
+                    }   // for i in cell
+                }   // for x
+            }   // for z
+
+            // All nodes not tested yet are outside of the cells tested so
+            // far. Compute the minimum distance to them (or stop if all
+            // cells were tested).
+            float bound = unlimited;
+            if (cell_x - r > 0)
+            {
+                bound = std::min(bound, xyz.getX() - m_grid_min_x
+                                 - (cell_x - r) * m_grid_cell_size);
+            }
+            if (cell_x + r < m_grid_width - 1)
+            {
+                bound = std::min(bound, m_grid_min_x
+                                 + (cell_x + r + 1) * m_grid_cell_size
+                                 - xyz.getX());
+            }
+            if (cell_z - r > 0)
+            {
+                bound = std::min(bound, xyz.getZ() - m_grid_min_z
+                                 - (cell_z - r) * m_grid_cell_size);
+            }
+            if (cell_z + r < m_grid_height - 1)
+            {
+                bound = std::min(bound, m_grid_min_z
+                                 + (cell_z + r + 1) * m_grid_cell_size
+                                 - xyz.getZ());
+            }
+            if (bound == unlimited)
+                break;
+            // Allow for rounding errors in the distance computations
+            bound -= 0.01f;
+            if (bound > 0.0f && min_dist_2 < bound * bound)
+                break;
+        }   // for r
+        // Leave in phase 0 if any sector was found.
+        if (min_sector != UNKNOWN_SECTOR)
+            return min_sector;
+    }   // phase
+
+    Log::info("Graph", "unknown sector found.");
+    return UNKNOWN_SECTOR;
+}   // findOutOfRoadSectorInGrid
+
+//-----------------------------------------------------------------------------
+/** Compares the results of findRoadSector and findOutOfRoadSector using the
+ *  spatial index with the results of testing all nodes, for points on and
+ *  around the nodes of the graphs of all tracks.
+ */
+void Graph::unitTesting()
+{
+    uint32_t random = 12345;
+    auto next_random = [&random](float range)
+    {
+        random = random * 1103515245 + 12345;
+        return ((random >> 8) % 10001) / 10000.0f * 2.0f * range - range;
+    };
+
+    for (unsigned int t = 0; t < track_manager->getNumberOfTracks(); t++)
+    {
+        const Track* track = track_manager->getTrack(t);
+        Graph* graph = NULL;
+        const std::string navmesh = track->getTrackFile("navmesh.xml");
+        const std::string quads = track->getTrackFile("quads.xml");
+        const std::string drive_graph = track->getTrackFile("graph.xml");
+        if (track->isArena() || track->isSoccer())
+        {
+            if (!file_manager->fileExists(navmesh))
+                continue;
+            graph = new ArenaGraph(navmesh);
+            Graph::setGraph(graph);
+        }
+        else if (file_manager->fileExists(quads) &&
+                 file_manager->fileExists(drive_graph))
+        {
+            // Sets itself as the graph
+            graph = new DriveGraph(quads, drive_graph, /*reverse*/false);
+        }
+        if (!graph || graph->m_grid_cell_start.empty())
+        {
+            Graph::destroy();
+            continue;
+        }
+
+        const int num_nodes = graph->getNumNodes();
+        const int step = std::max(num_nodes / 500, 1);
+        int error_count = 0;
+        for (int n = 0; n < num_nodes; n += step)
+        {
+            const Quad* q = graph->getQuad(n);
+            for (unsigned int i = 0; i < 8; i++)
+            {
+                // Points on the node, and up to 30 m around it
+                const float range = i < 4 ? 0.5f : 30.0f;
+                const Vec3 xyz = (i < 4 ? (*q)[i] : q->getCenter()) +
+                    Vec3(next_random(range), next_random(range * 0.3f),
+                         next_random(range));
+                const int prev = i % 3 == 0 ? UNKNOWN_SECTOR
+                               : (n + (int)next_random(20.0f) + num_nodes)
+                                 % num_nodes;
+                const bool ignore_vertical = i % 2 == 1;
+
+                int result[2][2];
+                for (int index = 0; index < 2; index++)
+                {
+                    graph->m_use_spatial_index = index == 0;
+                    int sector = prev;
+                    graph->findRoadSector(xyz, &sector, NULL,
+                                          ignore_vertical);
+                    result[index][0] = sector;
+                    result[index][1] = graph->findOutOfRoadSector(xyz, prev,
+                                                NULL, ignore_vertical);
+                }
+                if (result[0][0] != result[1][0] ||
+                    result[0][1] != result[1][1])
+                {
+                    Log::error("Graph", "Track %s point %f %f %f from %d: "
+                               "road sector %d / %d, out of road %d / %d.",
+                               track->getIdent().c_str(), xyz.getX(),
+                               xyz.getY(), xyz.getZ(), prev, result[0][0],
+                               result[1][0], result[0][1], result[1][1]);
+                    error_count++;
+                }
+            }   // for i
+        }   // for n
+        Graph::destroy();
+        assert(error_count == 0);
+    }   // for t
+}   // unitTesting
@@ -66,6 +66,8 @@ protected:
     // ------------------------------------------------------------------------
     /** Map 4 bounding box points to 4 closest graph nodes. */
     void loadBoundingBoxNodes();
+    // ------------------------------------------------------------------------
+    void createSpatialIndex();
 
 private:
     /** The 2d bounding box, used for hashing. */
@@ -90,6 +92,36 @@ private:
     /** The render target used for drawing the minimap. */
     std::unique_ptr<RenderTarget> m_render_target;
 
+    /** A uniform grid over the x/z plane, which stores for each cell the
+     *  nodes whose (enlarged) bounding box overlaps the cell. It is used by
+     *  findRoadSector and findOutOfRoadSector to test only the nodes close
+     *  to a point in graphs with many nodes. Empty for small graphs. */
+    float m_grid_min_x, m_grid_min_z;
+    float m_grid_cell_size;
+    int   m_grid_width, m_grid_height;
+
+    /** The nodes of cell i are m_grid_nodes[m_grid_cell_start[i]] up to
+     *  (excluding) m_grid_nodes[m_grid_cell_start[i+1]]. */
+    std::vector<unsigned int> m_grid_cell_start;
+    std::vector<int> m_grid_nodes;
+
+    /** Range of the minimum heights of the nodes of each cell, used to skip
+     *  cells without nodes at the height of a point in findOutOfRoadSector.
+     *  Unlimited for cells with 3d nodes. */
+    std::vector<float> m_grid_min_height, m_grid_max_height;
+
+    /** Can be disabled to compare the results with a test of all nodes. */
+    bool m_use_spatial_index;
+
+    // ------------------------------------------------------------------------
+    bool getGridCell(const Vec3& xyz, int* x, int* z) const;
+    // ------------------------------------------------------------------------
+    int findRoadSectorInGrid(const Vec3& xyz, int first,
+                             bool ignore_vertical) const;
+    // ------------------------------------------------------------------------
+    int findOutOfRoadSectorInGrid(const Vec3& xyz, int first,
+                                  bool ignore_vertical) const;
+
     // ------------------------------------------------------------------------
     void createMesh(bool show_invisible=true,
                     bool enable_transparency=false,
@@ -172,6 +204,8 @@ public:
     const Vec3& getBBMax() const                           { return m_bb_max; }
     // ------------------------------------------------------------------------
     const int* getBBNodes() const                        { return m_bb_nodes; }
+    // ------------------------------------------------------------------------
+    static void unitTesting();
 
 };   // Graph
 
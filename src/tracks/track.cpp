@@ -59,6 +59,7 @@
 #include "modes/easter_egg_hunt.hpp"
 #include "modes/profile_world.hpp"
 #include "network/network_config.hpp"
+#include "network/state_quantizer.hpp"
 #include "physics/physical_object.hpp"
 #include "physics/physics.hpp"
 #include "physics/triangle_mesh.hpp"
@@ -886,7 +887,9 @@ void Track::createPhysicsModel(unsigned int main_track_count)
         convertTrackToBullet(m_all_nodes[i]);
         uploadNodeVertexBuffer(m_all_nodes[i]);
     }
-    m_track_mesh->createPhysicalBody(m_friction);
+    // The BVH of the whole track is expensive to build, so it is cached
+    m_track_mesh->createPhysicalBody(m_friction,
+        (btCollisionObject::CollisionFlags)0, /*use_bvh_cache*/true);
     m_gfx_effect_mesh->createCollisionShape();
 }   // createPhysicsModel
 
@@ -1242,6 +1245,7 @@ bool Track::loadMainTrack(const XMLNode &root)
     // will handle items that are out of the AABB
     m_aabb_max.setY(m_aabb_max.getY()+30.0f);
     Physics::getInstance()->init(m_aabb_min, m_aabb_max);
+    StateQuantizer::setTrackBounds(m_aabb_min, m_aabb_max);
 
     ModelDefinitionLoader lodLoader(this);
 
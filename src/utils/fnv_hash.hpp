@@ -0,0 +1,54 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_FNV_HASH_HPP
+#define HEADER_FNV_HASH_HPP
+
+#include "utils/types.hpp"
+
+#include <stddef.h>
+
+/** \ingroup utils
+ *  Computes a 64-bit FNV-1a hash of data added in one or more parts. It is
+ *  used to identify cached data computed from track files, it is not meant
+ *  to protect against deliberate changes.
+ */
+class FnvHash
+{
+private:
+    uint64_t m_hash;
+
+public:
+    FnvHash() : m_hash(0xcbf29ce484222325ULL) {}
+    // ------------------------------------------------------------------------
+    /** Adds the given bytes to the hash. */
+    void add(const void* data, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            m_hash ^= bytes[i];
+            m_hash *= 0x100000001b3ULL;
+        }
+    }   // add
+    // ------------------------------------------------------------------------
+    uint64_t get() const                                     { return m_hash; }
+};   // FnvHash
+
+#endif
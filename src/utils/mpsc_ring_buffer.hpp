@@ -0,0 +1,201 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+#ifndef HEADER_MPSC_RING_BUFFER_HPP
+#define HEADER_MPSC_RING_BUFFER_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <assert.h>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** A lock-free queue for several producer threads and a single consumer
+ *  thread. Each cell of the ring has a sequence number, which tells a
+ *  producer if the cell is free in the current round of the ring, and the
+ *  consumer if the cell was written (so a producer that reserved a cell
+ *  but did not write it yet stops the consumer at that cell).
+ *  If the ring is full, elements are added to an overflow list protected
+ *  by a mutex, so a producer never has to wait for the consumer. While the
+ *  overflow list is in use all producers add to it, and the consumer only
+ *  takes it after the ring is completely empty, so the elements of each
+ *  producer are still popped in order.
+ *  \ingroup utils
+ */
+template<typename TYPE>
+class MPSCRingBuffer : public NoCopy
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> m_sequence;
+        TYPE                m_data;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+
+    /** Capacity - 1, the capacity is a power of two. */
+    const size_t m_mask;
+
+    /** Next position to write to, shared by all producers. */
+    std::atomic<size_t> m_enqueue_pos;
+
+    /** Keeps the positions on different cache lines, so the producers do
+     *  not slow down the consumer. */
+    char m_padding[64];
+
+    /** Next position to read from, only used by the consumer. */
+    size_t m_dequeue_pos;
+
+    /** True if elements were added to m_overflow since the consumer took
+     *  them the last time. */
+    std::atomic_bool m_overflowing;
+
+    /** Protects m_overflow. */
+    std::mutex m_overflow_mutex;
+
+    /** Elements which did not fit into the ring. */
+    std::vector<TYPE> m_overflow;
+
+    /** Elements taken from m_overflow, which are popped before any further
+     *  element of the ring. Only used by the consumer. */
+    std::deque<TYPE> m_overflow_popped;
+
+    // ------------------------------------------------------------------------
+    /** Adds an element to the ring if there is space.
+     *  \return False if the ring is full.
+     */
+    bool pushRing(const TYPE& data)
+    {
+        Cell* cell;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+            const ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+            if (diff == 0)
+            {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                    std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        cell->m_data = data;
+        cell->m_sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }   // pushRing
+    // ------------------------------------------------------------------------
+    /** Removes the oldest element of the ring.
+     *  \return False if no (completely written) element is available.
+     */
+    bool popRing(TYPE* data)
+    {
+        Cell* cell = &m_cells[m_dequeue_pos & m_mask];
+        const size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+        if ((ptrdiff_t)seq - (ptrdiff_t)(m_dequeue_pos + 1) < 0)
+            return false;
+        *data = cell->m_data;
+        cell->m_sequence.store(m_dequeue_pos + m_mask + 1,
+                               std::memory_order_release);
+        m_dequeue_pos++;
+        return true;
+    }   // popRing
+
+public:
+    /** Creates the queue.
+     *  \param capacity Maximum number of elements, must be a power of two.
+     */
+    MPSCRingBuffer(size_t capacity)
+        : m_cells(new Cell[capacity]), m_mask(capacity - 1)
+    {
+        assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+        for (size_t i = 0; i < capacity; i++)
+            m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos = 0;
+        m_overflowing.store(false);
+    }   // MPSCRingBuffer
+    // ------------------------------------------------------------------------
+    /** Adds an element, can be called from any thread. This never waits
+     *  for the consumer.
+     *  \return False if the ring was full and the element was added to the
+     *          overflow list instead.
+     */
+    bool push(const TYPE& data)
+    {
+        if (!m_overflowing.load() && pushRing(data))
+            return true;
+        std::lock_guard<std::mutex> lock(m_overflow_mutex);
+        m_overflow.push_back(data);
+        m_overflowing.store(true);
+        return false;
+    }   // push
+    // ------------------------------------------------------------------------
+    /** Removes the oldest element, must only be called by the consumer.
+     *  \return False if no (completely written) element is available.
+     */
+    bool pop(TYPE* data)
+    {
+        if (m_overflow_popped.empty())
+        {
+            if (popRing(data))
+                return true;
+            // Elements of the overflow list are only taken when no producer
+            // is writing to the ring any more, since they were added after
+            // all elements of the ring
+            if (!m_overflowing.load() ||
+                m_enqueue_pos.load(std::memory_order_acquire) != m_dequeue_pos)
+                return false;
+            std::lock_guard<std::mutex> lock(m_overflow_mutex);
+            m_overflow_popped.insert(m_overflow_popped.end(),
+                                     m_overflow.begin(), m_overflow.end());
+            m_overflow.clear();
+            m_overflowing.store(false);
+        }
+        if (m_overflow_popped.empty())
+            return false;
+        *data = m_overflow_popped.front();
+        m_overflow_popped.pop_front();
+        return true;
+    }   // pop
+    // ------------------------------------------------------------------------
+    /** Returns true if no element can be popped, must only be called by the
+     *  consumer. */
+    bool empty() const
+    {
+        if (!m_overflow_popped.empty() || m_overflowing.load())
+            return false;
+        const Cell* cell = &m_cells[m_dequeue_pos & m_mask];
+        const size_t seq = cell->m_sequence.load(std::memory_order_acquire);
+        return (ptrdiff_t)seq - (ptrdiff_t)(m_dequeue_pos + 1) < 0;
+    }   // empty
+    // ------------------------------------------------------------------------
+    /** Returns the number of elements which fit into the ring. */
+    size_t capacity() const                              { return m_mask + 1; }
+};   // MPSCRingBuffer
+
+#endif
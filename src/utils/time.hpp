@@ -38,6 +38,10 @@
 #include <time.h>
 #include <string>
 #include <stdio.h>
+#include <thread>
+#ifdef __linux__
+#  include <errno.h>
+#endif
 
 class StkTime
 {
@@ -108,6 +112,15 @@ public:
         return value.count();
     }
     // ------------------------------------------------------------------------
+    /** Returns a monotonic time in microseconds since an arbitrary start,
+     *  for measuring short durations (getRealTime() only has a resolution
+     *  of 1 ms). */
+    static uint64_t getMonoTimeUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>
+            (std::chrono::steady_clock::now().time_since_epoch()).count();
+    }   // getMonoTimeUs
+    // ------------------------------------------------------------------------
     /**
      * \brief Compare two different times.
      * \return A signed integral indicating the relation between the time.
@@ -137,6 +150,27 @@ public:
 #endif
     }   // sleep
     // ------------------------------------------------------------------------
+    /** Sleeps until the given time. On linux clock_nanosleep with an
+     *  absolute time is used, so the time needed to compute when to wake up
+     *  does not delay the wake up.
+     *  \param t Time to wake up.
+     */
+    static void sleepUntil(const std::chrono::steady_clock::time_point& t)
+    {
+#ifdef __linux__
+        // std::chrono::steady_clock uses CLOCK_MONOTONIC
+        const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+            (t.time_since_epoch()).count();
+        struct timespec ts;
+        ts.tv_sec = (time_t)(ns / 1000000000);
+        ts.tv_nsec = (long)(ns % 1000000000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+               EINTR) {}
+#else
+        std::this_thread::sleep_until(t);
+#endif
+    }   // sleepUntil
+    // ------------------------------------------------------------------------
     /**
      * \brief Add a interval to a time.
      */
@@ -0,0 +1,134 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#include "utils/worker_pool.hpp"
+
+#include "utils/vs.hpp"
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+/** Creates the pool and starts the worker threads.
+ *  \param num_threads Number of worker threads, 0 to always run the jobs in
+ *         the calling thread.
+ *  \param name Name of the worker threads (for debugging).
+ */
+WorkerPool::WorkerPool(unsigned num_threads, const char* name)
+{
+    m_job_id = 0;
+    m_busy_workers = 0;
+    m_shutdown = false;
+    m_job = NULL;
+    m_count = 0;
+    m_next.store(0);
+    for (unsigned i = 0; i < num_threads; i++)
+        m_threads.emplace_back(&WorkerPool::workerLoop, this, name);
+}   // WorkerPool
+
+// ----------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+    std::unique_lock<std::mutex> ul(m_mutex);
+    m_shutdown = true;
+    ul.unlock();
+    m_work_available.notify_all();
+    for (std::thread& t : m_threads)
+        t.join();
+}   // ~WorkerPool
+
+// ----------------------------------------------------------------------------
+void WorkerPool::workerLoop(const char* name)
+{
+    VS::setThreadName(name);
+    unsigned job_id = 0;
+    std::unique_lock<std::mutex> ul(m_mutex);
+    while (true)
+    {
+        m_work_available.wait(ul, [this, job_id]()
+            { return m_shutdown || m_job_id != job_id; });
+        if (m_shutdown)
+            return;
+        job_id = m_job_id;
+        ul.unlock();
+        runJob();
+        ul.lock();
+        if (--m_busy_workers == 0)
+            m_work_done.notify_one();
+    }
+}   // workerLoop
+
+// ----------------------------------------------------------------------------
+/** Runs the current job for the next indices, till all indices are handled.
+ *  This is called by the workers and the calling thread.
+ */
+void WorkerPool::runJob()
+{
+    unsigned i = m_next.fetch_add(1);
+    while (i < m_count)
+    {
+        (*m_job)(i);
+        i = m_next.fetch_add(1);
+    }
+}   // runJob
+
+// ----------------------------------------------------------------------------
+/** Calls job(i) for all i < count, and returns when all calls are finished.
+ *  Must only be called from one thread at a time.
+ */
+void WorkerPool::run(unsigned count, const std::function<void(unsigned)>& job)
+{
+    if (m_threads.empty() || count < 2)
+    {
+        for (unsigned i = 0; i < count; i++)
+            job(i);
+        return;
+    }
+
+    std::unique_lock<std::mutex> ul(m_mutex);
+    m_job = &job;
+    m_count = count;
+    m_next.store(0);
+    m_busy_workers = (unsigned)m_threads.size();
+    m_job_id++;
+    ul.unlock();
+    m_work_available.notify_all();
+
+    runJob();
+
+    ul.lock();
+    m_work_done.wait(ul, [this]() { return m_busy_workers == 0; });
+    m_job = NULL;
+    m_count = 0;
+}   // run
+
+// ----------------------------------------------------------------------------
+void WorkerPool::unitTesting()
+{
+    WorkerPool pool(3, "WorkerPoolTest");
+    for (unsigned count : { 0, 1, 7, 1000 })
+    {
+        for (int repeat = 0; repeat < 20; repeat++)
+        {
+            std::vector<unsigned> result(count, 0);
+            pool.run(count, [&result](unsigned i) { result[i] += i * 3 + 1; });
+            for (unsigned i = 0; i < count; i++)
+                assert(result[i] == i * 3 + 1);
+        }
+    }
+}   // unitTesting
@@ -0,0 +1,90 @@
+//
+//  SuperTuxKart - a fun racing game with go-kart
+//  Copyright (C) 2019 SuperTuxKart-Team
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 3
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+
+#ifndef HEADER_WORKER_POOL_HPP
+#define HEADER_WORKER_POOL_HPP
+
+#include "utils/no_copy.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** \ingroup utils
+ *  Runs a job for a number of independent indices in parallel. The indices
+ *  are handed out one at a time to the calling thread and the worker
+ *  threads, so a thread that finishes its items early takes the remaining
+ *  ones. The worker threads are kept alive between jobs. The job must only
+ *  modify data belonging to its index, then the result does not depend on
+ *  the number of threads or the order in which the indices are handled.
+ */
+class WorkerPool : public NoCopy
+{
+private:
+    /** The worker threads. */
+    std::vector<std::thread> m_threads;
+
+    /** Protects the job data below, and is used by the condition
+     *  variables. */
+    std::mutex m_mutex;
+
+    /** Signals the workers that a new job is available (or shutdown). */
+    std::condition_variable m_work_available;
+
+    /** Signals the calling thread that all workers finished the job. */
+    std::condition_variable m_work_done;
+
+    /** Increased for each job, so a worker knows if it has worked on the
+     *  current job already. */
+    unsigned m_job_id;
+
+    /** Number of workers still working on the current job. */
+    unsigned m_busy_workers;
+
+    bool m_shutdown;
+
+    /** The current job and its number of indices. */
+    const std::function<void(unsigned)>* m_job;
+    unsigned m_count;
+
+    /** The next index to handle. */
+    std::atomic<unsigned> m_next;
+
+    // ------------------------------------------------------------------------
+    void workerLoop(const char* name);
+    // ------------------------------------------------------------------------
+    void runJob();
+
+public:
+    WorkerPool(unsigned num_threads, const char* name);
+    // ------------------------------------------------------------------------
+    ~WorkerPool();
+    // ------------------------------------------------------------------------
+    void run(unsigned count, const std::function<void(unsigned)>& job);
+    // ------------------------------------------------------------------------
+    /** Returns the number of worker threads. */
+    unsigned getNumThreads() const  { return (unsigned)m_threads.size(); }
+    // ------------------------------------------------------------------------
+    static void unitTesting();
+};   // WorkerPool
+
+#endif
@@ -0,0 +1,129 @@
+#!/bin/sh
+#
+# (C) 2019 SuperTuxKart-Team, under the GPLv3
+#
+# A script that runs a network load test on a single machine: it starts a
+# LAN server and several clients driven by the network AI, which connect
+# through the loopback interface with simulated latency, jitter and loss.
+# The server and the clients run without graphics, so it can be used on a
+# CI machine without display and network (see the load_test build target).
+#
+# Usage:
+#     load_test.sh [number of clients] [AI players per client]
+#
+# The server and each client write their statistics (tick time percentiles,
+# bytes and kbit per second of each peer, rewind counts) as 'name value'
+# lines to $OUTPUT_DIR/server.txt and $OUTPUT_DIR/client-N.txt at the end of
+# the race. Run it from a directory with the supertuxkart binary and data,
+# or set CMD and the SUPERTUXKART_* variables below.
+#
+# Each client is a separate process, since the game state (world, physics,
+# network host) exists only once per process. Each client can control
+# several karts though, so e.g. 4 clients with 8 players each give a 32
+# player race.
+
+################# Config #################
+
+export DIRNAME="$(readlink -e "$(dirname "$0")")"
+
+# A path for STK binary file
+export CMD="${CMD:-$DIRNAME/supertuxkart}"
+
+# Number of clients and AI players per client
+export CLIENTS="${1:-4}"
+export PLAYERS_PER_CLIENT="${2:-4}"
+
+# Port used by the server
+export PORT="${PORT:-2759}"
+
+# Simulated network conditions of all hosts
+export LATENCY="${LATENCY:-40}"
+export JITTER="${JITTER:-10}"
+export LOSS="${LOSS:-1}"
+
+# Additional options, e.g. the track or game mode of the server
+export SERVER_OPTIONS="${SERVER_OPTIONS:-}"
+export CLIENT_OPTIONS="${CLIENT_OPTIONS:-}"
+
+# A path where statistics and logs will be saved
+export OUTPUT_DIR="${OUTPUT_DIR:-/tmp/stk-load-test}"
+
+# Maximum time in seconds the test may take
+export TIMEOUT="${TIMEOUT:-600}"
+
+##########################################
+
+NETWORK_OPTIONS="--network-latency=$LATENCY --network-jitter=$JITTER \
+                 --network-loss=$LOSS"
+
+if [ ! -x "$CMD" ]; then
+    echo "Error: Couldn't find STK executable in CMD: $CMD"
+    exit 1
+fi
+
+mkdir -p "$OUTPUT_DIR"
+rm -f "$OUTPUT_DIR"/*.txt "$OUTPUT_DIR"/*.log
+
+echo "Info: Starting server on port $PORT"
+"$CMD" --lan-server="load test"                            \
+       --no-graphics                                       \
+       --owner-less                                        \
+       --auto-end                                          \
+       --port=$PORT                                        \
+       --max-players=$(($CLIENTS * $PLAYERS_PER_CLIENT))   \
+       --min-players=$CLIENTS                              \
+       --load-statistics="$OUTPUT_DIR/server.txt"          \
+       --stdout="server.log"                               \
+       --stdout-dir="$OUTPUT_DIR"                          \
+       $NETWORK_OPTIONS $SERVER_OPTIONS > /dev/null 2>&1 &
+SERVER_PID=$!
+
+sleep 5
+if ! kill -0 $SERVER_PID 2> /dev/null; then
+    echo "Error: The server could not be started, last lines of its log:"
+    tail -n 5 "$OUTPUT_DIR/server.log" 2> /dev/null
+    exit 1
+fi
+
+CLIENT_PIDS=""
+for i in $(seq 1 $CLIENTS); do
+    echo "Info: Starting client $i with $PLAYERS_PER_CLIENT players"
+    "$CMD" --connect-now=127.0.0.1:$PORT                   \
+           --network-ai=$PLAYERS_PER_CLIENT                \
+           --auto-connect                                  \
+           --no-graphics                                   \
+           --load-statistics="$OUTPUT_DIR/client-$i.txt"   \
+           --stdout="client-$i.log"                        \
+           --stdout-dir="$OUTPUT_DIR"                      \
+           $NETWORK_OPTIONS $CLIENT_OPTIONS > /dev/null 2>&1 &
+    CLIENT_PIDS="$CLIENT_PIDS $!"
+done
+
+# The statistics are written when the race ends
+WAITED=0
+while [ ! -f "$OUTPUT_DIR/server.txt" ] && [ $WAITED -lt $TIMEOUT ]; do
+    if ! kill -0 $SERVER_PID 2> /dev/null; then
+        echo "Error: The server exited, see $OUTPUT_DIR/server.log"
+        break
+    fi
+    sleep 5
+    WAITED=$(($WAITED + 5))
+done
+sleep 5
+
+for PID in $CLIENT_PIDS $SERVER_PID; do
+    kill -15 $PID 2> /dev/null
+done
+
+if [ ! -f "$OUTPUT_DIR/server.txt" ]; then
+    echo "Error: The race did not finish, last lines of the server log:"
+    tail -n 5 "$OUTPUT_DIR/server.log" 2> /dev/null
+    exit 1
+fi
+
+echo "Info: Server statistics"
+grep -E "^(tick_|peer_)" "$OUTPUT_DIR/server.txt"
+for FILE in "$OUTPUT_DIR"/client-*.txt; do
+    [ -f "$FILE" ] || continue
+    echo "Info: $(basename "$FILE" .txt): $(grep -E "^rewind_count " "$FILE")"
+done